@@ -1,4 +1,3 @@
-#define GL_SILENCE_DEPRECATION
 #define STB_IMAGE_IMPLEMENTATION
 
 #include <algorithm>
@@ -18,37 +17,111 @@
 #include <iostream>
 #include <stb_image.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <limits>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
 #include <misc/cpp/imgui_stdlib.h>
 #include "types.h"
 #include "pcxparser.h"
+#include "textureuploader.h"
+#include "textureatlas.h"
+#include "thumbnail.h"
+#include "thumbnailcache.h"
+#include "trace.h"
+#include "threadpool.h"
+#include "entrystream.h"
+#include "entrytable.h"
+#include "archiveanalysis.h"
+#include "perceptualhash.h"
+#include "pakwriter.h"
+#include "pk3writer.h"
+#include "accesslog.h"
+#include "contentsearch.h"
+#include "fuzzymatch.h"
+#include "imageprefetcher.h"
+#include "audiopreview.h"
+#include "bspreader.h"
+#include "mappedfile.h"
+#include "textureusage.h"
+#include "md2model.h"
+#include "modelpreview.h"
+#include "extractor.h"
+#include "archivewatcher.h"
+#include "memorystats.h"
 
 struct FileTreeNode
 {
-    std::string name;
+    std::string_view name; // Last path component, pointing into the entry table's name pool
     std::vector<FileTreeNode> children;
-    std::optional<PakFileEntry> entry;
+    EntryId entry = INVALID_ENTRY_ID; // Set for files, not for directories
+
+    bool isFile() const { return entry != INVALID_ENTRY_ID; }
 };
 
 struct TextFile
 {
     std::string contents;
+    bool truncated = false; // Only the start of a very large file was read
 };
 
+// Binary entries can be many gigabytes, so only one page is held in memory at a time
 struct BinaryFile
 {
-    std::vector<uint8_t> data;
+    std::unique_ptr<EntryStream> stream;
+    uint64_t pageOffset = 0;
+    std::vector<uint8_t> page;
+};
+
+// A map opened in the content area. Embedded textures are uploaded as soon as it opens, since maps only
+// carry a few dozen of them.
+struct MapView
+{
+    BspHeader header;
+    std::vector<BspTexture> textures;
+    std::vector<std::optional<PCXImage>> images; // Alongside textures, set for embedded ones that decoded
+    std::vector<EntryId> files;                   // Alongside textures, the archive's .wal for each, if it has one
+};
+
+// A model opened in the content area. Its vertices live on the GPU in PakViewerState::modelPreview, so
+// only the frames, bounds and skins are kept here.
+struct ModelView
+{
+    Md2Model model;
+    std::vector<std::optional<PCXImage>> skins; // Alongside model.skins, set for the ones the archive has
+    int skin = 0;
+    int animation = 0;
+    float time = 0.0f; // In frames since the start of the animation
+    bool playing = true;
+    float yaw = 0.8f;
+    float pitch = 0.3f;
+    float zoom = 1.0f;
 };
 
 namespace ParserRegistry
 {
-    using LoadArchiveFunc = std::optional<std::vector<PakFileEntry>> (*)(const std::string &);
+    using LoadArchiveFunc = std::optional<EntryTable> (*)(const std::string &);
     using ReadDataFunc = std::vector<uint8_t> (*)(const std::string &, const PakFileEntry &);
+    using ReadPrefixesFunc = std::vector<std::vector<uint8_t>> (*)(const std::string &, const std::vector<PakFileEntry> &, size_t);
+    using OpenStreamFunc = std::unique_ptr<EntryStream> (*)(const std::string &, const PakFileEntry &);
+
+    // readData refuses entries bigger than this rather than trying to hold them in memory
+    constexpr uint64_t MAX_READ_SIZE = 1ull << 30;
 
     struct FormatHandlers
     {
         LoadArchiveFunc loadArchive;
         ReadDataFunc readData;
+        ReadPrefixesFunc readPrefixes; // Reads the first few bytes of many entries with the archive opened once
+        OpenStreamFunc openStream;     // For entries that should be read a piece at a time
+        VisitEntriesFunc visitEntries; // Streams a batch of entries with the archive opened once
         std::string description;
     };
 
@@ -58,10 +131,17 @@ namespace ParserRegistry
     {
         if (extension == ".pak")
             return PakFormat::PAK;
-        if (extension == ".pk3" || extension == ".pk4")
+        if (extension == ".pk3" || extension == ".pk4" || extension == ".zip")
             return PakFormat::PKZIP;
         return PakFormat::UNKNOWN;
     }
+
+    auto openArchive(const std::string &path) -> std::optional<EntryTable>;
+
+    // Once an archive inside the open one is mounted, a batch of entries can need more than one reader.
+    // These hand each entry to the right one and put the results back in the batch's order.
+    auto readPrefixes(const std::string &path, const std::vector<PakFileEntry> &entries, size_t maxSize) -> std::vector<std::vector<uint8_t>>;
+    auto visitEntries(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit) -> void;
 }
 
 namespace PakParser
@@ -73,65 +153,205 @@ namespace PakParser
         uint32_t dirLength;
     };
 
-    auto readHeader(std::ifstream &file) -> std::optional<PakHeader>
+    auto readHeader(EntryStream &file) -> std::optional<PakHeader>
     {
         char signature[4];
         uint32_t dirOffset, dirLength;
 
-        file.read(signature, 4);
-        file.read(reinterpret_cast<char *>(&dirOffset), 4);
-        file.read(reinterpret_cast<char *>(&dirLength), 4);
+        if (!file.seek(0) ||
+            file.read(reinterpret_cast<uint8_t *>(signature), 4) != 4 ||
+            file.read(reinterpret_cast<uint8_t *>(&dirOffset), 4) != 4 ||
+            file.read(reinterpret_cast<uint8_t *>(&dirLength), 4) != 4)
+            return std::nullopt;
 
-        if (!file || std::string(signature, 4) != "PACK")
+        if (std::string(signature, 4) != "PACK")
         {
             return std::nullopt;
         }
         return PakHeader{std::string(signature, 4), dirOffset, dirLength};
     }
 
-    auto readEntry(std::ifstream &file) -> PakFileEntry
+    struct DirectoryEntry
     {
         char name[56];
-        uint32_t offset, size;
-        file.read(name, 56);
-        file.read(reinterpret_cast<char *>(&offset), 4);
-        file.read(reinterpret_cast<char *>(&size), 4);
-        return {std::string(name), offset, size};
+        uint32_t offset;
+        uint32_t size;
+    };
+    static_assert(sizeof(DirectoryEntry) == 64, "PAK directory entries are 64 bytes on disk");
+
+    auto readData(const std::string &path, const PakFileEntry &entry) -> std::vector<uint8_t>
+    {
+        TRACE_SCOPE("Read PAK entry");
+        if (entry.size > ParserRegistry::MAX_READ_SIZE)
+            return {};
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return {};
+
+        file.seekg(static_cast<std::streamoff>(entry.offset));
+        std::vector<uint8_t> data(entry.size);
+        file.read(reinterpret_cast<char *>(data.data()), data.size());
+        data.resize(file.gcount());
+
+        return data;
     }
 
-    auto loadArchive(const std::string &path) -> std::optional<std::vector<PakFileEntry>>
+    auto readPrefixes(const std::string &path, const std::vector<PakFileEntry> &entries, size_t maxSize) -> std::vector<std::vector<uint8_t>>
     {
+        TRACE_SCOPE("Read PAK prefixes");
+        std::vector<std::vector<uint8_t>> prefixes(entries.size());
+
         std::ifstream file(path, std::ios::binary);
         if (!file.is_open())
-            return std::nullopt;
+            return prefixes;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            prefixes[i].resize(std::min<uint64_t>(maxSize, entries[i].size));
+            file.seekg(static_cast<std::streamoff>(entries[i].offset));
+            file.read(reinterpret_cast<char *>(prefixes[i].data()), prefixes[i].size());
+            if (!file)
+            {
+                prefixes[i].clear();
+                file.clear();
+            }
+        }
+
+        return prefixes;
+    }
+
+    // Reads an entry out of a file handle the caller keeps open, so a batch of entries can share one
+    class PakEntryStream : public EntryStream
+    {
+    public:
+        PakEntryStream(std::istream &file, const PakFileEntry &entry)
+            : file(file), base(entry.offset), length(entry.size)
+        {
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(base));
+        }
+
+        auto isOpen() const -> bool { return file.good(); }
+
+        auto size() const -> uint64_t override { return length; }
+        auto position() const -> uint64_t override { return current; }
+
+        auto read(uint8_t *buffer, size_t count) -> size_t override
+        {
+            count = static_cast<size_t>(std::min<uint64_t>(count, length - current));
+            file.read(reinterpret_cast<char *>(buffer), count);
+
+            size_t read = file.gcount();
+            current += read;
+            if (read < count)
+                file.clear();
+            return read;
+        }
+
+        auto seek(uint64_t position) -> bool override
+        {
+            if (position > length)
+                return false;
+
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(base + position));
+            current = position;
+            return static_cast<bool>(file);
+        }
 
+    private:
+        std::istream &file;
+        uint64_t base;
+        uint64_t length;
+        uint64_t current = 0;
+    };
+
+    // The file has to be opened before PakEntryStream's constructor seeks in it, hence the extra base
+    struct FileHolder
+    {
+        std::ifstream handle;
+    };
+
+    class OwningPakEntryStream : private FileHolder, public PakEntryStream
+    {
+    public:
+        OwningPakEntryStream(const std::string &path, const PakFileEntry &entry)
+            : FileHolder{std::ifstream(path, std::ios::binary)}, PakEntryStream(handle, entry) {}
+    };
+
+    // Reads the directory of a PAK that's either the file itself or an entry of another archive
+    auto readDirectory(EntryStream &file) -> std::optional<EntryTable>
+    {
         auto header = readHeader(file);
         if (!header)
             return std::nullopt;
 
-        file.seekg(header->dirOffset);
-        std::vector<PakFileEntry> entries(header->dirLength / 64);
+        uint64_t fileSize = file.size();
+        if (static_cast<uint64_t>(header->dirOffset) + header->dirLength > fileSize)
+            return std::nullopt;
+
+        // Read the whole directory in one go rather than an entry at a time
+        std::vector<DirectoryEntry> directory(header->dirLength / sizeof(DirectoryEntry));
+        size_t directoryBytes = directory.size() * sizeof(DirectoryEntry);
+        if (!file.seek(header->dirOffset) ||
+            file.read(reinterpret_cast<uint8_t *>(directory.data()), directoryBytes) != directoryBytes)
+            return std::nullopt;
+
+        EntryTable entries(PakFormat::PAK);
+        entries.reserve(directory.size(), directory.size() * 24);
 
-        for (auto &entry : entries)
+        for (const auto &entry : directory)
         {
-            entry = readEntry(file);
-            entry.format = PakFormat::PAK;
+            // Clamp entries that run off the end of a truncated file instead of reading garbage
+            uint64_t offset = std::min<uint64_t>(entry.offset, fileSize);
+            uint64_t size = std::min<uint64_t>(entry.size, fileSize - offset);
+            entries.add(std::string_view(entry.name, strnlen(entry.name, sizeof(entry.name))), offset, size);
         }
 
         return entries;
     }
 
-    auto readData(const std::string &path, const PakFileEntry &entry) -> std::vector<uint8_t>
+    auto loadArchive(const std::string &path) -> std::optional<EntryTable>
+    {
+        TRACE_SCOPE("Load PAK directory");
+        std::error_code error;
+        uint64_t fileSize = std::filesystem::file_size(path, error);
+        if (error)
+            return std::nullopt;
+
+        OwningPakEntryStream file(path, PakFileEntry{path, 0, fileSize, PakFormat::PAK});
+        if (!file.isOpen())
+            return std::nullopt;
+        return readDirectory(file);
+    }
+
+    auto openStream(const std::string &path, const PakFileEntry &entry) -> std::unique_ptr<EntryStream>
+    {
+        auto stream = std::make_unique<OwningPakEntryStream>(path, entry);
+        if (!stream->isOpen())
+            return nullptr;
+        return stream;
+    }
+
+    auto visitEntries(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit) -> void
     {
         std::ifstream file(path, std::ios::binary);
         if (!file.is_open())
-            return {};
+            return;
 
-        file.seekg(entry.offset);
-        std::vector<uint8_t> data(entry.size);
-        file.read(reinterpret_cast<char *>(data.data()), entry.size);
+        // Going through the batch in file order turns it into one forward sweep over the disk
+        std::vector<size_t> order(entries.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                  { return entries[a].offset < entries[b].offset; });
 
-        return data;
+        for (size_t i : order)
+        {
+            PakEntryStream stream(file, entries[i]);
+            if (stream.isOpen())
+                visit(i, stream);
+        }
     }
 }
 
@@ -149,100 +369,97 @@ namespace WALParser
         uint32_t value;
     };
 
-    static std::optional<std::vector<uint8_t>> globalPalette;
+    // Replaced when another archive is opened, possibly while decodes for the last one are still running,
+    // so decoders take their own reference under the lock and keep it until they're done
+    std::mutex paletteMutex;
+    std::shared_ptr<const std::vector<uint8_t>> globalPalette;
 
-    auto loadGlobalPalette(const std::string &pakPath, const std::vector<PakFileEntry> &entries) -> bool
+    auto currentPalette() -> std::shared_ptr<const std::vector<uint8_t>>
     {
-        // Find the colormap.pcx entry
-        auto it = std::find_if(entries.begin(), entries.end(),
-                               [](const PakFileEntry &e)
-                               { return e.filename == "pics/colormap.pcx"; });
+        std::lock_guard<std::mutex> lock(paletteMutex);
+        return globalPalette;
+    }
 
-        if (it == entries.end())
-        {
-            return false;
-        }
+    auto setGlobalPalette(std::shared_ptr<const std::vector<uint8_t>> palette) -> void
+    {
+        std::lock_guard<std::mutex> lock(paletteMutex);
+        if (globalPalette)
+            MemoryStats::release(MemoryCategory::Palettes, globalPalette->size());
+        globalPalette = std::move(palette);
+        if (globalPalette)
+            MemoryStats::allocate(MemoryCategory::Palettes, globalPalette->size());
+    }
 
-        // Load the PCX file
-        std::ifstream file(pakPath, std::ios::binary);
-        if (!file.is_open())
-        {
-            return false;
-        }
+    // The next WAL decoded loads the palette again, from whichever archive it's in
+    auto resetGlobalPalette() -> void
+    {
+        setGlobalPalette(nullptr);
+    }
+
+    auto loadGlobalPalette(const std::string &pakPath, const EntryTable &entries) -> bool
+    {
+        // Find the colormap.pcx entry
+        auto id = entries.find("pics/colormap.pcx");
 
-        file.seekg(it->offset);
-        auto pcxImage = PCXParser::loadPCX(pakPath, *it);
-        if (!pcxImage)
+        if (!id)
         {
             return false;
         }
 
-        // Read back the texture data to get the palette
-        std::vector<uint8_t> pixels(pcxImage->width * pcxImage->height * 4);
-        glBindTexture(GL_TEXTURE_2D, pcxImage->textureID);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        // The palette Quake 2 uses for every WAL is the one appended to the colormap
+        PakFileEntry colormap = entries.entry(*id);
+        auto palette = PCXParser::readPalette(ParserRegistry::handlers[colormap.format].readData(pakPath, colormap));
+        setGlobalPalette(palette ? std::make_shared<const std::vector<uint8_t>>(std::move(*palette)) : nullptr);
 
-        // Convert RGBA to RGB palette
-        globalPalette = std::vector<uint8_t>(256 * 3);
-        for (int i = 0; i < 256; i++)
-        {
-            globalPalette->at(i * 3 + 0) = pixels[i * 4 + 0];
-            globalPalette->at(i * 3 + 1) = pixels[i * 4 + 1];
-            globalPalette->at(i * 3 + 2) = pixels[i * 4 + 2];
-        }
-
-        // Clean up the temporary texture
-        glDeleteTextures(1, &pcxImage->textureID);
-        return true;
+        return palette.has_value();
     }
 
-    auto readHeader(std::ifstream &file) -> std::optional<WALHeader>
+    auto readHeader(const std::vector<uint8_t> &data) -> std::optional<WALHeader>
     {
+        if (data.size() < sizeof(WALHeader))
+            return std::nullopt;
+
         WALHeader header;
-        file.read(header.name, 32);
-        file.read(reinterpret_cast<char *>(&header.width), 4);
-        file.read(reinterpret_cast<char *>(&header.height), 4);
-        file.read(reinterpret_cast<char *>(&header.offset), 16); // 4 mipmap offsets
-        file.read(header.animname, 32);
-        file.read(reinterpret_cast<char *>(&header.flags), 4);
-        file.read(reinterpret_cast<char *>(&header.contents), 4);
-        file.read(reinterpret_cast<char *>(&header.value), 4);
+        std::memcpy(&header, data.data(), sizeof(WALHeader));
 
-        return file ? std::optional(header) : std::nullopt;
+        return header;
     }
 
-    auto loadWAL(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<PCXImage>
+    auto probeWAL(const std::vector<uint8_t> &data) -> std::optional<ImageInfo>
     {
-        // Load the global palette if we haven't already
-        if (!globalPalette)
-        {
-            // We need to find all entries to locate the colormap
-            auto entries = PakParser::loadArchive(pakPath);
-            if (!entries || !loadGlobalPalette(pakPath, *entries))
-            {
-                return std::nullopt;
-            }
-        }
-
-        std::ifstream file(pakPath, std::ios::binary);
-        if (!file.is_open())
+        auto header = readHeader(data);
+        if (!header || header->width == 0 || header->height == 0)
             return std::nullopt;
 
-        file.seekg(entry.offset);
-        auto header = readHeader(file);
+        return ImageInfo{static_cast<int>(header->width), static_cast<int>(header->height), "WAL 8-bit"};
+    }
+
+    auto decodeWAL(const std::vector<uint8_t> &data, const PixelAllocator &allocate) -> bool
+    {
+        TRACE_SCOPE("Decode WAL");
+        auto colors = currentPalette();
+        if (!colors)
+            return false;
+
+        auto header = readHeader(data);
         if (!header)
-            return std::nullopt;
+            return false;
 
-        // Read the main image data
-        std::vector<uint8_t> data(header->width * header->height);
-        file.seekg(entry.offset + header->offset[0]); // First mipmap level
-        file.read(reinterpret_cast<char *>(data.data()), data.size());
+        // Make sure the first mipmap level actually fits inside the file
+        size_t pixelCount = static_cast<size_t>(header->width) * header->height;
+        if (pixelCount == 0 || header->offset[0] > data.size() || data.size() - header->offset[0] < pixelCount)
+            return false;
+
+        uint8_t *rgba = allocate(header->width, header->height);
+        if (!rgba)
+            return false;
 
         // Convert indexed color to RGBA using global palette
-        std::vector<uint8_t> rgba(header->width * header->height * 4);
-        for (int i = 0; i < header->width * header->height; i++)
+        const uint8_t *indices = data.data() + header->offset[0]; // First mipmap level
+        const uint8_t *palette = colors->data();
+        for (size_t i = 0; i < pixelCount; i++)
         {
-            uint8_t colorIndex = data[i];
+            uint8_t colorIndex = indices[i];
             // Handle transparent pixels (index 255 is transparent)
             if (colorIndex == 255)
             {
@@ -253,65 +470,175 @@ namespace WALParser
             }
             else
             {
-                rgba[i * 4 + 0] = globalPalette->at(colorIndex * 3 + 0); // R
-                rgba[i * 4 + 1] = globalPalette->at(colorIndex * 3 + 1); // G
-                rgba[i * 4 + 2] = globalPalette->at(colorIndex * 3 + 2); // B
-                rgba[i * 4 + 3] = 255;                                   // A (opaque)
+                rgba[i * 4 + 0] = palette[colorIndex * 3 + 0]; // R
+                rgba[i * 4 + 1] = palette[colorIndex * 3 + 1]; // G
+                rgba[i * 4 + 2] = palette[colorIndex * 3 + 2]; // B
+                rgba[i * 4 + 3] = 255;                         // A (opaque)
             }
         }
 
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, header->width, header->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return true;
+    }
+
+    // Load the global palette if we haven't already
+    auto ensureGlobalPalette(const std::string &pakPath, const PakFileEntry &entry) -> bool
+    {
+        if (currentPalette())
+            return true;
 
-        return PCXImage{static_cast<int>(header->width), static_cast<int>(header->height), textureID, ""};
+        // We need to find all entries to locate the colormap. The entry may be in an archive mounted
+        // from inside the open one, so go by the open archive's own format.
+        auto entries = ParserRegistry::openArchive(pakPath);
+        return entries && loadGlobalPalette(pakPath, *entries);
     }
 }
 
 namespace PKZipParser
 {
-    auto loadArchive(const std::string &path) -> std::optional<std::vector<PakFileEntry>>
+    // libzip reads Zip64 end of central directory records and extra fields on its own, so sizes and
+    // counts past 4 GB / 65535 entries come through zip_stat intact
+    auto readDirectory(zip_t *archive) -> EntryTable
     {
-        int error;
-        zip_t *archive = zip_open(path.c_str(), 0, &error);
-        if (!archive)
-            return std::nullopt;
-
-        std::vector<PakFileEntry> entries;
         zip_int64_t num_entries = zip_get_num_entries(archive, 0);
+        EntryTable entries(PakFormat::PKZIP);
+        entries.reserve(num_entries, num_entries * 32);
 
         for (zip_int64_t i = 0; i < num_entries; i++)
         {
             struct zip_stat st;
             if (zip_stat_index(archive, i, 0, &st) == -1)
                 continue;
+            if (!(st.valid & ZIP_STAT_NAME) || !(st.valid & ZIP_STAT_SIZE) || !*st.name)
+                continue;
 
             // Skip directories
-            if (st.name[strlen(st.name) - 1] == '/')
+            size_t nameLength = strlen(st.name);
+            if (st.name[nameLength - 1] == '/')
                 continue;
 
-            PakFileEntry entry;
-            entry.filename = st.name;
-            entry.size = st.size;
-            entry.format = PakFormat::PKZIP;
-            entry.zipFile = nullptr; // Will be set when file is opened
-            entries.push_back(entry);
+            uint8_t flags = 0;
+            if ((st.valid & ZIP_STAT_COMP_METHOD) && st.comp_method != ZIP_CM_STORE)
+                flags |= ENTRY_COMPRESSED;
+            if (st.valid & ZIP_STAT_CRC)
+                flags |= ENTRY_HAS_CRC;
+
+            entries.add(std::string_view(st.name, nameLength), 0, st.size, flags, st.crc);
         }
 
         return entries;
     }
 
+    auto loadArchive(const std::string &path) -> std::optional<EntryTable>
+    {
+        TRACE_SCOPE("Load PK3 directory");
+        int error;
+        zip_t *archive = zip_open(path.c_str(), ZIP_RDONLY, &error);
+        if (!archive)
+            return std::nullopt;
+
+        EntryTable entries = readDirectory(archive);
+        zip_close(archive);
+        return entries;
+    }
+
+    // Lets libzip read a ZIP that is itself an entry of another archive, through that entry's stream
+    struct StreamSource
+    {
+        std::unique_ptr<EntryStream> stream;
+        zip_error_t error;
+    };
+
+    auto streamSourceCallback(void *userdata, void *data, zip_uint64_t length, zip_source_cmd_t command) -> zip_int64_t
+    {
+        auto *source = static_cast<StreamSource *>(userdata);
+        switch (command)
+        {
+        case ZIP_SOURCE_OPEN:
+            return source->stream->seek(0) ? 0 : -1;
+        case ZIP_SOURCE_READ:
+            return static_cast<zip_int64_t>(source->stream->read(static_cast<uint8_t *>(data), static_cast<size_t>(length)));
+        case ZIP_SOURCE_CLOSE:
+            return 0;
+        case ZIP_SOURCE_STAT:
+        {
+            if (length < sizeof(zip_stat_t))
+            {
+                zip_error_set(&source->error, ZIP_ER_INVAL, 0);
+                return -1;
+            }
+            zip_stat_t *st = static_cast<zip_stat_t *>(data);
+            zip_stat_init(st);
+            st->size = source->stream->size();
+            st->valid |= ZIP_STAT_SIZE;
+            return sizeof(zip_stat_t);
+        }
+        case ZIP_SOURCE_SEEK:
+        {
+            zip_int64_t position = zip_source_seek_compute_offset(source->stream->position(), source->stream->size(),
+                                                                  data, length, &source->error);
+            if (position < 0)
+                return -1;
+            if (!source->stream->seek(static_cast<uint64_t>(position)))
+            {
+                zip_error_set(&source->error, ZIP_ER_SEEK, 0);
+                return -1;
+            }
+            return 0;
+        }
+        case ZIP_SOURCE_TELL:
+            return static_cast<zip_int64_t>(source->stream->position());
+        case ZIP_SOURCE_ERROR:
+            return zip_error_to_data(&source->error, data, length);
+        case ZIP_SOURCE_FREE:
+            zip_error_fini(&source->error);
+            delete source;
+            return 0;
+        case ZIP_SOURCE_SUPPORTS:
+            return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE, ZIP_SOURCE_STAT,
+                                                  ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, ZIP_SOURCE_SEEK, ZIP_SOURCE_TELL,
+                                                  ZIP_SOURCE_SUPPORTS, -1);
+        default:
+            zip_error_set(&source->error, ZIP_ER_OPNOTSUPP, 0);
+            return -1;
+        }
+    }
+
+    // The archive owns the stream from here on, and frees it when it's closed
+    auto openArchive(std::unique_ptr<EntryStream> stream) -> zip_t *
+    {
+        auto *source = new StreamSource{std::move(stream), {}};
+        zip_error_init(&source->error);
+
+        zip_error_t error;
+        zip_error_init(&error);
+        zip_source_t *zipSource = zip_source_function_create(&streamSourceCallback, source, &error);
+        if (!zipSource)
+        {
+            zip_error_fini(&source->error);
+            delete source;
+            zip_error_fini(&error);
+            return nullptr;
+        }
+
+        zip_t *archive = zip_open_from_source(zipSource, ZIP_RDONLY, &error);
+        if (!archive)
+            zip_source_free(zipSource); // Sends ZIP_SOURCE_FREE, which deletes source
+        zip_error_fini(&error);
+        return archive;
+    }
+
     auto readData(const std::string &path, const PakFileEntry &entry) -> std::vector<uint8_t>
     {
+        TRACE_SCOPE("Read PK3 entry");
+        if (entry.size > ParserRegistry::MAX_READ_SIZE)
+            return {};
+
         int error;
-        zip_t *archive = zip_open(path.c_str(), 0, &error);
+        zip_t *archive = zip_open(path.c_str(), ZIP_RDONLY, &error);
         if (!archive)
             return {};
 
-        zip_file_t *file = zip_fopen(archive, entry.filename.c_str(), 0);
+        zip_file_t *file = zip_fopen(archive, entry.filename.data(), 0);
         if (!file)
         {
             zip_close(archive);
@@ -319,835 +646,4554 @@ namespace PKZipParser
         }
 
         std::vector<uint8_t> data(entry.size);
-        zip_fread(file, data.data(), entry.size);
+        zip_int64_t read = zip_fread(file, data.data(), data.size());
+        data.resize(read > 0 ? read : 0);
         zip_fclose(file);
         zip_close(archive);
 
         return data;
     }
-}
 
-namespace TextFileParser
-{
-    auto loadTextFile(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<TextFile>
+    auto readPrefixes(const std::string &path, const std::vector<PakFileEntry> &entries, size_t maxSize) -> std::vector<std::vector<uint8_t>>
     {
-        auto readDataFunc = ParserRegistry::handlers[entry.format].readData;
-        auto data = readDataFunc(pakPath, entry);
-
-        if (data.empty())
-            return std::nullopt;
+        TRACE_SCOPE("Read PK3 prefixes");
+        std::vector<std::vector<uint8_t>> prefixes(entries.size());
 
-        return TextFile{std::string(data.begin(), data.end())};
-    }
-}
+        int error;
+        zip_t *archive = zip_open(path.c_str(), ZIP_RDONLY, &error);
+        if (!archive)
+            return prefixes;
 
-namespace BinaryFileParser
-{
-    auto loadBinaryFile(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<BinaryFile>
-    {
-        auto readDataFunc = ParserRegistry::handlers[entry.format].readData;
-        auto data = readDataFunc(pakPath, entry);
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            zip_file_t *file = zip_fopen(archive, entries[i].filename.data(), 0);
+            if (!file)
+                continue;
 
-        if (data.empty())
-            return std::nullopt;
+            // Only inflates as much as is needed for the prefix
+            prefixes[i].resize(std::min<uint64_t>(maxSize, entries[i].size));
+            zip_int64_t read = zip_fread(file, prefixes[i].data(), prefixes[i].size());
+            prefixes[i].resize(read > 0 ? read : 0);
+            zip_fclose(file);
+        }
 
-        return BinaryFile{data};
+        zip_close(archive);
+        return prefixes;
     }
-}
 
-namespace STBImageParser
-{
-    auto loadSTBImage(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<PCXImage>
+    class ZipEntryStream : public EntryStream
     {
-        auto readDataFunc = ParserRegistry::handlers[entry.format].readData;
-        auto data = readDataFunc(pakPath, entry);
-
-        if (data.empty())
-            return std::nullopt;
-
-        int width, height, channels;
-        unsigned char *imageData = stbi_load_from_memory(data.data(), data.size(), &width, &height, &channels, STBI_rgb_alpha);
-        if (!imageData)
-            return std::nullopt;
-
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-        stbi_image_free(imageData);
-        return PCXImage{width, height, textureID, ""};
-    }
-}
+    public:
+        // Closes the archive too if ownsArchive, otherwise leaves it to the caller
+        ZipEntryStream(zip_t *archive, zip_file_t *file, const PakFileEntry &entry, bool ownsArchive)
+            : archive(archive), file(file), name(entry.filename), length(entry.size), ownsArchive(ownsArchive) {}
 
-namespace ParserRegistry
-{
-    std::unordered_map<PakFormat, FormatHandlers> handlers = {
-        {PakFormat::PAK, {&PakParser::loadArchive, &PakParser::readData, "Quake/Quake 2 PAK Format"}},
-        {PakFormat::PKZIP, {&PKZipParser::loadArchive, &PKZipParser::readData, "ZIP-based Format (PK3/PK4)"}}};
-}
+        ~ZipEntryStream() override
+        {
+            if (file)
+                zip_fclose(file);
+            if (ownsArchive)
+                zip_close(archive);
+        }
 
-struct PakViewerState
-{
-    std::vector<PakFileEntry> entries;
-    std::vector<PCXImage> loadedImages;
-    std::optional<PCXImage> currentImage;
-    std::optional<TextFile> currentText;
-    std::optional<BinaryFile> currentBinary;
-    std::string pakPath;
-    int selectedEntry = -1;
-    bool showFileDialog = false;
-    std::string selectedPath;
-    float sidebarWidth = 200.0f;
-    FileTreeNode fileTree;
-    bool gridView = true;
-    std::string currentFolder;
-    float gridScale = 0.5f;
-    std::string searchFilter;
-    std::string statusMessage;
-};
+        auto size() const -> uint64_t override { return length; }
+        auto position() const -> uint64_t override { return current; }
 
-void setStatusMessage(PakViewerState &state, const std::string &message)
-{
-    state.statusMessage = message;
-    std::cout << "Status: " << message << std::endl;
-}
+        auto read(uint8_t *buffer, size_t count) -> size_t override
+        {
+            if (!file)
+                return 0;
 
-void buildFileTree(const std::vector<PakFileEntry> &entries, FileTreeNode &root)
-{
-    root.children.clear();
+            zip_int64_t read = zip_fread(file, buffer, count);
+            if (read <= 0)
+                return 0;
 
-    for (const auto &entry : entries)
-    {
-        std::string path = entry.filename;
-        FileTreeNode *current = &root;
+            current += read;
+            return static_cast<size_t>(read);
+        }
 
-        size_t pos = 0;
-        while ((pos = path.find('/')) != std::string::npos)
+        auto seek(uint64_t position) -> bool override
         {
-            std::string dir = path.substr(0, pos);
-            path = path.substr(pos + 1);
-
-            auto it = std::find_if(current->children.begin(), current->children.end(),
-                                   [&dir](const FileTreeNode &node)
-                                   { return node.name == dir; });
+            if (position > length || !file)
+                return false;
+            if (position == current)
+                return true;
+
+            // Stored entries (and deflated ones on libzip versions that support it) seek directly. A
+            // failed zip_fseek leaves the file in an error state, so only try it when it can work.
+            if (zip_file_is_seekable(file) == 1 && zip_fseek(file, static_cast<zip_int64_t>(position), SEEK_SET) == 0)
+            {
+                current = position;
+                return true;
+            }
 
-            if (it == current->children.end())
+            // Otherwise inflate from the start, or from here if we're only moving forwards
+            if (position < current)
             {
-                current->children.push_back({dir, {}, std::nullopt});
-                current = &current->children.back();
+                zip_fclose(file);
+                file = zip_fopen(archive, name.c_str(), 0);
+                current = 0;
+                if (!file)
+                    return false;
             }
-            else
+
+            std::vector<uint8_t> discard(64 * 1024);
+            while (current < position)
             {
-                current = &(*it);
+                size_t chunk = static_cast<size_t>(std::min<uint64_t>(discard.size(), position - current));
+                if (read(discard.data(), chunk) != chunk)
+                    return false;
             }
+            return true;
         }
 
-        if (!path.empty())
+    private:
+        zip_t *archive;
+        zip_file_t *file;
+        std::string name;
+        uint64_t length;
+        uint64_t current = 0;
+        bool ownsArchive;
+    };
+
+    auto openStream(const std::string &path, const PakFileEntry &entry) -> std::unique_ptr<EntryStream>
+    {
+        int error;
+        zip_t *archive = zip_open(path.c_str(), ZIP_RDONLY, &error);
+        if (!archive)
+            return nullptr;
+
+        zip_file_t *file = zip_fopen(archive, entry.filename.data(), 0);
+        if (!file)
         {
-            current->children.push_back({path, {}, entry});
+            zip_close(archive);
+            return nullptr;
         }
+
+        return std::make_unique<ZipEntryStream>(archive, file, entry, true);
     }
-}
 
-void collectSupportedImages(const FileTreeNode &node, const std::string &pakPath, std::vector<PCXImage> &images)
-{
-    if (node.entry)
+    auto visitEntries(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit) -> void
     {
-        std::string ext = std::filesystem::path(node.name).extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        int error;
+        zip_t *archive = zip_open(path.c_str(), ZIP_RDONLY, &error);
+        if (!archive)
+            return;
 
-        if (ext == ".pcx")
+        for (size_t i = 0; i < entries.size(); i++)
         {
-            if (auto image = PCXParser::loadPCX(pakPath, *node.entry))
-            {
-                image->filename = node.entry->filename; // Store the filename
-                images.push_back(*image);
-            }
-        }
-        else if (ext == ".wal")
-        {
-            if (auto image = WALParser::loadWAL(pakPath, *node.entry))
-            {
-                image->filename = node.entry->filename; // Store the filename
-                images.push_back(*image);
-            }
-        }
-        else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga")
-        {
-            if (auto image = STBImageParser::loadSTBImage(pakPath, *node.entry))
-            {
-                image->filename = node.entry->filename; // Store the filename
-                images.push_back(*image);
-            }
+            zip_file_t *file = zip_fopen(archive, entries[i].filename.data(), 0);
+            if (!file)
+                continue;
+
+            ZipEntryStream stream(archive, file, entries[i], false);
+            visit(i, stream);
         }
-    }
 
-    // Recursively process all children
-    for (const auto &child : node.children)
-    {
-        collectSupportedImages(child, pakPath, images);
+        zip_close(archive);
     }
 }
 
-bool stringContainsFilter(const std::string &str, const std::string &filter)
+// WAD2 (Quake) and WAD3 (Half-Life) texture collections. Lumps have no extension of their own, so one is
+// made up from the lump type for the viewer to go by.
+namespace WADParser
 {
-    if (filter.empty())
-        return true;
+    struct LumpRecord
+    {
+        int32_t offset;
+        int32_t diskSize;
+        int32_t size;
+        uint8_t type;
+        uint8_t compression;
+        uint16_t padding;
+        char name[16];
+    };
+    static_assert(sizeof(LumpRecord) == 32, "WAD lump records are 32 bytes on disk");
 
-    std::string lowerStr = str;
-    std::string lowerFilter = filter;
-    std::transform(lowerStr.begin(), lowerStr.end(), lowerStr.begin(), ::tolower);
-    std::transform(lowerFilter.begin(), lowerFilter.end(), lowerFilter.begin(), ::tolower);
+    constexpr uint8_t TYPE_PALETTE = 0x40;
+    constexpr uint8_t TYPE_QPIC = 0x42;
+    constexpr uint8_t TYPE_MIPTEX_WAD3 = 0x43; // Quake used 0x43 for sounds, which never shipped
+    constexpr uint8_t TYPE_MIPTEX_WAD2 = 0x44;
 
-    return lowerStr.find(lowerFilter) != std::string::npos;
-}
+    auto readDirectory(EntryStream &file) -> std::optional<EntryTable>
+    {
+        char magic[4];
+        int32_t lumpCount, directoryOffset;
+        if (!file.seek(0) ||
+            file.read(reinterpret_cast<uint8_t *>(magic), 4) != 4 ||
+            file.read(reinterpret_cast<uint8_t *>(&lumpCount), 4) != 4 ||
+            file.read(reinterpret_cast<uint8_t *>(&directoryOffset), 4) != 4)
+            return std::nullopt;
 
-bool nodeMatchesFilter(const FileTreeNode &node, const std::string &filter)
-{
-    if (filter.empty())
-        return true;
+        bool wad3 = std::memcmp(magic, "WAD3", 4) == 0;
+        if (!wad3 && std::memcmp(magic, "WAD2", 4) != 0)
+            return std::nullopt;
 
-    if (stringContainsFilter(node.name, filter))
-        return true;
+        uint64_t fileSize = file.size();
+        if (lumpCount < 0 || directoryOffset < 0 || static_cast<uint64_t>(directoryOffset) > fileSize ||
+            static_cast<uint64_t>(lumpCount) > (fileSize - directoryOffset) / sizeof(LumpRecord))
+            return std::nullopt;
 
-    if (node.entry && stringContainsFilter(node.entry->filename, filter))
-        return true;
+        std::vector<LumpRecord> directory(static_cast<size_t>(lumpCount));
+        size_t directoryBytes = directory.size() * sizeof(LumpRecord);
+        if (!file.seek(static_cast<uint64_t>(directoryOffset)) ||
+            file.read(reinterpret_cast<uint8_t *>(directory.data()), directoryBytes) != directoryBytes)
+            return std::nullopt;
+
+        EntryTable entries;
+        entries.reserve(directory.size(), directory.size() * 24);
+
+        for (const auto &lump : directory)
+        {
+            // Compressed lumps were planned for WAD2 but nothing ever wrote them
+            size_t nameLength = strnlen(lump.name, sizeof(lump.name));
+            if (lump.compression != 0 || nameLength == 0 || lump.offset < 0 || lump.diskSize < 0)
+                continue;
+
+            std::string name(lump.name, nameLength);
+            if (lump.type == (wad3 ? TYPE_MIPTEX_WAD3 : TYPE_MIPTEX_WAD2))
+                name += ".mip";
+            else if (lump.type == TYPE_QPIC || lump.type == TYPE_PALETTE)
+                name += ".lmp";
 
-    return false;
+            uint64_t offset = std::min<uint64_t>(static_cast<uint64_t>(lump.offset), fileSize);
+            uint64_t size = std::min<uint64_t>(static_cast<uint64_t>(lump.diskSize), fileSize - offset);
+            entries.add(name, offset, size);
+        }
+
+        return entries;
+    }
 }
 
-std::vector<const FileTreeNode *> getFilteredFiles(const FileTreeNode &node, const std::string &filter, int maxResults = std::numeric_limits<int>::max())
+// Archives stored inside the open one, like a pk3 in a zip or a texture WAD in a PAK, are mounted where
+// they are. Their directory is read through the entry holding them and their entries are added to the
+// open archive's table under the container's name, flagged ENTRY_NESTED, so nothing is ever extracted to
+// disk. A stored container is read through a view onto its range of the outer archive. A compressed one
+// would have to be inflated again for every seek, so it's inflated into memory once when it's mounted.
+namespace NestedParser
 {
-    std::vector<const FileTreeNode *> results;
+    enum class Kind
+    {
+        Pak,
+        Zip,
+        Wad
+    };
+
+    // Whether an entry is an archive that can be mounted, going by its extension
+    auto kindOf(std::string_view filename) -> std::optional<Kind>
+    {
+        std::string ext = std::filesystem::path(filename).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
 
-    std::vector<const FileTreeNode *> stack;
-    stack.push_back(&node);
+        if (ext == ".pak")
+            return Kind::Pak;
+        if (ext == ".pk3" || ext == ".pk4" || ext == ".zip")
+            return Kind::Zip;
+        if (ext == ".wad")
+            return Kind::Wad;
+        return std::nullopt;
+    }
 
-    while (!stack.empty())
+    // A window onto another stream. It seeks the stream before every read, so several of them can share
+    // one that a batch reader keeps open.
+    class RangeStream : public EntryStream
     {
-        const FileTreeNode *current = stack.back();
-        stack.pop_back();
+    public:
+        RangeStream(EntryStream &source, uint64_t base, uint64_t length)
+            : source(source), base(base), length(length) {}
 
-        if (current->entry)
+        auto size() const -> uint64_t override { return length; }
+        auto position() const -> uint64_t override { return current; }
+
+        auto read(uint8_t *buffer, size_t count) -> size_t override
         {
-            if (filter.empty() || stringContainsFilter(current->entry->filename, filter))
-            {
-                std::string ext = std::filesystem::path(current->name).extension().string();
-                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            count = static_cast<size_t>(std::min<uint64_t>(count, length - current));
+            if (count == 0 || (source.position() != base + current && !source.seek(base + current)))
+                return 0;
 
-                if (ext == ".pcx" || ext == ".wal" || ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga")
-                {
-                    results.push_back(current);
-                }
-            }
+            size_t read = source.read(buffer, count);
+            current += read;
+            return read;
         }
-        else
+
+        auto seek(uint64_t position) -> bool override
         {
-            for (auto it = current->children.rbegin(); it != current->children.rend(); ++it)
-            {
-                stack.push_back(&(*it));
-            }
+            if (position > length)
+                return false;
+            current = position;
+            return true;
         }
-    }
 
-    return results;
-}
+    private:
+        EntryStream &source;
+        uint64_t base;
+        uint64_t length;
+        uint64_t current = 0;
+    };
 
-void loadFilteredImages(const std::vector<const FileTreeNode *> &filteredNodes, const std::string &pakPath, std::vector<PCXImage> &images)
-{
-    for (const FileTreeNode *node : filteredNodes)
+    // Reads a container that was inflated into memory when it was mounted
+    class MemoryStream : public EntryStream
     {
-        if (!node->entry)
-            continue;
+    public:
+        explicit MemoryStream(std::shared_ptr<const std::vector<uint8_t>> data) : data(std::move(data)) {}
 
-        std::string ext = std::filesystem::path(node->name).extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        auto size() const -> uint64_t override { return data->size(); }
+        auto position() const -> uint64_t override { return current; }
 
-        if (ext == ".pcx")
-        {
-            if (auto image = PCXParser::loadPCX(pakPath, *node->entry))
-            {
-                image->filename = node->entry->filename;
-                images.push_back(*image);
-            }
-        }
-        else if (ext == ".wal")
+        auto read(uint8_t *buffer, size_t count) -> size_t override
         {
-            if (auto image = WALParser::loadWAL(pakPath, *node->entry))
-            {
-                image->filename = node->entry->filename;
-                images.push_back(*image);
-            }
+            count = std::min(count, data->size() - current);
+            std::memcpy(buffer, data->data() + current, count);
+            current += count;
+            return count;
         }
-        else if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga")
+
+        auto seek(uint64_t position) -> bool override
         {
-            if (auto image = STBImageParser::loadSTBImage(pakPath, *node->entry))
-            {
-                image->filename = node->entry->filename;
-                images.push_back(*image);
-            }
+            if (position > data->size())
+                return false;
+            current = static_cast<size_t>(position);
+            return true;
         }
-    }
-}
 
-// Helper to check if any children match the filter
-bool anyChildrenMatchFilter(const FileTreeNode &node, const std::string &filter)
-{
-    if (filter.empty())
-        return true;
+    private:
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        size_t current = 0;
+    };
 
-    // Limit search to only direct children for performance
-    for (const auto &child : node.children)
+    struct Mount
     {
-        // Check node name
-        if (stringContainsFilter(child.name, filter))
-            return true;
+        std::string pakPath; // The archive open in the viewer
+        std::string name;    // The container's entry name, which every entry mounted from it starts with
+        uint64_t offset;
+        uint64_t size;
+        PakFormat format;    // How the container itself is read, NESTED if it was mounted from a mount
+        Kind kind;
+        std::shared_ptr<const std::vector<uint8_t>> inflated; // Set for compressed containers
+
+        auto container() const -> PakFileEntry { return {name, offset, size, format}; }
+    };
 
-        // Check filename for files
-        if (child.entry && stringContainsFilter(child.entry->filename, filter))
-            return true;
-    }
+    // Mounts are only added on the UI thread, but readers on any thread look them up
+    std::mutex mountsMutex;
+    std::unordered_map<std::string, std::shared_ptr<const Mount>> mounts; // By container name
 
-    return false;
-}
+    auto registerMount(std::shared_ptr<const Mount> mount) -> void
+    {
+        std::lock_guard<std::mutex> lock(mountsMutex);
+        mounts[mount->name] = std::move(mount);
+    }
 
-void renderFileTreeNode(const FileTreeNode &node, PakViewerState &state, int depth, int maxDepth)
-{
-    // Prevent excessive recursion by limiting tree depth
-    if (depth >= maxDepth)
-        return;
+    // Readers that are still running keep the mounts they found alive until they're done
+    auto unmountAll() -> void
+    {
+        std::lock_guard<std::mutex> lock(mountsMutex);
+        mounts.clear();
+    }
 
-    // Check if this node or any of its children match the filter
-    bool nodeMatches = nodeMatchesFilter(node, state.searchFilter);
-    bool childrenMatch = false;
+    // Points a mount at where a reloaded archive has its container now, which is the only thing about it
+    // that can change while the container's contents stay the same
+    auto moveMount(const std::string &name, uint64_t offset) -> void
+    {
+        std::lock_guard<std::mutex> lock(mountsMutex);
+        auto found = mounts.find(name);
+        if (found == mounts.end() || found->second->offset == offset)
+            return;
+        auto moved = std::make_shared<Mount>(*found->second);
+        moved->offset = offset;
+        found->second = std::move(moved);
+    }
 
-    if (!nodeMatches && !state.searchFilter.empty())
+    auto unmount(const std::string &name) -> void
     {
-        childrenMatch = anyChildrenMatchFilter(node, state.searchFilter);
-        if (!childrenMatch)
-            return; // Skip this node if neither it nor its children match
+        std::lock_guard<std::mutex> lock(mountsMutex);
+        mounts.erase(name);
     }
 
-    if (node.children.empty())
+    // The innermost mount holding filename, along with the name the entry has inside it
+    auto findMount(const std::string &pakPath, std::string_view filename) -> std::pair<std::shared_ptr<const Mount>, std::string_view>
     {
-        // This is a file
-        std::string ext = std::filesystem::path(node.name).extension().string();
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        std::lock_guard<std::mutex> lock(mountsMutex);
+        for (size_t slash = filename.rfind('/'); slash != std::string_view::npos && slash > 0; slash = filename.rfind('/', slash - 1))
+        {
+            auto found = mounts.find(std::string(filename.substr(0, slash)));
+            if (found != mounts.end() && found->second->pakPath == pakPath)
+                return {found->second, filename.substr(slash + 1)};
+        }
+        return {nullptr, {}};
+    }
 
-        bool isPCX = ext == ".pcx";
-        bool isWAL = ext == ".wal";
-        bool isSTBImage = ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga";
-        bool isText = ext == ".cfg" || ext == ".txt" || ext == ".script" || ext == ".ent" ||
-                      ext == ".def" || ext == ".qc" || ext == ".log" || ext == ".ini" ||
-                      ext == ".lst" || ext == ".bsp.info" || ext == ".loc" || ext == ".arena" ||
-                      ext == ".md" || ext == ".rtf" || ext == ".html" || ext == ".htm" || ext == ".lang";
-        bool isBinary = ext == ".dat";
-        bool isViewable = isPCX || isWAL || isSTBImage || isText || isBinary;
+    auto openContainer(const Mount &mount) -> std::unique_ptr<EntryStream>
+    {
+        if (mount.inflated)
+            return std::make_unique<MemoryStream>(mount.inflated);
+        return ParserRegistry::handlers[mount.format].openStream(mount.pakPath, mount.container());
+    }
 
-        // Set text color based on file type
-        if (!isViewable)
+    // Opens a mounted archive's entries with its container opened once for all of them. Streams it
+    // hands out read through it, so they mustn't outlive it.
+    class MountReader
+    {
+    public:
+        explicit MountReader(const Mount &mount) : container(openContainer(mount))
         {
-            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.5f, 0.5f, 0.5f, 1.0f));
+            if (container && mount.kind == Kind::Zip)
+                archive = PKZipParser::openArchive(std::move(container));
         }
-        else if (nodeMatches && !state.searchFilter.empty())
+
+        ~MountReader()
         {
-            // Highlight matches
-            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
+            if (archive)
+                zip_close(archive);
         }
 
-        if (ImGui::Selectable(node.name.c_str(), state.selectedEntry != -1 &&
-                                                     state.entries[state.selectedEntry].filename == node.entry->filename))
+        MountReader(const MountReader &) = delete;
+        MountReader &operator=(const MountReader &) = delete;
+
+        // inner is named and placed as the mounted archive has it
+        auto open(const PakFileEntry &inner) -> std::unique_ptr<EntryStream>
         {
-            if (isViewable)
+            if (archive)
             {
-                state.selectedEntry = std::find_if(state.entries.begin(), state.entries.end(),
-                                                   [&](const PakFileEntry &e)
-                                                   { return e.filename == node.entry->filename; }) -
-                                      state.entries.begin();
-                state.gridView = false; // Switch to single view when selecting an image
-
-                if (isPCX)
-                {
-                    state.currentImage = PCXParser::loadPCX(state.pakPath, *node.entry);
-                    state.currentText = std::nullopt;
-                    state.currentBinary = std::nullopt;
-                }
-                else if (isWAL)
-                {
-                    state.currentImage = WALParser::loadWAL(state.pakPath, *node.entry);
-                    state.currentText = std::nullopt;
-                    state.currentBinary = std::nullopt;
-                }
-                else if (isSTBImage)
-                {
-                    state.currentImage = STBImageParser::loadSTBImage(state.pakPath, *node.entry);
-                    state.currentText = std::nullopt;
-                    state.currentBinary = std::nullopt;
-                }
-                else if (isText)
-                {
-                    state.currentImage = std::nullopt;
-                    state.currentText = TextFileParser::loadTextFile(state.pakPath, *node.entry);
-                    state.currentBinary = std::nullopt;
-                }
-                else if (isBinary)
-                {
-                    state.currentImage = std::nullopt;
-                    state.currentText = std::nullopt;
-                    state.currentBinary = BinaryFileParser::loadBinaryFile(state.pakPath, *node.entry);
-                }
+                zip_file_t *file = zip_fopen(archive, inner.filename.data(), 0);
+                if (!file)
+                    return nullptr;
+                return std::make_unique<PKZipParser::ZipEntryStream>(archive, file, inner, false);
             }
+            if (!container)
+                return nullptr;
+            return std::make_unique<RangeStream>(*container, inner.offset, inner.size);
         }
 
-        // Pop the style color if we pushed it
-        if (!isViewable || (nodeMatches && !state.searchFilter.empty()))
+    private:
+        std::unique_ptr<EntryStream> container;
+        zip_t *archive = nullptr;
+    };
+
+    // A single entry opened on its own, which keeps its reader open for as long as it's read
+    class ReaderStream : public EntryStream
+    {
+    public:
+        ReaderStream(std::unique_ptr<MountReader> reader, std::unique_ptr<EntryStream> stream)
+            : reader(std::move(reader)), stream(std::move(stream)) {}
+
+        auto size() const -> uint64_t override { return stream->size(); }
+        auto position() const -> uint64_t override { return stream->position(); }
+        auto read(uint8_t *buffer, size_t count) -> size_t override { return stream->read(buffer, count); }
+        auto seek(uint64_t position) -> bool override { return stream->seek(position); }
+
+    private:
+        std::unique_ptr<MountReader> reader; // Declared first so the stream goes before it
+        std::unique_ptr<EntryStream> stream;
+    };
+
+    auto innerEntry(const PakFileEntry &entry, std::string_view innerName) -> PakFileEntry
+    {
+        return {innerName, entry.offset, entry.size, PakFormat::UNKNOWN};
+    }
+
+    struct MountGroup
+    {
+        std::shared_ptr<const Mount> mount;
+        std::vector<size_t> indices; // Into the batch
+        std::vector<PakFileEntry> inner;
+    };
+
+    // Splits a batch by the archive each entry was mounted from, so each container is opened once.
+    // Entries whose mount has gone are left out.
+    auto groupByMount(const std::string &path, const std::vector<PakFileEntry> &entries) -> std::vector<MountGroup>
+    {
+        std::vector<MountGroup> groups;
+        for (size_t i = 0; i < entries.size(); i++)
         {
-            ImGui::PopStyleColor();
+            auto [mount, innerName] = findMount(path, entries[i].filename);
+            if (!mount)
+                continue;
+
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const MountGroup &g)
+                                      { return g.mount == mount; });
+            if (group == groups.end())
+                group = groups.insert(groups.end(), MountGroup{mount, {}, {}});
+            group->indices.push_back(i);
+            group->inner.push_back(innerEntry(entries[i], innerName));
         }
+        return groups;
     }
-    else
+
+    auto loadArchive(const std::string &) -> std::optional<EntryTable>
     {
-        // This is a directory
-        // If there's a search filter and this node contains matches, automatically open it
-        ImGuiTreeNodeFlags nodeFlags = 0;
-        if (!state.searchFilter.empty() && childrenMatch)
-            nodeFlags |= ImGuiTreeNodeFlags_DefaultOpen;
+        return std::nullopt; // Mounts are only ever opened from inside another archive
+    }
+
+    auto openStream(const std::string &path, const PakFileEntry &entry) -> std::unique_ptr<EntryStream>
+    {
+        auto [mount, innerName] = findMount(path, entry.filename);
+        if (!mount)
+            return nullptr;
+
+        auto reader = std::make_unique<MountReader>(*mount);
+        auto stream = reader->open(innerEntry(entry, innerName));
+        if (!stream)
+            return nullptr;
+        return std::make_unique<ReaderStream>(std::move(reader), std::move(stream));
+    }
+
+    auto readData(const std::string &path, const PakFileEntry &entry) -> std::vector<uint8_t>
+    {
+        TRACE_SCOPE("Read nested entry");
+        if (entry.size > ParserRegistry::MAX_READ_SIZE)
+            return {};
 
-        // Highlight directory if it matches the search
-        if (nodeMatches && !state.searchFilter.empty())
-            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
+        auto stream = openStream(path, entry);
+        if (!stream)
+            return {};
 
-        if (ImGui::TreeNodeEx(node.name.c_str(), nodeFlags))
+        std::vector<uint8_t> data(entry.size);
+        size_t total = 0;
+        while (total < data.size())
         {
-            // Only process children if we haven't exceeded the maximum depth
-            if (depth + 1 < maxDepth)
-            {
-                for (const auto &child : node.children)
-                {
-                    renderFileTreeNode(child, state, depth + 1, maxDepth);
-                }
-            }
-            else if (depth + 1 == maxDepth)
+            size_t read = stream->read(data.data() + total, data.size() - total);
+            if (read == 0)
+                break;
+            total += read;
+        }
+        data.resize(total);
+        return data;
+    }
+
+    auto visitEntries(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit) -> void
+    {
+        for (auto &group : groupByMount(path, entries))
+        {
+            MountReader reader(*group.mount);
+
+            // Entries of PAKs and WADs sit at offsets in their container, so going in offset order
+            // sweeps forwards through it. ZIP entries all have offset 0 here and keep their order.
+            std::vector<size_t> order(group.inner.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                             { return group.inner[a].offset < group.inner[b].offset; });
+
+            for (size_t k : order)
             {
-                // At max depth, just display a message
-                ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "(Maximum depth reached)");
+                if (auto stream = reader.open(group.inner[k]))
+                    visit(group.indices[k], *stream);
             }
-
-            ImGui::TreePop();
         }
+    }
 
-        // Pop style if we pushed it
-        if (nodeMatches && !state.searchFilter.empty())
-            ImGui::PopStyleColor();
+    auto readPrefixes(const std::string &path, const std::vector<PakFileEntry> &entries, size_t maxSize) -> std::vector<std::vector<uint8_t>>
+    {
+        TRACE_SCOPE("Read nested prefixes");
+        std::vector<std::vector<uint8_t>> prefixes(entries.size());
+        visitEntries(path, entries, [&](size_t i, EntryStream &stream)
+                     {
+                         prefixes[i].resize(std::min<uint64_t>(maxSize, stream.size()));
+                         prefixes[i].resize(stream.read(prefixes[i].data(), prefixes[i].size())); });
+        return prefixes;
+    }
 
-        // Handle folder selection
-        if (ImGui::IsItemClicked())
+    struct Mounted
+    {
+        std::shared_ptr<const Mount> mount;
+        EntryTable entries; // Named as the mounted archive has them
+    };
+
+    // Reads the directory of the archive stored in container. Nothing is registered, so the caller can
+    // drop the result if the open archive changed while this ran.
+    auto mount(const std::string &pakPath, const PakFileEntry &container, uint8_t flags) -> std::optional<Mounted>
+    {
+        TRACE_SCOPE("Mount nested archive");
+        auto kind = kindOf(container.filename);
+        if (!kind)
+            return std::nullopt;
+
+        auto mount = std::make_shared<Mount>();
+        mount->pakPath = pakPath;
+        mount->name = std::string(container.filename);
+        mount->offset = container.offset;
+        mount->size = container.size;
+        mount->format = container.format;
+        mount->kind = *kind;
+
+        if (flags & ENTRY_COMPRESSED)
         {
-            state.gridView = true;
-            state.currentFolder = node.name;
+            auto data = ParserRegistry::handlers[container.format].readData(pakPath, container);
+            if (data.size() != container.size)
+                return std::nullopt;
+            mount->inflated = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+        }
 
-            // First get filtered files based on search criteria
-            auto filteredFiles = getFilteredFiles(node, state.searchFilter);
+        auto stream = openContainer(*mount);
+        if (!stream)
+            return std::nullopt;
 
-            // Clear previous images and load new ones
-            state.loadedImages.clear();
-            loadFilteredImages(filteredFiles, state.pakPath, state.loadedImages);
+        std::optional<EntryTable> entries;
+        if (*kind == Kind::Pak)
+            entries = PakParser::readDirectory(*stream);
+        else if (*kind == Kind::Wad)
+            entries = WADParser::readDirectory(*stream);
+        else if (zip_t *archive = PKZipParser::openArchive(std::move(stream)))
+        {
+            entries = PKZipParser::readDirectory(archive);
+            zip_close(archive);
         }
+
+        if (!entries)
+            return std::nullopt;
+        return Mounted{std::move(mount), std::move(*entries)};
     }
 }
 
-std::string openFileDialog()
+namespace TextFileParser
 {
-    const char *file = tinyfd_openFileDialog(
-        "Select PAK/PK3 etc. File",
-        "",
-        0,
-        nullptr,
-        "All Files",
-        0);
+    constexpr size_t MAX_TEXT_SIZE = 8 * 1024 * 1024; // More than this isn't readable in a text view anyway
 
-    if (file)
+    auto loadTextFile(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<TextFile>
     {
-        std::string path(file);
-        std::cout << "Selected file: " << path << std::endl;
-        std::cout << "Extension: " << std::filesystem::path(path).extension().string() << std::endl;
-        return path;
+        auto stream = ParserRegistry::handlers[entry.format].openStream(pakPath, entry);
+        if (!stream)
+            return std::nullopt;
+
+        std::string contents(std::min<uint64_t>(stream->size(), MAX_TEXT_SIZE), '\0');
+        contents.resize(stream->read(reinterpret_cast<uint8_t *>(contents.data()), contents.size()));
+
+        if (contents.empty())
+            return std::nullopt;
+
+        return TextFile{std::move(contents), stream->size() > MAX_TEXT_SIZE};
     }
-    return "";
 }
 
-auto renderUI(PakViewerState &state) -> void
+namespace BinaryFileParser
 {
-    ImGui::SetNextWindowPos(ImVec2(0, 0));
-    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
-    ImGui::Begin("PAK Adventure", nullptr,
-                 ImGuiWindowFlags_NoTitleBar |
-                     ImGuiWindowFlags_NoResize |
-                     ImGuiWindowFlags_NoMove |
-                     ImGuiWindowFlags_NoBringToFrontOnFocus |
-                     ImGuiWindowFlags_NoNavFocus);
+    constexpr size_t PAGE_SIZE = 64 * 1024;
 
-    // Create a horizontal layout for the top bar
-    ImGui::BeginChild("TopBar", ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 8), true);
-
-    // Left side: Open PAK File button
-    if (ImGui::Button("Open PAK File"))
+    // Loads the page containing offset
+    auto loadPage(BinaryFile &binary, uint64_t offset) -> bool
     {
-        std::string selectedFile = openFileDialog();
-        if (!selectedFile.empty())
-        {
-            if (std::filesystem::exists(selectedFile))
-            {
-                std::string ext = std::filesystem::path(selectedFile).extension().string();
-                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-
-                PakFormat format = ParserRegistry::getFormatFromExtension(ext);
+        offset -= offset % PAGE_SIZE;
+        if (!binary.stream->seek(offset))
+            return false;
 
-                if (format != PakFormat::UNKNOWN)
-                {
-                    auto loadFunc = ParserRegistry::handlers[format].loadArchive;
-                    auto newEntries = loadFunc(selectedFile);
+        binary.page.resize(std::min<uint64_t>(PAGE_SIZE, binary.stream->size() - offset));
+        binary.page.resize(binary.stream->read(binary.page.data(), binary.page.size()));
+        binary.pageOffset = offset;
 
-                    if (newEntries)
-                    {
-                        state.entries = *newEntries;
-                        state.pakPath = selectedFile;
-                        state.currentImage = std::nullopt;
-                        state.selectedEntry = -1;
-                        buildFileTree(state.entries, state.fileTree);
-                        state.searchFilter = ""; // Clear search filter when loading a new file
-                        state.loadedImages.clear();
-                        setStatusMessage(state, "File loaded successfully");
-                    }
-                    else
-                    {
-                        setStatusMessage(state, "Unknown file type");
-                    }
-                }
-            }
-        }
+        return true;
     }
 
-    // Right side: Status message
-    ImGui::SameLine();
-    float statusWidth = ImGui::GetWindowWidth() - ImGui::GetCursorPosX() - 10.0f;
-    ImGui::SetCursorPosX(ImGui::GetWindowWidth() - statusWidth - 10.0f);
-    ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "%s", state.statusMessage.c_str());
+    auto loadBinaryFile(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<BinaryFile>
+    {
+        auto stream = ParserRegistry::handlers[entry.format].openStream(pakPath, entry);
+        if (!stream)
+            return std::nullopt;
 
-    ImGui::EndChild();
+        BinaryFile binary;
+        binary.stream = std::move(stream);
+        if (!loadPage(binary, 0) || binary.page.empty())
+            return std::nullopt;
+
+        return binary;
+    }
+}
+
+namespace MapParser
+{
+    // Quake textures index into the palette every Quake game ships as gfx/palette.lmp
+    auto readQuakePalette(const std::string &pakPath, const EntryTable &entries) -> std::vector<uint8_t>
+    {
+        auto id = entries.find("gfx/palette.lmp");
+        if (!id)
+            return {};
+        PakFileEntry palette = entries.entry(*id);
+        return ParserRegistry::handlers[palette.format].readData(pakPath, palette);
+    }
+
+    // Quake 2 maps name .wal files under textures/. A map in a mounted archive looks in that archive
+    // first, then at the top level. Looked up once per table rather than every frame.
+    void findTextureFiles(const std::string &pakPath, const EntryTable &entries, std::string_view mapName, MapView &map)
+    {
+        map.files.assign(map.textures.size(), INVALID_ENTRY_ID);
+        if (map.header.version != BspVersion::Quake2)
+            return;
+
+        // One pass over the table, instead of a scan of it for every texture
+        std::unordered_map<std::string_view, EntryId> byName;
+        byName.reserve(entries.size());
+        for (EntryId id = 0; id < entries.size(); id++)
+            byName.emplace(entries.name(id), id);
+
+        std::string container;
+        if (auto [mount, inner] = NestedParser::findMount(pakPath, mapName); mount)
+            container = mount->name + "/";
+
+        for (size_t i = 0; i < map.textures.size(); i++)
+        {
+            std::string file = "textures/" + map.textures[i].name + ".wal";
+            auto found = byName.find(container + file);
+            if (found == byName.end() && !container.empty())
+                found = byName.find(file);
+            if (found != byName.end())
+                map.files[i] = found->second;
+        }
+    }
+
+    // Only the lump directory and the texture lumps are read. Maps in a PAK are read where they sit in
+    // the mapped archive, unless it isn't mapped; then, like everything else, they're streamed.
+    auto loadMap(const std::string &pakPath, const EntryTable &entries, const PakFileEntry &entry) -> std::optional<MapView>
+    {
+        TRACE_SCOPE("Load map");
+        std::optional<MappedFile> mapped;
+        std::unique_ptr<EntryStream> stream;
+        std::optional<BspSource> source;
+
+        if (entry.format == PakFormat::PAK)
+        {
+            mapped.emplace(pakPath);
+            if (const uint8_t *bytes = mapped->range(entry.offset, entry.size))
+                source.emplace(bytes, entry.size);
+        }
+        if (!source && (stream = ParserRegistry::handlers[entry.format].openStream(pakPath, entry)))
+            source.emplace(*stream);
+
+        if (!source)
+            return std::nullopt;
+
+        auto header = BspReader::readHeader(*source);
+        if (!header)
+            return std::nullopt;
+
+        MapView map;
+        map.header = std::move(*header);
+        map.textures = BspReader::readTextures(*source, map.header);
+        map.images.resize(map.textures.size());
+
+        std::vector<uint8_t> palette;
+        if (map.header.version == BspVersion::Quake)
+            palette = readQuakePalette(pakPath, entries);
+
+        for (size_t i = 0; i < map.textures.size(); i++)
+        {
+            const BspTexture &texture = map.textures[i];
+            if (!texture.embedded)
+                continue;
+
+            map.images[i] = TextureUploader::upload([&](const PixelAllocator &allocate)
+                                                    { return BspReader::decodeTexture(*source, map.header, texture, palette, allocate); },
+                                                    nullptr, MemoryCategory::MapTextures);
+            if (map.images[i])
+                map.images[i]->filename = texture.name;
+        }
+        findTextureFiles(pakPath, entries, entry.filename, map);
+        return map;
+    }
+
+    auto releaseMap(MapView &map) -> void
+    {
+        for (auto &image : map.images)
+        {
+            if (image)
+                TextureUploader::release(*image);
+        }
+    }
+}
+
+// Textures out of WAD2 and WAD3 files, which are laid out like the ones embedded in maps
+namespace MipParser
+{
+    constexpr size_t HEADER_SIZE = 40; // Name, width, height and four mip offsets
+    constexpr size_t PALETTE_SIZE = 768;
+
+    // Shared with running decodes the same way as WALParser's palette
+    std::mutex paletteMutex;
+    std::shared_ptr<const std::vector<uint8_t>> quakePalette; // Empty if the archive has none
+
+    auto currentPalette() -> std::shared_ptr<const std::vector<uint8_t>>
+    {
+        std::lock_guard<std::mutex> lock(paletteMutex);
+        return quakePalette;
+    }
+
+    auto setQuakePalette(std::shared_ptr<const std::vector<uint8_t>> palette) -> void
+    {
+        std::lock_guard<std::mutex> lock(paletteMutex);
+        if (quakePalette)
+            MemoryStats::release(MemoryCategory::Palettes, quakePalette->size());
+        quakePalette = std::move(palette);
+        if (quakePalette)
+            MemoryStats::allocate(MemoryCategory::Palettes, quakePalette->size());
+    }
+
+    auto resetQuakePalette() -> void
+    {
+        setQuakePalette(nullptr);
+    }
+
+    auto readHeader(const std::vector<uint8_t> &data, BspTexture &texture) -> bool
+    {
+        if (data.size() < HEADER_SIZE)
+            return false;
+
+        uint32_t offsets[5];
+        std::memcpy(offsets, data.data() + 16, sizeof(offsets));
+        texture.name = std::string(reinterpret_cast<const char *>(data.data()), strnlen(reinterpret_cast<const char *>(data.data()), 16));
+        texture.width = offsets[0];
+        texture.height = offsets[1];
+        texture.offset = 0;
+        texture.embedded = true;
+        return texture.width > 0 && texture.height > 0 && texture.width <= 4096 && texture.height <= 4096;
+    }
+
+    auto probeMip(const std::vector<uint8_t> &data) -> std::optional<ImageInfo>
+    {
+        BspTexture texture;
+        if (!readHeader(data, texture))
+            return std::nullopt;
+        return ImageInfo{static_cast<int>(texture.width), static_cast<int>(texture.height), "Miptex 8-bit"};
+    }
+
+    auto decodeMip(const std::vector<uint8_t> &data, const PixelAllocator &allocate) -> bool
+    {
+        TRACE_SCOPE("Decode miptex");
+        BspTexture texture;
+        if (!readHeader(data, texture))
+            return false;
+
+        // WAD3 textures carry a palette after the smallest mip level, which WAD2 ones have nothing after
+        uint32_t lastMipOffset;
+        std::memcpy(&lastMipOffset, data.data() + 36, 4);
+        uint64_t paletteEnd = static_cast<uint64_t>(lastMipOffset) + (texture.width / 8) * (texture.height / 8) + 2 + PALETTE_SIZE;
+        BspHeader header{paletteEnd <= data.size() ? BspVersion::HalfLife : BspVersion::Quake, "", {}};
+
+        static const std::vector<uint8_t> noPalette;
+        auto palette = currentPalette();
+        BspSource source(data.data(), data.size());
+        return BspReader::decodeTexture(source, header, texture, palette ? *palette : noPalette, allocate);
+    }
+
+    // WAD2 textures come out greyscale if the archive has no Quake palette
+    auto ensureQuakePalette(const std::string &pakPath) -> bool
+    {
+        if (currentPalette())
+            return true;
+
+        auto entries = ParserRegistry::openArchive(pakPath);
+        setQuakePalette(std::make_shared<const std::vector<uint8_t>>(
+            entries ? MapParser::readQuakePalette(pakPath, *entries) : std::vector<uint8_t>()));
+        return true;
+    }
+}
+
+namespace STBImageParser
+{
+    auto probeSTBImage(const std::vector<uint8_t> &data) -> std::optional<ImageInfo>
+    {
+        int width, height, channels;
+        if (!stbi_info_from_memory(data.data(), data.size(), &width, &height, &channels))
+            return std::nullopt;
+
+        // stb doesn't say which format it recognised, so go by the signature
+        std::string format = "TGA";
+        if (data.size() >= 4 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G')
+            format = "PNG";
+        else if (data.size() >= 2 && data[0] == 0xFF && data[1] == 0xD8)
+            format = "JPEG";
+
+        return ImageInfo{width, height, format + " " + std::to_string(channels * 8) + "-bit"};
+    }
+
+    auto decodeSTBImage(const std::vector<uint8_t> &data, const PixelAllocator &allocate) -> bool
+    {
+        TRACE_SCOPE("Decode STB image");
+        int width, height, channels;
+        unsigned char *imageData = stbi_load_from_memory(data.data(), data.size(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!imageData)
+            return false;
+
+        uint8_t *rgba = allocate(width, height);
+        if (rgba)
+            std::memcpy(rgba, imageData, static_cast<size_t>(width) * height * 4);
+
+        stbi_image_free(imageData);
+        return rgba != nullptr;
+    }
+}
+
+namespace ImageLoader
+{
+    using Prober = std::optional<ImageInfo> (*)(const std::vector<uint8_t> &);
+    using Decoder = bool (*)(const std::vector<uint8_t> &, const PixelAllocator &);
+
+    struct ImageFormat
+    {
+        Prober probe;   // Reads the dimensions from the first PROBE_SIZE bytes
+        Decoder decode; // Decodes the whole file
+    };
+
+    // Enough for every header we probe, apart from JPEGs with large metadata segments in front of the frame
+    constexpr size_t PROBE_SIZE = 512;
+    constexpr size_t PROBE_RETRY_SIZE = 64 * 1024;
+
+    // Returns how to handle a file, or nullptr if it isn't an image we can show
+    auto getImageFormat(std::string_view filename) -> const ImageFormat *
+    {
+        static const ImageFormat pcx{&PCXParser::probePCX, &PCXParser::decodePCX};
+        static const ImageFormat wal{&WALParser::probeWAL, &WALParser::decodeWAL};
+        static const ImageFormat stb{&STBImageParser::probeSTBImage, &STBImageParser::decodeSTBImage};
+        static const ImageFormat mip{&MipParser::probeMip, &MipParser::decodeMip};
+
+        std::string ext = std::filesystem::path(filename).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        if (ext == ".pcx")
+            return &pcx;
+        if (ext == ".wal")
+            return &wal;
+        if (ext == ".mip")
+            return &mip;
+        if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga")
+            return &stb;
+        return nullptr;
+    }
+
+    auto getDecoder(std::string_view filename) -> Decoder
+    {
+        const ImageFormat *format = getImageFormat(filename);
+        return format ? format->decode : nullptr;
+    }
+
+    // Reads just the headers of a batch of entries from one archive, opening it once. Entries that
+    // aren't images or can't be probed come back empty.
+    auto probeImages(const std::string &pakPath, const std::vector<PakFileEntry> &entries) -> std::vector<std::optional<ImageInfo>>
+    {
+        TRACE_SCOPE("Probe image headers");
+        std::vector<std::optional<ImageInfo>> infos(entries.size());
+        if (entries.empty())
+            return infos;
+
+        auto prefixes = ParserRegistry::readPrefixes(pakPath, entries, PROBE_SIZE);
+
+        std::vector<PakFileEntry> retries;
+        std::vector<size_t> retryIndices;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const ImageFormat *format = getImageFormat(entries[i].filename);
+            if (!format)
+                continue;
+
+            infos[i] = format->probe(prefixes[i]);
+            if (!infos[i] && entries[i].size > PROBE_SIZE)
+            {
+                retries.push_back(entries[i]);
+                retryIndices.push_back(i);
+            }
+        }
+
+        if (!retries.empty())
+        {
+            prefixes = ParserRegistry::readPrefixes(pakPath, retries, PROBE_RETRY_SIZE);
+            for (size_t i = 0; i < retries.size(); i++)
+            {
+                infos[retryIndices[i]] = getImageFormat(retries[i].filename)->probe(prefixes[i]);
+            }
+        }
+
+        return infos;
+    }
+
+    // Loads whatever shared state a decoder needs from the archive, like the WAL palette
+    auto prepareDecoder(const std::string &pakPath, const PakFileEntry &entry, Decoder decoder) -> bool
+    {
+        if (decoder == &WALParser::decodeWAL)
+            return WALParser::ensureGlobalPalette(pakPath, entry);
+        if (decoder == &MipParser::decodeMip)
+            return MipParser::ensureQuakePalette(pakPath);
+        return true;
+    }
+
+    // Forgets the shared state prepareDecoder loaded, which came from the archive that was open. Called
+    // from the main thread whenever the archive is replaced, before anything is queued to decode from
+    // the new one.
+    auto resetDecoders() -> void
+    {
+        WALParser::resetGlobalPalette();
+        MipParser::resetQuakePalette();
+    }
+
+    // Thumbnails come from the on-disk cache when possible, so a folder that has been viewed before
+    // doesn't read or decode anything from the archive
+    auto generateThumbnail(const std::string &pakPath, const PakFileEntry &entry, Decoder decoder, int thumbnailSize,
+                           const PixelAllocator &allocate) -> bool
+    {
+        uint64_t key = ThumbnailCache::entryKey(ThumbnailCache::archiveKey(pakPath), entry, thumbnailSize);
+        if (ThumbnailCache::lookup(key, allocate))
+            return true;
+
+        if (!prepareDecoder(pakPath, entry, decoder))
+            return false;
+
+        auto data = ParserRegistry::handlers[entry.format].readData(pakPath, entry);
+        if (data.empty())
+            return false;
+        MemoryScope dataMemory(MemoryCategory::DecodeBuffers, data.size());
+
+        // Upload memory is write-only, so build the thumbnail somewhere the cache can read it back from
+        std::vector<uint8_t> pixels;
+        int width = 0, height = 0;
+        bool generated = Thumbnail::generate([&](const PixelAllocator &decodeAllocate)
+                                             { return decoder(data, decodeAllocate); },
+                                             thumbnailSize,
+                                             [&](int w, int h) -> uint8_t *
+                                             {
+                                                 width = w;
+                                                 height = h;
+                                                 pixels.resize(static_cast<size_t>(w) * h * 4);
+                                                 return pixels.data();
+                                             });
+        MemoryScope pixelMemory(MemoryCategory::DecodeBuffers, pixels.size());
+        if (!generated)
+            return false;
+
+        ThumbnailCache::store(key, width, height, pixels.data());
+
+        uint8_t *dst = allocate(width, height);
+        if (dst)
+            std::memcpy(dst, pixels.data(), pixels.size());
+        return dst != nullptr;
+    }
+
+    // Decodes an entry and queues it for upload. With a thumbnail size the image is scaled down to fit
+    // it first, and small enough images are packed into the atlas when one is given. category is what
+    // a full size image's texture is accounted as.
+    auto loadImage(const std::string &pakPath, const PakFileEntry &entry, TextureAtlas *atlas = nullptr, int thumbnailSize = 0,
+                   MemoryCategory category = MemoryCategory::Images) -> std::optional<PCXImage>
+    {
+        Decoder decoder = getDecoder(entry.filename);
+        if (!decoder)
+            return std::nullopt;
+
+        std::optional<PCXImage> image;
+        if (thumbnailSize > 0)
+        {
+            image = TextureUploader::upload([&](const PixelAllocator &allocate)
+                                            { return generateThumbnail(pakPath, entry, decoder, thumbnailSize, allocate); },
+                                            atlas, MemoryCategory::Thumbnails);
+        }
+        else
+        {
+            if (!prepareDecoder(pakPath, entry, decoder))
+                return std::nullopt;
+
+            auto data = ParserRegistry::handlers[entry.format].readData(pakPath, entry);
+            if (data.empty())
+                return std::nullopt;
+            MemoryScope dataMemory(MemoryCategory::DecodeBuffers, data.size());
+
+            image = TextureUploader::upload([&](const PixelAllocator &allocate)
+                                            { return decoder(data, allocate); },
+                                            atlas, category);
+        }
+
+        if (image)
+            image->filename = std::string(entry.filename);
+        return image;
+    }
+}
+
+namespace ModelParser
+{
+    // Skins are usually named by their path in the game, but some are left with a path from the
+    // developer's machine, so fall back to a file of the same name next to the model
+    auto findSkin(const EntryTable &entries, const std::filesystem::path &modelDirectory, const std::string &skin) -> std::optional<EntryId>
+    {
+        if (auto id = entries.find(skin))
+            return id;
+        return entries.find((modelDirectory / std::filesystem::path(skin).filename()).generic_string());
+    }
+
+    // Player models name no skins at all, since the player picks one. Offer every PCX in the model's
+    // directory instead, apart from the _i.pcx icons that sit alongside them.
+    auto findDirectorySkins(const EntryTable &entries, const std::filesystem::path &modelDirectory) -> std::vector<std::string>
+    {
+        std::vector<std::string> skins;
+        for (EntryId id = 0; id < entries.size(); id++)
+        {
+            std::filesystem::path path(entries.name(id));
+            std::string ext = path.extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            std::string stem = path.stem().string();
+            bool icon = stem.size() >= 2 && stem.compare(stem.size() - 2, 2, "_i") == 0;
+            if (ext == ".pcx" && !icon && path.parent_path() == modelDirectory)
+                skins.emplace_back(entries.name(id));
+        }
+        std::sort(skins.begin(), skins.end());
+        return skins;
+    }
+
+    // Models in a PAK are parsed where they sit in the mapped archive, and everything else (or a model in
+    // a PAK that isn't mapped) is read into memory first. Skins go through the same decoders as the
+    // images in the gallery.
+    auto loadModel(const std::string &pakPath, const EntryTable &entries, const PakFileEntry &entry) -> std::optional<ModelView>
+    {
+        TRACE_SCOPE("Load model");
+        std::optional<Md2Model> model;
+        std::optional<MappedFile> mapped;
+        const uint8_t *bytes = nullptr;
+        if (entry.format == PakFormat::PAK)
+            bytes = mapped.emplace(pakPath).range(entry.offset, entry.size);
+        if (bytes)
+            model = Md2Reader::read(bytes, entry.size);
+        else
+        {
+            auto data = ParserRegistry::handlers[entry.format].readData(pakPath, entry);
+            model = Md2Reader::read(data.data(), data.size());
+        }
+        if (!model)
+            return std::nullopt;
+
+        ModelView view;
+        view.model = std::move(*model);
+
+        std::filesystem::path directory = std::filesystem::path(entry.filename).parent_path();
+        if (view.model.skins.empty())
+            view.model.skins = findDirectorySkins(entries, directory);
+
+        view.skins.resize(view.model.skins.size());
+        for (size_t i = 0; i < view.skins.size(); i++)
+        {
+            if (auto id = findSkin(entries, directory, view.model.skins[i]))
+                view.skins[i] = ImageLoader::loadImage(pakPath, entries.entry(*id), nullptr, 0, MemoryCategory::ModelSkins);
+        }
+
+        // Start on the first skin the archive actually has
+        auto found = std::find_if(view.skins.begin(), view.skins.end(), [](const auto &skin)
+                                  { return skin.has_value(); });
+        view.skin = found != view.skins.end() ? static_cast<int>(found - view.skins.begin()) : 0;
+        return view;
+    }
+
+    auto releaseModel(ModelView &view) -> void
+    {
+        for (auto &skin : view.skins)
+        {
+            if (skin)
+                TextureUploader::release(*skin);
+        }
+    }
+}
+
+namespace ParserRegistry
+{
+    std::unordered_map<PakFormat, FormatHandlers> handlers = {
+        {PakFormat::PAK, {&PakParser::loadArchive, &PakParser::readData, &PakParser::readPrefixes, &PakParser::openStream, &PakParser::visitEntries, "Quake/Quake 2 PAK Format"}},
+        {PakFormat::PKZIP, {&PKZipParser::loadArchive, &PKZipParser::readData, &PKZipParser::readPrefixes, &PKZipParser::openStream, &PKZipParser::visitEntries, "ZIP-based Format (PK3/PK4)"}},
+        {PakFormat::NESTED, {&NestedParser::loadArchive, &NestedParser::readData, &NestedParser::readPrefixes, &NestedParser::openStream, &NestedParser::visitEntries, "Archive inside the open one"}}};
+
+    // Indices into a batch, grouped by the format that reads them
+    auto groupByFormat(const std::vector<PakFileEntry> &entries) -> std::vector<std::pair<PakFormat, std::vector<size_t>>>
+    {
+        std::vector<std::pair<PakFormat, std::vector<size_t>>> groups;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const auto &g)
+                                      { return g.first == entries[i].format; });
+            if (group == groups.end())
+                group = groups.insert(groups.end(), {entries[i].format, {}});
+            group->second.push_back(i);
+        }
+        return groups;
+    }
+
+    auto readPrefixes(const std::string &path, const std::vector<PakFileEntry> &entries, size_t maxSize) -> std::vector<std::vector<uint8_t>>
+    {
+        auto groups = groupByFormat(entries);
+        if (groups.size() == 1)
+            return handlers[groups.front().first].readPrefixes(path, entries, maxSize);
+
+        std::vector<std::vector<uint8_t>> prefixes(entries.size());
+        for (const auto &[format, indices] : groups)
+        {
+            std::vector<PakFileEntry> batch;
+            for (size_t i : indices)
+                batch.push_back(entries[i]);
+
+            auto read = handlers[format].readPrefixes(path, batch, maxSize);
+            for (size_t k = 0; k < indices.size(); k++)
+                prefixes[indices[k]] = std::move(read[k]);
+        }
+        return prefixes;
+    }
+
+    auto visitEntries(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit) -> void
+    {
+        auto groups = groupByFormat(entries);
+        if (groups.size() == 1)
+            return handlers[groups.front().first].visitEntries(path, entries, visit);
+
+        for (const auto &[format, indices] : groups)
+        {
+            std::vector<PakFileEntry> batch;
+            for (size_t i : indices)
+                batch.push_back(entries[i]);
+
+            handlers[format].visitEntries(path, batch, [&](size_t k, EntryStream &stream)
+                                          { visit(indices[k], stream); });
+        }
+    }
+
+    // Picks the format from the extension and reads the archive's directory
+    auto openArchive(const std::string &path) -> std::optional<EntryTable>
+    {
+        std::string ext = std::filesystem::path(path).extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        PakFormat format = getFormatFromExtension(ext);
+        if (format == PakFormat::UNKNOWN)
+            return std::nullopt;
+
+        return handlers[format].loadArchive(path);
+    }
+}
+
+struct GalleryItem
+{
+    EntryId entry;
+    ImageInfo info;                // From the header probe, so the cell can be laid out before decoding
+    std::optional<PCXImage> image; // The thumbnail, once it has been decoded
+    bool failed = false;           // Decoding was attempted and didn't work
+};
+
+enum class GallerySort
+{
+    Name,
+    Dimensions,
+    Format,
+    Relevance // The order the gallery was filled in, which is best match first while searching
+};
+
+struct DuplicateReport
+{
+    ArchiveDigests digests;
+    std::vector<DuplicateGroup> groups;
+    uint64_t wastedBytes = 0;
+};
+
+struct DiffReport
+{
+    std::string newPath;
+    EntryTable newEntries; // The current archive is the old side
+    DigestKind kind;
+    std::vector<ArchiveChange> changes;
+};
+
+// The archive as it was read again after changing on disk, and what became of each old entry
+struct ArchiveReload
+{
+    EntryTable entries;
+    ArchiveDigests digests;
+    std::vector<EntryId> newIds; // Indexed by old id: its new id if the contents are the same, else INVALID_ENTRY_ID
+    uint64_t generation;          // Of the archive it was diffed against
+    size_t added = 0;
+    size_t removed = 0;
+    size_t modified = 0;
+    size_t moved = 0;
+};
+
+struct SimilarityReport
+{
+    std::vector<EntryId> images; // The entry behind each hash in the index
+    PerceptualIndex index;
+    size_t failed = 0;                       // Images that couldn't be decoded, and so aren't in the index
+    int maxDistance = PerceptualIndex::DEFAULT_DISTANCE; // What the clusters were grouped with
+    std::vector<std::vector<EntryId>> clusters;
+};
+
+struct PakViewerState
+{
+    EntryTable entries;
+    std::vector<GalleryItem> gallery;
+    TextureAtlas galleryAtlas;                  // Backs the small thumbnails in gallery
+    int thumbnailSize = 0;                      // Size bucket the gallery thumbnails were generated for
+    size_t galleryLoadCursor = 0;               // Everything before this has been decoded (or failed to)
+    GallerySort gallerySort = GallerySort::Name;
+    std::optional<PCXImage> currentImage;
+    std::optional<TextFile> currentText;
+    std::optional<BinaryFile> currentBinary;
+    EntryId currentSound = INVALID_ENTRY_ID;    // Sound entry open in the content area, if any
+    std::optional<MapView> currentMap;
+    std::optional<ModelView> currentModel;
+    AudioPreview audio;
+    ModelPreview modelPreview;                  // Draws currentModel, whose vertices it holds on the GPU
+    std::string pakPath;
+    EntryId selectedEntry = INVALID_ENTRY_ID;
+    bool showFileDialog = false;
+    std::string selectedPath;
+    float sidebarWidth = 200.0f;
+    FileTreeNode fileTree;
+    bool gridView = true;
+    std::string currentFolder;
+    float gridScale = 0.5f;
+    std::string searchFilter;
+    FuzzyIndex fuzzyIndex;                      // Character signatures of every entry name, for searching
+    FuzzyResults searchResults;                 // Best matches for searchFilter, shown in place of the tree
+    const FileTreeNode *galleryFolder = nullptr; // Folder the gallery was last filled from, if any
+    ImagePrefetcher prefetcher;                 // Full size images around the one being viewed
+    std::shared_ptr<std::atomic<bool>> folderWarmup; // Set to cancel the thumbnail job for the next folder
+    std::string statusMessage;
+    bool showTrace = false;
+    bool showMemory = false;
+    std::future<std::optional<EntryTable>> pendingArchive; // Directory being read in the background
+    std::string pendingArchivePath;
+    std::future<std::optional<NestedParser::Mounted>> pendingMount; // Archive inside this one being mounted
+    EntryId pendingMountEntry = INVALID_ENTRY_ID;
+    std::unordered_set<EntryId> failedMounts; // Aren't retried every frame they're expanded
+    bool showAnalysis = false;
+    std::optional<DuplicateReport> duplicates;
+    std::future<DuplicateReport> pendingDuplicates;
+    std::optional<DiffReport> archiveDiff;
+    std::future<std::optional<DiffReport>> pendingDiff;
+    std::optional<SimilarityReport> similar;
+    std::future<SimilarityReport> pendingSimilar;
+    std::optional<TextureUsage> textureUsage;
+    std::future<TextureUsage> pendingTextureUsage;
+    std::string textureUsageFilter;
+    bool showContentSearch = false;
+    std::string contentQuery;
+    bool contentMatchCase = false;
+    ContentSearch contentSearch;
+    std::vector<SearchHit> contentHits;                 // Collected from contentSearch as they come in
+    std::shared_ptr<const EntryTable> searchedEntries; // Copy of entries every search shares, until entries changes
+    Extractor extractor;
+    std::string extractDir;
+    bool extracting = false; // Until the finished extraction has been reported
+    ArchiveWatcher watcher;
+    uint64_t archiveGeneration = 0;                   // Bumped whenever the entry table is replaced
+    std::optional<ArchiveDigests> digests;            // As of the last reload, to tell what the next one changed
+    std::future<std::optional<ArchiveReload>> pendingReload;
+    bool reloadQueued = false; // The archive changed again while it was being reloaded
+};
+
+void setStatusMessage(PakViewerState &state, const std::string &message)
+{
+    state.statusMessage = message;
+    std::cout << "Status: " << message << std::endl;
+}
+
+// Drops every thumbnail, including any uploads still queued for them, but keeps the items
+void releaseGalleryImages(PakViewerState &state)
+{
+    for (auto &item : state.gallery)
+    {
+        if (item.image)
+            TextureUploader::release(*item.image);
+        item.image = std::nullopt;
+        item.failed = false;
+    }
+    state.galleryAtlas.clear();
+    state.galleryLoadCursor = 0;
+}
+
+void clearGallery(PakViewerState &state)
+{
+    releaseGalleryImages(state);
+    state.gallery.clear();
+}
+
+// Stored in the entry table's type column, where 0 is what an unclassified entry reads as
+enum class FileKind : uint8_t
+{
+    Unknown,
+    Image,
+    Text,
+    Binary,
+    Sound,
+    Map,
+    Model,
+    Archive // Mounted as a subtree when expanded, rather than opened in the content area
+};
+
+FileKind getFileKind(std::string_view filename)
+{
+    if (ImageLoader::getDecoder(filename))
+        return FileKind::Image;
+
+    std::string ext = std::filesystem::path(filename).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    if (ext == ".cfg" || ext == ".txt" || ext == ".script" || ext == ".ent" ||
+        ext == ".def" || ext == ".qc" || ext == ".log" || ext == ".ini" ||
+        ext == ".lst" || ext == ".bsp.info" || ext == ".loc" || ext == ".arena" ||
+        ext == ".md" || ext == ".rtf" || ext == ".html" || ext == ".htm" || ext == ".lang")
+        return FileKind::Text;
+    if (ext == ".dat")
+        return FileKind::Binary;
+    if (AudioPreview::isSoundFile(ext))
+        return FileKind::Sound;
+    if (ext == ".bsp")
+        return FileKind::Map;
+    if (ext == ".md2")
+        return FileKind::Model;
+    if (NestedParser::kindOf(filename))
+        return FileKind::Archive;
+    return FileKind::Unknown;
+}
+
+// Works out each entry's FileKind up front, so the tree and gallery don't have to go by extension every frame
+void classifyEntries(EntryTable &entries)
+{
+    for (EntryId id = 0; id < entries.size(); id++)
+        entries.setType(id, static_cast<uint8_t>(getFileKind(entries.name(id))));
+}
+
+// Node names point into the table's name pool, so the table has to outlive the tree
+void buildFileTree(const EntryTable &entries, FileTreeNode &root)
+{
+    TRACE_SCOPE("Build file tree");
+    root.children.clear();
+
+    // Once the paths are sorted everything under a directory is contiguous, so the tree can be built
+    // in one pass that only ever appends to the directory on top of the stack
+    std::vector<EntryId> order(entries.size());
+    for (EntryId id = 0; id < order.size(); id++)
+        order[id] = id;
+    std::sort(order.begin(), order.end(), [&](EntryId a, EntryId b)
+              { return entries.name(a) < entries.name(b); });
+
+    std::vector<FileTreeNode *> stack{&root};
+    std::vector<std::string_view> stackPaths{std::string_view()}; // Directory path of each stack node, with its trailing slash
+
+    for (EntryId id : order)
+    {
+        // A mounted archive shows up as the directory its entries are under instead
+        if (entries.flags(id) & ENTRY_MOUNTED)
+            continue;
+
+        std::string_view path = entries.name(id);
+
+        // Climb back up to the deepest directory this entry is still inside
+        while (stack.size() > 1 && path.substr(0, stackPaths.back().size()) != stackPaths.back())
+        {
+            stack.pop_back();
+            stackPaths.pop_back();
+        }
+
+        size_t start = stackPaths.back().size();
+        size_t pos;
+        while ((pos = path.find('/', start)) != std::string_view::npos)
+        {
+            FileTreeNode *current = stack.back();
+            current->children.push_back({path.substr(start, pos - start), {}, INVALID_ENTRY_ID});
+            stack.push_back(&current->children.back());
+            stackPaths.push_back(path.substr(0, pos + 1));
+            start = pos + 1;
+        }
+
+        if (start < path.size())
+        {
+            stack.back()->children.push_back({path.substr(start), {}, id});
+        }
+    }
+}
+
+// Siblings in the order buildFileTree leaves them, which is by full path, so a folder sorts as its name
+// followed by a slash
+bool treeOrder(const FileTreeNode &a, const FileTreeNode &b)
+{
+    size_t common = std::min(a.name.size(), b.name.size());
+    if (int order = a.name.substr(0, common).compare(b.name.substr(0, common)))
+        return order < 0;
+
+    auto next = [&](const FileTreeNode &node) -> int
+    {
+        if (node.name.size() > common)
+            return static_cast<unsigned char>(node.name[common]);
+        return node.isFile() ? -1 : '/';
+    };
+    return next(a) < next(b);
+}
+
+void sortTree(FileTreeNode &node)
+{
+    if (!std::is_sorted(node.children.begin(), node.children.end(), treeOrder))
+        std::sort(node.children.begin(), node.children.end(), treeOrder);
+    for (auto &child : node.children)
+    {
+        if (!child.isFile())
+            sortTree(child);
+    }
+}
+
+// Keeps the files under node that a reload kept under the same name, pointing them at their new ids and
+// the new table's names, and drops the rest along with folders left empty. start is where the names of
+// node's children begin in a full path. Returns the full name of a file still under node, or nothing.
+std::string_view keepTreeNodes(FileTreeNode &node, size_t start, const EntryTable &entries,
+                               const std::vector<EntryId> &keptIds, std::vector<uint8_t> &placed)
+{
+    std::string_view kept;
+    size_t count = 0;
+    for (auto &child : node.children)
+    {
+        std::string_view path;
+        if (!child.isFile())
+            path = keepTreeNodes(child, start + child.name.size() + 1, entries, keptIds, placed);
+        else if (child.entry < keptIds.size() && keptIds[child.entry] != INVALID_ENTRY_ID)
+        {
+            child.entry = keptIds[child.entry];
+            path = entries.name(child.entry);
+            placed[child.entry] = 1;
+        }
+        if (path.empty())
+            continue;
+
+        child.name = path.substr(start, child.name.size());
+        kept = path;
+        if (&node.children[count] != &child)
+            node.children[count] = std::move(child);
+        count++;
+    }
+    node.children.erase(node.children.begin() + count, node.children.end());
+    return kept;
+}
+
+// Moves the tree over to a reloaded table, rather than building it again: only what was added, removed
+// or renamed is touched. keptIds is as for FuzzyIndex::remap; nothing of the old table is read.
+void patchFileTree(FileTreeNode &root, const EntryTable &entries, const std::vector<EntryId> &keptIds)
+{
+    TRACE_SCOPE("Patch file tree");
+    std::vector<uint8_t> placed(entries.size(), 0);
+    keepTreeNodes(root, 0, entries, keptIds, placed);
+
+    std::vector<EntryId> added;
+    for (EntryId id = 0; id < entries.size(); id++)
+    {
+        if (!placed[id] && !(entries.flags(id) & ENTRY_MOUNTED))
+            added.push_back(id);
+    }
+    if (added.empty())
+        return;
+    std::sort(added.begin(), added.end(), [&](EntryId a, EntryId b)
+              { return entries.name(a) < entries.name(b); });
+
+    // Sorted, everything in a folder is contiguous, so the folder is only looked up when it changes.
+    // Adding a folder can move its siblings, but never one that's still to be added to.
+    FileTreeNode *folder = &root;
+    std::string_view folderPath; // With its trailing slash
+    for (EntryId id : added)
+    {
+        std::string_view path = entries.name(id);
+        size_t slash = path.rfind('/');
+        size_t start = slash == std::string_view::npos ? 0 : slash + 1;
+        if (path.substr(0, start) != folderPath)
+        {
+            folder = &root;
+            folderPath = path.substr(0, start);
+            for (size_t begin = 0, end; (end = path.find('/', begin)) != std::string_view::npos; begin = end + 1)
+            {
+                std::string_view name = path.substr(begin, end - begin);
+                auto found = std::find_if(folder->children.begin(), folder->children.end(), [&](const FileTreeNode &child)
+                                          { return !child.isFile() && child.name == name; });
+                if (found == folder->children.end())
+                {
+                    folder->children.push_back({name, {}, INVALID_ENTRY_ID});
+                    found = folder->children.end() - 1;
+                }
+                folder = &*found;
+            }
+        }
+        folder->children.push_back({path.substr(start), {}, id});
+    }
+    sortTree(root);
+}
+
+void addTreeMemory(const FileTreeNode &node, uint64_t &bytes, uint64_t &allocations)
+{
+    if (node.children.capacity() > 0)
+    {
+        bytes += node.children.capacity() * sizeof(FileTreeNode);
+        allocations++;
+    }
+    for (const auto &child : node.children)
+        addTreeMemory(child, bytes, allocations);
+}
+
+// The tree and the search index are measured after each rebuild or reload rather than accounted as they
+// grow. Entry tables account for themselves.
+void updateMemoryGauges(const FileTreeNode &fileTree, const FuzzyIndex &fuzzyIndex)
+{
+    uint64_t treeBytes = 0, treeAllocations = 0;
+    addTreeMemory(fileTree, treeBytes, treeAllocations);
+    MemoryStats::set(MemoryCategory::FileTree, treeBytes, treeAllocations);
+
+    size_t indexBytes = fuzzyIndex.memoryUsage();
+    MemoryStats::set(MemoryCategory::SearchIndex, indexBytes, indexBytes > 0 ? 1 : 0);
+}
+
+// How many of the best search matches the sidebar and the gallery keep. Anything further down is too
+// poor a match to be worth scrolling to.
+constexpr size_t MAX_LIST_MATCHES = 1000;
+constexpr size_t MAX_GALLERY_MATCHES = 10000;
+
+// Images under node. While searching they come back best match first, otherwise in tree order.
+std::vector<EntryId> getFilteredFiles(const PakViewerState &state, const FileTreeNode &node)
+{
+    std::vector<EntryId> results;
+    bool wholeArchive = &node == &state.fileTree;
+
+    // Searching the whole archive can skip the walk and let the index go through every entry
+    if (state.searchFilter.empty() || !wholeArchive)
+    {
+        std::vector<const FileTreeNode *> stack;
+        stack.push_back(&node);
+
+        while (!stack.empty())
+        {
+            const FileTreeNode *current = stack.back();
+            stack.pop_back();
+
+            if (current->isFile())
+            {
+                if (state.entries.type(current->entry) == static_cast<uint8_t>(FileKind::Image))
+                    results.push_back(current->entry);
+            }
+            else
+            {
+                for (auto it = current->children.rbegin(); it != current->children.rend(); ++it)
+                {
+                    stack.push_back(&(*it));
+                }
+            }
+        }
+    }
+
+    if (state.searchFilter.empty())
+        return results;
+
+    std::vector<uint8_t> inFolder;
+    std::function<bool(EntryId)> accept = [&](EntryId id)
+    { return state.entries.type(id) == static_cast<uint8_t>(FileKind::Image); };
+    if (!wholeArchive)
+    {
+        inFolder.assign(state.entries.size(), 0);
+        for (EntryId id : results)
+            inFolder[id] = 1;
+        accept = [&](EntryId id)
+        { return inFolder[id] != 0; };
+    }
+
+    auto ranked = state.fuzzyIndex.rank(state.entries, FuzzyPattern(state.searchFilter), MAX_GALLERY_MATCHES, accept);
+    results.clear();
+    for (const auto &match : ranked.matches)
+        results.push_back(match.entry);
+    return results;
+}
+
+void sortGallery(PakViewerState &state)
+{
+    auto byName = [&](const GalleryItem &a, const GalleryItem &b)
+    { return state.entries.name(a.entry) < state.entries.name(b.entry); };
+
+    switch (state.gallerySort)
+    {
+    case GallerySort::Name:
+        std::stable_sort(state.gallery.begin(), state.gallery.end(), byName);
+        break;
+    case GallerySort::Dimensions:
+        std::stable_sort(state.gallery.begin(), state.gallery.end(), [&](const GalleryItem &a, const GalleryItem &b)
+                         {
+                             long areaA = static_cast<long>(a.info.width) * a.info.height;
+                             long areaB = static_cast<long>(b.info.width) * b.info.height;
+                             if (areaA != areaB)
+                                 return areaA > areaB;
+                             return byName(a, b); });
+        break;
+    case GallerySort::Format:
+        std::stable_sort(state.gallery.begin(), state.gallery.end(), [&](const GalleryItem &a, const GalleryItem &b)
+                         {
+                             if (a.info.format != b.info.format)
+                                 return a.info.format < b.info.format;
+                             return byName(a, b); });
+        break;
+    case GallerySort::Relevance:
+        break;
+    }
+
+    // Decoding picks up from the first item that hasn't been attempted yet
+    state.galleryLoadCursor = 0;
+}
+
+// Replaces the gallery with the given files. Only their headers are read here; the thumbnails are
+// decoded a few at a time by loadGalleryImages.
+void showGallery(PakViewerState &state, const std::vector<EntryId> &ids)
+{
+    clearGallery(state);
+    state.thumbnailSize = Thumbnail::sizeForCell(200.0f * state.gridScale);
+
+    std::vector<PakFileEntry> entries;
+    entries.reserve(ids.size());
+    for (EntryId id : ids)
+        entries.push_back(state.entries.entry(id));
+
+    auto infos = ImageLoader::probeImages(state.pakPath, entries);
+
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        if (infos[i])
+            state.gallery.push_back({ids[i], *infos[i], std::nullopt});
+    }
+
+    sortGallery(state);
+}
+
+// Decodes gallery thumbnails in display order until the time budget for this frame runs out
+void loadGalleryImages(PakViewerState &state, double budgetSeconds)
+{
+    TRACE_SCOPE("Gallery decode");
+    auto start = std::chrono::steady_clock::now();
+
+    while (state.galleryLoadCursor < state.gallery.size())
+    {
+        GalleryItem &item = state.gallery[state.galleryLoadCursor++];
+        if (item.image || item.failed)
+            continue;
+
+        AccessLog::record(state.entries.name(item.entry));
+        item.image = ImageLoader::loadImage(state.pakPath, state.entries.entry(item.entry), &state.galleryAtlas, state.thumbnailSize);
+        item.failed = !item.image;
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= budgetSeconds)
+            break;
+    }
+}
+
+// How far around the entry being viewed the prefetcher reaches. People mostly step forwards.
+constexpr int PREFETCH_AHEAD = 8;
+constexpr int PREFETCH_BEHIND = 2;
+constexpr size_t MAX_WARMUP_IMAGES = 256;
+
+// Reads and decodes a full size image on a pool thread. The WAL palette has to be loaded already.
+ImagePrefetcher::Loader makeImageLoader(const std::string &pakPath)
+{
+    return [pakPath](const PakFileEntry &entry, const PixelAllocator &allocate)
+    {
+        ImageLoader::Decoder decoder = ImageLoader::getDecoder(entry.filename);
+        if (!decoder)
+            return false;
+
+        auto data = ParserRegistry::handlers[entry.format].readData(pakPath, entry);
+        MemoryScope dataMemory(MemoryCategory::DecodeBuffers, data.size());
+        return !data.empty() && decoder(data, allocate);
+    };
+}
+
+// Decoders share state that has to be loaded on the main thread before any pool job decodes with them
+void prepareDecodersFor(PakViewerState &state, const std::vector<EntryId> &ids)
+{
+    std::vector<ImageLoader::Decoder> prepared;
+    for (EntryId id : ids)
+    {
+        ImageLoader::Decoder decoder = ImageLoader::getDecoder(state.entries.name(id));
+        if ((decoder == &WALParser::decodeWAL || decoder == &MipParser::decodeMip) &&
+            std::find(prepared.begin(), prepared.end(), decoder) == prepared.end())
+        {
+            ImageLoader::prepareDecoder(state.pakPath, state.entries.entry(id), decoder);
+            prepared.push_back(decoder);
+        }
+    }
+}
+
+// The folder node that directly holds id, following its path down from node
+const FileTreeNode *findParentFolder(const FileTreeNode &node, std::string_view rest, EntryId id)
+{
+    size_t slash = rest.find('/');
+    if (slash == std::string_view::npos)
+    {
+        for (const auto &child : node.children)
+        {
+            if (child.entry == id)
+                return &node;
+        }
+        return nullptr;
+    }
+
+    std::string_view folder = rest.substr(0, slash);
+    for (const auto &child : node.children)
+    {
+        if (!child.isFile() && child.name == folder)
+            return findParentFolder(child, rest.substr(slash + 1), id);
+    }
+    return nullptr;
+}
+
+// Whether the arrow keys stop at an entry. Archives aren't opened in the content area, so they're passed over.
+bool isSteppable(const EntryTable &entries, EntryId id)
+{
+    FileKind kind = static_cast<FileKind>(entries.type(id));
+    return kind != FileKind::Unknown && kind != FileKind::Archive;
+}
+
+// What the arrow keys step through from id: the gallery if it came from there, the search results
+// while searching, and otherwise the viewable files beside it in the tree
+std::vector<EntryId> navigationList(const PakViewerState &state, EntryId id)
+{
+    std::vector<EntryId> ids;
+
+    auto inGallery = std::find_if(state.gallery.begin(), state.gallery.end(), [&](const GalleryItem &item)
+                                  { return item.entry == id; });
+    if (inGallery != state.gallery.end())
+    {
+        for (const auto &item : state.gallery)
+            ids.push_back(item.entry);
+        return ids;
+    }
+
+    if (!state.searchFilter.empty())
+    {
+        for (const auto &match : state.searchResults.matches)
+        {
+            if (isSteppable(state.entries, match.entry))
+                ids.push_back(match.entry);
+        }
+        return ids;
+    }
+
+    if (const FileTreeNode *folder = findParentFolder(state.fileTree, state.entries.name(id), id))
+    {
+        for (const auto &child : folder->children)
+        {
+            if (child.isFile() && isSteppable(state.entries, child.entry))
+                ids.push_back(child.entry);
+        }
+    }
+    return ids;
+}
+
+// Queues the images either side of id, nearest first, so stepping to them doesn't wait on a decode
+void prefetchAround(PakViewerState &state, EntryId id, const std::vector<EntryId> &ids)
+{
+    auto position = std::find(ids.begin(), ids.end(), id);
+    if (position == ids.end())
+        return;
+
+    auto index = static_cast<int>(position - ids.begin());
+    std::vector<int> offsets = {1, -1};
+    for (int i = 2; i <= PREFETCH_AHEAD; i++)
+        offsets.push_back(i);
+    for (int i = 2; i <= PREFETCH_BEHIND; i++)
+        offsets.push_back(-i);
+
+    std::vector<EntryId> wanted;
+    for (int offset : offsets)
+    {
+        int neighbour = index + offset;
+        if (neighbour < 0 || neighbour >= static_cast<int>(ids.size()))
+            continue;
+
+        EntryId other = ids[neighbour];
+        if (static_cast<FileKind>(state.entries.type(other)) == FileKind::Image &&
+            state.entries.size(other) <= ParserRegistry::MAX_READ_SIZE)
+            wanted.push_back(other);
+    }
+
+    prepareDecodersFor(state, wanted);
+    state.prefetcher.prefetch(state.entries, wanted);
+}
+
+// Starts a sound entry playing. The feeder thread opens its own stream, so it only gets copies.
+void playSound(PakViewerState &state, EntryId id)
+{
+    PakFileEntry entry = state.entries.entry(id);
+    auto openStream = ParserRegistry::handlers[entry.format].openStream;
+    std::string pakPath = state.pakPath;
+    std::string name(entry.filename);
+
+    bool playing = state.audio.play([=]() mutable
+                                    {
+        entry.filename = name; // The table's name pool may be gone by the time this runs
+        return openStream(pakPath, entry); });
+    if (!playing)
+        setStatusMessage(state, "No audio device to play sounds on");
+}
+
+// Reads the directory of an archive inside the open one in the background. One mount runs at a time;
+// asking for another while it does is ignored, and the tree asks again every frame it stays expanded.
+void startMount(PakViewerState &state, EntryId id)
+{
+    if (state.pendingMountEntry != INVALID_ENTRY_ID || (state.entries.flags(id) & ENTRY_MOUNTED) || state.failedMounts.count(id))
+        return;
+
+    state.pendingMountEntry = id;
+    state.pendingMount = ThreadPool::submit([path = state.pakPath, name = std::string(state.entries.name(id)),
+                                             container = state.entries.entry(id), flags = state.entries.flags(id)]() mutable
+                                            {
+                                                container.filename = name;
+                                                return NestedParser::mount(path, container, flags); });
+    setStatusMessage(state, "Opening " + std::string(state.entries.name(id)) + "...");
+}
+
+// Adds a mounted archive's entries under the container's name. Ids only ever get appended, so
+// everything holding ids into the table stays valid; the tree and the search index are rebuilt.
+void attachMount(PakViewerState &state, EntryId container, NestedParser::Mounted mounted)
+{
+    TRACE_SCOPE("Attach nested archive");
+    std::string prefix = std::string(state.entries.name(container)) + "/";
+    const EntryTable &inner = mounted.entries;
+
+    std::string name;
+    for (EntryId id = 0; id < inner.size(); id++)
+    {
+        name.assign(prefix).append(inner.name(id));
+        EntryId added = state.entries.add(name, inner.offset(id), inner.size(id), inner.flags(id) | ENTRY_NESTED, inner.crc(id));
+        if (added == INVALID_ENTRY_ID)
+            break;
+        state.entries.setType(added, static_cast<uint8_t>(getFileKind(inner.name(id))));
+    }
+    state.entries.addFlags(container, ENTRY_MOUNTED);
+    NestedParser::registerMount(std::move(mounted.mount));
+    state.searchedEntries = nullptr;
+
+    state.galleryFolder = nullptr; // Points into the tree that's about to be rebuilt
+    buildFileTree(state.entries, state.fileTree);
+    state.fuzzyIndex.build(state.entries);
+    updateMemoryGauges(state.fileTree, state.fuzzyIndex);
+    if (!state.searchFilter.empty())
+        state.searchResults = state.fuzzyIndex.rank(state.entries, FuzzyPattern(state.searchFilter), MAX_LIST_MATCHES);
+    setStatusMessage(state, "Opened " + prefix.substr(0, prefix.size() - 1) + " with " + std::to_string(inner.size()) + " entries");
+}
+
+// Keeps the archives mounted from the old table mounted in a reloaded one, for containers whose contents
+// didn't change: their entries are added to the new table again, and newIds is extended to cover them.
+// The rest are unmounted, and mounted again if they're expanded.
+void carryMounts(const std::string &pakPath, const EntryTable &oldEntries, EntryTable &entries, std::vector<EntryId> &newIds)
+{
+    newIds.resize(oldEntries.size(), INVALID_ENTRY_ID);
+    std::unordered_set<std::string_view> kept;
+    std::vector<std::string> dropped; // Unmounted at the end, or entries in them would find the mount outside
+    for (EntryId id = 0; id < oldEntries.size(); id++)
+    {
+        uint8_t flags = oldEntries.flags(id);
+        std::string_view name = oldEntries.name(id);
+
+        // Entries are appended as archives are mounted, so a container's mount is settled before its entries
+        if (flags & ENTRY_NESTED)
+        {
+            auto [mount, inner] = NestedParser::findMount(pakPath, name);
+            if (mount && kept.count(mount->name))
+            {
+                EntryId added = entries.add(name, oldEntries.offset(id), oldEntries.size(id),
+                                            flags & ~ENTRY_MOUNTED, oldEntries.crc(id));
+                if (added != INVALID_ENTRY_ID)
+                    entries.setType(added, oldEntries.type(id));
+                newIds[id] = added;
+            }
+        }
+
+        if (flags & ENTRY_MOUNTED)
+        {
+            // A container that moved keeps its contents but not the name its entries are under
+            EntryId container = newIds[id];
+            if (container == INVALID_ENTRY_ID || entries.name(container) != name)
+                dropped.emplace_back(name);
+            else
+            {
+                kept.insert(name);
+                entries.addFlags(container, ENTRY_MOUNTED);
+                NestedParser::moveMount(std::string(name), entries.offset(container));
+            }
+        }
+    }
+
+    for (const auto &name : dropped)
+        NestedParser::unmount(name);
+}
+
+// Empties the content area
+void closeEntry(PakViewerState &state)
+{
+    if (state.currentImage)
+        TextureUploader::release(*state.currentImage);
+    state.currentImage = std::nullopt;
+    state.currentText = std::nullopt;
+    state.currentBinary = std::nullopt;
+    state.currentSound = INVALID_ENTRY_ID;
+    state.audio.stop();
+    if (state.currentMap)
+        MapParser::releaseMap(*state.currentMap);
+    state.currentMap = std::nullopt;
+    if (state.currentModel)
+        ModelParser::releaseModel(*state.currentModel);
+    state.currentModel = std::nullopt;
+    state.modelPreview.unload();
+    state.selectedEntry = INVALID_ENTRY_ID;
+}
+
+// Shows a single entry at full resolution in the content area
+void openEntry(PakViewerState &state, EntryId id)
+{
+    FileKind kind = static_cast<FileKind>(state.entries.type(id));
+    if (kind == FileKind::Unknown)
+        return;
+    if (kind == FileKind::Archive)
+    {
+        startMount(state, id);
+        return;
+    }
+
+    PakFileEntry entry = state.entries.entry(id);
+    state.selectedEntry = id;
+    AccessLog::record(entry.filename);
+    state.gridView = false; // Switch to single view when selecting an image
+
+    if (state.currentImage)
+        TextureUploader::release(*state.currentImage);
+    state.currentImage = std::nullopt;
+    state.currentText = std::nullopt;
+    state.currentBinary = std::nullopt;
+    state.currentSound = INVALID_ENTRY_ID;
+    if (state.currentMap)
+        MapParser::releaseMap(*state.currentMap);
+    state.currentMap = std::nullopt;
+    if (state.currentModel)
+        ModelParser::releaseModel(*state.currentModel);
+    state.currentModel = std::nullopt;
+    state.modelPreview.unload();
+    if (kind != FileKind::Sound)
+        state.audio.stop();
+
+    if (kind == FileKind::Image)
+    {
+        // A prefetched image only has to be copied into upload memory
+        state.currentImage = TextureUploader::upload([&](const PixelAllocator &allocate)
+                                                     { return state.prefetcher.take(id, allocate); });
+        if (state.currentImage)
+            state.currentImage->filename = std::string(entry.filename);
+        else
+            state.currentImage = ImageLoader::loadImage(state.pakPath, entry);
+    }
+    else if (kind == FileKind::Text)
+        state.currentText = TextFileParser::loadTextFile(state.pakPath, entry);
+    else if (kind == FileKind::Binary)
+        state.currentBinary = BinaryFileParser::loadBinaryFile(state.pakPath, entry);
+    else if (kind == FileKind::Sound)
+    {
+        state.currentSound = id;
+        playSound(state, id);
+    }
+    else if (kind == FileKind::Map)
+    {
+        state.currentMap = MapParser::loadMap(state.pakPath, state.entries, entry);
+        if (!state.currentMap)
+            setStatusMessage(state, "Not a Quake or Quake 2 map: " + std::string(entry.filename));
+    }
+    else if (kind == FileKind::Model)
+    {
+        state.currentModel = ModelParser::loadModel(state.pakPath, state.entries, entry);
+        if (state.currentModel && state.modelPreview.load(state.currentModel->model))
+        {
+            // Everything the renderer needs per vertex is on the GPU now
+            Md2Model &model = state.currentModel->model;
+            model.positions = {};
+            model.texCoords = {};
+            model.indices = {};
+        }
+        else
+        {
+            if (state.currentModel)
+                ModelParser::releaseModel(*state.currentModel);
+            state.currentModel = std::nullopt;
+            setStatusMessage(state, "Not a Quake 2 model: " + std::string(entry.filename));
+        }
+    }
+
+    prefetchAround(state, id, navigationList(state, id));
+}
+
+// Moves to the entry before or after the one being viewed
+void stepEntry(PakViewerState &state, int direction)
+{
+    auto ids = navigationList(state, state.selectedEntry);
+    auto position = std::find(ids.begin(), ids.end(), state.selectedEntry);
+    if (position == ids.end())
+        return;
+
+    auto index = static_cast<int>(position - ids.begin()) + direction;
+    if (index >= 0 && index < static_cast<int>(ids.size()))
+        openEntry(state, ids[index]);
+}
+
+// The folder after this one in tree order, which is where someone paging through folders goes next
+const FileTreeNode *findNextFolder(const FileTreeNode &root, const FileTreeNode *folder)
+{
+    std::vector<const FileTreeNode *> ancestors;
+    std::function<bool(const FileTreeNode &)> locate = [&](const FileTreeNode &node)
+    {
+        ancestors.push_back(&node);
+        for (const auto &child : node.children)
+        {
+            if (&child == folder || (!child.isFile() && locate(child)))
+                return true;
+        }
+        ancestors.pop_back();
+        return false;
+    };
+    if (!locate(root))
+        return nullptr;
+
+    const FileTreeNode *current = folder;
+    while (!ancestors.empty())
+    {
+        const FileTreeNode *parent = ancestors.back();
+        ancestors.pop_back();
+
+        for (size_t i = static_cast<size_t>(current - parent->children.data()) + 1; i < parent->children.size(); i++)
+        {
+            if (!parent->children[i].isFile())
+                return &parent->children[i];
+        }
+        current = parent;
+    }
+    return nullptr;
+}
+
+// Generates the next folder's thumbnails in the background, so opening it finds them in the
+// thumbnail cache instead of decoding while it draws
+void warmNextFolder(PakViewerState &state)
+{
+    if (state.folderWarmup)
+        *state.folderWarmup = true;
+    state.folderWarmup = nullptr;
+
+    const FileTreeNode *next = state.galleryFolder ? findNextFolder(state.fileTree, state.galleryFolder) : nullptr;
+    if (!next || state.thumbnailSize <= 0)
+        return;
+
+    std::vector<EntryId> ids = getFilteredFiles(state, *next);
+    if (ids.size() > MAX_WARMUP_IMAGES)
+        ids.resize(MAX_WARMUP_IMAGES);
+    prepareDecodersFor(state, ids);
+
+    // Names are copied, since the entry table can be replaced while the job runs
+    std::vector<std::string> names;
+    std::vector<PakFileEntry> entries;
+    for (EntryId id : ids)
+    {
+        names.emplace_back(state.entries.name(id));
+        entries.push_back(state.entries.entry(id));
+    }
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    state.folderWarmup = cancelled;
+    ThreadPool::enqueue([path = state.pakPath, names = std::move(names), entries = std::move(entries),
+                         thumbnailSize = state.thumbnailSize, cancelled]() mutable
+                        {
+        TRACE_SCOPE("Warm next folder");
+        uint64_t archiveKey = ThumbnailCache::archiveKey(path);
+        std::vector<uint8_t> scratch;
+        for (size_t i = 0; i < entries.size() && !*cancelled; i++)
+        {
+            entries[i].filename = names[i];
+            if (ThumbnailCache::contains(ThumbnailCache::entryKey(archiveKey, entries[i], thumbnailSize)))
+                continue;
+
+            ImageLoader::generateThumbnail(path, entries[i], ImageLoader::getDecoder(entries[i].filename), thumbnailSize,
+                                           [&](int width, int height)
+                                           {
+                                               scratch.resize(static_cast<size_t>(width) * height * 4);
+                                               return scratch.data();
+                                           });
+        } });
+}
+
+void collectEntries(const FileTreeNode &node, std::vector<EntryId> &ids)
+{
+    if (node.isFile())
+        ids.push_back(node.entry);
+    for (const auto &child : node.children)
+        collectEntries(child, ids);
+}
+
+// Asks for a folder, then writes the entries out to it in the background
+void startExtract(PakViewerState &state, std::vector<EntryId> ids)
+{
+    if (ids.empty() || state.extractor.isRunning())
+        return;
+
+    const char *folder = tinyfd_selectFolderDialog("Extract to", "");
+    if (!folder)
+        return;
+
+    size_t count = ids.size();
+    state.extractDir = folder;
+    state.extractor.start(state.pakPath, state.entries, std::move(ids), state.extractDir, &ParserRegistry::visitEntries);
+    state.extracting = true;
+    setStatusMessage(state, "Extracting " + std::to_string(count) + " entries...");
+}
+
+void renderFileTreeNode(const FileTreeNode &node, PakViewerState &state, int depth, int maxDepth)
+{
+    // Prevent excessive recursion by limiting tree depth
+    if (depth >= maxDepth)
+        return;
+
+    if (node.children.empty() && static_cast<FileKind>(state.entries.type(node.entry)) == FileKind::Archive)
+    {
+        // An archive expands like a directory, and the first time it does it's mounted. Once it is, it
+        // comes back as a directory with the same ID, so it stays open.
+        ImGui::PushID(node.name.data(), node.name.data() + node.name.size());
+        bool open = ImGui::TreeNodeEx("##dir", 0, "%s", node.name.data());
+        ImGui::PopID();
+
+        if (open)
+        {
+            if (state.failedMounts.count(node.entry))
+                ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "(Can't be opened)");
+            else
+            {
+                startMount(state, node.entry);
+                ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "Opening...");
+            }
+            ImGui::TreePop();
+        }
+    }
+    else if (node.children.empty())
+    {
+        // This is a file
+        FileKind kind = static_cast<FileKind>(state.entries.type(node.entry));
+        bool isViewable = kind != FileKind::Unknown;
+
+        // Set text color based on file type
+        if (!isViewable)
+        {
+            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.5f, 0.5f, 0.5f, 1.0f));
+        }
+
+        // File names are the tail of the entry's name, so they are NUL-terminated
+        if (ImGui::Selectable(node.name.data(), state.selectedEntry == node.entry))
+        {
+            if (isViewable)
+            {
+                openEntry(state, node.entry);
+            }
+        }
+
+        // Pop the style color if we pushed it
+        if (!isViewable)
+        {
+            ImGui::PopStyleColor();
+        }
+    }
+    else
+    {
+        // This is a directory
+        // Directory names are a slice out of the middle of a path, so they need an explicit length
+        ImGui::PushID(node.name.data(), node.name.data() + node.name.size());
+        bool open = ImGui::TreeNodeEx("##dir", 0, "%.*s", static_cast<int>(node.name.size()), node.name.data());
+        if (ImGui::BeginPopupContextItem())
+        {
+            if (ImGui::MenuItem("Extract...", nullptr, false, !state.extractor.isRunning()))
+            {
+                std::vector<EntryId> ids;
+                collectEntries(node, ids);
+                startExtract(state, std::move(ids));
+            }
+            ImGui::EndPopup();
+        }
+        ImGui::PopID();
+
+        if (open)
+        {
+            // Only process children if we haven't exceeded the maximum depth
+            if (depth + 1 < maxDepth)
+            {
+                for (const auto &child : node.children)
+                {
+                    renderFileTreeNode(child, state, depth + 1, maxDepth);
+                }
+            }
+            else if (depth + 1 == maxDepth)
+            {
+                // At max depth, just display a message
+                ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "(Maximum depth reached)");
+            }
+
+            ImGui::TreePop();
+        }
+
+        // Handle folder selection
+        if (ImGui::IsItemClicked())
+        {
+            state.gridView = true;
+            state.currentFolder = std::string(node.name);
+            state.galleryFolder = &node;
+            showGallery(state, getFilteredFiles(state, node));
+            warmNextFolder(state);
+        }
+    }
+}
+
+// While searching, the sidebar lists the best matches by full path instead of showing the tree
+void renderSearchResults(PakViewerState &state)
+{
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(state.searchResults.matches.size()));
+    while (clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+        {
+            EntryId id = state.searchResults.matches[i].entry;
+            bool isViewable = static_cast<FileKind>(state.entries.type(id)) != FileKind::Unknown;
+
+            if (!isViewable)
+                ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.5f, 0.5f, 0.5f, 1.0f));
+
+            ImGui::PushID(i);
+            if (ImGui::Selectable(state.entries.name(id).data(), state.selectedEntry == id) && isViewable)
+                openEntry(state, id);
+            ImGui::PopID();
+
+            if (!isViewable)
+                ImGui::PopStyleColor();
+        }
+    }
+    clipper.End();
+}
+
+std::string openFileDialog()
+{
+    const char *file = tinyfd_openFileDialog(
+        "Select PAK/PK3 etc. File",
+        "",
+        0,
+        nullptr,
+        "All Files",
+        0);
+
+    if (file)
+    {
+        std::string path(file);
+        std::cout << "Selected file: " << path << std::endl;
+        std::cout << "Extension: " << std::filesystem::path(path).extension().string() << std::endl;
+        return path;
+    }
+    return "";
+}
+
+std::string saveJsonDialog(const char *title, const char *defaultName)
+{
+    const char *patterns[] = {"*.json"};
+    const char *file = tinyfd_saveFileDialog(title, defaultName, 1, patterns, "JSON files");
+    return file ? std::string(file) : "";
+}
+
+auto findDuplicates(const std::string &pakPath, const EntryTable &entries) -> DuplicateReport
+{
+    DuplicateReport report;
+    report.digests = ArchiveAnalysis::hashEntries(pakPath, entries, ArchiveAnalysis::chooseKind({&entries}),
+                                                  &ParserRegistry::visitEntries);
+    report.groups = ArchiveAnalysis::findDuplicates(entries, report.digests);
+
+    for (const auto &group : report.groups)
+        report.wastedBytes += group.size * (group.entries.size() - 1);
+    return report;
+}
+
+auto diffArchives(const std::string &oldPath, const EntryTable &oldEntries, const std::string &newPath) -> std::optional<DiffReport>
+{
+    auto newEntries = ParserRegistry::openArchive(newPath);
+    if (!newEntries)
+        return std::nullopt;
+
+    DigestKind kind = ArchiveAnalysis::chooseKind({&oldEntries, &*newEntries});
+    auto oldDigests = ArchiveAnalysis::hashEntries(oldPath, oldEntries, kind, &ParserRegistry::visitEntries);
+    auto newDigests = ArchiveAnalysis::hashEntries(newPath, *newEntries, kind, &ParserRegistry::visitEntries);
+    auto changes = ArchiveAnalysis::diff(oldEntries, oldDigests, *newEntries, newDigests);
+
+    return DiffReport{newPath, std::move(*newEntries), kind, std::move(changes)};
+}
+
+// Reports refer to entries by id, so none of them carry over when the entry table is replaced. Jobs
+// still running for the old table finish in the background and are ignored.
+void clearReports(PakViewerState &state)
+{
+    state.duplicates = std::nullopt;
+    state.archiveDiff = std::nullopt;
+    state.similar = std::nullopt;
+    state.pendingDuplicates = {};
+    state.pendingDiff = {};
+    state.pendingSimilar = {};
+    state.textureUsage = std::nullopt;
+    state.pendingTextureUsage = {};
+    state.contentSearch.cancel();
+    state.contentHits.clear();
+    state.searchedEntries = nullptr;
+}
+
+// Starts watching the archive just loaded for changes. It isn't hashed until the first reload, since
+// most archives are never rebuilt while they're open.
+void watchArchive(PakViewerState &state)
+{
+    state.archiveGeneration++;
+    state.digests = std::nullopt;
+    state.pendingReload = {};
+    state.reloadQueued = false;
+    // A watched archive can be written over in place under any reader, so it's streamed rather than mapped
+    bool watched = state.watcher.watch(state.pakPath, glfwPostEmptyEvent);
+    MappedFile::avoid(watched ? state.pakPath : "");
+}
+
+// Reads the archive again and matches its entries up with the old ones. Runs on a pool thread.
+auto reloadArchive(const std::string &path, const EntryTable &oldEntries, ArchiveDigests oldDigests, int originalFd,
+                   uint64_t generation) -> std::optional<ArchiveReload>
+{
+    TRACE_SCOPE("Reload archive");
+
+    // On the first reload the old archive is hashed now, through the descriptor that still reaches it
+    // after being renamed over. PK3s have CRCs in their directory, so for them that reads nothing.
+    // Written over in place, the old contents are gone and nothing can be shown to be unchanged.
+    if (oldDigests.valid.empty() && (oldDigests.kind == DigestKind::CRC32 || originalFd >= 0))
+    {
+        std::string original = originalFd >= 0 ? "/proc/self/fd/" + std::to_string(originalFd) : path;
+        oldDigests = ArchiveAnalysis::hashEntries(original, oldEntries, oldDigests.kind, &ParserRegistry::visitEntries);
+    }
+    if (originalFd >= 0)
+        ::close(originalFd);
+
+    auto entries = ParserRegistry::openArchive(path);
+    if (!entries)
+        return std::nullopt; // Most likely caught halfway through being written, and it'll change again
+    classifyEntries(*entries);
+
+    ArchiveReload reload{std::move(*entries), {}, {}, generation};
+    reload.digests = ArchiveAnalysis::hashEntries(path, reload.entries, oldDigests.kind, &ParserRegistry::visitEntries);
+
+    // Entries mounted from nested archives after the digests were taken have none, and as they aren't
+    // in the new table either they come out as removed
+    oldDigests.values.resize(oldEntries.size());
+    oldDigests.valid.resize(oldEntries.size(), 0);
+
+    std::vector<uint8_t> changed(oldEntries.size(), 0);
+    reload.newIds.assign(oldEntries.size(), INVALID_ENTRY_ID);
+    for (const auto &change : ArchiveAnalysis::diff(oldEntries, oldDigests, reload.entries, reload.digests))
+    {
+        // Entries mounted from nested archives are only in the old table, and are carried over when the
+        // reload is applied (or mounted again if their archive changed), so they aren't counted as changes
+        bool nested = change.type == ChangeType::Added ? reload.entries.flags(change.newEntry) & ENTRY_NESTED
+                                                        : oldEntries.flags(change.oldEntry) & ENTRY_NESTED;
+        switch (change.type)
+        {
+        case ChangeType::Added:
+            reload.added += !nested;
+            break;
+        case ChangeType::Removed:
+            reload.removed += !nested;
+            changed[change.oldEntry] = 1;
+            break;
+        case ChangeType::Modified:
+            reload.modified += !nested;
+            changed[change.oldEntry] = 1;
+            break;
+        case ChangeType::Moved:
+            reload.moved += !nested;
+            changed[change.oldEntry] = 1;
+            reload.newIds[change.oldEntry] = change.newEntry;
+            break;
+        }
+    }
+
+    // Everything else kept its name and, as far as the digests can tell, its contents. An entry that
+    // couldn't be hashed on both sides may still have changed, so it's loaded again to be safe.
+    std::unordered_map<std::string_view, EntryId> newByName;
+    newByName.reserve(reload.entries.size());
+    for (EntryId id = 0; id < reload.entries.size(); id++)
+        newByName.emplace(reload.entries.name(id), id);
+    for (EntryId id = 0; id < oldEntries.size(); id++)
+    {
+        if (changed[id] || !oldDigests.valid[id])
+            continue;
+        auto it = newByName.find(oldEntries.name(id));
+        if (it != newByName.end() && reload.digests.valid[it->second])
+            reload.newIds[id] = it->second;
+    }
+    return reload;
+}
+
+// Reloads the archive in the background after it changed on disk. One reload runs at a time; a change
+// while it does queues another for when it's done.
+void startReload(PakViewerState &state)
+{
+    if (state.pendingReload.valid())
+    {
+        state.reloadQueued = true;
+        return;
+    }
+    state.reloadQueued = false;
+
+    // Until the first reload there are no digests, and the job works them out from the original
+    ArchiveDigests digests;
+    int originalFd = -1;
+    if (state.digests)
+        digests = *state.digests;
+    else
+    {
+        digests.kind = ArchiveAnalysis::chooseKind({&state.entries});
+        originalFd = state.watcher.openOriginal();
+    }
+
+    state.pendingReload = ThreadPool::submit([path = state.pakPath, entries = state.entries, digests = std::move(digests),
+                                              originalFd, generation = state.archiveGeneration]() mutable
+                                             { return reloadArchive(path, entries, std::move(digests), originalFd, generation); });
+    setStatusMessage(state, "Reloading " + std::filesystem::path(state.pakPath).filename().string() + "...");
+}
+
+// Path of a folder in the tree, like "textures/e1u1", or nothing if it isn't there
+auto folderPath(const FileTreeNode &root, const FileTreeNode *folder) -> std::optional<std::string>
+{
+    for (const auto &child : root.children)
+    {
+        if (child.isFile())
+            continue;
+        if (&child == folder)
+            return std::string(child.name);
+        if (auto path = folderPath(child, folder))
+            return std::string(child.name) + "/" + *path;
+    }
+    return std::nullopt;
+}
+
+auto findFolder(const FileTreeNode &root, std::string_view path) -> const FileTreeNode *
+{
+    const FileTreeNode *node = &root;
+    while (node && !path.empty())
+    {
+        size_t slash = path.find('/');
+        std::string_view name = path.substr(0, slash);
+        path = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+
+        const FileTreeNode *next = nullptr;
+        for (const auto &child : node->children)
+        {
+            if (!child.isFile() && child.name == name)
+                next = &child;
+        }
+        node = next;
+    }
+    return node;
+}
+
+// Swaps in a reloaded archive. Whatever belongs to entries whose contents didn't change, like their
+// thumbnails, prefetched images or the entry being viewed, is kept under their new ids; the rest is
+// dropped and loaded again when it's next wanted. The tree and the search index are patched rather
+// than built again, and archives expanded in the tree stay mounted if they didn't change.
+void applyReload(PakViewerState &state, ArchiveReload reload)
+{
+    TRACE_SCOPE("Apply reload");
+    auto newId = [&](EntryId id)
+    { return id < reload.newIds.size() ? reload.newIds[id] : INVALID_ENTRY_ID; };
+
+    // Nodes move as the tree is patched, so the gallery's folder is found again by its path. ImGui knows
+    // tree nodes by name, so folders that were expanded stay that way.
+    auto galleryPath = state.galleryFolder ? folderPath(state.fileTree, state.galleryFolder) : std::nullopt;
+    std::string selectedName = state.selectedEntry != INVALID_ENTRY_ID ? std::string(state.entries.name(state.selectedEntry)) : "";
+
+    EntryTable oldEntries = std::move(state.entries);
+    state.entries = std::move(reload.entries);
+    carryMounts(state.pakPath, oldEntries, state.entries, reload.newIds);
+    EntryId selected = newId(state.selectedEntry);
+    EntryId sound = newId(state.currentSound);
+
+    // Moved entries have new names, so the tree and the search index only keep what kept its name
+    std::vector<EntryId> keptIds = reload.newIds;
+    for (EntryId id = 0; id < keptIds.size(); id++)
+    {
+        if (keptIds[id] != INVALID_ENTRY_ID && state.entries.name(keptIds[id]) != oldEntries.name(id))
+            keptIds[id] = INVALID_ENTRY_ID;
+    }
+
+    std::unordered_set<EntryId> failedMounts;
+    for (EntryId id : state.failedMounts)
+    {
+        if (newId(id) != INVALID_ENTRY_ID)
+            failedMounts.insert(newId(id));
+    }
+
+    state.digests = std::move(reload.digests);
+    state.watcher.releaseOriginal(); // Reloads from here on compare against the digests
+    ImageLoader::resetDecoders(); // The colormap or palette may be among what changed
+    state.archiveGeneration++;
+    state.pendingMount = {};
+    state.pendingMountEntry = INVALID_ENTRY_ID;
+    state.failedMounts = std::move(failedMounts);
+    state.galleryFolder = nullptr;
+    patchFileTree(state.fileTree, state.entries, keptIds);
+    state.fuzzyIndex.remap(state.entries, keptIds);
+    updateMemoryGauges(state.fileTree, state.fuzzyIndex);
+    if (!state.searchFilter.empty())
+        state.searchResults = state.fuzzyIndex.rank(state.entries, FuzzyPattern(state.searchFilter), MAX_LIST_MATCHES);
+    clearReports(state);
+    state.prefetcher.remap(reload.newIds);
+
+    // Thumbnails of unchanged images are kept; the folder's new and changed images are probed
+    std::unordered_map<EntryId, GalleryItem> kept;
+    std::vector<EntryId> ids;
+    for (auto &item : state.gallery)
+    {
+        EntryId id = newId(item.entry);
+        if (id != INVALID_ENTRY_ID)
+        {
+            item.entry = id;
+            ids.push_back(id);
+            kept.emplace(id, std::move(item));
+        }
+        else if (item.image)
+            TextureUploader::release(*item.image);
+    }
+    state.gallery.clear();
+
+    const FileTreeNode *folder = galleryPath ? findFolder(state.fileTree, *galleryPath) : nullptr;
+    if (folder)
+        ids = getFilteredFiles(state, *folder);
+
+    std::vector<EntryId> probeIds;
+    std::vector<PakFileEntry> probeEntries;
+    for (EntryId id : ids)
+    {
+        if (!kept.count(id))
+        {
+            probeIds.push_back(id);
+            probeEntries.push_back(state.entries.entry(id));
+        }
+    }
+    auto infos = ImageLoader::probeImages(state.pakPath, probeEntries);
+    std::unordered_map<EntryId, ImageInfo> probed;
+    for (size_t i = 0; i < probeIds.size(); i++)
+    {
+        if (infos[i])
+            probed.emplace(probeIds[i], *infos[i]);
+    }
+
+    for (EntryId id : ids)
+    {
+        if (auto it = kept.find(id); it != kept.end())
+        {
+            state.gallery.push_back(std::move(it->second));
+            kept.erase(it);
+        }
+        else if (auto info = probed.find(id); info != probed.end())
+            state.gallery.push_back({id, info->second, std::nullopt});
+    }
+    for (auto &[id, item] : kept)
+    {
+        if (item.image)
+            TextureUploader::release(*item.image);
+    }
+    sortGallery(state);
+    state.galleryFolder = folder;
+
+    // The entry being viewed stays open if it didn't change, and is opened again if it did
+    if (selected != INVALID_ENTRY_ID)
+    {
+        state.selectedEntry = selected;
+        state.currentSound = sound;
+        if (state.currentMap)
+            MapParser::findTextureFiles(state.pakPath, state.entries, state.entries.name(selected), *state.currentMap);
+    }
+    else if (auto id = selectedName.empty() ? std::nullopt : state.entries.find(selectedName))
+    {
+        closeEntry(state);
+        if (state.gridView)
+            state.selectedEntry = *id;
+        else
+            openEntry(state, *id);
+    }
+    else
+        closeEntry(state);
+
+    setStatusMessage(state, "Reloaded: " + std::to_string(reload.added) + " added, " + std::to_string(reload.removed) +
+                                " removed, " + std::to_string(reload.modified) + " modified, " + std::to_string(reload.moved) + " moved");
+}
+
+// Loads the shared state some decoders need, like the WAL palette, so that worker threads only ever read it
+void prepareImageDecoders(const std::string &pakPath, const EntryTable &entries)
+{
+    std::vector<ImageLoader::Decoder> prepared;
+    for (EntryId id = 0; id < entries.size(); id++)
+    {
+        ImageLoader::Decoder decoder = ImageLoader::getDecoder(entries.name(id));
+        if ((decoder == &WALParser::decodeWAL || decoder == &MipParser::decodeMip) &&
+            std::find(prepared.begin(), prepared.end(), decoder) == prepared.end())
+        {
+            ImageLoader::prepareDecoder(pakPath, entries.entry(id), decoder);
+            prepared.push_back(decoder);
+        }
+    }
+}
+
+void clusterSimilarImages(SimilarityReport &report, int maxDistance)
+{
+    report.maxDistance = maxDistance;
+    report.clusters.clear();
+    for (const auto &cluster : report.index.clusters(maxDistance))
+    {
+        std::vector<EntryId> ids;
+        for (uint32_t i : cluster)
+            ids.push_back(report.images[i]);
+        report.clusters.push_back(std::move(ids));
+    }
+}
+
+auto hashImage(std::string_view filename, EntryStream &stream, std::vector<uint8_t> &data) -> std::optional<uint64_t>
+{
+    // The decoders want the whole file in a vector
+    data.resize(stream.size());
+    size_t total = 0;
+    while (total < data.size())
+    {
+        size_t read = stream.read(data.data() + total, data.size() - total);
+        if (read == 0)
+            return std::nullopt;
+        total += read;
+    }
+
+    std::vector<uint8_t> pixels;
+    int width = 0, height = 0;
+    bool decoded = ImageLoader::getDecoder(filename)(data, [&](int w, int h) -> uint8_t *
+                                                     {
+                                                         width = w;
+                                                         height = h;
+                                                         pixels.resize(static_cast<size_t>(w) * h * 4);
+                                                         return pixels.data();
+                                                     });
+    if (!decoded || width <= 0 || height <= 0)
+        return std::nullopt;
+
+    return PerceptualHash::compute(pixels.data(), width, height);
+}
+
+// Decodes and hashes every image in the archive across the thread pool. prepareImageDecoders has to
+// have been called for the archive first.
+auto findSimilarImages(const std::string &pakPath, const EntryTable &entries, int maxDistance) -> SimilarityReport
+{
+    std::vector<EntryId> ids;
+    for (EntryId id = 0; id < entries.size(); id++)
+    {
+        if (entries.type(id) == static_cast<uint8_t>(FileKind::Image) && entries.size(id) <= ParserRegistry::MAX_READ_SIZE)
+            ids.push_back(id);
+    }
+
+    std::vector<uint64_t> hashes(entries.size());
+    std::vector<uint8_t> hashed(entries.size(), 0);
+
+    ArchiveAnalysis::visitParallel(pakPath, entries, ids, &ParserRegistry::visitEntries,
+                                   [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &data)
+                                   {
+                                       if (auto hash = hashImage(entries.name(id), stream, data))
+                                       {
+                                           hashes[id] = *hash;
+                                           hashed[id] = 1;
+                                       }
+                                   });
+
+    SimilarityReport report;
+    std::vector<uint64_t> indexed;
+    for (EntryId id : ids)
+    {
+        if (hashed[id])
+        {
+            report.images.push_back(id);
+            indexed.push_back(hashes[id]);
+        }
+    }
+    report.failed = ids.size() - report.images.size();
+    report.index = PerceptualIndex(std::move(indexed));
+
+    clusterSimilarImages(report, maxDistance);
+    return report;
+}
+
+std::string formatBytes(uint64_t bytes)
+{
+    const char *units[] = {"bytes", "KB", "MB", "GB", "TB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4)
+    {
+        value /= 1024.0;
+        unit++;
+    }
+
+    char text[32];
+    snprintf(text, sizeof(text), unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+    return text;
+}
+
+void renderAnalysisWindow(PakViewerState &state)
+{
+    ImGui::SetNextWindowSize(ImVec2(640, 480), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Analysis", &state.showAnalysis))
+    {
+        ImGui::End();
+        return;
+    }
+
+    if (isReady(state.pendingDuplicates))
+        state.duplicates = state.pendingDuplicates.get();
+    if (isReady(state.pendingSimilar))
+        state.similar = state.pendingSimilar.get();
+    if (isReady(state.pendingTextureUsage))
+        state.textureUsage = state.pendingTextureUsage.get();
+    if (isReady(state.pendingDiff))
+    {
+        state.archiveDiff = state.pendingDiff.get();
+        if (!state.archiveDiff)
+            setStatusMessage(state, "Couldn't open the archive to compare with");
+    }
+
+    bool busy = state.pendingDuplicates.valid() || state.pendingDiff.valid() || state.pendingSimilar.valid() ||
+                state.pendingTextureUsage.valid();
+    ImGui::BeginDisabled(busy || state.entries.empty());
+
+    if (ImGui::Button("Find Duplicates"))
+    {
+        // The job gets its own copy of the table in case another archive is opened in the meantime
+        state.pendingDuplicates = ThreadPool::submit([path = state.pakPath, entries = state.entries]
+                                                     { return findDuplicates(path, entries); });
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Find Similar Images"))
+    {
+        prepareImageDecoders(state.pakPath, state.entries);
+        int maxDistance = state.similar ? state.similar->maxDistance : PerceptualIndex::DEFAULT_DISTANCE;
+        state.pendingSimilar = ThreadPool::submit([path = state.pakPath, entries = state.entries, maxDistance]
+                                                  { return findSimilarImages(path, entries, maxDistance); });
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Index Map Textures"))
+    {
+        std::vector<EntryId> maps;
+        for (EntryId id = 0; id < state.entries.size(); id++)
+        {
+            if (static_cast<FileKind>(state.entries.type(id)) == FileKind::Map)
+                maps.push_back(id);
+        }
+        auto visitEntries = &ParserRegistry::visitEntries;
+        state.pendingTextureUsage = ThreadPool::submit([path = state.pakPath, entries = state.entries, maps = std::move(maps), visitEntries]() mutable
+                                                       { return TextureUsage::build(path, entries, std::move(maps), visitEntries); });
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Compare With..."))
+    {
+        std::string other = openFileDialog();
+        if (!other.empty())
+        {
+            state.pendingDiff = ThreadPool::submit([path = state.pakPath, entries = state.entries, other]
+                                                   { return diffArchives(path, entries, other); });
+        }
+    }
+
+    ImGui::EndDisabled();
+
+    if (busy)
+    {
+        ImGui::SameLine();
+        ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Working...");
+    }
+
+    if (ImGui::BeginTabBar("AnalysisTabs"))
+    {
+        if (ImGui::BeginTabItem("Duplicates"))
+        {
+            if (state.duplicates)
+            {
+                const auto &report = *state.duplicates;
+                ImGui::Text("%zu groups of identical files, %s wasted (%s, %s read)", report.groups.size(),
+                            formatBytes(report.wastedBytes).c_str(), ArchiveAnalysis::kindName(report.digests.kind),
+                            formatBytes(report.digests.bytesRead).c_str());
+
+                ImGui::SameLine();
+                if (ImGui::Button("Export JSON##Duplicates"))
+                {
+                    std::string path = saveJsonDialog("Save duplicate report", "duplicates.json");
+                    if (!path.empty())
+                    {
+                        bool written = ArchiveAnalysis::writeDuplicatesJson(path, state.pakPath, state.entries, report.digests, report.groups);
+                        setStatusMessage(state, written ? "Duplicate report written to " + path : "Failed to write " + path);
+                    }
+                }
+
+                ImGui::BeginChild("DuplicateList", ImVec2(0, 0), true);
+                for (const auto &group : report.groups)
+                {
+                    ImGui::PushID(&group);
+                    if (ImGui::TreeNode("group", "%zu copies of %s", group.entries.size(), formatBytes(group.size).c_str()))
+                    {
+                        for (EntryId id : group.entries)
+                        {
+                            if (ImGui::Selectable(state.entries.name(id).data(), state.selectedEntry == id))
+                                openEntry(state, id);
+                        }
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                }
+                ImGui::EndChild();
+            }
+            else
+            {
+                ImGui::TextDisabled("Hash every entry in the open archive to find files with identical contents.");
+            }
+            ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Similar Images"))
+        {
+            if (state.similar)
+            {
+                auto &report = *state.similar;
+                ImGui::Text("%zu images hashed, %zu failed to decode, %zu clusters", report.images.size(), report.failed,
+                            report.clusters.size());
+
+                // Hashes stay in the index, so regrouping at another distance is quick
+                int maxDistance = report.maxDistance;
+                ImGui::SetNextItemWidth(200.0f);
+                if (ImGui::SliderInt("Max Distance", &maxDistance, 0, PerceptualIndex::MAX_DISTANCE))
+                    clusterSimilarImages(report, maxDistance);
+
+                ImGui::BeginChild("ClusterList", ImVec2(0, 0), true);
+                ImGuiListClipper clipper;
+                clipper.Begin(static_cast<int>(report.clusters.size()));
+                while (clipper.Step())
+                {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                    {
+                        const auto &cluster = report.clusters[i];
+                        ImGui::PushID(i);
+                        if (ImGui::Selectable("##cluster"))
+                        {
+                            state.gridView = true;
+                            state.currentFolder.clear();
+                            showGallery(state, cluster);
+                        }
+                        ImGui::SameLine();
+                        ImGui::Text("%zu images: %s, ...", cluster.size(), state.entries.name(cluster.front()).data());
+                        ImGui::PopID();
+                    }
+                }
+                clipper.End();
+                ImGui::EndChild();
+            }
+            else
+            {
+                ImGui::TextDisabled("Group images that look alike, even when their files differ. Click a group to view it in the gallery.");
+            }
+            ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Diff"))
+        {
+            if (state.archiveDiff)
+            {
+                const auto &report = *state.archiveDiff;
+
+                size_t counts[4] = {};
+                for (const auto &change : report.changes)
+                    counts[static_cast<int>(change.type)]++;
+
+                ImGui::TextWrapped("Against %s: %zu added, %zu removed, %zu modified, %zu moved (%s)", report.newPath.c_str(),
+                                   counts[0], counts[1], counts[2], counts[3], ArchiveAnalysis::kindName(report.kind));
+
+                if (ImGui::Button("Export JSON##Diff"))
+                {
+                    std::string path = saveJsonDialog("Save diff report", "diff.json");
+                    if (!path.empty())
+                    {
+                        bool written = ArchiveAnalysis::writeDiffJson(path, state.pakPath, state.entries, report.newPath,
+                                                                      report.newEntries, report.kind, report.changes);
+                        setStatusMessage(state, written ? "Diff written to " + path : "Failed to write " + path);
+                    }
+                }
+
+                if (ImGui::BeginTable("Changes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable))
+                {
+                    ImGui::TableSetupScrollFreeze(0, 1);
+                    ImGui::TableSetupColumn("Change");
+                    ImGui::TableSetupColumn("Path");
+                    ImGui::TableSetupColumn("Old Size");
+                    ImGui::TableSetupColumn("New Size");
+                    ImGui::TableHeadersRow();
+
+                    ImGuiListClipper clipper;
+                    clipper.Begin(static_cast<int>(report.changes.size()));
+                    while (clipper.Step())
+                    {
+                        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                        {
+                            const auto &change = report.changes[i];
+                            bool hasOld = change.oldEntry != INVALID_ENTRY_ID;
+                            bool hasNew = change.newEntry != INVALID_ENTRY_ID;
+
+                            ImGui::TableNextRow();
+                            ImGui::TableNextColumn();
+                            ImGui::TextUnformatted(ArchiveAnalysis::changeName(change.type));
+                            ImGui::TableNextColumn();
+                            if (change.type == ChangeType::Moved)
+                                ImGui::Text("%s -> %s", state.entries.name(change.oldEntry).data(), report.newEntries.name(change.newEntry).data());
+                            else
+                                ImGui::TextUnformatted(hasNew ? report.newEntries.name(change.newEntry).data() : state.entries.name(change.oldEntry).data());
+                            ImGui::TableNextColumn();
+                            ImGui::TextUnformatted(hasOld ? formatBytes(state.entries.size(change.oldEntry)).c_str() : "");
+                            ImGui::TableNextColumn();
+                            ImGui::TextUnformatted(hasNew ? formatBytes(report.newEntries.size(change.newEntry)).c_str() : "");
+                        }
+                    }
+                    clipper.End();
+                    ImGui::EndTable();
+                }
+            }
+            else
+            {
+                ImGui::TextDisabled("Compare the open archive with another version of it.");
+            }
+            ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Texture Usage"))
+        {
+            if (state.textureUsage)
+            {
+                const auto &usage = *state.textureUsage;
+                ImGui::Text("%zu textures used across %zu maps", usage.textureCount(), usage.mapCount);
+                if (usage.failedMaps)
+                {
+                    ImGui::SameLine();
+                    ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.0f, 1.0f), "(%zu maps couldn't be read)", usage.failedMaps);
+                }
+
+                ImGui::SetNextItemWidth(200.0f);
+                ImGui::InputTextWithHint("##TextureFilter", "Filter textures", &state.textureUsageFilter);
+                std::string filter = state.textureUsageFilter;
+                std::transform(filter.begin(), filter.end(), filter.begin(), ::tolower);
+
+                ImGui::BeginChild("TextureList", ImVec2(0, 0), true);
+                for (size_t i = 0; i < usage.textureCount(); i++)
+                {
+                    const std::string &name = usage.texture(i);
+                    if (!filter.empty() && name.find(filter) == std::string::npos)
+                        continue;
+
+                    const auto &users = usage.users(i);
+                    ImGui::PushID(static_cast<int>(i));
+                    if (ImGui::TreeNode("texture", "%s (%zu maps)", name.c_str(), users.size()))
+                    {
+                        for (EntryId id : users)
+                        {
+                            if (ImGui::Selectable(state.entries.name(id).data(), state.selectedEntry == id))
+                                openEntry(state, id);
+                        }
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                }
+                ImGui::EndChild();
+            }
+            else
+            {
+                ImGui::TextDisabled("Read the texture references of every map in the archive, to see which maps use each texture.");
+            }
+            ImGui::EndTabItem();
+        }
+
+        ImGui::EndTabBar();
+    }
+
+    ImGui::End();
+}
+
+// Starts searching every text entry in the open archive for the query, dropping any earlier results
+void startContentSearch(PakViewerState &state)
+{
+    std::vector<EntryId> ids;
+    for (EntryId id = 0; id < state.entries.size(); id++)
+    {
+        if (static_cast<FileKind>(state.entries.type(id)) == FileKind::Text)
+            ids.push_back(id);
+    }
+
+    // The query changes with every key typed, so the table is copied once and shared between searches
+    if (!state.searchedEntries)
+        state.searchedEntries = std::make_shared<const EntryTable>(state.entries);
+
+    state.contentHits.clear();
+    state.contentSearch.start(state.pakPath, state.searchedEntries, std::move(ids), state.contentQuery, state.contentMatchCase,
+                              &ParserRegistry::visitEntries);
+}
+
+void renderContentSearchWindow(PakViewerState &state)
+{
+    ImGui::SetNextWindowSize(ImVec2(720, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Find in Files", &state.showContentSearch))
+    {
+        ImGui::End();
+        return;
+    }
+
+    state.contentSearch.collect(state.contentHits);
+    bool running = state.contentSearch.isRunning();
+
+    ImGui::SetNextItemWidth(-260.0f);
+    bool submitted = ImGui::InputText("##ContentQuery", &state.contentQuery, ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    ImGui::Checkbox("Match case", &state.contentMatchCase);
+    ImGui::SameLine();
+    if (running)
+    {
+        if (ImGui::Button("Cancel"))
+            state.contentSearch.cancel();
+    }
+    else
+    {
+        ImGui::BeginDisabled(state.entries.empty() || state.contentQuery.empty());
+        if (ImGui::Button("Search"))
+            submitted = true;
+        ImGui::EndDisabled();
+    }
+
+    if (submitted && !state.entries.empty() && !state.contentQuery.empty())
+    {
+        startContentSearch(state);
+        running = true;
+    }
+
+    if (running)
+    {
+        ImGui::ProgressBar(state.contentSearch.progress(), ImVec2(-1.0f, 0.0f),
+                           (formatBytes(state.contentSearch.bytesScanned()) + " searched").c_str());
+    }
+    else
+    {
+        ImGui::Text("%zu matching lines%s", state.contentHits.size(),
+                    state.contentSearch.isTruncated() ? " (stopped at the limit)" : "");
+    }
+
+    if (ImGui::BeginTable("ContentHits", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable))
+    {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("Entry");
+        ImGui::TableSetupColumn("Line", ImGuiTableColumnFlags_WidthFixed, 50.0f);
+        ImGui::TableSetupColumn("Context");
+        ImGui::TableHeadersRow();
+
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(state.contentHits.size()));
+        while (clipper.Step())
+        {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+            {
+                const auto &hit = state.contentHits[i];
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::PushID(i);
+                if (ImGui::Selectable(state.entries.name(hit.entry).data(), state.selectedEntry == hit.entry,
+                                      ImGuiSelectableFlags_SpanAllColumns))
+                {
+                    openEntry(state, hit.entry);
+                    setStatusMessage(state, std::string(state.entries.name(hit.entry)) + ":" + std::to_string(hit.line));
+                }
+                ImGui::PopID();
+                ImGui::TableNextColumn();
+                ImGui::Text("%u", hit.line);
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(hit.context.c_str());
+            }
+        }
+        clipper.End();
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+void renderTraceWindow(PakViewerState &state)
+{
+    ImGui::SetNextWindowSize(ImVec2(420, 360), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Trace", &state.showTrace))
+    {
+        ImGui::End();
+        return;
+    }
+
+    bool recording = Trace::isEnabled();
+    if (ImGui::Checkbox("Record", &recording))
+    {
+        Trace::setEnabled(recording);
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Export"))
+    {
+        auto stamp = std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+        std::string path = "pak-adventure-trace-" + std::to_string(stamp) + ".json";
+
+        if (Trace::exportChromeTrace(path))
+        {
+            setStatusMessage(state, "Trace written to " + path);
+        }
+        else
+        {
+            setStatusMessage(state, "Failed to write " + path);
+        }
+    }
+
+    auto history = Trace::frameHistory();
+    if (!history.empty())
+    {
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%.2f ms", history.back());
+        ImGui::PlotLines("##FrameTimes", history.data(), static_cast<int>(history.size()), 0, overlay, 0.0f, 50.0f,
+                         ImVec2(-1, 80));
+    }
+    else if (!recording)
+    {
+        ImGui::TextDisabled("Not recording");
+    }
+
+    if (ImGui::BeginTable("Phases", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV))
+    {
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableHeadersRow();
+
+        for (const auto &phase : Trace::lastFrame())
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(phase.name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", phase.milliseconds);
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", phase.calls);
+        }
+
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+void renderMemoryWindow(PakViewerState &state)
+{
+    ImGui::SetNextWindowSize(ImVec2(520, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Memory", &state.showMemory))
+    {
+        ImGui::End();
+        return;
+    }
+
+    if (uint64_t resident = MemoryStats::residentBytes())
+    {
+        ImGui::Text("Process resident: %s", formatBytes(resident).c_str());
+        ImGui::SameLine();
+    }
+    if (ImGui::Button("Reset peaks"))
+        MemoryStats::resetPeaks();
+
+    auto stats = MemoryStats::snapshot();
+    if (ImGui::BeginTable("Subsystems", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV))
+    {
+        ImGui::TableSetupColumn("Subsystem");
+        ImGui::TableSetupColumn("Live");
+        ImGui::TableSetupColumn("Peak");
+        ImGui::TableSetupColumn("Allocations");
+        ImGui::TableSetupColumn("Ever");
+        ImGui::TableHeadersRow();
+
+        for (bool gpu : {false, true})
+        {
+            uint64_t bytes = 0, allocations = 0;
+            for (const auto &stat : stats)
+            {
+                if (stat.gpu != gpu)
+                    continue;
+                bytes += stat.bytes;
+                allocations += stat.allocations;
+            }
+
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(gpu ? "GPU (estimated)" : "CPU");
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(formatBytes(bytes).c_str());
+            ImGui::TableNextColumn();
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(allocations));
+
+            for (const auto &stat : stats)
+            {
+                if (stat.gpu != gpu)
+                    continue;
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("  %s", stat.name);
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(formatBytes(stat.bytes).c_str());
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(formatBytes(stat.peakBytes).c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", static_cast<unsigned long long>(stat.allocations));
+                ImGui::TableNextColumn();
+                if (stat.gauge)
+                    ImGui::TextDisabled("-");
+                else
+                    ImGui::Text("%llu", static_cast<unsigned long long>(stat.totalAllocations));
+            }
+        }
+
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+auto renderUI(PakViewerState &state) -> void
+{
+    TRACE_SCOPE("renderUI");
+    ImGui::SetNextWindowPos(ImVec2(0, 0));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    ImGui::Begin("PAK Adventure", nullptr,
+                 ImGuiWindowFlags_NoTitleBar |
+                     ImGuiWindowFlags_NoResize |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoBringToFrontOnFocus |
+                     ImGuiWindowFlags_NoNavFocus);
+
+    // Create a horizontal layout for the top bar
+    ImGui::BeginChild("TopBar", ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 8), true);
+
+    // Left side: Open PAK File button
+    if (ImGui::Button("Open PAK File"))
+    {
+        std::string selectedFile = openFileDialog();
+        if (!selectedFile.empty())
+        {
+            if (std::filesystem::exists(selectedFile))
+            {
+                std::string ext = std::filesystem::path(selectedFile).extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+                PakFormat format = ParserRegistry::getFormatFromExtension(ext);
+
+                if (format != PakFormat::UNKNOWN)
+                {
+                    // Big archives take a while to index, so the directory is read off the UI thread
+                    auto loadFunc = ParserRegistry::handlers[format].loadArchive;
+                    state.pendingArchive = ThreadPool::submit([loadFunc, selectedFile]
+                                                              {
+                                                                  auto entries = loadFunc(selectedFile);
+                                                                  if (entries)
+                                                                      classifyEntries(*entries);
+                                                                  return entries; });
+                    state.pendingArchivePath = selectedFile;
+                    setStatusMessage(state, "Loading " + std::filesystem::path(selectedFile).filename().string() + "...");
+                }
+            }
+        }
+    }
+
+    if (isReady(state.pendingArchive))
+    {
+        auto newEntries = state.pendingArchive.get();
+
+        if (newEntries)
+        {
+            clearGallery(state);
+            state.entries = std::move(*newEntries);
+            state.pakPath = state.pendingArchivePath;
+            ImageLoader::resetDecoders();
+            AccessLog::setArchive(state.pakPath);
+            closeEntry(state);
+            NestedParser::unmountAll();
+            state.pendingMount = {};
+            state.pendingMountEntry = INVALID_ENTRY_ID;
+            state.failedMounts.clear();
+            state.galleryFolder = nullptr; // Points into the tree that's about to be rebuilt
+            buildFileTree(state.entries, state.fileTree);
+            state.fuzzyIndex.build(state.entries);
+            updateMemoryGauges(state.fileTree, state.fuzzyIndex);
+            state.searchFilter = ""; // Clear search filter when loading a new file
+            state.searchResults = {};
+            clearReports(state);
+            state.prefetcher.reset(makeImageLoader(state.pakPath));
+            if (state.folderWarmup)
+                *state.folderWarmup = true;
+            watchArchive(state);
+            setStatusMessage(state, "Loaded " + std::to_string(state.entries.size()) + " entries");
+        }
+        else
+        {
+            setStatusMessage(state, "Unknown file type");
+        }
+    }
+
+    if (isReady(state.pendingReload))
+    {
+        auto reload = state.pendingReload.get();
+        if (!reload)
+            setStatusMessage(state, "Couldn't reload " + std::filesystem::path(state.pakPath).filename().string());
+        else if (reload->generation == state.archiveGeneration)
+            applyReload(state, std::move(*reload));
+    }
+    if (state.watcher.takeChange() || (state.reloadQueued && !state.pendingReload.valid()))
+        startReload(state);
+
+    if (isReady(state.pendingMount))
+    {
+        EntryId container = state.pendingMountEntry;
+        state.pendingMountEntry = INVALID_ENTRY_ID;
+
+        auto mounted = state.pendingMount.get();
+        if (mounted && !mounted->entries.empty())
+            attachMount(state, container, std::move(*mounted));
+        else
+        {
+            state.failedMounts.insert(container);
+            setStatusMessage(state, "Couldn't open " + std::string(state.entries.name(container)));
+        }
+    }
+
+    ImGui::SameLine();
+    ImGui::Checkbox("Analysis", &state.showAnalysis);
+    ImGui::SameLine();
+    ImGui::Checkbox("Find in Files", &state.showContentSearch);
+    ImGui::SameLine();
+    ImGui::Checkbox("Trace", &state.showTrace);
+    ImGui::SameLine();
+    ImGui::Checkbox("Memory", &state.showMemory);
+
+    ImGui::SameLine();
+    if (state.extractor.isRunning())
+    {
+        ImGui::ProgressBar(state.extractor.progress(), ImVec2(120.0f, 0.0f));
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel Extract"))
+            state.extractor.cancel();
+    }
+    else
+    {
+        ImGui::BeginDisabled(state.entries.empty());
+        if (ImGui::Button("Extract All..."))
+        {
+            std::vector<EntryId> ids(state.entries.size());
+            std::iota(ids.begin(), ids.end(), 0);
+            startExtract(state, std::move(ids));
+        }
+        ImGui::EndDisabled();
+    }
+
+    if (state.extracting && !state.extractor.isRunning())
+    {
+        state.extracting = false;
+        auto summary = state.extractor.summary();
+        std::string message = (summary.cancelled ? "Extract cancelled after " : "Extracted ") + std::to_string(summary.written) +
+                              " entries (" + formatBytes(summary.bytes) + ") to " + state.extractDir;
+        if (summary.failed)
+            message += ", " + std::to_string(summary.failed) + " failed";
+        setStatusMessage(state, message);
+    }
+
+    // Right side: Status message
+    ImGui::SameLine();
+    float statusWidth = ImGui::GetWindowWidth() - ImGui::GetCursorPosX() - 10.0f;
+    ImGui::SetCursorPosX(ImGui::GetWindowWidth() - statusWidth - 10.0f);
+    ImGui::TextColored(ImVec4(0.7f, 0.7f, 0.7f, 1.0f), "%s", state.statusMessage.c_str());
+
+    ImGui::EndChild();
 
     const float minSidebarWidth = 100.0f;
     const float maxSidebarWidth = 400.0f;
 
-    ImGui::BeginChild("FileList", ImVec2(state.sidebarWidth, 0), true);
+    ImGui::BeginChild("FileList", ImVec2(state.sidebarWidth, 0), true);
+
+    // Add search box at the top of the sidebar
+    ImGui::Text("Search:");
+    ImGui::SameLine();
+    // Create a full-width search box minus some margin
+    float searchWidth = ImGui::GetContentRegionAvail().x - 10.0f;
+    ImGui::PushItemWidth(searchWidth);
+
+    // Store the previous search filter to detect changes
+    std::string prevSearchFilter = state.searchFilter;
+
+    // Limit input length to prevent performance issues with long search terms
+    if (state.searchFilter.length() > 50)
+    {
+        state.searchFilter = state.searchFilter.substr(0, 50);
+    }
+
+    // Use a buffer here to avoid issues with the input text callback
+    bool searchChanged = ImGui::InputText("##SearchFilter", &state.searchFilter, ImGuiInputTextFlags_AutoSelectAll);
+
+    ImGui::PopItemWidth();
+
+    if (searchChanged)
+    {
+        // Ranking the whole archive is quick enough to redo on every keystroke
+        state.searchResults = state.fuzzyIndex.rank(state.entries, FuzzyPattern(state.searchFilter), MAX_LIST_MATCHES);
+
+        // Matches go into the gallery best first, until the search is cleared again
+        if (!state.searchFilter.empty() && state.gallerySort == GallerySort::Name)
+            state.gallerySort = GallerySort::Relevance;
+        else if (state.searchFilter.empty() && state.gallerySort == GallerySort::Relevance)
+            state.gallerySort = GallerySort::Name;
+
+        if (state.gridView && !state.fileTree.children.empty())
+        {
+            // Find the current folder node - simplified approach
+            FileTreeNode *folderNode = &state.fileTree;
+
+            // Only attempt to find the specific folder if it's a top-level folder
+            // This avoids expensive recursive searches
+            if (!state.currentFolder.empty())
+            {
+                for (auto &child : state.fileTree.children)
+                {
+                    if (child.name == state.currentFolder)
+                    {
+                        folderNode = &child;
+                        break;
+                    }
+                }
+            }
+
+            showGallery(state, getFilteredFiles(state, *folderNode));
+        }
+    }
+
+    if (!state.searchFilter.empty())
+    {
+        ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.0f, 1.0f), "Found %zu results", state.searchResults.total);
+    }
+
+    ImGui::Separator();
+
+    if (!state.searchFilter.empty())
+    {
+        renderSearchResults(state);
+    }
+    else if (ImGui::TreeNode("PAK Contents"))
+    {
+        // Maximum depth for tree rendering to prevent stack overflow
+        const int MAX_DEPTH = 10;
+
+        for (const auto &node : state.fileTree.children)
+        {
+            renderFileTreeNode(node, state, 0, MAX_DEPTH);
+        }
+        ImGui::TreePop();
+    }
+    ImGui::EndChild();
+
+    ImGui::SameLine();
+
+    // Use ImGui's native splitter
+    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
+    ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(0, 0));
+
+    // Get the window height for the splitter
+    float windowHeight = ImGui::GetWindowHeight();
+    ImGui::Button("##splitter", ImVec2(4, windowHeight));
+    ImGui::PopStyleVar(2);
+
+    if (ImGui::IsItemActive())
+    {
+        float delta = ImGui::GetMouseDragDelta(ImGuiMouseButton_Left).x;
+        state.sidebarWidth = std::clamp(state.sidebarWidth + delta, minSidebarWidth, maxSidebarWidth);
+        ImGui::ResetMouseDragDelta();
+    }
+
+    // Add hover effect to make it more obvious it's draggable
+    if (ImGui::IsItemHovered())
+    {
+        ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeEW);
+    }
+
+    ImGui::SameLine();
+
+    // Create a parent container for controls and image view
+    ImGui::BeginChild("ContentArea", ImVec2(0, 0), false);
+
+    // Fixed control panel section
+    if (state.gridView)
+    {
+        ImGui::BeginChild("ControlPanel", ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 8), true);
+        // Grid view controls
+        ImGui::SliderFloat("Grid Scale", &state.gridScale, 0.1f, 2.0f);
+
+        // Sorting only needs the probed headers, so it works before anything is decoded
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120.0f);
+        const char *sortNames[] = {"Name", "Dimensions", "Format", "Relevance"};
+        int sort = static_cast<int>(state.gallerySort);
+        if (ImGui::Combo("Sort", &sort, sortNames, 4))
+        {
+            state.gallerySort = static_cast<GallerySort>(sort);
+            sortGallery(state);
+        }
+
+        // Show image count in grid view
+        if (!state.gallery.empty())
+        {
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(0.0f, 0.7f, 1.0f, 1.0f), "Showing %d image(s), %d atlas page(s)",
+                               (int)state.gallery.size(), (int)state.galleryAtlas.pageCount());
+        }
+
+        ImGui::EndChild();
+    }
+
+    // Scrollable content area
+    ImGui::BeginChild("ImageView", ImVec2(0, 0), true);
+
+    if (state.gridView)
+    {
+        float windowWidth = ImGui::GetWindowWidth();
+        float cellSize = 200.0f * state.gridScale;
+        int imagesPerRow = std::max(1, static_cast<int>(windowWidth / cellSize));
+
+        // Regenerate the thumbnails once the cells have grown or shrunk past their size bucket
+        if (!state.gallery.empty() && Thumbnail::sizeForCell(cellSize) != state.thumbnailSize)
+        {
+            releaseGalleryImages(state);
+            state.thumbnailSize = Thumbnail::sizeForCell(cellSize);
+        }
+
+        // Cells are laid out from the probed headers straight away, and filled in as thumbnails decode
+        loadGalleryImages(state, 0.008);
+
+        // Defensive check for empty image list
+        if (state.gallery.empty())
+        {
+            ImGui::TextWrapped("No images to display in this folder.");
+        }
+        else
+        {
+            // Simple grid layout without tables (more efficient)
+            int imageCount = state.gallery.size();
+            ImGui::Columns(imagesPerRow, nullptr, false);
+
+            for (int i = 0; i < imageCount; i++)
+            {
+                const auto &item = state.gallery[i];
 
-    // Add search box at the top of the sidebar
-    ImGui::Text("Search:");
-    ImGui::SameLine();
-    // Create a full-width search box minus some margin
-    float searchWidth = ImGui::GetContentRegionAvail().x - 10.0f;
-    ImGui::PushItemWidth(searchWidth);
+                // Calculate image dimensions with aspect ratio
+                float imageAspect = (float)item.info.width / item.info.height;
+                if (imageAspect <= 0.0f)
+                    imageAspect = 1.0f;
 
-    // Store the previous search filter to detect changes
-    std::string prevSearchFilter = state.searchFilter;
+                float maxImgHeight = cellSize * 0.7f;
+                float maxImgWidth = cellSize * 0.9f;
 
-    // Limit input length to prevent performance issues with long search terms
-    if (state.searchFilter.length() > 50)
+                float imgWidth, imgHeight;
+                if (imageAspect > 1.0f)
+                {
+                    imgWidth = maxImgWidth;
+                    imgHeight = imgWidth / imageAspect;
+                    if (imgHeight > maxImgHeight)
+                    {
+                        imgHeight = maxImgHeight;
+                        imgWidth = imgHeight * imageAspect;
+                    }
+                }
+                else
+                {
+                    imgHeight = maxImgHeight;
+                    imgWidth = imgHeight * imageAspect;
+                    if (imgWidth > maxImgWidth)
+                    {
+                        imgWidth = maxImgWidth;
+                        imgHeight = imgWidth / imageAspect;
+                    }
+                }
+
+                // Center the image in column
+                float colWidth = ImGui::GetColumnWidth();
+                float centerOffset = (colWidth - imgWidth) * 0.5f;
+                if (centerOffset > 0)
+                {
+                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + centerOffset);
+                }
+
+                // Always render all images. Packed images share a page texture, so ImGui can merge
+                // consecutive cells into a single draw command.
+                if (item.image)
+                {
+                    const PCXImage &image = *item.image;
+                    ImGui::Image((ImTextureID)(uintptr_t)image.textureID, ImVec2(imgWidth, imgHeight),
+                                 ImVec2(image.u0, image.v0), ImVec2(image.u1, image.v1));
+                }
+                else
+                {
+                    ImGui::Dummy(ImVec2(imgWidth, imgHeight));
+                }
+
+                // Thumbnails are scaled down, so only load the full resolution image once it's opened
+                if (ImGui::IsItemClicked())
+                {
+                    openEntry(state, item.entry);
+                }
+
+                // Get filename for label
+                std::string filename = std::filesystem::path(state.entries.name(item.entry)).filename().string();
+
+                // Simple truncation
+                if (filename.length() > 18)
+                {
+                    filename = filename.substr(0, 15) + "...";
+                }
+
+                // Center filename
+                float textWidth = ImGui::CalcTextSize(filename.c_str()).x;
+                centerOffset = (colWidth - textWidth) * 0.5f;
+                if (centerOffset > 0)
+                {
+                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + centerOffset);
+                }
+
+                ImGui::TextUnformatted(filename.c_str());
+
+                // Dimensions from the header, centered under the filename
+                std::string dimensions = std::to_string(item.info.width) + "x" + std::to_string(item.info.height);
+                textWidth = ImGui::CalcTextSize(dimensions.c_str()).x;
+                centerOffset = (colWidth - textWidth) * 0.5f;
+                if (centerOffset > 0)
+                {
+                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + centerOffset);
+                }
+                ImGui::TextColored(ImVec4(0.5f, 0.5f, 0.5f, 1.0f), "%s", dimensions.c_str());
+
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("%s", item.info.format.c_str());
+
+                ImGui::NextColumn();
+            }
+
+            ImGui::Columns(1);
+        }
+    }
+    else if (state.currentImage)
     {
-        state.searchFilter = state.searchFilter.substr(0, 50);
+        // Single image view
+        if (state.textureUsage)
+        {
+            // A texture in a mounted archive goes by its name inside it, the way that archive's maps refer to it
+            const auto &usage = *state.textureUsage;
+            std::string_view name = state.entries.name(state.selectedEntry);
+            if (auto [mount, inner] = NestedParser::findMount(state.pakPath, name); mount)
+                name = inner;
+            size_t index = usage.find(TextureUsage::textureKey(name));
+            if (index == std::string::npos)
+            {
+                ImGui::TextDisabled("Not used by any map");
+            }
+            else
+            {
+                const auto &users = usage.users(index);
+                ImGui::TextDisabled("Used by %zu maps", users.size());
+                if (ImGui::IsItemHovered())
+                {
+                    ImGui::BeginTooltip();
+                    for (EntryId id : users)
+                        ImGui::TextUnformatted(state.entries.name(id).data());
+                    ImGui::EndTooltip();
+                }
+            }
+        }
+        ImGui::Image((ImTextureID)(uintptr_t)state.currentImage->textureID,
+                     ImVec2(state.currentImage->width, state.currentImage->height));
+    }
+    else if (state.currentText)
+    {
+        // Text file view
+        ImGui::BeginChild("TextView", ImVec2(0, 0), true);
+        if (state.currentText->truncated)
+            ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.0f, 1.0f), "Showing the first %zu bytes", state.currentText->contents.size());
+        ImGui::TextWrapped("%s", state.currentText->contents.c_str());
+        ImGui::EndChild();
     }
+    else if (state.currentBinary)
+    {
+        // Binary file view (hex viewer)
+        ImGui::BeginChild("HexView", ImVec2(0, 0), true);
 
-    // Use a buffer here to avoid issues with the input text callback
-    bool searchChanged = ImGui::InputText("##SearchFilter", &state.searchFilter, ImGuiInputTextFlags_AutoSelectAll);
+        auto &binary = *state.currentBinary;
+        uint64_t fileSize = binary.stream->size();
+        uint64_t pageCount = (fileSize + BinaryFileParser::PAGE_SIZE - 1) / BinaryFileParser::PAGE_SIZE;
+        uint64_t pageIndex = binary.pageOffset / BinaryFileParser::PAGE_SIZE;
 
-    ImGui::PopItemWidth();
+        // File size info
+        ImGui::Text("File Size: %llu bytes", static_cast<unsigned long long>(fileSize));
 
-    // Show a search in progress indicator
-    static bool searchInProgress = false;
-    if (searchChanged)
+        // Hex viewer settings
+        static int bytesPerRow = 16;
+        static bool showAscii = true;
+        ImGui::SliderInt("Bytes per Row", &bytesPerRow, 4, 32, "%d", ImGuiSliderFlags_None);
+        ImGui::SameLine();
+        ImGui::Checkbox("Show ASCII", &showAscii);
+
+        // Only one page of the entry is read at a time
+        if (pageCount > 1)
+        {
+            if (ImGui::Button("< Prev") && pageIndex > 0)
+                BinaryFileParser::loadPage(binary, binary.pageOffset - BinaryFileParser::PAGE_SIZE);
+            ImGui::SameLine();
+            if (ImGui::Button("Next >") && pageIndex + 1 < pageCount)
+                BinaryFileParser::loadPage(binary, binary.pageOffset + BinaryFileParser::PAGE_SIZE);
+            ImGui::SameLine();
+            ImGui::Text("Page %llu of %llu", static_cast<unsigned long long>(binary.pageOffset / BinaryFileParser::PAGE_SIZE + 1),
+                        static_cast<unsigned long long>(pageCount));
+        }
+
+        // Hex viewer content, with only the visible rows laid out
+        ImGui::BeginChild("HexRows", ImVec2(0, 0), false);
+        const auto &data = binary.page;
+        int rowCount = static_cast<int>((data.size() + bytesPerRow - 1) / bytesPerRow);
+        char line[256];
+
+        ImGuiListClipper clipper;
+        clipper.Begin(rowCount);
+        while (clipper.Step())
+        {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+            {
+                size_t i = static_cast<size_t>(row) * bytesPerRow;
+                size_t rowSize = std::min<size_t>(bytesPerRow, data.size() - i);
+
+                // Address
+                int length = snprintf(line, sizeof(line), "%08llX: ", static_cast<unsigned long long>(binary.pageOffset + i));
+
+                // Hex values
+                for (size_t j = 0; j < rowSize; j++)
+                    length += snprintf(line + length, sizeof(line) - length, "%02X ", data[i + j]);
+
+                // ASCII representation
+                if (showAscii)
+                {
+                    for (size_t j = rowSize; j < static_cast<size_t>(bytesPerRow); j++)
+                        length += snprintf(line + length, sizeof(line) - length, "   ");
+                    length += snprintf(line + length, sizeof(line) - length, " |");
+                    for (size_t j = 0; j < rowSize; j++)
+                    {
+                        char c = data[i + j];
+                        line[length++] = (c >= 32 && c <= 126) ? c : '.';
+                    }
+                    line[length] = '\0';
+                }
+
+                ImGui::TextUnformatted(line);
+            }
+        }
+        clipper.End();
+
+        ImGui::EndChild();
+        ImGui::EndChild();
+    }
+    else if (state.currentSound != INVALID_ENTRY_ID)
     {
-        searchInProgress = true;
+        // Sound view, played straight out of the archive
+        std::string_view name = state.entries.name(state.currentSound);
+        ImGui::Text("%.*s", static_cast<int>(name.size()), name.data());
 
-        // Defer grid view update to avoid UI freezing
-        if (state.gridView && !state.fileTree.children.empty())
+        bool playing = state.audio.isPlaying();
+        if (state.audio.hasFailed())
         {
-            // Find the current folder node - simplified approach
-            FileTreeNode *folderNode = &state.fileTree;
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "This sound couldn't be decoded");
+        }
+        else
+        {
+            double position = playing ? state.audio.position() : 0.0;
+            double length = state.audio.length();
+            char label[64];
+            if (length > 0.0)
+                snprintf(label, sizeof(label), "%.1f / %.1f s", position, length);
+            else
+                snprintf(label, sizeof(label), "%.1f s", position);
+            ImGui::ProgressBar(length > 0.0 ? static_cast<float>(position / length) : 0.0f, ImVec2(-1.0f, 0.0f), label);
 
-            // Only attempt to find the specific folder if it's a top-level folder
-            // This avoids expensive recursive searches
-            if (!state.currentFolder.empty())
+            // Clicking the bar plays from that point
+            if (length > 0.0 && ImGui::IsItemClicked())
             {
-                for (auto &child : state.fileTree.children)
+                float x = ImGui::GetIO().MousePos.x - ImGui::GetItemRectMin().x;
+                double fraction = std::clamp(static_cast<double>(x / ImGui::GetItemRectSize().x), 0.0, 1.0);
+                state.audio.seek(fraction * length);
+            }
+        }
+
+        if (ImGui::Button(playing ? "Stop" : "Play"))
+        {
+            if (playing)
+                state.audio.stop();
+            else
+                playSound(state, state.currentSound);
+        }
+    }
+    else if (state.currentMap)
+    {
+        // Map view: the lump directory, the textures the map uses, and the ones it carries with it
+        const MapView &map = *state.currentMap;
+        std::string_view name = state.entries.name(state.selectedEntry);
+        ImGui::Text("%.*s: %s, %zu textures", static_cast<int>(name.size()), name.data(), map.header.format.c_str(),
+                    map.textures.size());
+
+        std::optional<EntryId> textureToOpen; // Opened once the view is drawn, since opening replaces it
+        ImGui::BeginChild("MapView", ImVec2(0, 0), false);
+        if (ImGui::CollapsingHeader("Lumps"))
+        {
+            if (ImGui::BeginTable("Lumps", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+            {
+                ImGui::TableSetupColumn("Lump");
+                ImGui::TableSetupColumn("Offset");
+                ImGui::TableSetupColumn("Size");
+                ImGui::TableHeadersRow();
+                for (size_t i = 0; i < map.header.lumps.size(); i++)
                 {
-                    if (child.name == state.currentFolder)
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(BspReader::lumpName(map.header.version, i));
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%u", map.header.lumps[i].offset);
+                    ImGui::TableNextColumn();
+                    ImGui::TextUnformatted(formatBytes(map.header.lumps[i].length).c_str());
+                }
+                ImGui::EndTable();
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Textures", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            // Textures the archive has a .wal for can be opened from here
+            for (size_t i = 0; i < map.textures.size(); i++)
+            {
+                const BspTexture &texture = map.textures[i];
+                EntryId file = map.files[i];
+
+                ImGui::PushID(static_cast<int>(i));
+                if (file != INVALID_ENTRY_ID)
+                {
+                    if (ImGui::Selectable(texture.name.c_str()))
+                        textureToOpen = file;
+                }
+                else
+                {
+                    ImGui::TextUnformatted(texture.name.c_str());
+                }
+                if (texture.width > 0)
+                {
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("%ux%u%s", texture.width, texture.height, texture.embedded ? "" : ", from a WAD");
+                }
+                if (state.textureUsage)
+                {
+                    size_t index = state.textureUsage->find(TextureUsage::textureKey(texture.name));
+                    if (index != std::string::npos)
                     {
-                        folderNode = &child;
-                        break;
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("(%zu maps)", state.textureUsage->users(index).size());
                     }
                 }
+                ImGui::PopID();
             }
+        }
+
+        if (ImGui::CollapsingHeader("Embedded Textures", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            constexpr float MAX_SIZE = 128.0f;
+            float available = ImGui::GetContentRegionAvail().x;
+            float x = 0.0f;
+            for (const auto &image : map.images)
+            {
+                if (!image)
+                    continue;
+
+                float scale = std::min(1.0f, MAX_SIZE / std::max(image->width, image->height));
+                ImVec2 size(image->width * scale, image->height * scale);
+                float cellWidth = std::max(size.x, ImGui::CalcTextSize(image->filename.c_str()).x);
+                if (x > 0.0f && x + cellWidth <= available)
+                    ImGui::SameLine();
+                else
+                    x = 0.0f;
+
+                ImGui::BeginGroup();
+                ImGui::Image((ImTextureID)(uintptr_t)image->textureID, size);
+                ImGui::TextUnformatted(image->filename.c_str());
+                ImGui::EndGroup();
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("%s, %dx%d", image->filename.c_str(), image->width, image->height);
+                x += cellWidth + ImGui::GetStyle().ItemSpacing.x;
+            }
+        }
+        ImGui::EndChild();
+
+        if (textureToOpen)
+            openEntry(state, *textureToOpen);
+    }
+    else if (state.currentModel)
+    {
+        // Model view. Quake 2 runs animations at 10 frames a second, and the shader blends between them.
+        constexpr float FRAMES_PER_SECOND = 10.0f;
+        ModelView &view = *state.currentModel;
+        const Md2Model &model = view.model;
+        std::string_view name = state.entries.name(state.selectedEntry);
+        ImGui::Text("%.*s: %zu frames, %zu vertices", static_cast<int>(name.size()), name.data(), model.frames.size(),
+                    model.vertexCount);
+
+        const Md2Animation &animation = model.animations[view.animation];
+        ImGui::SetNextItemWidth(160.0f);
+        if (ImGui::BeginCombo("Animation", animation.name.c_str()))
+        {
+            for (size_t i = 0; i < model.animations.size(); i++)
+            {
+                if (ImGui::Selectable(model.animations[i].name.c_str(), static_cast<int>(i) == view.animation))
+                {
+                    view.animation = static_cast<int>(i);
+                    view.time = 0.0f;
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        if (!model.skins.empty())
+        {
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(240.0f);
+            if (ImGui::BeginCombo("Skin", model.skins[view.skin].c_str()))
+            {
+                for (size_t i = 0; i < model.skins.size(); i++)
+                {
+                    ImGui::BeginDisabled(!view.skins[i]);
+                    if (ImGui::Selectable(model.skins[i].c_str(), static_cast<int>(i) == view.skin))
+                        view.skin = static_cast<int>(i);
+                    ImGui::EndDisabled();
+                }
+                ImGui::EndCombo();
+            }
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button(view.playing ? "Pause" : "Play"))
+            view.playing = !view.playing;
+
+        const Md2Animation &current = model.animations[view.animation];
+        if (view.playing)
+            view.time = std::fmod(view.time + ImGui::GetIO().DeltaTime * FRAMES_PER_SECOND, static_cast<float>(current.frameCount));
+        int frame = static_cast<int>(view.time);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(200.0f);
+        if (ImGui::SliderInt("##Frame", &frame, 0, current.frameCount - 1))
+        {
+            view.time = static_cast<float>(frame);
+            view.playing = false;
+        }
+        ImGui::SameLine();
+        ImGui::TextUnformatted(model.frames[current.firstFrame + frame].name.c_str());
+
+        ModelPreview::Pose pose;
+        pose.frame = current.firstFrame + frame;
+        pose.nextFrame = current.firstFrame + (frame + 1) % current.frameCount;
+        pose.blend = view.time - static_cast<float>(frame);
+        pose.yaw = view.yaw;
+        pose.pitch = view.pitch;
+        pose.zoom = view.zoom;
+        if (view.skin < static_cast<int>(view.skins.size()) && view.skins[view.skin])
+            pose.skin = view.skins[view.skin]->textureID;
+
+        ImVec2 size = ImGui::GetContentRegionAvail();
+        GLuint texture = state.modelPreview.render(model, pose, static_cast<int>(size.x), static_cast<int>(size.y));
+        if (texture)
+        {
+            // The render target is bottom-up, like every GL framebuffer
+            ImGui::Image((ImTextureID)(uintptr_t)texture, size, ImVec2(0.0f, 1.0f), ImVec2(1.0f, 0.0f));
+            if (ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left, 0.0f))
+            {
+                ImVec2 delta = ImGui::GetIO().MouseDelta;
+                view.yaw -= delta.x * 0.01f;
+                view.pitch = std::clamp(view.pitch + delta.y * 0.01f, -1.5f, 1.5f);
+            }
+            if (ImGui::IsItemHovered() && ImGui::GetIO().MouseWheel != 0.0f)
+                view.zoom = std::clamp(view.zoom * std::pow(0.9f, ImGui::GetIO().MouseWheel), 0.2f, 5.0f);
+            if (ImGui::IsItemHovered() && !ImGui::IsItemActive())
+                ImGui::SetTooltip("Drag to turn, scroll to zoom");
+        }
+    }
+
+    ImGui::EndChild();
+
+    ImGui::EndChild();
+    ImGui::End();
+
+    // Left and right step through the entries around the one being viewed
+    if (!state.gridView && state.selectedEntry != INVALID_ENTRY_ID && !ImGui::GetIO().WantTextInput)
+    {
+        if (ImGui::IsKeyPressed(ImGuiKey_RightArrow))
+            stepEntry(state, 1);
+        else if (ImGui::IsKeyPressed(ImGuiKey_LeftArrow))
+            stepEntry(state, -1);
+    }
+
+    if (state.showAnalysis)
+    {
+        renderAnalysisWindow(state);
+    }
+    if (state.showContentSearch)
+    {
+        renderContentSearchWindow(state);
+    }
+    if (state.showTrace)
+    {
+        renderTraceWindow(state);
+    }
+    if (state.showMemory)
+    {
+        renderMemoryWindow(state);
+    }
+}
+
+// Copies every entry of a directory or archive into a PakWriter or Pk3Writer, in layout order. Entries
+// the writer can't hold, like PAK names longer than 55 characters, are left out with a warning.
+template <typename Writer>
+auto repackInto(Writer &writer, const std::string &source, const std::string &output, PakLayout layout,
+                const std::vector<std::string> &accessLog) -> bool
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (!writer.open(output))
+    {
+        std::cerr << "Couldn't create " << output << std::endl;
+        return false;
+    }
 
-            // Run the improved filtering and loading approach
-            auto filteredFiles = getFilteredFiles(*folderNode, state.searchFilter);
-            state.loadedImages.clear();
-            loadFilteredImages(filteredFiles, state.pakPath, state.loadedImages);
+    size_t skipped = 0;
+    auto added = [&](bool result, std::string_view name)
+    {
+        if (!result && !writer.hasFailed())
+        {
+            std::cerr << "Skipping " << name << std::endl;
+            skipped++;
         }
-        searchInProgress = false;
-    }
+        return !writer.hasFailed();
+    };
 
-    if (searchInProgress)
+    std::error_code error;
+    if (std::filesystem::is_directory(source, error))
     {
-        ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Searching...");
+        EntryTable files(PakFormat::UNKNOWN);
+        std::vector<std::string> paths;
+        for (const auto &file : std::filesystem::recursive_directory_iterator(source, error))
+        {
+            if (!file.is_regular_file())
+                continue;
+            files.add(std::filesystem::relative(file.path(), source).generic_string(), 0, file.file_size());
+            paths.push_back(file.path().string());
+        }
+
+        for (EntryId id : PakWriter::order(files, layout, accessLog))
+        {
+            int fd = ::open(paths[id].c_str(), O_RDONLY);
+            bool result = fd >= 0 && writer.addFileRange(files.name(id), fd, 0, files.size(id));
+            if (fd >= 0)
+                ::close(fd);
+            if (!added(result, files.name(id)))
+                break;
+        }
     }
-    else if (!state.searchFilter.empty())
+    else
     {
-        ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.0f, 1.0f), "Found %d results", (int)state.loadedImages.size());
-    }
+        auto entries = ParserRegistry::openArchive(source);
+        if (!entries)
+        {
+            std::cerr << "Couldn't open " << source << std::endl;
+            return false;
+        }
 
-    ImGui::Separator();
+        auto ids = PakWriter::order(*entries, layout, accessLog);
 
-    if (ImGui::TreeNode("PAK Contents"))
-    {
-        // Maximum depth for tree rendering to prevent stack overflow
-        const int MAX_DEPTH = 10;
+        if (entries->format() == PakFormat::PAK)
+        {
+            // Entry data is read straight out of the file, and copied in the kernel where the writer can
+            int fd = ::open(source.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                std::cerr << "Couldn't open " << source << std::endl;
+                return false;
+            }
 
-        for (const auto &node : state.fileTree.children)
+            for (EntryId id : ids)
+            {
+                if (!added(writer.addFileRange(entries->name(id), fd, entries->offset(id), entries->size(id)), entries->name(id)))
+                    break;
+            }
+            ::close(fd);
+        }
+        else
         {
-            renderFileTreeNode(node, state, 0, MAX_DEPTH);
+            std::vector<PakFileEntry> batch;
+            batch.reserve(ids.size());
+            for (EntryId id : ids)
+                batch.push_back(entries->entry(id));
+
+            std::vector<uint8_t> visited(batch.size(), 0);
+            ParserRegistry::handlers[entries->format()].visitEntries(source, batch, [&](size_t i, EntryStream &stream)
+                                                                     {
+                                                                         visited[i] = 1;
+                                                                         if (!writer.hasFailed())
+                                                                             added(writer.addStream(batch[i].filename, stream), batch[i].filename);
+                                                                     });
+
+            for (size_t i = 0; i < batch.size() && !writer.hasFailed(); i++)
+            {
+                if (!visited[i])
+                    added(false, batch[i].filename);
+            }
         }
-        ImGui::TreePop();
     }
-    ImGui::EndChild();
 
-    ImGui::SameLine();
+    if (writer.hasFailed() || !writer.finish())
+    {
+        std::cerr << "Failed to write " << output << std::endl;
+        return false;
+    }
 
-    // Use ImGui's native splitter
-    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-    ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(0, 0));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Wrote " << writer.entryCount() << " entries (" << formatBytes(writer.bytesWritten()) << ") to " << output
+              << " in " << elapsed.count() << " s";
+    if (skipped)
+        std::cout << ", skipped " << skipped;
+    std::cout << std::endl;
+    return true;
+}
 
-    // Get the window height for the splitter
-    float windowHeight = ImGui::GetWindowHeight();
-    ImGui::Button("##splitter", ImVec2(4, windowHeight));
-    ImGui::PopStyleVar(2);
+auto repackArchive(const std::string &source, const std::string &output, PakLayout layout,
+                   const std::vector<std::string> &accessLog, int level) -> bool
+{
+    std::string ext = std::filesystem::path(output).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
 
-    if (ImGui::IsItemActive())
+    switch (ParserRegistry::getFormatFromExtension(ext))
     {
-        float delta = ImGui::GetMouseDragDelta(ImGuiMouseButton_Left).x;
-        state.sidebarWidth = std::clamp(state.sidebarWidth + delta, minSidebarWidth, maxSidebarWidth);
-        ImGui::ResetMouseDragDelta();
+    case PakFormat::PAK:
+    {
+        PakWriter writer;
+        return repackInto(writer, source, output, layout, accessLog);
     }
-
-    // Add hover effect to make it more obvious it's draggable
-    if (ImGui::IsItemHovered())
+    case PakFormat::PKZIP:
     {
-        ImGui::SetMouseCursor(ImGuiMouseCursor_ResizeEW);
+        Pk3Writer writer(level);
+        return repackInto(writer, source, output, layout, accessLog);
     }
+    default:
+        std::cerr << "Can only write .pak and .pk3 archives" << std::endl;
+        return false;
+    }
+}
 
-    ImGui::SameLine();
-
-    // Create a parent container for controls and image view
-    ImGui::BeginChild("ContentArea", ImVec2(0, 0), false);
+void printUsage()
+{
+    std::cerr << "Usage: PakViewer [command]\n"
+                 "  --duplicates <archive> [--json <file>]    List entries with identical contents\n"
+                 "  --diff <old> <new> [--json <file>]        List entries added, removed, modified or moved\n"
+                 "  --repack <directory|archive> <output.pak|output.pk3> [--order original|name|directory]\n"
+                 "           [--access-log <file>] [--level 0-9]\n"
+                 "                                            Write an archive, with entries read together placed together.\n"
+                 "                                            PK3 entries are compressed on every core at the given zlib level.\n"
+                 "  --extract <archive> <directory> [--prefix <path>]\n"
+                 "                                            Write the entries, or those under path, out as files\n"
+                 "  --list <archive>                          Print each entry's offset, size and name\n"
+                 "  --stats <archive> [--json <file>] [--decode]\n"
+                 "                                            Load the archive as the viewer does and report memory per subsystem.\n"
+                 "                                            With --decode every image is probed and decoded too.\n"
+                 "Without a command the viewer window opens.\n"
+                 "Set " << AccessLog::ENVIRONMENT_VARIABLE << " to a file to record which entries the viewer reads.\n";
+}
 
-    // Fixed control panel section
-    if (state.gridView)
-    {
-        ImGui::BeginChild("ControlPanel", ImVec2(0, ImGui::GetFrameHeightWithSpacing() + 8), true);
-        // Grid view controls
-        ImGui::SliderFloat("Grid Scale", &state.gridScale, 0.1f, 2.0f);
+// Removes "name value" from args. Returns false if the name is there without a value.
+bool takeOption(std::vector<std::string> &args, const char *name, std::string &value)
+{
+    auto it = std::find(args.begin(), args.end(), name);
+    if (it == args.end())
+        return true;
+    if (it + 1 == args.end())
+        return false;
 
-        // Show image count in grid view
-        if (!state.loadedImages.empty())
-        {
-            ImGui::SameLine();
-            ImGui::TextColored(ImVec4(0.0f, 0.7f, 1.0f, 1.0f), "Showing %d image(s)", (int)state.loadedImages.size());
-        }
+    value = *(it + 1);
+    args.erase(it, it + 2);
+    return true;
+}
 
-        ImGui::EndChild();
-    }
+// Removes name from args, and says whether it was there
+bool takeFlag(std::vector<std::string> &args, const char *name)
+{
+    auto it = std::find(args.begin(), args.end(), name);
+    if (it == args.end())
+        return false;
 
-    // Scrollable content area
-    ImGui::BeginChild("ImageView", ImVec2(0, 0), true);
+    args.erase(it);
+    return true;
+}
 
-    if (state.gridView)
+auto runDuplicatesCommand(const std::string &path, const std::string &jsonPath) -> int
+{
+    auto entries = ParserRegistry::openArchive(path);
+    if (!entries)
     {
-        float windowWidth = ImGui::GetWindowWidth();
-        float cellSize = 200.0f * state.gridScale;
-        int imagesPerRow = std::max(1, static_cast<int>(windowWidth / cellSize));
-
-        // Defensive check for empty image list
-        if (state.loadedImages.empty())
-        {
-            ImGui::TextWrapped("No images to display in this folder.");
-        }
-        else
-        {
-            // Simple grid layout without tables (more efficient)
-            int imageCount = state.loadedImages.size();
-            ImGui::Columns(imagesPerRow, nullptr, false);
+        std::cerr << "Couldn't open " << path << std::endl;
+        return 1;
+    }
 
-            for (int i = 0; i < imageCount; i++)
-            {
-                const auto &image = state.loadedImages[i];
+    DuplicateReport report = findDuplicates(path, *entries);
+    for (const auto &group : report.groups)
+    {
+        std::cout << group.entries.size() << " x " << group.size << " bytes\n";
+        for (EntryId id : group.entries)
+            std::cout << "  " << entries->name(id) << "\n";
+    }
+    std::cout << report.groups.size() << " duplicate groups, " << formatBytes(report.wastedBytes) << " wasted ("
+              << ArchiveAnalysis::kindName(report.digests.kind) << ", " << formatBytes(report.digests.bytesRead) << " read)"
+              << std::endl;
 
-                // Calculate image dimensions with aspect ratio
-                float imageAspect = (float)image.width / image.height;
-                if (imageAspect <= 0.0f)
-                    imageAspect = 1.0f;
+    if (!jsonPath.empty() && !ArchiveAnalysis::writeDuplicatesJson(jsonPath, path, *entries, report.digests, report.groups))
+    {
+        std::cerr << "Failed to write " << jsonPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-                float maxImgHeight = cellSize * 0.7f;
-                float maxImgWidth = cellSize * 0.9f;
+auto runDiffCommand(const std::string &oldPath, const std::string &newPath, const std::string &jsonPath) -> int
+{
+    auto entries = ParserRegistry::openArchive(oldPath);
+    if (!entries)
+    {
+        std::cerr << "Couldn't open " << oldPath << std::endl;
+        return 1;
+    }
 
-                float imgWidth, imgHeight;
-                if (imageAspect > 1.0f)
-                {
-                    imgWidth = maxImgWidth;
-                    imgHeight = imgWidth / imageAspect;
-                    if (imgHeight > maxImgHeight)
-                    {
-                        imgHeight = maxImgHeight;
-                        imgWidth = imgHeight * imageAspect;
-                    }
-                }
-                else
-                {
-                    imgHeight = maxImgHeight;
-                    imgWidth = imgHeight * imageAspect;
-                    if (imgWidth > maxImgWidth)
-                    {
-                        imgWidth = maxImgWidth;
-                        imgHeight = imgWidth / imageAspect;
-                    }
-                }
+    auto report = diffArchives(oldPath, *entries, newPath);
+    if (!report)
+    {
+        std::cerr << "Couldn't open " << newPath << std::endl;
+        return 1;
+    }
 
-                // Center the image in column
-                float colWidth = ImGui::GetColumnWidth();
-                float centerOffset = (colWidth - imgWidth) * 0.5f;
-                if (centerOffset > 0)
-                {
-                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + centerOffset);
-                }
+    for (const auto &change : report->changes)
+    {
+        std::cout << ArchiveAnalysis::changeName(change.type) << "\t";
+        if (change.type == ChangeType::Added)
+            std::cout << report->newEntries.name(change.newEntry);
+        else
+            std::cout << entries->name(change.oldEntry);
+        if (change.type == ChangeType::Moved)
+            std::cout << " -> " << report->newEntries.name(change.newEntry);
+        std::cout << "\n";
+    }
+    std::cout << report->changes.size() << " changes (" << ArchiveAnalysis::kindName(report->kind) << ")" << std::endl;
 
-                // Always render all images
-                ImGui::Image((ImTextureID)(uintptr_t)image.textureID, ImVec2(imgWidth, imgHeight));
+    if (!jsonPath.empty() && !ArchiveAnalysis::writeDiffJson(jsonPath, oldPath, *entries, newPath, report->newEntries,
+                                                             report->kind, report->changes))
+    {
+        std::cerr << "Failed to write " << jsonPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-                // Get filename for label
-                std::string filename;
-                try
-                {
-                    filename = image.filename;
-                    size_t lastSlash = filename.find_last_of('/');
-                    if (lastSlash != std::string::npos && lastSlash < filename.length() - 1)
-                        filename = filename.substr(lastSlash + 1);
-                }
-                catch (...)
-                {
-                    filename = "[Error]";
-                }
+auto runExtractCommand(const std::string &path, const std::string &outputDir, const std::string &prefix) -> int
+{
+    auto entries = ParserRegistry::openArchive(path);
+    if (!entries)
+    {
+        std::cerr << "Couldn't open " << path << std::endl;
+        return 1;
+    }
 
-                // Simple truncation
-                if (filename.length() > 18)
-                {
-                    filename = filename.substr(0, 15) + "...";
-                }
+    std::vector<EntryId> ids;
+    for (EntryId id = 0; id < entries->size(); id++)
+    {
+        if (Extractor::isUnder(entries->name(id), prefix))
+            ids.push_back(id);
+    }
 
-                // Center filename
-                float textWidth = ImGui::CalcTextSize(filename.c_str()).x;
-                centerOffset = (colWidth - textWidth) * 0.5f;
-                if (centerOffset > 0)
-                {
-                    ImGui::SetCursorPosX(ImGui::GetCursorPosX() + centerOffset);
-                }
+    auto start = std::chrono::steady_clock::now();
+    auto summary = Extractor::extract(path, *entries, std::move(ids), outputDir, &ParserRegistry::visitEntries);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (const auto &name : summary.failures)
+        std::cerr << "Couldn't extract " << name << "\n";
+    std::cout << "Extracted " << summary.written << " entries (" << formatBytes(summary.bytes) << ") to " << outputDir
+              << " in " << elapsed.count() << " s, writing with " << (summary.usedIoUring ? "io_uring" : "the thread pool");
+    if (summary.failed)
+        std::cout << ", " << summary.failed << " failed";
+    std::cout << std::endl;
+    return summary.failed ? 1 : 0;
+}
 
-                ImGui::TextUnformatted(filename.c_str());
+auto runListCommand(const std::string &path) -> int
+{
+    auto entries = ParserRegistry::openArchive(path);
+    if (!entries)
+    {
+        std::cerr << "Couldn't open " << path << std::endl;
+        return 1;
+    }
 
-                ImGui::NextColumn();
-            }
+    for (EntryId id = 0; id < entries->size(); id++)
+        std::cout << entries->offset(id) << "\t" << entries->size(id) << "\t" << entries->name(id) << "\n";
+    std::cout << entries->size() << " entries" << std::endl;
+    return 0;
+}
 
-            ImGui::Columns(1);
+// Probes every image and then decodes each in full across the pool, as paging through the gallery
+// would, so the palettes and decode buffers are measured along with the tables. Pixels are held as
+// decode buffers for as long as the decode that made them.
+void decodeAllImages(const std::string &path, const EntryTable &entries)
+{
+    std::vector<EntryId> images;
+    std::vector<PakFileEntry> imageEntries;
+    for (EntryId id = 0; id < entries.size(); id++)
+    {
+        if (entries.type(id) == static_cast<uint8_t>(FileKind::Image) && entries.size(id) <= ParserRegistry::MAX_READ_SIZE)
+        {
+            images.push_back(id);
+            imageEntries.push_back(entries.entry(id));
         }
     }
-    else if (state.currentImage)
+
+    prepareImageDecoders(path, entries);
+    auto infos = ImageLoader::probeImages(path, imageEntries);
+    size_t probed = std::count_if(infos.begin(), infos.end(), [](const auto &info) { return info.has_value(); });
+
+    ImagePrefetcher::Loader loader = makeImageLoader(path);
+    std::atomic<size_t> decoded{0};
+    ThreadPool::parallelFor(imageEntries.size(), [&](size_t i)
+                            {
+                                std::vector<uint8_t> pixels;
+                                std::optional<MemoryScope> pixelMemory;
+                                bool ok = loader(imageEntries[i], [&](int width, int height) -> uint8_t *
+                                                 {
+                                                     pixels.resize(static_cast<size_t>(width) * height * 4);
+                                                     pixelMemory.emplace(MemoryCategory::DecodeBuffers, pixels.size());
+                                                     return pixels.data();
+                                                 });
+                                decoded += ok; });
+
+    std::cout << images.size() << " images, " << probed << " probed, " << decoded << " decoded\n";
+}
+
+auto runStatsCommand(const std::string &path, const std::string &jsonPath, bool decode) -> int
+{
+    auto entries = ParserRegistry::openArchive(path);
+    if (!entries)
     {
-        // Single image view
-        ImGui::Image((ImTextureID)(uintptr_t)state.currentImage->textureID,
-                     ImVec2(state.currentImage->width, state.currentImage->height));
+        std::cerr << "Couldn't open " << path << std::endl;
+        return 1;
     }
-    else if (state.currentText)
+
+    classifyEntries(*entries);
+    FileTreeNode fileTree;
+    buildFileTree(*entries, fileTree);
+    FuzzyIndex fuzzyIndex;
+    fuzzyIndex.build(*entries);
+    updateMemoryGauges(fileTree, fuzzyIndex);
+
+    std::cout << entries->size() << " entries\n";
+    if (decode)
+        decodeAllImages(path, *entries);
+    if (uint64_t resident = MemoryStats::residentBytes())
+        std::cout << "Process resident: " << formatBytes(resident) << "\n";
+    std::cout << "Subsystem\tLive\tPeak\tAllocations\tEver\n";
+    for (const auto &stat : MemoryStats::snapshot())
     {
-        // Text file view
-        ImGui::BeginChild("TextView", ImVec2(0, 0), true);
-        ImGui::TextWrapped("%s", state.currentText->contents.c_str());
-        ImGui::EndChild();
+        std::cout << (stat.gpu ? "GPU " : "CPU ") << stat.name << "\t" << formatBytes(stat.bytes) << "\t" << formatBytes(stat.peakBytes) << "\t"
+                  << stat.allocations << "\t" << (stat.gauge ? "-" : std::to_string(stat.totalAllocations)) << "\n";
     }
-    else if (state.currentBinary)
-    {
-        // Binary file view (hex viewer)
-        ImGui::BeginChild("HexView", ImVec2(0, 0), true);
+    std::cout << std::flush;
 
-        // File size info
-        ImGui::Text("File Size: %zu bytes", state.currentBinary->data.size());
-
-        // Hex viewer settings
-        static int bytesPerRow = 16;
-        static bool showAscii = true;
-        ImGui::SliderInt("Bytes per Row", &bytesPerRow, 4, 32, "%d", ImGuiSliderFlags_None);
-        ImGui::SameLine();
-        ImGui::Checkbox("Show ASCII", &showAscii);
+    if (!jsonPath.empty() && !MemoryStats::writeJson(jsonPath))
+    {
+        std::cerr << "Failed to write " << jsonPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-        // Hex viewer content
-        const auto &data = state.currentBinary->data;
-        char line[256];
-        for (size_t i = 0; i < data.size(); i += bytesPerRow)
-        {
-            // Address
-            snprintf(line, sizeof(line), "%08zX: ", i);
-            ImGui::Text("%s", line);
+// Runs a headless command if one was given, returning its exit code. Returns nothing when the
+// viewer should start instead.
+auto runCommandLine(int argc, char **argv) -> std::optional<int>
+{
+    if (argc < 2)
+        return std::nullopt;
 
-            // Hex values
-            for (int j = 0; j < bytesPerRow && (i + j) < data.size(); j++)
-            {
-                ImGui::SameLine();
-                snprintf(line, sizeof(line), "%02X", data[i + j]);
-                ImGui::Text("%s", line);
-            }
+    std::vector<std::string> args(argv + 1, argv + argc);
 
-            // ASCII representation
-            if (showAscii)
-            {
-                ImGui::SameLine();
-                ImGui::Text("  |");
-                for (int j = 0; j < bytesPerRow && (i + j) < data.size(); j++)
-                {
-                    ImGui::SameLine();
-                    char c = data[i + j];
-                    if (c >= 32 && c <= 126)
-                    {
-                        snprintf(line, sizeof(line), "%c", c);
-                    }
-                    else
-                    {
-                        snprintf(line, sizeof(line), ".");
-                    }
-                    ImGui::Text("%s", line);
-                }
-            }
-        }
+    bool decode = takeFlag(args, "--decode");
+    std::string jsonPath, order = "directory", accessLogPath, level = "-1", prefix;
+    if (!takeOption(args, "--json", jsonPath) || !takeOption(args, "--order", order) ||
+        !takeOption(args, "--access-log", accessLogPath) || !takeOption(args, "--level", level) ||
+        !takeOption(args, "--prefix", prefix) || args.empty())
+    {
+        printUsage();
+        return 2;
+    }
 
-        ImGui::EndChild();
+    static const std::unordered_map<std::string, PakLayout> layouts = {
+        {"original", PakLayout::Original}, {"name", PakLayout::Name}, {"directory", PakLayout::Directory}};
+
+    const std::string &command = args[0];
+    bool isDuplicates = command == "--duplicates" && args.size() == 2;
+    bool isDiff = command == "--diff" && args.size() == 3;
+    bool isRepack = command == "--repack" && args.size() == 3 && layouts.count(order) &&
+                    std::atoi(level.c_str()) >= -1 && std::atoi(level.c_str()) <= 9;
+    bool isExtract = command == "--extract" && args.size() == 3;
+    bool isStats = command == "--stats" && args.size() == 2;
+    bool isList = command == "--list" && args.size() == 2;
+    if ((!isDuplicates && !isDiff && !isRepack && !isExtract && !isStats && !isList) || (decode && !isStats))
+    {
+        printUsage();
+        return 2;
     }
 
-    ImGui::EndChild();
+    ThreadPool::init();
+    int exitCode;
+
+    if (isDuplicates)
+        exitCode = runDuplicatesCommand(args[1], jsonPath);
+    else if (isDiff)
+        exitCode = runDiffCommand(args[1], args[2], jsonPath);
+    else if (isExtract)
+        exitCode = runExtractCommand(args[1], args[2], prefix);
+    else if (isStats)
+        exitCode = runStatsCommand(args[1], jsonPath, decode);
+    else if (isList)
+        exitCode = runListCommand(args[1]);
+    else
+    {
+        auto accessLog = accessLogPath.empty() ? std::vector<std::string>() : AccessLog::load(accessLogPath, args[1]);
+        exitCode = repackArchive(args[1], args[2], layouts.at(order), accessLog, std::atoi(level.c_str())) ? 0 : 1;
+    }
 
-    ImGui::EndChild();
-    ImGui::End();
+    ThreadPool::shutdown();
+    return exitCode;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    if (auto exitCode = runCommandLine(argc, argv))
+        return *exitCode;
+
     if (!glfwInit())
         return -1;
 
@@ -1172,35 +5218,94 @@ int main()
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 410");
 
+    TextureUploader::init();
+    ThumbnailCache::open();
+    AccessLog::openFromEnvironment();
+    ThreadPool::init();
+    ThreadPool::setCompletionHook(glfwPostEmptyEvent);
+
     PakViewerState state;
 
+    // ImGui can take a couple of frames to settle after input (hover state, window sizes), so a few
+    // frames are drawn after every event before the loop goes back to sleep
+    constexpr int FRAMES_AFTER_EVENT = 3;
+    constexpr double CARET_BLINK_INTERVAL = 0.4;
+    int activeFrames = FRAMES_AFTER_EVENT;
+
     while (!glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        Trace::beginFrame();
+
+        bool busy = TextureUploader::hasPendingUploads() ||
+                    (state.gridView && state.galleryLoadCursor < state.gallery.size()) ||
+                    state.contentSearch.isRunning() || // Hits stream in without waking the loop
+                    state.extractor.isRunning() ||
+                    state.audio.isPlaying() ||
+                    (!state.gridView && state.currentModel && state.currentModel->playing);
+        if (busy)
+            activeFrames = FRAMES_AFTER_EVENT;
+
+        if (activeFrames > 0)
+        {
+            glfwPollEvents();
+            activeFrames--;
+        }
+        else
+        {
+            // Blocks until there is input, or until a background job posts an empty event
+            TRACE_SCOPE("Wait for events");
+            if (ImGui::GetIO().WantTextInput)
+                glfwWaitEventsTimeout(CARET_BLINK_INTERVAL);
+            else
+                glfwWaitEvents();
+            activeFrames = FRAMES_AFTER_EVENT - 1;
+        }
+        TextureUploader::pump();
+
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
         renderUI(state);
 
-        ImGui::Render();
-        int display_w, display_h;
-        glfwGetFramebufferSize(window, &display_w, &display_h);
-        glViewport(0, 0, display_w, display_h);
-        glClear(GL_COLOR_BUFFER_BIT);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("Render");
+            ImGui::Render();
+            int display_w, display_h;
+            glfwGetFramebufferSize(window, &display_w, &display_h);
+            glViewport(0, 0, display_w, display_h);
+            glClear(GL_COLOR_BUFFER_BIT);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+
+        {
+            TRACE_SCOPE("Swap buffers");
+            glfwSwapBuffers(window);
+        }
     }
 
     // Clean up all loaded textures
     if (state.currentImage)
     {
-        glDeleteTextures(1, &state.currentImage->textureID);
-    }
-    for (const auto &image : state.loadedImages)
-    {
-        glDeleteTextures(1, &image.textureID);
+        TextureUploader::release(*state.currentImage);
     }
+    if (state.currentMap)
+        MapParser::releaseMap(*state.currentMap);
+    if (state.currentModel)
+        ModelParser::releaseModel(*state.currentModel);
+    state.modelPreview.release();
+    // Otherwise shutdown waits for these to run to the end
+    state.contentSearch.cancel();
+    state.extractor.cancel();
+    state.watcher.stop();
+    state.prefetcher.reset(nullptr);
+    if (state.folderWarmup)
+        *state.folderWarmup = true;
+    ThreadPool::shutdown();
+    clearGallery(state);
+    TextureUploader::shutdown();
+    ThumbnailCache::close();
+    AccessLog::close();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
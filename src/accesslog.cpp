@@ -0,0 +1,75 @@
+#include "accesslog.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+    std::ofstream logFile;
+    std::unordered_set<std::string> recorded; // Names already logged since the current archive was opened
+
+    // The log may have been written from another directory, or name the archive through a link
+    auto isSameArchive(const std::string &logged, const std::string &archivePath) -> bool {
+        std::error_code error;
+        bool same = fs::equivalent(logged, archivePath, error);
+        return error ? logged == archivePath : same;
+    }
+}
+
+auto AccessLog::openFromEnvironment() -> bool {
+    const char *path = std::getenv(ENVIRONMENT_VARIABLE);
+    if (!path || !*path) {
+        return false;
+    }
+
+    logFile.open(path, std::ios::app);
+    return logFile.is_open();
+}
+
+auto AccessLog::close() -> void {
+    logFile.close();
+    recorded.clear();
+}
+
+auto AccessLog::setArchive(const std::string &pakPath) -> void {
+    if (!logFile.is_open()) {
+        return;
+    }
+
+    recorded.clear();
+    std::error_code error;
+    fs::path absolute = fs::absolute(pakPath, error);
+    logFile << "# " << (error ? pakPath : absolute.string()) << '\n';
+}
+
+auto AccessLog::record(std::string_view name) -> void {
+    if (!logFile.is_open() || !recorded.emplace(name).second) {
+        return;
+    }
+
+    // Flushed every time so the log survives the viewer being killed
+    logFile << name << std::endl;
+}
+
+auto AccessLog::load(const std::string &path, const std::string &archivePath) -> std::vector<std::string> {
+    std::vector<std::string> names;
+    std::unordered_set<std::string> seen;
+
+    std::ifstream file(path);
+    std::string line;
+    bool inSection = false; // Names before the first marker belong to no known archive
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '#') {
+            inSection = line.size() > 2 && isSameArchive(line.substr(2), archivePath);
+        } else if (inSection && seen.insert(line).second) {
+            names.push_back(line);
+        }
+    }
+    return names;
+}
@@ -0,0 +1,25 @@
+// Records the order the viewer reads entries in, for laying out repacked archives
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One entry name per line, each written the first time it is read in a session. Lines starting with
+// '#' mark which archive the names that follow belong to.
+class AccessLog {
+public:
+    static constexpr const char *ENVIRONMENT_VARIABLE = "PAK_ADVENTURE_ACCESS_LOG";
+
+    // Starts appending to the file named by the environment variable. Does nothing if it isn't set.
+    static auto openFromEnvironment() -> bool;
+    static auto close() -> void;
+
+    static auto setArchive(const std::string &pakPath) -> void;
+    static auto record(std::string_view name) -> void;
+
+    // Every name logged for archivePath, in the order each was first read. Sections for other archives
+    // are skipped, so one log can be shared by several archives.
+    static auto load(const std::string &path, const std::string &archivePath) -> std::vector<std::string>;
+};
@@ -0,0 +1,355 @@
+#include "archiveanalysis.h"
+#include "contenthash.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+    constexpr size_t READ_BUFFER_SIZE = 1024 * 1024;
+    constexpr uint64_t BATCH_BYTES = 64 * 1024 * 1024; // Big enough to keep reads sequential, small enough to balance
+    constexpr size_t BATCH_ENTRIES = 4096;
+    constexpr size_t BATCHES_PER_THREAD = 4; // Lets threads that drew cheap batches pick up more work
+
+    struct DigestKey {
+        uint64_t digest;
+        uint64_t size;
+
+        auto operator==(const DigestKey &other) const -> bool {
+            return digest == other.digest && size == other.size;
+        }
+    };
+
+    struct DigestKeyHash {
+        auto operator()(const DigestKey &key) const -> size_t {
+            return static_cast<size_t>(key.digest ^ (key.size * 0x9e3779b97f4a7c15ull));
+        }
+    };
+
+    auto hashStream(EntryStream &stream, DigestKind kind, std::vector<uint8_t> &buffer, uint64_t &bytesRead) -> std::optional<uint64_t> {
+        ContentHash hasher;
+        uLong crc = crc32(0, nullptr, 0);
+        uint64_t total = 0;
+
+        while (total < stream.size()) {
+            size_t read = stream.read(buffer.data(), buffer.size());
+            if (read == 0) {
+                return std::nullopt;
+            }
+
+            if (kind == DigestKind::XXH64) {
+                hasher.update(buffer.data(), read);
+            } else {
+                crc = crc32(crc, buffer.data(), static_cast<uInt>(read));
+            }
+            total += read;
+        }
+
+        bytesRead += total;
+        return kind == DigestKind::XXH64 ? hasher.digest() : static_cast<uint64_t>(crc);
+    }
+
+    auto writeEscaped(std::ofstream &out, std::string_view text) -> void {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    auto writeDigest(std::ofstream &out, uint64_t digest, DigestKind kind) -> void {
+        out << '"' << std::hex << std::setw(kind == DigestKind::XXH64 ? 16 : 8) << std::setfill('0') << digest << std::dec << '"';
+    }
+}
+
+auto ArchiveAnalysis::chooseKind(const std::vector<const EntryTable *> &tables) -> DigestKind {
+    for (const EntryTable *table : tables) {
+        bool allStored = !table->empty();
+        for (EntryId id = 0; id < table->size() && allStored; id++) {
+            allStored = table->flags(id) & ENTRY_HAS_CRC;
+        }
+        if (allStored) {
+            return DigestKind::CRC32;
+        }
+    }
+    return DigestKind::XXH64;
+}
+
+auto ArchiveAnalysis::visitParallel(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                                    VisitEntriesFunc visitEntries, const ParallelVisitor &visit) -> void {
+    std::sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) { return entries.offset(a) < entries.offset(b); });
+
+    // Contiguous runs of entries become batches, each read with the archive opened once. Batches are
+    // kept small enough that every thread gets a few, so one slow batch doesn't hold everything up.
+    uint64_t totalBytes = 0;
+    for (EntryId id : ids) {
+        totalBytes += entries.size(id);
+    }
+    size_t targetBatches = (ThreadPool::threadCount() + 1) * BATCHES_PER_THREAD;
+    uint64_t batchBytes = std::clamp<uint64_t>(totalBytes / targetBatches, 1, BATCH_BYTES);
+    size_t batchEntries = std::clamp<size_t>(ids.size() / targetBatches, 1, BATCH_ENTRIES);
+
+    std::vector<std::pair<size_t, size_t>> batches;
+    for (size_t start = 0; start < ids.size();) {
+        size_t end = start;
+        uint64_t bytes = 0;
+        while (end < ids.size() && end - start < batchEntries && (bytes < batchBytes || end == start)) {
+            bytes += entries.size(ids[end++]);
+        }
+        batches.emplace_back(start, end);
+        start = end;
+    }
+
+    ThreadPool::parallelFor(batches.size(), [&](size_t b) {
+        auto [start, end] = batches[b];
+
+        std::vector<PakFileEntry> batch;
+        batch.reserve(end - start);
+        for (size_t i = start; i < end; i++) {
+            batch.push_back(entries.entry(ids[i]));
+        }
+
+        std::vector<uint8_t> scratch;
+        visitEntries(path, batch, [&](size_t index, EntryStream &stream) { visit(ids[start + index], stream, scratch); });
+    });
+}
+
+auto ArchiveAnalysis::hashEntries(const std::string &path, const EntryTable &entries, DigestKind kind,
+                                  VisitEntriesFunc visitEntries) -> ArchiveDigests {
+    TRACE_SCOPE("Hash entries");
+    ArchiveDigests digests;
+    digests.kind = kind;
+    digests.values.assign(entries.size(), 0);
+    digests.valid.assign(entries.size(), 0);
+
+    // Take whatever the directory already knows, and read the rest
+    std::vector<EntryId> toRead;
+    for (EntryId id = 0; id < entries.size(); id++) {
+        if (kind == DigestKind::CRC32 && (entries.flags(id) & ENTRY_HAS_CRC)) {
+            digests.values[id] = entries.crc(id);
+            digests.valid[id] = 1;
+        } else {
+            toRead.push_back(id);
+        }
+    }
+
+    std::atomic<uint64_t> bytesRead{0};
+    visitParallel(path, entries, std::move(toRead), visitEntries, [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &buffer) {
+        buffer.resize(READ_BUFFER_SIZE);
+        uint64_t entryBytes = 0;
+        if (auto digest = hashStream(stream, kind, buffer, entryBytes)) {
+            digests.values[id] = *digest;
+            digests.valid[id] = 1;
+        }
+        bytesRead.fetch_add(entryBytes, std::memory_order_relaxed);
+    });
+
+    digests.bytesRead = bytesRead;
+    return digests;
+}
+
+auto ArchiveAnalysis::findDuplicates(const EntryTable &entries, const ArchiveDigests &digests) -> std::vector<DuplicateGroup> {
+    std::unordered_map<DigestKey, std::vector<EntryId>, DigestKeyHash> byContent;
+    for (EntryId id = 0; id < entries.size(); id++) {
+        // Empty files are all identical and not worth reporting
+        if (digests.valid[id] && entries.size(id) > 0) {
+            byContent[{digests.values[id], entries.size(id)}].push_back(id);
+        }
+    }
+
+    std::vector<DuplicateGroup> groups;
+    for (auto &[key, ids] : byContent) {
+        if (ids.size() > 1) {
+            std::sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) { return entries.name(a) < entries.name(b); });
+            groups.push_back({key.digest, key.size, std::move(ids)});
+        }
+    }
+
+    auto wasted = [](const DuplicateGroup &group) { return group.size * (group.entries.size() - 1); };
+    std::sort(groups.begin(), groups.end(), [&](const DuplicateGroup &a, const DuplicateGroup &b) {
+        if (wasted(a) != wasted(b)) {
+            return wasted(a) > wasted(b);
+        }
+        return a.digest < b.digest;
+    });
+    return groups;
+}
+
+auto ArchiveAnalysis::diff(const EntryTable &oldEntries, const ArchiveDigests &oldDigests,
+                           const EntryTable &newEntries, const ArchiveDigests &newDigests) -> std::vector<ArchiveChange> {
+    TRACE_SCOPE("Diff archives");
+    std::unordered_map<std::string_view, EntryId> newByName;
+    newByName.reserve(newEntries.size());
+    for (EntryId id = 0; id < newEntries.size(); id++) {
+        newByName.emplace(newEntries.name(id), id);
+    }
+
+    std::vector<ArchiveChange> changes;
+    std::vector<uint8_t> matched(newEntries.size(), 0);
+    std::unordered_map<DigestKey, std::vector<EntryId>, DigestKeyHash> removedByContent;
+    std::vector<EntryId> removed;
+
+    for (EntryId oldId = 0; oldId < oldEntries.size(); oldId++) {
+        auto it = newByName.find(oldEntries.name(oldId));
+        if (it == newByName.end()) {
+            removed.push_back(oldId);
+            if (oldDigests.valid[oldId]) {
+                removedByContent[{oldDigests.values[oldId], oldEntries.size(oldId)}].push_back(oldId);
+            }
+            continue;
+        }
+
+        EntryId newId = it->second;
+        matched[newId] = 1;
+
+        // An entry that couldn't be hashed on either side is only known to have changed if its size did
+        bool comparable = oldDigests.valid[oldId] && newDigests.valid[newId];
+        bool sameSize = oldEntries.size(oldId) == newEntries.size(newId);
+        if (!sameSize || (comparable && oldDigests.values[oldId] != newDigests.values[newId])) {
+            changes.push_back({ChangeType::Modified, oldId, newId});
+        }
+    }
+
+    std::vector<uint8_t> moved(oldEntries.size(), 0);
+    for (EntryId newId = 0; newId < newEntries.size(); newId++) {
+        if (matched[newId]) {
+            continue;
+        }
+
+        auto it = newDigests.valid[newId] ? removedByContent.find({newDigests.values[newId], newEntries.size(newId)})
+                                          : removedByContent.end();
+        if (it != removedByContent.end() && !it->second.empty()) {
+            EntryId oldId = it->second.back();
+            it->second.pop_back();
+            moved[oldId] = 1;
+            changes.push_back({ChangeType::Moved, oldId, newId});
+        } else {
+            changes.push_back({ChangeType::Added, INVALID_ENTRY_ID, newId});
+        }
+    }
+
+    for (EntryId oldId : removed) {
+        if (!moved[oldId]) {
+            changes.push_back({ChangeType::Removed, oldId, INVALID_ENTRY_ID});
+        }
+    }
+
+    auto pathOf = [&](const ArchiveChange &change) {
+        return change.newEntry != INVALID_ENTRY_ID ? newEntries.name(change.newEntry) : oldEntries.name(change.oldEntry);
+    };
+    std::sort(changes.begin(), changes.end(), [&](const ArchiveChange &a, const ArchiveChange &b) {
+        if (a.type != b.type) {
+            return a.type < b.type;
+        }
+        return pathOf(a) < pathOf(b);
+    });
+    return changes;
+}
+
+auto ArchiveAnalysis::writeDuplicatesJson(const std::string &path, const std::string &archive, const EntryTable &entries,
+                                          const ArchiveDigests &digests, const std::vector<DuplicateGroup> &groups) -> bool {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    uint64_t wastedBytes = 0;
+    for (const auto &group : groups) {
+        wastedBytes += group.size * (group.entries.size() - 1);
+    }
+
+    out << "{\n  \"archive\": ";
+    writeEscaped(out, archive);
+    out << ",\n  \"digest\": \"" << kindName(digests.kind) << "\",\n  \"wastedBytes\": " << wastedBytes
+        << ",\n  \"duplicates\": [";
+
+    for (size_t g = 0; g < groups.size(); g++) {
+        const auto &group = groups[g];
+        out << (g ? ",\n" : "\n") << "    {\"digest\": ";
+        writeDigest(out, group.digest, digests.kind);
+        out << ", \"size\": " << group.size << ", \"entries\": [";
+        for (size_t i = 0; i < group.entries.size(); i++) {
+            out << (i ? ", " : "");
+            writeEscaped(out, entries.name(group.entries[i]));
+        }
+        out << "]}";
+    }
+
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+auto ArchiveAnalysis::writeDiffJson(const std::string &path, const std::string &oldArchive, const EntryTable &oldEntries,
+                                    const std::string &newArchive, const EntryTable &newEntries, DigestKind kind,
+                                    const std::vector<ArchiveChange> &changes) -> bool {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    size_t counts[4] = {};
+    for (const auto &change : changes) {
+        counts[static_cast<int>(change.type)]++;
+    }
+
+    out << "{\n  \"old\": ";
+    writeEscaped(out, oldArchive);
+    out << ",\n  \"new\": ";
+    writeEscaped(out, newArchive);
+    out << ",\n  \"digest\": \"" << kindName(kind) << "\",\n  \"summary\": {";
+    for (int type = 0; type < 4; type++) {
+        out << (type ? ", " : "") << '"' << changeName(static_cast<ChangeType>(type)) << "\": " << counts[type];
+    }
+    out << "},\n  \"changes\": [";
+
+    for (size_t i = 0; i < changes.size(); i++) {
+        const auto &change = changes[i];
+        out << (i ? ",\n" : "\n") << "    {\"type\": \"" << changeName(change.type) << '"';
+
+        if (change.oldEntry != INVALID_ENTRY_ID) {
+            out << ", \"oldPath\": ";
+            writeEscaped(out, oldEntries.name(change.oldEntry));
+            out << ", \"oldSize\": " << oldEntries.size(change.oldEntry);
+        }
+        if (change.newEntry != INVALID_ENTRY_ID) {
+            out << ", \"newPath\": ";
+            writeEscaped(out, newEntries.name(change.newEntry));
+            out << ", \"newSize\": " << newEntries.size(change.newEntry);
+        }
+        out << '}';
+    }
+
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+auto ArchiveAnalysis::kindName(DigestKind kind) -> const char * {
+    return kind == DigestKind::XXH64 ? "xxh64" : "crc32";
+}
+
+auto ArchiveAnalysis::changeName(ChangeType type) -> const char * {
+    switch (type) {
+    case ChangeType::Added:
+        return "added";
+    case ChangeType::Removed:
+        return "removed";
+    case ChangeType::Modified:
+        return "modified";
+    case ChangeType::Moved:
+        break;
+    }
+    return "moved";
+}
@@ -0,0 +1,70 @@
+// Content hashing of whole archives, duplicate detection and diffs between archive versions
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "entrystream.h"
+#include "entrytable.h"
+
+enum class DigestKind {
+    XXH64, // Hash of the contents, which means reading every entry
+    CRC32  // The CRC-32 ZIP directories already store, so most entries needn't be read at all
+};
+
+struct ArchiveDigests {
+    DigestKind kind = DigestKind::XXH64;
+    std::vector<uint64_t> values; // Indexed by EntryId
+    std::vector<uint8_t> valid;   // 0 where the entry couldn't be read
+    uint64_t bytesRead = 0;       // Only what had to be read, not what came from the directory
+};
+
+struct DuplicateGroup {
+    uint64_t digest;
+    uint64_t size;
+    std::vector<EntryId> entries;
+};
+
+enum class ChangeType { Added, Removed, Modified, Moved };
+
+struct ArchiveChange {
+    ChangeType type;
+    EntryId oldEntry; // INVALID_ENTRY_ID for added entries
+    EntryId newEntry; // INVALID_ENTRY_ID for removed entries
+};
+
+// Called for each entry from several threads at once. The scratch buffer belongs to the calling thread's
+// current batch, so it can be grown and reused without locking.
+using ParallelVisitor = std::function<void(EntryId id, EntryStream &stream, std::vector<uint8_t> &scratch)>;
+
+class ArchiveAnalysis {
+public:
+    // Digests from different kinds can't be compared, so every archive in a comparison uses the same
+    // one. CRC-32 wins as soon as one of them has it stored for every entry.
+    static auto chooseKind(const std::vector<const EntryTable *> &tables) -> DigestKind;
+
+    // Reads the given entries in offset order, in batches spread over the thread pool
+    static auto visitParallel(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                              VisitEntriesFunc visitEntries, const ParallelVisitor &visit) -> void;
+
+    // Hashes every entry, with batches of entries spread over the thread pool
+    static auto hashEntries(const std::string &path, const EntryTable &entries, DigestKind kind,
+                            VisitEntriesFunc visitEntries) -> ArchiveDigests;
+
+    // Groups of two or more entries with identical contents, biggest waste of space first
+    static auto findDuplicates(const EntryTable &entries, const ArchiveDigests &digests) -> std::vector<DuplicateGroup>;
+
+    // Entries are matched up by path. Anything removed that reappears elsewhere with the same contents
+    // counts as moved rather than as a removal plus an addition.
+    static auto diff(const EntryTable &oldEntries, const ArchiveDigests &oldDigests,
+                     const EntryTable &newEntries, const ArchiveDigests &newDigests) -> std::vector<ArchiveChange>;
+
+    static auto writeDuplicatesJson(const std::string &path, const std::string &archive, const EntryTable &entries,
+                                    const ArchiveDigests &digests, const std::vector<DuplicateGroup> &groups) -> bool;
+    static auto writeDiffJson(const std::string &path, const std::string &oldArchive, const EntryTable &oldEntries,
+                              const std::string &newArchive, const EntryTable &newEntries, DigestKind kind,
+                              const std::vector<ArchiveChange> &changes) -> bool;
+
+    static auto kindName(DigestKind kind) -> const char *;
+    static auto changeName(ChangeType type) -> const char *;
+};
@@ -0,0 +1,144 @@
+#include "archivewatcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+auto ArchiveWatcher::watch(const std::string &path, std::function<void()> notifyChange) -> bool {
+    stop();
+#ifdef __linux__
+    // A symlinked archive gets rebuilt where it really lives
+    std::error_code error;
+    std::filesystem::path target = std::filesystem::canonical(path, error);
+    if (error) {
+        return false;
+    }
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    uint32_t events = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE;
+    if (inotifyFd < 0 || stopFd < 0 || inotify_add_watch(inotifyFd, target.parent_path().c_str(), events) < 0) {
+        stop();
+        return false;
+    }
+
+    fileName = target.filename().string();
+    filePath = target.string();
+    originalFd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    notify = std::move(notifyChange);
+    changed = false;
+    thread = std::thread([this] { run(); });
+    return true;
+#else
+    (void)path;
+    (void)notifyChange;
+    return false;
+#endif
+}
+
+auto ArchiveWatcher::stop() -> void {
+#ifdef __linux__
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        ssize_t written = ::write(stopFd, &one, sizeof(one));
+        (void)written;
+        thread.join();
+    }
+#endif
+    if (inotifyFd >= 0) {
+        ::close(inotifyFd);
+    }
+    if (stopFd >= 0) {
+        ::close(stopFd);
+    }
+    inotifyFd = stopFd = -1;
+    notify = nullptr;
+    releaseOriginal();
+}
+
+auto ArchiveWatcher::openOriginal() const -> int {
+    if (originalFd < 0) {
+        return -1;
+    }
+    struct stat original;
+    struct stat current;
+    if (::fstat(originalFd, &original) != 0) {
+        return -1;
+    }
+    // Still the same file, so what it holds now is the new contents
+    if (::stat(filePath.c_str(), &current) == 0 && current.st_ino == original.st_ino && current.st_dev == original.st_dev) {
+        return -1;
+    }
+    return ::fcntl(originalFd, F_DUPFD_CLOEXEC, 0);
+}
+
+auto ArchiveWatcher::releaseOriginal() -> void {
+    if (originalFd >= 0) {
+        ::close(originalFd);
+    }
+    originalFd = -1;
+}
+
+auto ArchiveWatcher::drainEvents() -> bool {
+    bool relevant = false;
+#ifdef __linux__
+    alignas(inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t length = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            break;
+        }
+
+        for (char *next = buffer; next < buffer + length;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(next);
+            // Events were dropped, so the archive may have been among them
+            if (event->mask & IN_Q_OVERFLOW) {
+                relevant = true;
+            } else if (event->len > 0 && fileName == event->name) {
+                relevant = true;
+            }
+            next += sizeof(inotify_event) + event->len;
+        }
+    }
+#endif
+    return relevant;
+}
+
+auto ArchiveWatcher::run() -> void {
+#ifdef __linux__
+    pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    bool pending = false; // Written to, and waiting for it to settle
+
+    for (;;) {
+        int ready = ::poll(fds, 2, pending ? SETTLE_MS : -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0 || (fds[1].revents & POLLIN)) {
+            return;
+        }
+
+        if (ready == 0) {
+            pending = false;
+            changed = true;
+            if (notify) {
+                notify();
+            }
+        } else if (fds[0].revents & POLLIN) {
+            pending = drainEvents() || pending;
+        }
+    }
+#endif
+}
@@ -0,0 +1,53 @@
+// Notices when the open archive is rewritten on disk
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Watches the directory the archive is in rather than the file, since tools that rebuild an archive
+// often write a new file and rename it over the old one, which a watch on the file itself wouldn't
+// survive. A change is only reported once the file has been left alone for SETTLE_MS, so a pak being
+// written over several seconds comes through as one change rather than hundreds. The watching is
+// done on a thread of its own, which calls notify when there is a change to take. Linux only;
+// elsewhere watch() returns false and nothing is ever reported.
+class ArchiveWatcher {
+public:
+    static constexpr int SETTLE_MS = 300;
+
+    ArchiveWatcher() = default;
+    ~ArchiveWatcher() { stop(); }
+
+    ArchiveWatcher(const ArchiveWatcher &) = delete;
+    ArchiveWatcher &operator=(const ArchiveWatcher &) = delete;
+
+    // Stops watching whatever was watched before. notify runs on the watching thread.
+    auto watch(const std::string &path, std::function<void()> notify) -> bool;
+    auto stop() -> void;
+
+    // True once for each change, however many times the file was written in it
+    auto takeChange() -> bool { return changed.exchange(false); }
+
+    // A new descriptor, for the caller to close, on the archive as it was when watch() was called, or -1.
+    // It's only there once the archive has been replaced by a rename; written over in place, the old
+    // contents are gone. Keeping the original open keeps its disk space in use, so it's let go of with
+    // releaseOriginal() once it's no longer needed.
+    auto openOriginal() const -> int;
+    auto releaseOriginal() -> void;
+
+private:
+    auto run() -> void;
+    // Reads every queued event, and says whether any of them were about the archive
+    auto drainEvents() -> bool;
+
+    int inotifyFd = -1;
+    int stopFd = -1; // Written to by stop() to wake the thread
+    std::string fileName;
+    std::string filePath;
+    int originalFd = -1; // The archive as watch() found it
+    std::function<void()> notify;
+    std::atomic<bool> changed{false};
+    std::thread thread;
+};
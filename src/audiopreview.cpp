@@ -0,0 +1,441 @@
+#define MINIAUDIO_IMPLEMENTATION
+#define MA_NO_ENCODING
+#define MA_NO_GENERATION
+#include <miniaudio.h>
+
+#include "audiopreview.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace {
+    constexpr ma_format SAMPLE_FORMAT = ma_format_f32;
+    constexpr ma_uint32 CHANNELS = 2;
+    constexpr ma_uint32 FEED_FRAMES = 1024; // Decoded per step, so the first frames reach the ring quickly
+    constexpr auto FEED_POLL = std::chrono::milliseconds(2); // How long the feeder waits on the device
+
+    // Decoder callbacks, reading the entry through the EntryStream it was given as user data
+    auto readStream(ma_decoder *decoder, void *buffer, size_t bytes, size_t *bytesRead) -> ma_result {
+        auto *stream = static_cast<EntryStream *>(decoder->pUserData);
+        *bytesRead = stream->read(static_cast<uint8_t *>(buffer), bytes);
+        return *bytesRead == 0 && bytes > 0 ? MA_AT_END : MA_SUCCESS;
+    }
+
+    auto seekStream(ma_decoder *decoder, ma_int64 offset, ma_seek_origin origin) -> ma_result {
+        auto *stream = static_cast<EntryStream *>(decoder->pUserData);
+        int64_t base = 0;
+        if (origin == ma_seek_origin_current) {
+            base = static_cast<int64_t>(stream->position());
+        } else if (origin == ma_seek_origin_end) {
+            base = static_cast<int64_t>(stream->size());
+        }
+
+        int64_t target = base + offset;
+        if (target < 0 || !stream->seek(static_cast<uint64_t>(target))) {
+            return MA_BAD_SEEK;
+        }
+        return MA_SUCCESS;
+    }
+}
+
+struct AudioPreview::Engine {
+    // What the device reads from. Has to start with the miniaudio base so it can be passed as one.
+    struct RingSource {
+        ma_data_source_base base;
+        Engine *engine;
+    };
+
+    ma_context context;
+    ma_device device;
+    ma_pcm_rb ring;
+    RingSource source;
+    bool contextReady = false;
+    bool deviceReady = false;
+    bool ringReady = false;
+    bool sourceReady = false;
+    bool started = false; // Only touched by the main thread
+
+    std::thread feeder;
+    std::mutex mutex;
+    std::condition_variable wake;
+    StreamOpener pending; // Empty for stop()
+    uint64_t pendingStart = 0; // Frame to start pending from
+    uint64_t requested = 0;
+    bool quit = false;
+
+    // Each play() or stop() is a new generation. The feeder only starts writing a sound once the device
+    // has seen it take over and emptied the ring of whatever came before, so the ring never needs a lock.
+    std::atomic<uint64_t> latest{0};  // requested, readable while the feeder is busy decoding
+    std::atomic<uint64_t> feeding{0}; // Nothing from an older generation is written after this changes
+    std::atomic<uint64_t> flushed{0}; // The device has emptied the ring for this generation
+
+    std::atomic<uint64_t> startFrame{0}; // Where in the sound the ring starts, for seeks
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<uint64_t> framesPlayed{0};
+    std::atomic<uint64_t> lengthFrames{0};
+    std::atomic<bool> streaming{false};
+    std::atomic<bool> failed{false};
+
+    Engine() = default;
+    ~Engine();
+
+    static auto create(Output output) -> std::unique_ptr<Engine>;
+
+    auto request(StreamOpener open, uint64_t start) -> void;
+    auto feed() -> void;
+    auto stream(ma_decoder &decoder, uint64_t generation) -> void;
+    auto waitFor(uint64_t generation) -> bool;
+
+    static auto playback(ma_device *device, void *output, const void *input, ma_uint32 frameCount) -> void;
+
+    static auto readRing(ma_data_source *source, void *frames, ma_uint64 frameCount, ma_uint64 *framesRead) -> ma_result;
+    static auto seekRing(ma_data_source *source, ma_uint64 frame) -> ma_result;
+    static auto ringFormat(ma_data_source *source, ma_format *format, ma_uint32 *channels, ma_uint32 *sampleRate,
+                           ma_channel *channelMap, size_t channelMapCap) -> ma_result;
+    static auto ringCursor(ma_data_source *source, ma_uint64 *cursor) -> ma_result;
+    static auto ringLength(ma_data_source *source, ma_uint64 *length) -> ma_result;
+    static ma_data_source_vtable ringVtable;
+};
+
+ma_data_source_vtable AudioPreview::Engine::ringVtable = {
+    readRing,
+    seekRing,
+    ringFormat,
+    ringCursor,
+    ringLength,
+    nullptr, // Never loops
+    0,
+};
+
+auto AudioPreview::Engine::create(Output output) -> std::unique_ptr<Engine> {
+    TRACE_SCOPE("Open audio device");
+    auto engine = std::make_unique<Engine>();
+
+    ma_backend nullBackend = ma_backend_null;
+    ma_context_config contextConfig = ma_context_config_init();
+    bool useNull = output == Output::Null;
+    if (ma_context_init(useNull ? &nullBackend : nullptr, useNull ? 1 : 0, &contextConfig, &engine->context) != MA_SUCCESS) {
+        return nullptr;
+    }
+    engine->contextReady = true;
+
+    // Decoders convert to the device's own rate, so nothing is resampled twice
+    ma_device_config config = ma_device_config_init(ma_device_type_playback);
+    config.playback.format = SAMPLE_FORMAT;
+    config.playback.channels = CHANNELS;
+    config.sampleRate = 0;
+    config.dataCallback = playback;
+    config.pUserData = engine.get();
+    if (ma_device_init(&engine->context, &config, &engine->device) != MA_SUCCESS) {
+        return nullptr;
+    }
+    engine->deviceReady = true;
+
+    ma_uint32 ringFrames = std::max<ma_uint32>(FEED_FRAMES, engine->device.sampleRate * RING_MILLISECONDS / 1000);
+    if (ma_pcm_rb_init(SAMPLE_FORMAT, CHANNELS, ringFrames, nullptr, nullptr, &engine->ring) != MA_SUCCESS) {
+        return nullptr;
+    }
+    engine->ringReady = true;
+
+    ma_data_source_config sourceConfig = ma_data_source_config_init();
+    sourceConfig.vtable = &ringVtable;
+    engine->source.engine = engine.get();
+    if (ma_data_source_init(&sourceConfig, &engine->source.base) != MA_SUCCESS) {
+        return nullptr;
+    }
+    engine->sourceReady = true;
+
+    engine->feeder = std::thread([feeder = engine.get()] { feeder->feed(); });
+    return engine;
+}
+
+AudioPreview::Engine::~Engine() {
+    if (feeder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+            latest = ++requested;
+        }
+        wake.notify_all();
+        feeder.join();
+    }
+
+    if (deviceReady) {
+        ma_device_uninit(&device);
+    }
+    if (sourceReady) {
+        ma_data_source_uninit(&source.base);
+    }
+    if (ringReady) {
+        ma_pcm_rb_uninit(&ring);
+    }
+    if (contextReady) {
+        ma_context_uninit(&context);
+    }
+}
+
+auto AudioPreview::Engine::request(StreamOpener open, uint64_t start) -> void {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(open);
+        pendingStart = start;
+        latest = ++requested;
+    }
+    wake.notify_all();
+}
+
+// Waits up to FEED_POLL, or until a newer request comes in. False once this generation is out of date.
+auto AudioPreview::Engine::waitFor(uint64_t generation) -> bool {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait_for(lock, FEED_POLL, [&] { return requested != generation; });
+    return requested == generation;
+}
+
+auto AudioPreview::Engine::feed() -> void {
+    uint64_t served = 0;
+
+    while (true) {
+        StreamOpener open;
+        uint64_t start;
+        uint64_t generation;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || requested != served; });
+            if (quit) {
+                return;
+            }
+            open = std::move(pending);
+            pending = nullptr;
+            start = pendingStart;
+            generation = served = requested;
+        }
+
+        startFrame = start;
+        framesWritten = 0;
+        lengthFrames = 0;
+        failed = false;
+        streaming = static_cast<bool>(open);
+        feeding = generation; // The device drops what's left of the last sound while this one opens
+        if (!open) {
+            continue;
+        }
+
+        std::unique_ptr<EntryStream> entry;
+        ma_decoder decoder;
+        ma_decoder_config config = ma_decoder_config_init(SAMPLE_FORMAT, CHANNELS, device.sampleRate);
+        {
+            TRACE_SCOPE("Open sound");
+            entry = open();
+            if (!entry || ma_decoder_init(readStream, seekStream, entry.get(), &config, &decoder) != MA_SUCCESS) {
+                failed = true;
+                streaming = false;
+                continue;
+            }
+        }
+
+        ma_uint64 length;
+        if (ma_decoder_get_length_in_pcm_frames(&decoder, &length) == MA_SUCCESS) {
+            lengthFrames = length;
+        }
+        if (start > 0 && ma_decoder_seek_to_pcm_frame(&decoder, start) != MA_SUCCESS) {
+            startFrame = 0; // Formats that can't seek play from the beginning
+        }
+
+        stream(decoder, generation);
+        ma_decoder_uninit(&decoder);
+        streaming = false;
+    }
+}
+
+// Keeps the ring topped up with the sound until it ends or something else is asked for
+auto AudioPreview::Engine::stream(ma_decoder &decoder, uint64_t generation) -> void {
+    while (flushed != generation) {
+        if (!waitFor(generation)) {
+            return;
+        }
+    }
+
+    while (latest == generation) {
+        ma_uint32 frames = FEED_FRAMES;
+        void *buffer;
+        if (ma_pcm_rb_acquire_write(&ring, &frames, &buffer) != MA_SUCCESS) {
+            return;
+        }
+
+        if (frames == 0) {
+            ma_pcm_rb_commit_write(&ring, 0);
+            waitFor(generation);
+            continue;
+        }
+
+        ma_uint64 decoded = 0;
+        ma_result result = ma_decoder_read_pcm_frames(&decoder, buffer, frames, &decoded);
+        ma_pcm_rb_commit_write(&ring, static_cast<ma_uint32>(decoded));
+        framesWritten += decoded;
+
+        if (result != MA_SUCCESS || decoded < frames) {
+            return; // The end of the sound, or as far as it would decode
+        }
+    }
+}
+
+// Runs on the device's thread, so it only ever touches the ring and atomics
+auto AudioPreview::Engine::playback(ma_device *device, void *output, const void *input, ma_uint32 frameCount) -> void {
+    (void)input; // Playback only
+    auto *engine = static_cast<Engine *>(device->pUserData);
+
+    // The feeder has moved on and stopped writing, so whatever is left in the ring belongs to an old
+    // sound. The output buffer starts out silent, which covers this period.
+    uint64_t generation = engine->feeding;
+    if (engine->flushed != generation) {
+        ma_pcm_rb_reset(&engine->ring);
+        engine->framesPlayed = 0;
+        engine->flushed = generation;
+        return;
+    }
+
+    ma_uint64 read = 0;
+    ma_data_source_read_pcm_frames(&engine->source.base, output, frameCount, &read);
+    engine->framesPlayed += read;
+}
+
+// Hands over whatever has been decoded. Running dry is left as silence rather than waited out.
+auto AudioPreview::Engine::readRing(ma_data_source *source, void *frames, ma_uint64 frameCount, ma_uint64 *framesRead) -> ma_result {
+    ma_pcm_rb &ring = static_cast<RingSource *>(source)->engine->ring;
+    ma_uint64 total = 0;
+
+    while (total < frameCount) {
+        auto available = static_cast<ma_uint32>(std::min<ma_uint64>(frameCount - total, UINT32_MAX));
+        void *buffer;
+        if (ma_pcm_rb_acquire_read(&ring, &available, &buffer) != MA_SUCCESS || available == 0) {
+            break;
+        }
+        ma_copy_pcm_frames(ma_offset_pcm_frames_ptr(frames, total, SAMPLE_FORMAT, CHANNELS), buffer, available,
+                           SAMPLE_FORMAT, CHANNELS);
+        ma_pcm_rb_commit_read(&ring, available);
+        total += available;
+    }
+
+    if (framesRead) {
+        *framesRead = total;
+    }
+    return total == 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+// The ring only holds what's just ahead of the device. Seeks restart the feeder instead; see seek().
+auto AudioPreview::Engine::seekRing(ma_data_source *source, ma_uint64 frame) -> ma_result {
+    (void)source;
+    (void)frame;
+    return MA_NOT_IMPLEMENTED;
+}
+
+auto AudioPreview::Engine::ringFormat(ma_data_source *source, ma_format *format, ma_uint32 *channels, ma_uint32 *sampleRate,
+                                      ma_channel *channelMap, size_t channelMapCap) -> ma_result {
+    *format = SAMPLE_FORMAT;
+    *channels = CHANNELS;
+    *sampleRate = static_cast<RingSource *>(source)->engine->device.sampleRate;
+    if (channelMap) {
+        ma_channel_map_init_standard(ma_standard_channel_map_default, channelMap, channelMapCap, CHANNELS);
+    }
+    return MA_SUCCESS;
+}
+
+auto AudioPreview::Engine::ringCursor(ma_data_source *source, ma_uint64 *cursor) -> ma_result {
+    *cursor = static_cast<RingSource *>(source)->engine->framesPlayed;
+    return MA_SUCCESS;
+}
+
+auto AudioPreview::Engine::ringLength(ma_data_source *source, ma_uint64 *length) -> ma_result {
+    *length = static_cast<RingSource *>(source)->engine->lengthFrames;
+    return *length ? MA_SUCCESS : MA_NOT_IMPLEMENTED;
+}
+
+AudioPreview::AudioPreview(Output output) : output(output) {}
+
+AudioPreview::~AudioPreview() = default;
+
+auto AudioPreview::play(StreamOpener open) -> bool {
+    current = std::move(open);
+    return start(0);
+}
+
+// A new generation of the same sound, opened again and decoded from the new position, so the device
+// goes through the same handover as it does for a different sound
+auto AudioPreview::seek(double seconds) -> bool {
+    if (!current) {
+        return false;
+    }
+    if (!engine) {
+        return start(0);
+    }
+    return start(static_cast<uint64_t>(std::max(0.0, seconds) * engine->device.sampleRate));
+}
+
+auto AudioPreview::start(uint64_t frame) -> bool {
+    if (!engine && !unavailable) {
+        engine = Engine::create(output);
+        unavailable = !engine;
+    }
+    if (!engine) {
+        return false;
+    }
+
+    if (!engine->started) {
+        engine->started = ma_device_start(&engine->device) == MA_SUCCESS;
+        if (!engine->started) {
+            return false;
+        }
+    }
+    engine->request(current, frame);
+    return true;
+}
+
+// Stops the device too, so nothing runs while there's nothing to hear
+auto AudioPreview::stop() -> void {
+    if (!engine) {
+        return;
+    }
+
+    engine->request(nullptr, 0);
+    if (engine->started) {
+        ma_device_stop(&engine->device);
+        engine->started = false;
+    }
+}
+
+auto AudioPreview::isPlaying() const -> bool {
+    if (!engine || !engine->started) {
+        return false;
+    }
+    if (engine->flushed != engine->latest) {
+        return true; // Still starting
+    }
+    return engine->streaming || engine->framesPlayed < engine->framesWritten;
+}
+
+auto AudioPreview::hasFailed() const -> bool {
+    return engine && engine->flushed == engine->latest && engine->failed;
+}
+
+auto AudioPreview::position() const -> double {
+    if (!engine || engine->flushed != engine->latest) {
+        return 0.0;
+    }
+    return static_cast<double>(engine->startFrame + engine->framesPlayed) / engine->device.sampleRate;
+}
+
+auto AudioPreview::length() const -> double {
+    if (!engine || engine->flushed != engine->latest) {
+        return 0.0;
+    }
+    return static_cast<double>(engine->lengthFrames) / engine->device.sampleRate;
+}
+
+auto AudioPreview::isSoundFile(std::string_view extension) -> bool {
+    return extension == ".wav" || extension == ".mp3" || extension == ".flac";
+}
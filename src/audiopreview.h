@@ -0,0 +1,54 @@
+// Streams sound entries out of an archive to the audio device
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include "entrystream.h"
+
+// Plays one sound at a time through miniaudio. A feeder thread decodes the entry straight from an
+// EntryStream into a small ring of PCM frames, and the device reads the ring through a custom data
+// source, so nothing is extracted or read whole. The device, ring and thread are set up on the first
+// play() and reused for every sound after it, so auditioning sound after sound doesn't grow memory.
+class AudioPreview {
+public:
+    // Null runs everything on miniaudio's null backend, which keeps time like a real device without one
+    enum class Output { Device, Null };
+
+    // Opens the entry to play. Called on the feeder thread, so it mustn't touch anything the main
+    // thread changes.
+    using StreamOpener = std::function<std::unique_ptr<EntryStream>()>;
+
+    static constexpr uint32_t RING_MILLISECONDS = 200; // Decoded audio kept ahead of the device
+
+    explicit AudioPreview(Output output = Output::Device);
+    ~AudioPreview();
+
+    AudioPreview(const AudioPreview &) = delete;
+    AudioPreview &operator=(const AudioPreview &) = delete;
+
+    // Stops whatever is playing and starts on the new sound. Returns false if there's no audio device.
+    auto play(StreamOpener open) -> bool;
+    auto seek(double seconds) -> bool; // Restarts the last sound played from there
+    auto stop() -> void;
+
+    auto isPlaying() const -> bool; // Until the last decoded frame has been played
+    auto hasFailed() const -> bool; // The current sound couldn't be opened or decoded
+    auto position() const -> double; // Seconds
+    auto length() const -> double;   // Seconds, or 0 if the decoder can't tell up front
+
+    // Extensions of the formats miniaudio can decode
+    static auto isSoundFile(std::string_view extension) -> bool;
+
+private:
+    struct Engine;
+
+    auto start(uint64_t frame) -> bool;
+
+    Output output;
+    StreamOpener current;           // The last sound played, kept for seeks
+    std::unique_ptr<Engine> engine; // Created by the first play()
+    bool unavailable = false;       // Creating the engine failed, so don't keep trying
+};
@@ -0,0 +1,333 @@
+#include "batchfilewriter.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+    constexpr int OPEN_FLAGS = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    constexpr mode_t OPEN_MODE = 0644;
+
+    // Bigger writes are finished with pwrite, since a ring write's length is 32-bit
+    constexpr size_t MAX_RING_WRITE = 1u << 30;
+
+    // What a completion was for goes in the top bits of its user data, with the file's index below
+    constexpr uint64_t OP_OPEN = 1ull << 62;
+    constexpr uint64_t OP_WRITE = 2ull << 62;
+    constexpr uint64_t OP_CLOSE = 3ull << 62;
+    constexpr uint64_t OP_MASK = 3ull << 62;
+    constexpr int32_t NOT_RUN = INT32_MIN; // No completion came back for the operation
+
+    auto writeAll(int fd, const uint8_t *data, size_t size, uint64_t offset) -> bool {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            offset += written;
+            size -= written;
+        }
+        return true;
+    }
+}
+
+BatchFileWriter::BatchFileWriter() {
+    if (!setUp()) {
+        tearDown();
+    }
+}
+
+BatchFileWriter::~BatchFileWriter() {
+    tearDown();
+}
+
+auto BatchFileWriter::setUp() -> bool {
+#ifdef __linux__
+    io_uring_params params{};
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(MAX_BATCH * 2), &params));
+    if (ringFd < 0) {
+        return false;
+    }
+
+    // Opening, writing and closing through the ring all arrived in 5.6
+    std::vector<uint8_t> probeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(probeMemory.data());
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    for (int op : {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    void *mapped = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    sqRing = mapped;
+
+    if (singleMap) {
+        cqRing = sqRing;
+    } else {
+        mapped = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        cqRing = mapped;
+    }
+
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    mapped = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe *>(mapped);
+    sqEntries = params.sq_entries;
+
+    auto *sq = static_cast<uint8_t *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    auto *cq = static_cast<uint8_t *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+#else
+    return false;
+#endif
+}
+
+auto BatchFileWriter::tearDown() -> void {
+#ifdef __linux__
+    if (sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+#endif
+    if (ringFd >= 0) {
+        ::close(ringFd);
+    }
+    ringFd = -1;
+    sqRing = cqRing = nullptr;
+    sqes = nullptr;
+    queued = 0;
+}
+
+auto BatchFileWriter::nextEntry() -> io_uring_sqe * {
+#ifdef __linux__
+    unsigned tail = *sqTail + queued;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        return nullptr;
+    }
+
+    unsigned index = tail & *sqMask;
+    sqArray[index] = index;
+    queued++;
+
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+#else
+    return nullptr;
+#endif
+}
+
+auto BatchFileWriter::submit() -> bool {
+#ifdef __linux__
+    __atomic_store_n(sqTail, *sqTail + queued, __ATOMIC_RELEASE);
+    unsigned pending = queued;
+    queued = 0;
+
+    while (pending > 0) {
+        long submitted = syscall(__NR_io_uring_enter, ringFd, pending, 0, 0, nullptr, 0);
+        if (submitted < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+            continue;
+        }
+        if (submitted <= 0) {
+            return false;
+        }
+        pending -= static_cast<unsigned>(submitted);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+auto BatchFileWriter::reap(unsigned count, const std::function<void(uint64_t, int32_t)> &handle) -> bool {
+#ifdef __linux__
+    while (count > 0) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            long result = syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result < 0 && errno != EINTR && errno != EAGAIN) {
+                return false;
+            }
+            continue;
+        }
+
+        for (; head != tail && count > 0; head++, count--) {
+            const io_uring_cqe &cqe = cqes[head & *cqMask];
+            handle(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+auto BatchFileWriter::writeBatch(File *files, size_t count) -> void {
+#ifdef __linux__
+    TRACE_SCOPE("io_uring batch");
+    std::vector<int> fds(count, -1);
+    std::vector<int32_t> written(count, NOT_RUN);
+    std::vector<int32_t> closed(count, NOT_RUN);
+
+    // Once the ring fails it's no use any more, and anything it didn't get to is written the ordinary
+    // way. Files it opened but hadn't closed are closed first, so falling back doesn't leak them.
+    auto abandon = [&] {
+        tearDown();
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i] >= 0 && (closed[i] == NOT_RUN || closed[i] == -ECANCELED)) {
+                ::close(fds[i]);
+            }
+        }
+    };
+
+    // Every open in one submission...
+    for (size_t i = 0; i < count; i++) {
+        io_uring_sqe *sqe = nextEntry();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(files[i].path);
+        sqe->len = OPEN_MODE;
+        sqe->open_flags = OPEN_FLAGS;
+        sqe->user_data = OP_OPEN | i;
+    }
+    if (!submit() || !reap(static_cast<unsigned>(count), [&](uint64_t data, int32_t result) { fds[data & ~OP_MASK] = result; })) {
+        abandon();
+        return;
+    }
+
+    // ...then every write, each linked to a close that only runs if the write went through in full
+    unsigned expected = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0 || files[i].size > MAX_RING_WRITE) {
+            continue;
+        }
+        if (files[i].size > 0) {
+            io_uring_sqe *sqe = nextEntry();
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fds[i];
+            sqe->addr = reinterpret_cast<uintptr_t>(files[i].data);
+            sqe->len = static_cast<uint32_t>(files[i].size);
+            sqe->off = 0;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = OP_WRITE | i;
+            expected++;
+        } else {
+            written[i] = 0;
+        }
+
+        io_uring_sqe *sqe = nextEntry();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fds[i];
+        sqe->user_data = OP_CLOSE | i;
+        expected++;
+    }
+
+    bool reaped = submit() && reap(expected, [&](uint64_t data, int32_t result) {
+        size_t i = data & ~OP_MASK;
+        if ((data & OP_MASK) == OP_WRITE) {
+            written[i] = result;
+        } else {
+            closed[i] = result;
+        }
+    });
+    if (!reaped) {
+        abandon();
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        if (closed[i] == 0 && written[i] == static_cast<int32_t>(files[i].size)) {
+            files[i].written = true;
+            continue;
+        }
+
+        // A short or failed write cancels its close, so the file is still open: finish it by hand
+        if (closed[i] != -ECANCELED && closed[i] != NOT_RUN) {
+            continue; // Closed, but a close that fails means the data may not have made it
+        }
+        size_t done = written[i] > 0 ? static_cast<size_t>(written[i]) : 0;
+        bool finished = writeAll(fds[i], files[i].data + done, files[i].size - done, done);
+        files[i].written = ::close(fds[i]) == 0 && finished;
+    }
+#else
+    (void)files;
+    (void)count;
+#endif
+}
+
+auto BatchFileWriter::writeFile(const char *path, const uint8_t *data, size_t size) -> bool {
+    int fd = ::open(path, OPEN_FLAGS, OPEN_MODE);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = writeAll(fd, data, size, 0);
+    return ::close(fd) == 0 && written;
+}
+
+auto BatchFileWriter::write(std::vector<File> &files) -> size_t {
+    TRACE_SCOPE("Write files");
+    for (size_t start = 0; start < files.size() && ringFd >= 0; start += MAX_BATCH) {
+        writeBatch(files.data() + start, std::min(MAX_BATCH, files.size() - start));
+    }
+
+    // Everything, without io_uring; otherwise only the files it failed on, in case it was the ring
+    // rather than the file at fault
+    ThreadPool::parallelFor(files.size(), [&](size_t i) {
+        if (!files[i].written) {
+            files[i].written = writeFile(files[i].path, files[i].data, files[i].size);
+        }
+    });
+
+    return static_cast<size_t>(std::count_if(files.begin(), files.end(), [](const File &file) { return file.written; }));
+}
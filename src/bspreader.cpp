@@ -0,0 +1,245 @@
+#include "bspreader.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+    constexpr uint32_t QUAKE_VERSION = 29;
+    constexpr uint32_t HALF_LIFE_VERSION = 30;
+    constexpr uint32_t QUAKE2_VERSION = 38;
+    constexpr size_t QUAKE_LUMP_COUNT = 15;
+    constexpr size_t QUAKE2_LUMP_COUNT = 19;
+
+    constexpr size_t MIPTEX_HEADER_SIZE = 40; // char name[16], uint32 width, height, offsets[4]
+    constexpr size_t MIPTEX_NAME_SIZE = 16;
+    constexpr uint32_t MAX_MIPTEX_SIZE = 4096;
+    constexpr size_t TEXINFO_SIZE = 76;       // float vecs[2][4], int32 flags, value, char texture[32], int32 next
+    constexpr size_t TEXINFO_NAME_OFFSET = 40;
+    constexpr size_t TEXINFO_NAME_SIZE = 32;
+    constexpr size_t PALETTE_SIZE = 768;
+
+    const char *QUAKE_LUMP_NAMES[QUAKE_LUMP_COUNT] = {
+        "Entities", "Planes", "Textures", "Vertices", "Visibility", "Nodes", "Texinfo", "Faces",
+        "Lighting", "Clipnodes", "Leaves", "Marksurfaces", "Edges", "Surfedges", "Models",
+    };
+
+    const char *QUAKE2_LUMP_NAMES[QUAKE2_LUMP_COUNT] = {
+        "Entities", "Planes", "Vertices", "Visibility", "Nodes", "Texinfo", "Faces", "Lighting", "Leaves",
+        "Leaf faces", "Leaf brushes", "Edges", "Surfedges", "Models", "Brushes", "Brush sides", "Pop",
+        "Areas", "Area portals",
+    };
+
+    // Maps are little endian on disk, like everything else the viewer reads
+    auto readU32(const uint8_t *bytes) -> uint32_t {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    // Fixed size name fields are only NUL-terminated when they're shorter than the field
+    auto readName(const uint8_t *bytes, size_t size) -> std::string {
+        const char *text = reinterpret_cast<const char *>(bytes);
+        return std::string(text, strnlen(text, size));
+    }
+}
+
+auto BspSource::read(uint64_t offset, size_t count) -> const uint8_t * {
+    if (offset > length || count > length - offset) {
+        return nullptr;
+    }
+    if (mapped) {
+        return mapped + offset;
+    }
+
+    scratch.resize(count);
+    if (!stream->seek(offset)) {
+        return nullptr;
+    }
+    size_t got = 0;
+    while (got < count) {
+        size_t read = stream->read(scratch.data() + got, count - got);
+        if (read == 0) {
+            return nullptr;
+        }
+        got += read;
+    }
+    return scratch.data();
+}
+
+auto BspReader::readHeader(BspSource &source) -> std::optional<BspHeader> {
+    const uint8_t *start = source.read(0, 8);
+    if (!start) {
+        return std::nullopt;
+    }
+
+    BspHeader header;
+    size_t lumpCount = QUAKE_LUMP_COUNT;
+    uint64_t directory = 4;
+    uint32_t version = readU32(start);
+
+    if (std::memcmp(start, "IBSP", 4) == 0) {
+        if (readU32(start + 4) != QUAKE2_VERSION) {
+            return std::nullopt;
+        }
+        header.version = BspVersion::Quake2;
+        header.format = "Quake 2 IBSP 38";
+        lumpCount = QUAKE2_LUMP_COUNT;
+        directory = 8;
+    } else if (std::memcmp(start, "BSP2", 4) == 0 || std::memcmp(start, "2PSB", 4) == 0) {
+        // Wider counts and indices elsewhere, but the lump directory and textures are laid out the same
+        header.version = BspVersion::Quake;
+        header.format = "Quake " + std::string(reinterpret_cast<const char *>(start), 4);
+    } else if (version == QUAKE_VERSION) {
+        header.version = BspVersion::Quake;
+        header.format = "Quake BSP29";
+    } else if (version == HALF_LIFE_VERSION) {
+        header.version = BspVersion::HalfLife;
+        header.format = "Half-Life BSP30";
+    } else {
+        return std::nullopt;
+    }
+
+    const uint8_t *lumps = source.read(directory, lumpCount * sizeof(BspLump));
+    if (!lumps) {
+        return std::nullopt;
+    }
+
+    header.lumps.resize(lumpCount);
+    for (size_t i = 0; i < lumpCount; i++) {
+        BspLump &lump = header.lumps[i];
+        lump.offset = readU32(lumps + i * 8);
+        lump.length = readU32(lumps + i * 8 + 4);
+        if (static_cast<uint64_t>(lump.offset) + lump.length > source.size()) {
+            return std::nullopt;
+        }
+    }
+    return header;
+}
+
+auto BspReader::readTextures(BspSource &source, const BspHeader &header) -> std::vector<BspTexture> {
+    TRACE_SCOPE("Read BSP textures");
+    std::vector<BspTexture> textures;
+
+    if (header.version == BspVersion::Quake2) {
+        // Texture names live in the texinfo records, which faces share, so most names repeat
+        const BspLump &lump = header.lumps[QUAKE2_LUMP_TEXINFO];
+        size_t count = lump.length / TEXINFO_SIZE;
+        const uint8_t *texinfo = source.read(lump.offset, count * TEXINFO_SIZE);
+        if (!texinfo) {
+            return textures;
+        }
+
+        std::unordered_set<std::string> seen;
+        for (size_t i = 0; i < count; i++) {
+            std::string name = readName(texinfo + i * TEXINFO_SIZE + TEXINFO_NAME_OFFSET, TEXINFO_NAME_SIZE);
+            if (!name.empty() && seen.insert(name).second) {
+                textures.push_back({std::move(name)});
+            }
+        }
+        return textures;
+    }
+
+    // The miptex lump starts with a count and an offset for each texture, -1 for ones left out
+    const BspLump &lump = header.lumps[QUAKE_LUMP_TEXTURES];
+    const uint8_t *counted = lump.length >= 4 ? source.read(lump.offset, 4) : nullptr;
+    if (!counted) {
+        return textures;
+    }
+    auto count = static_cast<int32_t>(readU32(counted));
+    if (count <= 0 || static_cast<uint64_t>(count) * 4 + 4 > lump.length) {
+        return textures;
+    }
+
+    const uint8_t *table = source.read(lump.offset + 4, static_cast<size_t>(count) * 4);
+    if (!table) {
+        return textures;
+    }
+    std::vector<int32_t> offsets(count);
+    std::memcpy(offsets.data(), table, offsets.size() * 4);
+
+    for (int32_t offset : offsets) {
+        if (offset < 0 || static_cast<uint64_t>(offset) + MIPTEX_HEADER_SIZE > lump.length) {
+            continue;
+        }
+        const uint8_t *miptex = source.read(lump.offset + static_cast<uint64_t>(offset), MIPTEX_HEADER_SIZE);
+        if (!miptex) {
+            continue;
+        }
+
+        BspTexture texture;
+        texture.name = readName(miptex, MIPTEX_NAME_SIZE);
+        texture.width = readU32(miptex + 16);
+        texture.height = readU32(miptex + 20);
+        texture.offset = lump.offset + static_cast<uint64_t>(offset);
+
+        // Half-Life maps usually leave the pixels out and name a texture in a WAD instead, which shows
+        // up as a zero offset
+        uint64_t pixels = readU32(miptex + 24);
+        texture.embedded = pixels != 0 && texture.width > 0 && texture.height > 0 && texture.width <= MAX_MIPTEX_SIZE &&
+                           texture.height <= MAX_MIPTEX_SIZE &&
+                           offset + pixels + static_cast<uint64_t>(texture.width) * texture.height <= lump.length;
+        textures.push_back(std::move(texture));
+    }
+    return textures;
+}
+
+auto BspReader::decodeTexture(BspSource &source, const BspHeader &header, const BspTexture &texture,
+                              const std::vector<uint8_t> &palette, const PixelAllocator &allocate) -> bool {
+    if (!texture.embedded) {
+        return false;
+    }
+
+    const uint8_t *miptex = source.read(texture.offset, MIPTEX_HEADER_SIZE);
+    if (!miptex) {
+        return false;
+    }
+    uint32_t width = texture.width;
+    uint32_t height = texture.height;
+    uint32_t pixelOffset = readU32(miptex + 24);
+    uint32_t lastMipOffset = readU32(miptex + 36);
+
+    // RGBA for each palette index. Half-Life textures carry their own palette after the smallest mip
+    // level, as a 16-bit count and then the colours.
+    uint8_t colors[256][4];
+    const uint8_t *rgb = palette.size() >= PALETTE_SIZE ? palette.data() : nullptr;
+    if (header.version == BspVersion::HalfLife) {
+        uint64_t paletteOffset = texture.offset + lastMipOffset + static_cast<uint64_t>(width / 8) * (height / 8) + 2;
+        rgb = source.read(paletteOffset, PALETTE_SIZE);
+    }
+    for (int i = 0; i < 256; i++) {
+        uint8_t grey = static_cast<uint8_t>(i);
+        colors[i][0] = rgb ? rgb[i * 3 + 0] : grey;
+        colors[i][1] = rgb ? rgb[i * 3 + 1] : grey;
+        colors[i][2] = rgb ? rgb[i * 3 + 2] : grey;
+        colors[i][3] = 255;
+    }
+
+    // Textures named {something are cut out, with the last colour as the transparent one
+    if (texture.name.compare(0, 1, "{") == 0) {
+        std::memset(colors[255], 0, 4);
+    }
+
+    const uint8_t *pixels = source.read(texture.offset + pixelOffset, static_cast<size_t>(width) * height);
+    if (!pixels) {
+        return false;
+    }
+
+    uint8_t *rgba = allocate(static_cast<int>(width), static_cast<int>(height));
+    if (!rgba) {
+        return false;
+    }
+    size_t count = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(rgba + i * 4, colors[pixels[i]], 4);
+    }
+    return true;
+}
+
+auto BspReader::lumpName(BspVersion version, size_t lump) -> const char * {
+    if (version == BspVersion::Quake2) {
+        return lump < QUAKE2_LUMP_COUNT ? QUAKE2_LUMP_NAMES[lump] : "?";
+    }
+    return lump < QUAKE_LUMP_COUNT ? QUAKE_LUMP_NAMES[lump] : "?";
+}
@@ -0,0 +1,74 @@
+// Reads the lump directory and texture references of Quake and Quake 2 maps
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "entrystream.h"
+#include "types.h"
+
+enum class BspVersion {
+    Quake,    // BSP29, and the BSP2 / 2PSB extended-limit variants
+    HalfLife, // BSP30, which is Quake's layout with a palette in every texture
+    Quake2    // IBSP 38
+};
+
+struct BspLump {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct BspHeader {
+    BspVersion version;
+    std::string format; // For display, e.g. "Quake 2 IBSP 38"
+    std::vector<BspLump> lumps;
+};
+
+struct BspTexture {
+    std::string name;     // As the map has it: a Quake miptex name, or a Quake 2 path under textures/
+    uint32_t width = 0;   // Only known for Quake textures
+    uint32_t height = 0;
+    uint64_t offset = 0;  // Of the miptex in the map, for textures whose pixels are in it
+    bool embedded = false;
+};
+
+// Where a map's bytes come from. Mapped bytes are handed out where they are; a stream is read into
+// scratch space, so only the lumps that are asked for ever get read.
+class BspSource {
+public:
+    BspSource(const uint8_t *data, uint64_t size) : mapped(data), length(size) {}
+    explicit BspSource(EntryStream &stream) : stream(&stream), length(stream.size()) {}
+
+    auto size() const -> uint64_t { return length; }
+
+    // count bytes at offset, or nullptr if they run past the end or can't be read. Only valid until the
+    // next read.
+    auto read(uint64_t offset, size_t count) -> const uint8_t *;
+
+private:
+    const uint8_t *mapped = nullptr;
+    EntryStream *stream = nullptr;
+    uint64_t length;
+    std::vector<uint8_t> scratch;
+};
+
+class BspReader {
+public:
+    static constexpr int QUAKE_LUMP_TEXTURES = 2;
+    static constexpr int QUAKE2_LUMP_TEXINFO = 5;
+
+    // Reads the version and lump directory, checking every lump lies inside the map
+    static auto readHeader(BspSource &source) -> std::optional<BspHeader>;
+
+    // Every texture the map refers to, once each, in the order the map lists them
+    static auto readTextures(BspSource &source, const BspHeader &header) -> std::vector<BspTexture>;
+
+    // Decodes the full size image of an embedded Quake or Half-Life texture. Quake textures need the
+    // 768 byte palette from gfx/palette.lmp, and come out greyscale without it.
+    static auto decodeTexture(BspSource &source, const BspHeader &header, const BspTexture &texture,
+                              const std::vector<uint8_t> &palette, const PixelAllocator &allocate) -> bool;
+
+    static auto lumpName(BspVersion version, size_t lump) -> const char *;
+};
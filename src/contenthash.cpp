@@ -0,0 +1,136 @@
+#include "contenthash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr uint64_t PRIME1 = 11400714785074694791ull;
+    constexpr uint64_t PRIME2 = 14029467366897019727ull;
+    constexpr uint64_t PRIME3 = 1609587929392839161ull;
+    constexpr uint64_t PRIME4 = 9650029242287828579ull;
+    constexpr uint64_t PRIME5 = 2870177450012600261ull;
+
+    inline auto rotl(uint64_t value, int bits) -> uint64_t {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // Little endian loads; every platform we build for is little endian
+    inline auto read64(const uint8_t *p) -> uint64_t {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline auto read32(const uint8_t *p) -> uint32_t {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline auto round(uint64_t accumulator, uint64_t input) -> uint64_t {
+        accumulator += input * PRIME2;
+        accumulator = rotl(accumulator, 31);
+        return accumulator * PRIME1;
+    }
+
+    inline auto mergeRound(uint64_t hash, uint64_t accumulator) -> uint64_t {
+        hash ^= round(0, accumulator);
+        return hash * PRIME1 + PRIME4;
+    }
+}
+
+ContentHash::ContentHash(uint64_t seed) : seed(seed) {
+    accumulators[0] = seed + PRIME1 + PRIME2;
+    accumulators[1] = seed + PRIME2;
+    accumulators[2] = seed;
+    accumulators[3] = seed - PRIME1;
+}
+
+auto ContentHash::update(const void *data, size_t size) -> void {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + size;
+    totalSize += size;
+
+    // Top up a partial stripe left over from the last call first
+    if (bufferSize > 0) {
+        size_t take = std::min(size, sizeof(buffer) - bufferSize);
+        std::memcpy(buffer + bufferSize, p, take);
+        bufferSize += take;
+        p += take;
+
+        if (bufferSize < sizeof(buffer)) {
+            return;
+        }
+
+        for (int i = 0; i < 4; i++) {
+            accumulators[i] = round(accumulators[i], read64(buffer + i * 8));
+        }
+        bufferSize = 0;
+    }
+
+    // The four lanes are independent, which keeps the CPU's multipliers busy
+    uint64_t v1 = accumulators[0], v2 = accumulators[1], v3 = accumulators[2], v4 = accumulators[3];
+    while (end - p >= 32) {
+        v1 = round(v1, read64(p));
+        v2 = round(v2, read64(p + 8));
+        v3 = round(v3, read64(p + 16));
+        v4 = round(v4, read64(p + 24));
+        p += 32;
+    }
+    accumulators[0] = v1;
+    accumulators[1] = v2;
+    accumulators[2] = v3;
+    accumulators[3] = v4;
+
+    bufferSize = end - p;
+    std::memcpy(buffer, p, bufferSize);
+}
+
+auto ContentHash::digest() const -> uint64_t {
+    uint64_t hash;
+
+    if (totalSize >= 32) {
+        hash = rotl(accumulators[0], 1) + rotl(accumulators[1], 7) + rotl(accumulators[2], 12) + rotl(accumulators[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = mergeRound(hash, accumulators[i]);
+        }
+    } else {
+        hash = seed + PRIME5;
+    }
+
+    hash += totalSize;
+
+    const uint8_t *p = buffer;
+    const uint8_t *end = buffer + bufferSize;
+
+    while (end - p >= 8) {
+        hash ^= round(0, read64(p));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+
+    if (end - p >= 4) {
+        hash ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+
+    while (p < end) {
+        hash ^= *p * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+auto ContentHash::hash(const void *data, size_t size, uint64_t seed) -> uint64_t {
+    ContentHash hasher(seed);
+    hasher.update(data, size);
+    return hasher.digest();
+}
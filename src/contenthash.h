@@ -0,0 +1,25 @@
+// Fast non-cryptographic hashing of entry contents
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64, written out here rather than pulled in as another dependency. Good for telling files apart,
+// not for anything security related.
+class ContentHash {
+public:
+    explicit ContentHash(uint64_t seed = 0);
+
+    auto update(const void *data, size_t size) -> void;
+    auto digest() const -> uint64_t;
+
+    static auto hash(const void *data, size_t size, uint64_t seed = 0) -> uint64_t;
+
+private:
+    uint64_t accumulators[4];
+    uint64_t seed;
+    uint64_t totalSize = 0;
+    uint8_t buffer[32];   // Input that doesn't fill a whole 32-byte stripe yet
+    size_t bufferSize = 0;
+};
@@ -0,0 +1,378 @@
+#include "contentsearch.h"
+#include "archiveanalysis.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <optional>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CONTENTSEARCH_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONTENTSEARCH_NEON
+#endif
+
+namespace {
+    constexpr size_t SCAN_WINDOW = 1024 * 1024;           // Cancellation is checked this often inside an entry
+    constexpr uint64_t BATCH_BYTES = 16 * 1024 * 1024;    // Of a mapped archive, per parallelFor item
+    constexpr size_t BATCHES_PER_THREAD = 8;
+    constexpr size_t HITS_PER_FLUSH = 256;                // Hits held back before the UI gets to see them
+    constexpr size_t MAX_CONTEXT = 200;
+    constexpr size_t CONTEXT_BEFORE = 60;                 // Of a long line, kept ahead of the match
+
+    auto isLetter(unsigned char c) -> bool {
+        return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+    }
+
+    // ORing in 0x20 lower-cases a letter, and only the two cases of that letter end up equal to it, so
+    // a case-insensitive compare is an OR and an equality test
+    auto foldMask(unsigned char c, bool matchCase) -> uint8_t {
+        return !matchCase && isLetter(c) ? 0x20 : 0;
+    }
+
+    auto makeContext(const char *data, size_t lineStart, size_t lineEnd, size_t match) -> std::string {
+        if (lineEnd > lineStart && data[lineEnd - 1] == '\r') {
+            lineEnd--;
+        }
+        size_t start = lineStart;
+        if (lineEnd - lineStart > MAX_CONTEXT && match - lineStart > CONTEXT_BEFORE) {
+            start = std::min(match - CONTEXT_BEFORE, lineEnd - MAX_CONTEXT);
+        }
+        size_t end = std::min(lineEnd, start + MAX_CONTEXT);
+
+        std::string context(data + start, end - start);
+        for (char &c : context) {
+            if (static_cast<unsigned char>(c) < 0x20) {
+                c = ' ';
+            }
+        }
+        return context;
+    }
+}
+
+auto ContentSearch::find(const char *text, size_t size, std::string_view needle, bool matchCase) -> size_t {
+    size_t length = needle.size();
+    if (length == 0) {
+        return 0;
+    }
+    if (length > size) {
+        return std::string_view::npos;
+    }
+
+    auto matchesAt = [&](size_t at) {
+        for (size_t i = 0; i < length; i++) {
+            auto c = static_cast<unsigned char>(needle[i]);
+            uint8_t mask = foldMask(c, matchCase);
+            if ((static_cast<unsigned char>(text[at + i]) | mask) != (c | mask)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Candidates are positions where both the first and the last byte of the needle line up, which
+    // rules out almost everything 16 bytes at a time; the rest is checked in full
+    size_t last = length - 1;
+    auto first = static_cast<unsigned char>(needle[0]);
+    auto final = static_cast<unsigned char>(needle[last]);
+    uint8_t firstMask = foldMask(first, matchCase);
+    uint8_t finalMask = foldMask(final, matchCase);
+    size_t i = 0;
+
+#if defined(CONTENTSEARCH_SSE2)
+    const __m128i firstMaskV = _mm_set1_epi8(static_cast<char>(firstMask));
+    const __m128i firstV = _mm_set1_epi8(static_cast<char>(first | firstMask));
+    const __m128i finalMaskV = _mm_set1_epi8(static_cast<char>(finalMask));
+    const __m128i finalV = _mm_set1_epi8(static_cast<char>(final | finalMask));
+    for (; i + last + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + last));
+        __m128i equal = _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(a, firstMaskV), firstV),
+                                      _mm_cmpeq_epi8(_mm_or_si128(b, finalMaskV), finalV));
+        auto bits = static_cast<unsigned>(_mm_movemask_epi8(equal));
+        while (bits) {
+            size_t at = i + static_cast<size_t>(__builtin_ctz(bits));
+            if (matchesAt(at)) {
+                return at;
+            }
+            bits &= bits - 1;
+        }
+    }
+#elif defined(CONTENTSEARCH_NEON)
+    const uint8x16_t firstMaskV = vdupq_n_u8(firstMask);
+    const uint8x16_t firstV = vdupq_n_u8(first | firstMask);
+    const uint8x16_t finalMaskV = vdupq_n_u8(finalMask);
+    const uint8x16_t finalV = vdupq_n_u8(final | finalMask);
+    for (; i + last + 16 <= size; i += 16) {
+        uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t *>(text + i));
+        uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t *>(text + i + last));
+        uint8x16_t equal = vandq_u8(vceqq_u8(vorrq_u8(a, firstMaskV), firstV), vceqq_u8(vorrq_u8(b, finalMaskV), finalV));
+        // Narrowing leaves four bits per byte, which stands in for the movemask NEON doesn't have
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+        while (bits) {
+            int bit = __builtin_ctzll(bits);
+            size_t at = i + static_cast<size_t>(bit / 4);
+            if (matchesAt(at)) {
+                return at;
+            }
+            bits &= ~(0xfull << (bit & ~3));
+        }
+    }
+#endif
+
+    for (; i + last < size; i++) {
+        if ((static_cast<unsigned char>(text[i]) | firstMask) == (first | firstMask) &&
+            (static_cast<unsigned char>(text[i + last]) | finalMask) == (final | finalMask) && matchesAt(i)) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+auto ContentSearch::start(const std::string &path, std::shared_ptr<const EntryTable> entries, std::vector<EntryId> ids,
+                          const std::string &needle, bool matchCase, VisitEntriesFunc visitEntries) -> void {
+    cancel();
+
+    job = std::make_shared<Job>();
+    job->path = path;
+    job->entries = std::move(entries);
+    job->ids = std::move(ids);
+    job->needle = needle;
+    job->matchCase = matchCase;
+    job->visitEntries = visitEntries;
+    for (EntryId id : job->ids) {
+        job->totalBytes += job->entries->size(id);
+    }
+
+    ThreadPool::enqueue([job = job] {
+        run(*job);
+        job->running = false;
+    });
+}
+
+// The job is let go of rather than just flagged, so hits it finds on the way out never reach collect().
+// They'd refer to the table the search started with, which may have been replaced by now.
+auto ContentSearch::cancel() -> void {
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+}
+
+auto ContentSearch::isRunning() const -> bool {
+    return job && job->running;
+}
+
+auto ContentSearch::isTruncated() const -> bool {
+    return job && job->truncated;
+}
+
+auto ContentSearch::progress() const -> float {
+    if (!job || job->totalBytes == 0) {
+        return job && !job->running ? 1.0f : 0.0f;
+    }
+    return static_cast<float>(static_cast<double>(job->scanned) / static_cast<double>(job->totalBytes));
+}
+
+auto ContentSearch::bytesScanned() const -> uint64_t {
+    return job ? job->scanned.load() : 0;
+}
+
+auto ContentSearch::collect(std::vector<SearchHit> &hits) -> void {
+    if (!job) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(job->mutex);
+    std::move(job->pending.begin(), job->pending.end(), std::back_inserter(hits));
+    job->pending.clear();
+}
+
+auto ContentSearch::run(Job &job) -> void {
+    TRACE_SCOPE("Content search");
+    if (job.needle.empty() || job.ids.empty()) {
+        return;
+    }
+
+    // PAK entries are stored as-is, so with the archive mapped they can be searched where they sit
+    // without being copied anywhere
+    std::optional<MappedFile> mapped;
+    if (job.entries->format() == PakFormat::PAK) {
+        mapped.emplace(job.path);
+    }
+    std::vector<EntryId> streamed = job.ids;
+    if (mapped && mapped->data) {
+        // Entries of archives mounted from inside the PAK have offsets into those, so they're streamed
+        const EntryTable &entries = *job.entries;
+        auto nested = std::stable_partition(job.ids.begin(), job.ids.end(), [&](EntryId id) { return !(entries.flags(id) & ENTRY_NESTED); });
+        streamed.assign(nested, job.ids.end());
+        job.ids.erase(nested, job.ids.end());
+
+        auto &ids = job.ids;
+        std::sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) { return entries.offset(a) < entries.offset(b); });
+
+        size_t targetBatches = (ThreadPool::threadCount() + 1) * BATCHES_PER_THREAD;
+        uint64_t batchBytes = std::clamp<uint64_t>(job.totalBytes / targetBatches, 1, BATCH_BYTES);
+        std::vector<std::pair<size_t, size_t>> batches;
+        for (size_t start = 0; start < ids.size();) {
+            size_t end = start;
+            uint64_t bytes = 0;
+            while (end < ids.size() && (bytes < batchBytes || end == start)) {
+                bytes += entries.size(ids[end++]);
+            }
+            batches.emplace_back(start, end);
+            start = end;
+        }
+
+        ThreadPool::parallelFor(batches.size(), [&](size_t b) {
+            for (size_t i = batches[b].first; i < batches[b].second && !job.cancelled; i++) {
+                EntryId id = ids[i];
+                uint64_t offset = entries.offset(id);
+                uint64_t size = entries.size(id);
+                if (offset <= mapped->size && size <= mapped->size - offset) {
+                    Scan scan;
+                    searchEntry(job, id, mapped->data + offset, static_cast<size_t>(size), static_cast<size_t>(size), scan);
+                }
+                job.scanned += size;
+            }
+        });
+    }
+    if (streamed.empty()) {
+        return;
+    }
+
+    ArchiveAnalysis::visitParallel(job.path, *job.entries, std::move(streamed), job.visitEntries,
+                                   [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &scratch) {
+        if (!job.cancelled) {
+            searchStream(job, id, stream, scratch);
+        }
+    });
+}
+
+// Reads SCAN_WINDOW at a time into buffer. What's left of the last line is carried over to the front
+// of the next window, so a match near the join still has its line around it, and at least the
+// needle's length less one is, so a match across the join is still found.
+auto ContentSearch::searchStream(Job &job, EntryId id, EntryStream &stream, std::vector<uint8_t> &buffer) -> void {
+    const size_t length = job.needle.size();
+    const size_t window = std::max(SCAN_WINDOW, length);
+    uint64_t remaining = stream.size();
+    size_t kept = 0;
+    Scan scan;
+
+    while (!job.cancelled) {
+        size_t wanted = static_cast<size_t>(std::min<uint64_t>(window, remaining));
+        buffer.resize(kept + wanted);
+        size_t read = 0;
+        while (read < wanted) {
+            size_t got = stream.read(buffer.data() + kept + read, wanted - read);
+            if (got == 0) {
+                break;
+            }
+            read += got;
+        }
+        remaining -= read;
+        job.scanned += read;
+
+        auto data = reinterpret_cast<const char *>(buffer.data());
+        size_t size = kept + read;
+        if (read < wanted || remaining == 0) {
+            searchEntry(job, id, data, size, size, scan);
+            return;
+        }
+
+        // A window is at least the needle's length, so there's always that much to carry
+        size_t lowest = size - std::min(size, MAX_CONTEXT + length);
+        size_t end = size;
+        while (end > lowest && data[end - 1] != '\n') {
+            end--;
+        }
+        end = std::clamp(end, lowest, size - (length - 1));
+
+        searchEntry(job, id, data, size, end, scan);
+        kept = size - end;
+        std::memmove(buffer.data(), buffer.data() + end, kept);
+    }
+}
+
+auto ContentSearch::searchEntry(Job &job, EntryId id, const char *data, size_t size, size_t end, Scan &scan) -> void {
+    const size_t length = job.needle.size();
+    std::vector<SearchHit> hits;
+
+    auto flush = [&] {
+        if (!hits.empty()) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            std::move(hits.begin(), hits.end(), std::back_inserter(job.pending));
+            hits.clear();
+        }
+    };
+
+    uint32_t line = scan.line;
+    size_t counted = 0; // Newlines before here are already in line
+    size_t position = 0;
+    bool lineHit = false;
+
+    // One hit per line, so the rest of a line that already had one is passed over
+    if (scan.lineHit) {
+        auto newline = static_cast<const char *>(std::memchr(data, '\n', end));
+        if (!newline) {
+            return;
+        }
+        position = counted = static_cast<size_t>(newline - data) + 1;
+        line++;
+    }
+
+    while (position + length <= size && position < end && !job.cancelled) {
+        // Searching a window at a time keeps one huge entry from holding up a cancel
+        size_t limit = std::min(size, position + SCAN_WINDOW + length - 1);
+        size_t found = find(data + position, limit - position, job.needle, job.matchCase);
+        if (found == std::string_view::npos) {
+            if (limit == size) {
+                break;
+            }
+            position = limit - (length - 1);
+            continue;
+        }
+
+        size_t match = position + found;
+        if (match >= end) {
+            break;
+        }
+        line += static_cast<uint32_t>(std::count(data + counted, data + match, '\n'));
+        counted = match;
+
+        size_t lineStart = match;
+        while (lineStart > 0 && data[lineStart - 1] != '\n') {
+            lineStart--;
+        }
+        auto newline = static_cast<const char *>(std::memchr(data + match, '\n', size - match));
+        size_t lineEnd = newline ? static_cast<size_t>(newline - data) : size;
+
+        if (job.hitCount.fetch_add(1) >= MAX_HITS) {
+            job.truncated = true;
+            job.cancelled = true;
+            break;
+        }
+        hits.push_back({id, line, makeContext(data, lineStart, lineEnd, match)});
+        if (hits.size() >= HITS_PER_FLUSH) {
+            flush();
+        }
+
+        // One hit per line, like grep
+        if (lineEnd >= end) {
+            lineHit = true;
+            counted = end;
+            break;
+        }
+        position = lineEnd + 1;
+        counted = position;
+        line++;
+    }
+
+    flush();
+    scan.line = line + static_cast<uint32_t>(std::count(data + std::min(counted, end), data + end, '\n'));
+    scan.lineHit = lineHit;
+}
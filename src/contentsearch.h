@@ -0,0 +1,85 @@
+// Background full-text search through the contents of archive entries
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrystream.h"
+#include "entrytable.h"
+
+struct SearchHit {
+    EntryId entry;
+    uint32_t line; // 1-based
+    std::string context; // The line the match is on, cut down if it's long
+};
+
+// One search at a time, running on the thread pool. PAK archives are memory mapped and searched in
+// place; other formats are inflated an entry at a time, a window at a time, so a large entry never
+// has to fit in memory whole. Hits can be collected while the search is still
+// going, and starting another search or destroying the object cancels the one in progress. Once
+// cancelled, nothing more from that search is collected.
+class ContentSearch {
+public:
+    static constexpr size_t MAX_HITS = 100000;
+
+    ContentSearch() = default;
+    ~ContentSearch() { cancel(); }
+
+    ContentSearch(const ContentSearch &) = delete;
+    ContentSearch &operator=(const ContentSearch &) = delete;
+
+    // entries is only read, so one copy of the table can serve every search until it changes
+    auto start(const std::string &path, std::shared_ptr<const EntryTable> entries, std::vector<EntryId> ids,
+               const std::string &needle, bool matchCase, VisitEntriesFunc visitEntries) -> void;
+    auto cancel() -> void;
+
+    auto isRunning() const -> bool;
+    auto isTruncated() const -> bool; // Stopped at MAX_HITS
+    auto progress() const -> float;   // Fraction of bytes scanned
+    auto bytesScanned() const -> uint64_t;
+
+    // Moves hits found since the last call onto the end of hits
+    auto collect(std::vector<SearchHit> &hits) -> void;
+
+    // Offset of the first match of needle in text, or npos. Letters in needle match either case unless
+    // matchCase is set.
+    static auto find(const char *text, size_t size, std::string_view needle, bool matchCase) -> size_t;
+
+private:
+    struct Job {
+        std::string path;
+        std::shared_ptr<const EntryTable> entries;
+        std::vector<EntryId> ids;
+        std::string needle;
+        bool matchCase;
+        VisitEntriesFunc visitEntries;
+
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> running{true};
+        std::atomic<bool> truncated{false};
+        std::atomic<uint64_t> scanned{0};
+        std::atomic<size_t> hitCount{0};
+        uint64_t totalBytes = 0;
+
+        std::mutex mutex;
+        std::vector<SearchHit> pending; // Found but not collected yet
+    };
+
+    // Where a piece of an entry starts, when it's searched a piece at a time
+    struct Scan {
+        uint32_t line = 1;    // Of the first byte
+        bool lineHit = false; // The line the piece starts on already had a hit in the piece before
+    };
+
+    static auto run(Job &job) -> void;
+    // Reports matches that start before end, and leaves scan at end. Bytes past end are only there
+    // so that a match straddling it, or a line running on past it, can be seen whole.
+    static auto searchEntry(Job &job, EntryId id, const char *data, size_t size, size_t end, Scan &scan) -> void;
+    static auto searchStream(Job &job, EntryId id, EntryStream &stream, std::vector<uint8_t> &buffer) -> void;
+
+    std::shared_ptr<Job> job; // Shared with the pool, so the job can outlive a cancelled search
+};
@@ -0,0 +1,34 @@
+// Incremental reads of a single archive entry
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "types.h"
+
+// Lets callers work through entries far bigger than they'd want in memory (videos, megatextures)
+// a chunk at a time. Sizes and positions are 64-bit throughout.
+class EntryStream {
+public:
+    virtual ~EntryStream() = default;
+
+    virtual auto size() const -> uint64_t = 0;
+    virtual auto position() const -> uint64_t = 0;
+
+    // Reads up to count bytes from the current position. Returns how many were read, which is only
+    // less than count at the end of the entry or on an error.
+    virtual auto read(uint8_t *buffer, size_t count) -> size_t = 0;
+
+    // Moves to an absolute position. Compressed entries may have to be re-inflated up to that point.
+    virtual auto seek(uint64_t position) -> bool = 0;
+};
+
+// Called once for each entry a batch reader opens, with the entry's index in the batch
+using EntryVisitor = std::function<void(size_t index, EntryStream &stream)>;
+
+// Opens an archive once and streams a whole batch of entries through the visitor, in whatever order
+// reads them fastest. Entries that can't be opened are skipped.
+using VisitEntriesFunc = void (*)(const std::string &path, const std::vector<PakFileEntry> &entries, const EntryVisitor &visit);
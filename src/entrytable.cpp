@@ -0,0 +1,138 @@
+#include "entrytable.h"
+
+#include <cstring>
+#include "memorystats.h"
+
+EntryTable::~EntryTable() {
+    unaccount();
+}
+
+EntryTable::EntryTable(const EntryTable &other)
+    : tableFormat(other.tableFormat), names(other.names), nameOffsets(other.nameOffsets), offsets(other.offsets),
+      sizes(other.sizes), crcs(other.crcs), types(other.types), entryFlags(other.entryFlags) {
+    account();
+}
+
+// The arrays change hands without reallocating, so the accounting goes with them
+EntryTable::EntryTable(EntryTable &&other) noexcept
+    : tableFormat(other.tableFormat), names(std::move(other.names)), nameOffsets(std::move(other.nameOffsets)),
+      offsets(std::move(other.offsets)), sizes(std::move(other.sizes)), crcs(std::move(other.crcs)),
+      types(std::move(other.types)), entryFlags(std::move(other.entryFlags)), accountedBytes(other.accountedBytes),
+      accountedAllocations(other.accountedAllocations) {
+    other.nameOffsets.assign(1, 0);
+    other.accountedBytes = other.accountedAllocations = 0;
+    other.account();
+}
+
+EntryTable &EntryTable::operator=(const EntryTable &other) {
+    if (this != &other) {
+        *this = EntryTable(other);
+    }
+    return *this;
+}
+
+EntryTable &EntryTable::operator=(EntryTable &&other) noexcept {
+    if (this != &other) {
+        unaccount();
+        tableFormat = other.tableFormat;
+        names = std::move(other.names);
+        nameOffsets = std::move(other.nameOffsets);
+        offsets = std::move(other.offsets);
+        sizes = std::move(other.sizes);
+        crcs = std::move(other.crcs);
+        types = std::move(other.types);
+        entryFlags = std::move(other.entryFlags);
+        accountedBytes = other.accountedBytes;
+        accountedAllocations = other.accountedAllocations;
+
+        // Moving leaves the vectors empty, so put back the offset every table starts with
+        other.nameOffsets.assign(1, 0);
+        other.accountedBytes = other.accountedAllocations = 0;
+        other.account();
+    }
+    return *this;
+}
+
+auto EntryTable::reserve(size_t entryCount, size_t nameBytes) -> void {
+    names.reserve(nameBytes + entryCount);
+    nameOffsets.reserve(entryCount + 1);
+    offsets.reserve(entryCount);
+    sizes.reserve(entryCount);
+    crcs.reserve(entryCount);
+    types.reserve(entryCount);
+    entryFlags.reserve(entryCount);
+    account();
+}
+
+auto EntryTable::add(std::string_view name, uint64_t offset, uint64_t size, uint8_t flags, uint32_t crc) -> EntryId {
+    if (names.size() + name.size() + 1 > UINT32_MAX || sizes.size() >= INVALID_ENTRY_ID) {
+        return INVALID_ENTRY_ID;
+    }
+
+    names.insert(names.end(), name.begin(), name.end());
+    names.push_back('\0');
+    nameOffsets.push_back(static_cast<uint32_t>(names.size()));
+
+    offsets.push_back(offset);
+    sizes.push_back(size);
+    crcs.push_back(crc);
+    types.push_back(0);
+    entryFlags.push_back(flags);
+    account();
+
+    return static_cast<EntryId>(sizes.size() - 1);
+}
+
+auto EntryTable::clear() -> void {
+    names.clear();
+    nameOffsets.assign(1, 0);
+    offsets.clear();
+    sizes.clear();
+    crcs.clear();
+    types.clear();
+    entryFlags.clear();
+}
+
+auto EntryTable::find(std::string_view name) const -> std::optional<EntryId> {
+    for (EntryId id = 0; id < size(); id++) {
+        if (this->name(id) == name) {
+            return id;
+        }
+    }
+    return std::nullopt;
+}
+
+auto EntryTable::memoryUsage() const -> size_t {
+    return names.capacity() + nameOffsets.capacity() * sizeof(uint32_t) + offsets.capacity() * sizeof(uint64_t) +
+           sizes.capacity() * sizeof(uint64_t) + crcs.capacity() * sizeof(uint32_t) + types.capacity() +
+           entryFlags.capacity();
+}
+
+auto EntryTable::allocationCount() const -> size_t {
+    size_t count = 0;
+    for (size_t capacity : {names.capacity(), nameOffsets.capacity(), offsets.capacity(), sizes.capacity(),
+                            crcs.capacity(), types.capacity(), entryFlags.capacity()}) {
+        count += capacity > 0;
+    }
+    return count;
+}
+
+auto EntryTable::account() -> void {
+    uint64_t bytes = memoryUsage();
+    uint64_t allocations = allocationCount();
+    // Only when an array has been reallocated, which add() does a handful of times per table
+    if (bytes > accountedBytes) {
+        MemoryStats::allocate(MemoryCategory::EntryTable, bytes - accountedBytes,
+                              allocations > accountedAllocations ? allocations - accountedAllocations : 0);
+    } else if (bytes < accountedBytes) {
+        MemoryStats::release(MemoryCategory::EntryTable, accountedBytes - bytes,
+                             accountedAllocations > allocations ? accountedAllocations - allocations : 0);
+    }
+    accountedBytes = bytes;
+    accountedAllocations = allocations;
+}
+
+auto EntryTable::unaccount() -> void {
+    MemoryStats::release(MemoryCategory::EntryTable, accountedBytes, accountedAllocations);
+    accountedBytes = accountedAllocations = 0;
+}
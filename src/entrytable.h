@@ -0,0 +1,89 @@
+// Columnar table of every entry in an archive
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "types.h"
+
+using EntryId = uint32_t;
+constexpr EntryId INVALID_ENTRY_ID = UINT32_MAX;
+
+enum EntryFlags : uint8_t {
+    ENTRY_COMPRESSED = 1 << 0, // Has to be inflated to read; seeking inside it is expensive
+    ENTRY_HAS_CRC = 1 << 1,    // The archive's directory records a CRC-32 of the contents
+    ENTRY_NESTED = 1 << 2,     // Belongs to an archive mounted from inside this one; offset is within that archive
+    ENTRY_MOUNTED = 1 << 3,    // An archive whose own entries have been added to the table under its name
+};
+
+// Archives can hold a million entries, so rather than an object (and a heap allocated name) per entry
+// the names are packed back to back into one pool and everything else lives in parallel arrays. The
+// rest of the viewer refers to entries by their 32-bit index into the table.
+//
+// Every table accounts its own memory, so the copies background jobs take of the open archive's
+// table show up alongside it rather than only the table the viewer is showing.
+class EntryTable {
+public:
+    EntryTable() = default;
+    explicit EntryTable(PakFormat format) : tableFormat(format) {}
+    ~EntryTable();
+
+    EntryTable(const EntryTable &other);
+    EntryTable(EntryTable &&other) noexcept;
+    EntryTable &operator=(const EntryTable &other);
+    EntryTable &operator=(EntryTable &&other) noexcept;
+
+    auto reserve(size_t entryCount, size_t nameBytes) -> void;
+
+    // Returns INVALID_ENTRY_ID if the name pool is full
+    auto add(std::string_view name, uint64_t offset, uint64_t size, uint8_t flags = 0, uint32_t crc = 0) -> EntryId;
+    auto clear() -> void;
+
+    auto size() const -> size_t { return sizes.size(); }
+    auto empty() const -> bool { return sizes.empty(); }
+    auto format() const -> PakFormat { return tableFormat; }
+
+    // The view stays valid as long as the table does, and is NUL-terminated so it can go to C APIs
+    auto name(EntryId id) const -> std::string_view {
+        return {names.data() + nameOffsets[id], nameOffsets[id + 1] - nameOffsets[id] - 1};
+    }
+    auto offset(EntryId id) const -> uint64_t { return offsets[id]; }
+    auto size(EntryId id) const -> uint64_t { return sizes[id]; }
+    auto flags(EntryId id) const -> uint8_t { return entryFlags[id]; }
+    auto crc(EntryId id) const -> uint32_t { return crcs[id]; } // Only meaningful with ENTRY_HAS_CRC
+    auto addFlags(EntryId id, uint8_t flags) -> void { entryFlags[id] |= flags; }
+
+    // What kind of file the viewer treats the entry as, filled in once after loading so it isn't
+    // worked out from the extension every frame. 0 until set.
+    auto type(EntryId id) const -> uint8_t { return types[id]; }
+    auto setType(EntryId id, uint8_t type) -> void { types[id] = type; }
+
+    // Bundles up one entry for the readers, which take a PakFileEntry. Entries of mounted archives go to
+    // the nested reader rather than the table's own.
+    auto entry(EntryId id) const -> PakFileEntry {
+        return {name(id), offsets[id], sizes[id], (entryFlags[id] & ENTRY_NESTED) ? PakFormat::NESTED : tableFormat};
+    }
+
+    auto find(std::string_view name) const -> std::optional<EntryId>;
+
+    auto memoryUsage() const -> size_t;
+    auto allocationCount() const -> size_t; // Heap blocks behind memoryUsage()
+
+private:
+    // Brings MemoryStats up to date with what the arrays hold now
+    auto account() -> void;
+    auto unaccount() -> void;
+
+    PakFormat tableFormat = PakFormat::UNKNOWN;
+    std::vector<char> names;               // Every name followed by a NUL
+    std::vector<uint32_t> nameOffsets{0};  // Where each name starts in names, plus one past the end
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> sizes;
+    std::vector<uint32_t> crcs;
+    std::vector<uint8_t> types;
+    std::vector<uint8_t> entryFlags;
+    uint64_t accountedBytes = 0;
+    uint64_t accountedAllocations = 0;
+};
@@ -0,0 +1,360 @@
+#include "extractor.h"
+#include "archiveanalysis.h"
+#include "batchfilewriter.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    constexpr uint64_t COPY_RANGE_MIN = 64 * 1024;      // PAK entries from this size up are copied in the kernel
+    constexpr uint64_t WINDOW_BYTES = 64 * 1024 * 1024; // Inflated and held in memory at once
+    constexpr size_t WINDOW_FILES = 4096;
+    constexpr uint64_t STREAM_MIN = 16 * 1024 * 1024;   // Entries this big are written as they inflate instead
+    constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+    auto writeAll(int fd, const uint8_t *data, size_t size, uint64_t offset) -> bool {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            offset += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    auto createFile(const std::string &path) -> int {
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+
+    auto copyRange(int sourceFd, uint64_t offset, uint64_t size, const std::string &path) -> bool {
+        int fd = createFile(path);
+        if (fd < 0) {
+            return false;
+        }
+
+        uint64_t done = 0;
+#ifdef __linux__
+        loff_t sourceOffset = static_cast<loff_t>(offset);
+        while (done < size) {
+            ssize_t copied = copy_file_range(sourceFd, &sourceOffset, fd, nullptr, size - done, 0);
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+            if (copied <= 0) {
+                break; // Not supported here (ENOSYS, EXDEV, EOPNOTSUPP...), so the rest goes through a buffer
+            }
+            done += copied;
+        }
+#endif
+
+        std::vector<uint8_t> buffer;
+        bool copied = true;
+        while (done < size && copied) {
+            buffer.resize(static_cast<size_t>(std::min<uint64_t>(size - done, CHUNK_SIZE)));
+            ssize_t read = ::pread(sourceFd, buffer.data(), buffer.size(), static_cast<off_t>(offset + done));
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            copied = read > 0 && writeAll(fd, buffer.data(), static_cast<size_t>(read), done);
+            done += read > 0 ? read : 0;
+        }
+        return ::close(fd) == 0 && copied;
+    }
+
+    auto streamToFile(EntryStream &stream, const std::string &path) -> bool {
+        int fd = createFile(path);
+        if (fd < 0) {
+            return false;
+        }
+
+        std::vector<uint8_t> buffer(CHUNK_SIZE);
+        uint64_t done = 0;
+        bool written = true;
+        while (done < stream.size() && written) {
+            size_t read = stream.read(buffer.data(), buffer.size());
+            written = read > 0 && writeAll(fd, buffer.data(), read, done);
+            done += read;
+        }
+        return ::close(fd) == 0 && written;
+    }
+
+    auto readAll(EntryStream &stream, std::vector<uint8_t> &data) -> bool {
+        data.resize(static_cast<size_t>(stream.size()));
+        size_t total = 0;
+        while (total < data.size()) {
+            size_t read = stream.read(data.data() + total, data.size() - total);
+            if (read == 0) {
+                break;
+            }
+            total += read;
+        }
+        return total == data.size();
+    }
+}
+
+auto Extractor::isUnder(std::string_view name, std::string_view prefix) -> bool {
+    if (!prefix.empty() && prefix.back() == '/') {
+        prefix.remove_suffix(1);
+    }
+    if (prefix.empty()) {
+        return true;
+    }
+    return name.substr(0, prefix.size()) == prefix && (name.size() == prefix.size() || name[prefix.size()] == '/');
+}
+
+auto Extractor::outputPath(const std::string &outputDir, std::string_view name) -> std::optional<std::string> {
+    std::filesystem::path relative(name);
+    if (name.empty() || name.back() == '/' || relative.has_root_path()) {
+        return std::nullopt;
+    }
+    for (const auto &part : relative) {
+        if (part == "..") {
+            return std::nullopt;
+        }
+    }
+    return (std::filesystem::path(outputDir) / relative).lexically_normal().string();
+}
+
+auto Extractor::makeJob(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                        const std::string &outputDir, VisitEntriesFunc visitEntries) -> std::shared_ptr<Job> {
+    auto job = std::make_shared<Job>();
+    job->path = path;
+    job->entries = entries;
+    job->ids = std::move(ids);
+    job->outputDir = outputDir;
+    job->visitEntries = visitEntries;
+    for (EntryId id : job->ids) {
+        if (!(entries.flags(id) & ENTRY_MOUNTED)) {
+            job->totalBytes += entries.size(id);
+        }
+    }
+    return job;
+}
+
+auto Extractor::start(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                      const std::string &outputDir, VisitEntriesFunc visitEntries) -> void {
+    cancel();
+    job = makeJob(path, entries, std::move(ids), outputDir, visitEntries);
+    ThreadPool::enqueue([job = job] {
+        run(*job);
+        job->running = false;
+    });
+}
+
+auto Extractor::extract(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                        const std::string &outputDir, VisitEntriesFunc visitEntries) -> Summary {
+    auto job = makeJob(path, entries, std::move(ids), outputDir, visitEntries);
+    run(*job);
+    job->running = false;
+    return summarize(*job);
+}
+
+auto Extractor::cancel() -> void {
+    if (job) {
+        job->cancelled = true;
+    }
+}
+
+auto Extractor::isRunning() const -> bool {
+    return job && job->running;
+}
+
+auto Extractor::progress() const -> float {
+    if (!job || job->totalBytes == 0) {
+        return job && !job->running ? 1.0f : 0.0f;
+    }
+    return static_cast<float>(static_cast<double>(job->bytes) / static_cast<double>(job->totalBytes));
+}
+
+auto Extractor::summary() const -> Summary {
+    return job ? summarize(*job) : Summary{};
+}
+
+auto Extractor::summarize(const Job &job) -> Summary {
+    Summary summary;
+    summary.written = job.written;
+    summary.failed = job.failed;
+    summary.bytes = job.bytes;
+    summary.usedIoUring = job.usedIoUring;
+    summary.cancelled = job.cancelled;
+    std::lock_guard<std::mutex> lock(job.mutex);
+    summary.failures = job.failures;
+    return summary;
+}
+
+auto Extractor::fail(Job &job, EntryId id) -> void {
+    job.failed++;
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (job.failures.size() < MAX_FAILURES) {
+        job.failures.emplace_back(job.entries.name(id));
+    }
+}
+
+auto Extractor::run(Job &job) -> void {
+    TRACE_SCOPE("Extract");
+    const EntryTable &entries = job.entries;
+
+    // Archives mounted from inside this one come out as the directory of their entries instead
+    std::vector<EntryId> ids;
+    std::vector<std::string> paths(entries.size());
+    for (EntryId id : job.ids) {
+        if (entries.flags(id) & ENTRY_MOUNTED) {
+            continue;
+        }
+        if (auto path = outputPath(job.outputDir, entries.name(id))) {
+            paths[id] = std::move(*path);
+            ids.push_back(id);
+        } else {
+            fail(job, id);
+        }
+    }
+
+    // Every directory is made up front, once, rather than checked for each file
+    {
+        TRACE_SCOPE("Create directories");
+        std::vector<std::string> directories;
+        for (EntryId id : ids) {
+            directories.push_back(std::filesystem::path(paths[id]).parent_path().string());
+        }
+        std::sort(directories.begin(), directories.end());
+        directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+        for (const auto &directory : directories) {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+        }
+    }
+
+    std::optional<MappedFile> mapped;
+    if (entries.format() == PakFormat::PAK) {
+        mapped.emplace(job.path);
+    }
+
+    std::vector<EntryId> copied, fromMap, inflated, streamed;
+    for (EntryId id : ids) {
+        bool inPak = entries.format() == PakFormat::PAK && !(entries.flags(id) & ENTRY_NESTED);
+        if (inPak && (entries.size(id) >= COPY_RANGE_MIN || !mapped->data)) {
+            copied.push_back(id);
+        } else if (inPak) {
+            fromMap.push_back(id);
+        } else if (entries.size(id) >= STREAM_MIN) {
+            streamed.push_back(id);
+        } else {
+            inflated.push_back(id);
+        }
+    }
+
+    auto finish = [&](EntryId id, bool written) {
+        if (written) {
+            job.written++;
+            job.bytes += entries.size(id);
+        } else {
+            fail(job, id);
+        }
+    };
+
+    if (!copied.empty()) {
+        TRACE_SCOPE("Copy PAK entries");
+        int sourceFd = ::open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+        ThreadPool::parallelFor(copied.size(), [&](size_t i) {
+            EntryId id = copied[i];
+            if (!job.cancelled) {
+                finish(id, sourceFd >= 0 && copyRange(sourceFd, entries.offset(id), entries.size(id), paths[id]));
+            }
+        });
+        if (sourceFd >= 0) {
+            ::close(sourceFd);
+        }
+    }
+
+    BatchFileWriter writer;
+    job.usedIoUring = writer.usesIoUring();
+    std::vector<BatchFileWriter::File> files;
+    auto writeFiles = [&](const std::vector<EntryId> &window) {
+        writer.write(files);
+        for (size_t i = 0; i < files.size(); i++) {
+            finish(window[i], files[i].written);
+        }
+        files.clear();
+    };
+
+    // Small PAK entries go to the writer straight out of the mapping
+    for (size_t start = 0; start < fromMap.size() && !job.cancelled; start += WINDOW_FILES) {
+        std::vector<EntryId> window(fromMap.begin() + start, fromMap.begin() + std::min(start + WINDOW_FILES, fromMap.size()));
+        std::vector<EntryId> present;
+        for (EntryId id : window) {
+            if (const uint8_t *bytes = mapped->range(entries.offset(id), entries.size(id))) {
+                files.push_back({paths[id].c_str(), bytes, static_cast<size_t>(entries.size(id))});
+                present.push_back(id);
+            } else {
+                fail(job, id);
+            }
+        }
+        writeFiles(present);
+    }
+
+    // Everything else is inflated a window at a time across the pool, then written as one batch
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<uint8_t> loaded;
+    std::vector<uint32_t> slots(entries.size());
+    for (size_t start = 0; start < inflated.size() && !job.cancelled;) {
+        size_t end = start;
+        uint64_t bytes = 0;
+        while (end < inflated.size() && end - start < WINDOW_FILES && (bytes < WINDOW_BYTES || end == start)) {
+            bytes += entries.size(inflated[end++]);
+        }
+        std::vector<EntryId> window(inflated.begin() + start, inflated.begin() + end);
+        start = end;
+
+        buffers.assign(window.size(), {});
+        loaded.assign(window.size(), 0);
+        for (size_t i = 0; i < window.size(); i++) {
+            slots[window[i]] = static_cast<uint32_t>(i);
+        }
+
+        ArchiveAnalysis::visitParallel(job.path, entries, window, job.visitEntries,
+                                       [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &) {
+            size_t slot = slots[id];
+            loaded[slot] = !job.cancelled && readAll(stream, buffers[slot]);
+        });
+
+        std::vector<EntryId> present;
+        for (size_t i = 0; i < window.size(); i++) {
+            if (loaded[i]) {
+                files.push_back({paths[window[i]].c_str(), buffers[i].data(), buffers[i].size()});
+                present.push_back(window[i]);
+            } else if (!job.cancelled) {
+                fail(job, window[i]);
+            }
+        }
+        writeFiles(present);
+    }
+
+    // Big entries are written as they inflate rather than held in memory whole
+    if (!streamed.empty() && !job.cancelled) {
+        std::vector<uint8_t> visited(entries.size(), 0);
+        ArchiveAnalysis::visitParallel(job.path, entries, streamed, job.visitEntries,
+                                       [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &) {
+            visited[id] = 1;
+            if (!job.cancelled) {
+                finish(id, streamToFile(stream, paths[id]));
+            }
+        });
+        for (EntryId id : streamed) {
+            if (!visited[id] && !job.cancelled) {
+                fail(job, id);
+            }
+        }
+    }
+}
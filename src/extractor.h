@@ -0,0 +1,88 @@
+// Writes archive entries out to a directory, in the background
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrystream.h"
+#include "entrytable.h"
+
+// Entries keep their path in the archive under the output directory. How each one gets there depends
+// on where it is:
+//  - Large entries stored in a PAK are copied with copy_file_range, so the data never comes into user
+//    space, and on filesystems that can share extents isn't copied at all.
+//  - Small PAK entries are written straight out of the mapped archive, a batch of files at a time
+//    through io_uring, since for them the open and close cost more than the copy.
+//  - Everything else is inflated across the thread pool a window at a time, then written the same way.
+// One extraction at a time; starting another, or destroying the object, cancels the one running.
+class Extractor {
+public:
+    static constexpr size_t MAX_FAILURES = 1000; // Names kept for the report; failures past this are only counted
+
+    struct Summary {
+        size_t written = 0;
+        size_t failed = 0;
+        uint64_t bytes = 0;
+        bool usedIoUring = false;
+        bool cancelled = false;            // Stopped early, so written is only what got done before that
+        std::vector<std::string> failures; // Entry names, up to MAX_FAILURES
+    };
+
+    Extractor() = default;
+    ~Extractor() { cancel(); }
+
+    Extractor(const Extractor &) = delete;
+    Extractor &operator=(const Extractor &) = delete;
+
+    auto start(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids, const std::string &outputDir,
+               VisitEntriesFunc visitEntries) -> void;
+    auto cancel() -> void;
+
+    auto isRunning() const -> bool;
+    auto progress() const -> float; // Fraction of bytes written
+    auto summary() const -> Summary;
+
+    // Extracts on the calling thread, spreading the work over the pool, and returns once it's done
+    static auto extract(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                        const std::string &outputDir, VisitEntriesFunc visitEntries) -> Summary;
+
+    // Whether name is the folder or file prefix names, or is inside it. A trailing '/' on prefix makes no
+    // difference, and an empty one takes in everything.
+    static auto isUnder(std::string_view name, std::string_view prefix) -> bool;
+
+    // Where name goes under outputDir, or nothing if it would end up outside it
+    static auto outputPath(const std::string &outputDir, std::string_view name) -> std::optional<std::string>;
+
+private:
+    struct Job {
+        std::string path;
+        EntryTable entries;
+        std::vector<EntryId> ids;
+        std::string outputDir;
+        VisitEntriesFunc visitEntries;
+
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> running{true};
+        std::atomic<size_t> written{0};
+        std::atomic<size_t> failed{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<bool> usedIoUring{false};
+        uint64_t totalBytes = 0;
+
+        mutable std::mutex mutex;
+        std::vector<std::string> failures;
+    };
+
+    static auto makeJob(const std::string &path, const EntryTable &entries, std::vector<EntryId> ids,
+                        const std::string &outputDir, VisitEntriesFunc visitEntries) -> std::shared_ptr<Job>;
+    static auto run(Job &job) -> void;
+    static auto fail(Job &job, EntryId id) -> void;
+    static auto summarize(const Job &job) -> Summary;
+
+    std::shared_ptr<Job> job; // Shared with the pool, so the job can outlive a cancelled extraction
+};
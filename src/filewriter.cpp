@@ -0,0 +1,189 @@
+#include "filewriter.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    auto writeAll(int fd, const uint8_t *data, size_t size) -> bool {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+}
+
+FileWriter::~FileWriter() {
+    if (fd >= 0) {
+        ::close(fd);
+        ::unlink(tempPath.c_str());
+    }
+}
+
+auto FileWriter::open(const std::string &destination) -> bool {
+    path = destination;
+    tempPath = destination + ".tmp";
+
+    buffer.reset(static_cast<uint8_t *>(std::aligned_alloc(ALIGNMENT, BUFFER_SIZE)));
+    if (!buffer) {
+        return false;
+    }
+
+    fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return fd >= 0;
+}
+
+auto FileWriter::fail() -> bool {
+    failed = true;
+    return false;
+}
+
+auto FileWriter::flush(bool all) -> bool {
+    size_t count = buffered;
+    if (!all) {
+        count -= (flushed + buffered) % ALIGNMENT;
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    if (!writeAll(fd, buffer.get(), count)) {
+        return fail();
+    }
+
+    std::memmove(buffer.get(), buffer.get() + count, buffered - count);
+    buffered -= count;
+    flushed += count;
+    return true;
+}
+
+auto FileWriter::write(const void *data, size_t size) -> bool {
+    if (failed || fd < 0) {
+        return false;
+    }
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        size_t chunk = std::min(size, BUFFER_SIZE - buffered);
+        std::memcpy(buffer.get() + buffered, bytes, chunk);
+        buffered += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (buffered == BUFFER_SIZE && !flush(false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto FileWriter::copyFrom(int sourceFd, uint64_t offset, uint64_t size) -> bool {
+    TRACE_SCOPE("Copy file range");
+    if (failed || fd < 0) {
+        return false;
+    }
+
+#ifdef __linux__
+    // Small copies aren't worth giving up a full buffer for
+    if (copyRangeWorks && size >= ALIGNMENT) {
+        if (!flush(true)) {
+            return false;
+        }
+
+        loff_t sourceOffset = static_cast<loff_t>(offset);
+        while (size > 0) {
+            ssize_t copied = copy_file_range(sourceFd, &sourceOffset, fd, nullptr, size, 0);
+            if (copied < 0 && errno == EINTR) {
+                continue;
+            }
+            if (copied < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                // Old kernels and some filesystem pairs can't do it; copy the rest by hand from now on
+                copyRangeWorks = false;
+                break;
+            }
+            if (copied <= 0) {
+                return fail();
+            }
+
+            flushed += copied;
+            size -= copied;
+        }
+        offset = static_cast<uint64_t>(sourceOffset);
+    }
+#endif
+
+    // Read straight into the output buffer so the data is only copied once
+    while (size > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(size, BUFFER_SIZE - buffered));
+        ssize_t read = ::pread(sourceFd, buffer.get() + buffered, chunk, static_cast<off_t>(offset));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            return fail();
+        }
+
+        buffered += read;
+        offset += read;
+        size -= read;
+
+        if (buffered == BUFFER_SIZE && !flush(false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto FileWriter::writeAt(uint64_t offset, const void *data, size_t size) -> bool {
+    if (failed || fd < 0 || offset + size > position()) {
+        return false;
+    }
+
+    // Patch whatever part of it is still sitting in the buffer
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    if (offset + size > flushed) {
+        size_t skip = offset < flushed ? static_cast<size_t>(flushed - offset) : 0;
+        std::memcpy(buffer.get() + (offset + skip - flushed), bytes + skip, size - skip);
+        size = skip;
+    }
+
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, bytes, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return fail();
+        }
+        bytes += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+auto FileWriter::commit() -> bool {
+    if (failed || fd < 0 || !flush(true)) {
+        return false;
+    }
+
+    int result = ::close(fd);
+    fd = -1;
+    if (result != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// Buffered sequential output for the archive writers
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+// Everything goes through one large buffer that is flushed on block boundaries, so the disk sees a few
+// big aligned writes instead of one per entry. Output goes to a temporary file beside the destination
+// that only replaces it on commit(), which also makes writing over the archive being read safe.
+class FileWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 8 * 1024 * 1024;
+    static constexpr size_t ALIGNMENT = 4096;
+
+    FileWriter() = default;
+    ~FileWriter(); // Throws the temporary file away unless commit() succeeded
+
+    FileWriter(const FileWriter &) = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    auto open(const std::string &path) -> bool;
+    auto isOpen() const -> bool { return fd >= 0; }
+    auto hasFailed() const -> bool { return failed; } // Once a write fails every later one does too
+
+    auto write(const void *data, size_t size) -> bool;
+
+    // Appends size bytes of another file starting at offset. On Linux this is copy_file_range, which
+    // never brings the data into user space and can share extents on filesystems that support it.
+    auto copyFrom(int sourceFd, uint64_t offset, uint64_t size) -> bool;
+
+    // Overwrites bytes that were already written, for headers that can only be filled in at the end
+    auto writeAt(uint64_t offset, const void *data, size_t size) -> bool;
+
+    // Bytes written so far, which is where the next write lands
+    auto position() const -> uint64_t { return flushed + buffered; }
+
+    auto commit() -> bool;
+
+private:
+    struct FreeDeleter {
+        auto operator()(uint8_t *memory) const -> void { std::free(memory); }
+    };
+
+    // Writes out the buffer, or with all false only as much as ends on an ALIGNMENT boundary
+    auto flush(bool all) -> bool;
+    auto fail() -> bool;
+
+    int fd = -1;
+    std::string path;
+    std::string tempPath;
+    std::unique_ptr<uint8_t, FreeDeleter> buffer;
+    size_t buffered = 0;
+    uint64_t flushed = 0;
+    bool failed = false;
+    bool copyRangeWorks = true;
+};
@@ -0,0 +1,344 @@
+#include "fuzzymatch.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FUZZY_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FUZZY_NEON
+#endif
+
+namespace {
+    constexpr size_t RANK_BLOCK = 16384; // Paths per parallelFor item
+
+    // Scores from fzf's v1 algorithm. The delimiter bonus is a point above the plain boundary bonus so
+    // matches at the start of a path component beat ones after a '_' or '.'.
+    constexpr int SCORE_MATCH = 16;
+    constexpr int SCORE_GAP_START = -3;
+    constexpr int SCORE_GAP_EXTENSION = -1;
+    constexpr int BONUS_BOUNDARY = SCORE_MATCH / 2;
+    constexpr int BONUS_BOUNDARY_DELIMITER = BONUS_BOUNDARY + 1;
+    constexpr int BONUS_NON_WORD = SCORE_MATCH / 2;
+    constexpr int BONUS_CAMEL_123 = BONUS_BOUNDARY - 1;
+    constexpr int BONUS_CONSECUTIVE = -(SCORE_GAP_START + SCORE_GAP_EXTENSION);
+    constexpr int BONUS_FIRST_CHAR_MULTIPLIER = 2;
+
+    enum class CharClass { Delimiter, NonWord, Lower, Upper, Number };
+
+    // Letters get a bit each, digits share two and the commonest punctuation gets its own, so the
+    // signature of a path fits in 32 bits
+    constexpr auto makeSignatureTable() -> std::array<uint32_t, 256> {
+        std::array<uint32_t, 256> table{};
+        for (int c = 0; c < 256; c++) {
+            if (c >= 'a' && c <= 'z') {
+                table[c] = 1u << (c - 'a');
+            } else if (c >= 'A' && c <= 'Z') {
+                table[c] = 1u << (c - 'A');
+            } else if (c >= '0' && c <= '4') {
+                table[c] = 1u << 26;
+            } else if (c >= '5' && c <= '9') {
+                table[c] = 1u << 27;
+            } else if (c == '_') {
+                table[c] = 1u << 28;
+            } else if (c == '/') {
+                table[c] = 1u << 29;
+            } else if (c == '.') {
+                table[c] = 1u << 30;
+            } else {
+                table[c] = 1u << 31;
+            }
+        }
+        return table;
+    }
+
+    constexpr std::array<uint32_t, 256> SIGNATURE_BITS = makeSignatureTable();
+
+    auto toLower(char c) -> char {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    }
+
+    auto classOf(char c) -> CharClass {
+        if (c >= 'a' && c <= 'z') {
+            return CharClass::Lower;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            return CharClass::Upper;
+        }
+        if (c >= '0' && c <= '9') {
+            return CharClass::Number;
+        }
+        if (c == '/' || c == '\\') {
+            return CharClass::Delimiter;
+        }
+        return CharClass::NonWord;
+    }
+
+    auto bonusFor(CharClass previous, CharClass current) -> int {
+        bool isWord = current != CharClass::Delimiter && current != CharClass::NonWord;
+        if (isWord) {
+            if (previous == CharClass::Delimiter) {
+                return BONUS_BOUNDARY_DELIMITER;
+            }
+            if (previous == CharClass::NonWord) {
+                return BONUS_BOUNDARY;
+            }
+        }
+        if ((previous == CharClass::Lower && current == CharClass::Upper) ||
+            (previous != CharClass::Number && current == CharClass::Number)) {
+            return BONUS_CAMEL_123;
+        }
+        return isWord ? 0 : BONUS_NON_WORD;
+    }
+
+    // Finds the first place the term matches as a subsequence, then walks back from the end of it to
+    // the latest possible start, which gives a short window without searching every alignment
+    auto scoreTerm(std::string_view text, std::string_view term) -> std::optional<int> {
+        size_t termIndex = 0;
+        size_t start = 0;
+        size_t end = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            if (toLower(text[i]) == term[termIndex]) {
+                if (termIndex == 0) {
+                    start = i;
+                }
+                if (++termIndex == term.size()) {
+                    end = i + 1;
+                    break;
+                }
+            }
+        }
+        if (termIndex < term.size()) {
+            return std::nullopt;
+        }
+
+        termIndex = term.size() - 1;
+        for (size_t i = end; i-- > start;) {
+            if (toLower(text[i]) == term[termIndex]) {
+                if (termIndex == 0) {
+                    start = i;
+                    break;
+                }
+                termIndex--;
+            }
+        }
+
+        int score = 0;
+        int consecutive = 0;
+        int firstBonus = 0;
+        bool inGap = false;
+        CharClass previous = start > 0 ? classOf(text[start - 1]) : CharClass::Delimiter;
+        termIndex = 0;
+
+        for (size_t i = start; i < end; i++) {
+            CharClass current = classOf(text[i]);
+            if (toLower(text[i]) == term[termIndex]) {
+                int bonus = bonusFor(previous, current);
+                if (consecutive == 0) {
+                    firstBonus = bonus;
+                } else {
+                    // A run keeps the bonus of the boundary it started on
+                    if (bonus >= BONUS_BOUNDARY && bonus > firstBonus) {
+                        firstBonus = bonus;
+                    }
+                    bonus = std::max({bonus, firstBonus, BONUS_CONSECUTIVE});
+                }
+
+                score += SCORE_MATCH + (termIndex == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus);
+                consecutive++;
+                termIndex++;
+                inGap = false;
+            } else {
+                score += inGap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+                consecutive = 0;
+                firstBonus = 0;
+                inGap = true;
+            }
+            previous = current;
+        }
+        return score;
+    }
+
+    // Bit i of the result is set when (signatures[i] & mask) == mask, for the four signatures at
+    // signatures[0..3]
+    auto matchFour(const uint32_t *signatures, uint32_t mask) -> unsigned {
+#if defined(FUZZY_SSE2)
+        const __m128i maskV = _mm_set1_epi32(static_cast<int>(mask));
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(signatures));
+        __m128i equal = _mm_cmpeq_epi32(_mm_and_si128(values, maskV), maskV);
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(equal)));
+#elif defined(FUZZY_NEON)
+        const uint32x4_t maskV = vdupq_n_u32(mask);
+        uint32x4_t equal = vceqq_u32(vandq_u32(vld1q_u32(signatures), maskV), maskV);
+        const uint32x4_t weights = {1, 2, 4, 8};
+        uint32x4_t bits = vandq_u32(equal, weights);
+        uint32x2_t sum = vpadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+        return vget_lane_u32(vpadd_u32(sum, sum), 0);
+#else
+        unsigned bits = 0;
+        for (int i = 0; i < 4; i++) {
+            if ((signatures[i] & mask) == mask) {
+                bits |= 1u << i;
+            }
+        }
+        return bits;
+#endif
+    }
+}
+
+FuzzyPattern::FuzzyPattern(std::string_view text) {
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t space = text.find(' ', position);
+        if (space == std::string_view::npos) {
+            space = text.size();
+        }
+        if (space > position) {
+            std::string term(text.substr(position, space - position));
+            std::transform(term.begin(), term.end(), term.begin(), toLower);
+            mask |= characterSignature(term);
+            terms.push_back(std::move(term));
+        }
+        position = space + 1;
+    }
+}
+
+auto FuzzyPattern::score(std::string_view path) const -> std::optional<int> {
+    int total = 0;
+    for (const auto &term : terms) {
+        auto termScore = scoreTerm(path, term);
+        if (!termScore) {
+            return std::nullopt;
+        }
+        total += *termScore;
+    }
+    return total;
+}
+
+auto FuzzyPattern::characterSignature(std::string_view text) -> uint32_t {
+    uint32_t signature = 0;
+    for (char c : text) {
+        signature |= SIGNATURE_BITS[static_cast<unsigned char>(c)];
+    }
+    return signature;
+}
+
+auto FuzzyIndex::build(const EntryTable &entries) -> void {
+    TRACE_SCOPE("Build fuzzy index");
+    signatures.assign(entries.size(), 0);
+
+    size_t blocks = (entries.size() + RANK_BLOCK - 1) / RANK_BLOCK;
+    ThreadPool::parallelFor(blocks, [&](size_t block) {
+        size_t end = std::min(entries.size(), (block + 1) * RANK_BLOCK);
+        for (size_t id = block * RANK_BLOCK; id < end; id++) {
+            signatures[id] = FuzzyPattern::characterSignature(entries.name(static_cast<EntryId>(id)));
+        }
+    });
+}
+
+auto FuzzyIndex::remap(const EntryTable &entries, const std::vector<EntryId> &keptIds) -> void {
+    TRACE_SCOPE("Remap fuzzy index");
+    std::vector<uint32_t> remapped(entries.size(), 0);
+    std::vector<uint8_t> known(entries.size(), 0);
+    for (size_t id = 0; id < keptIds.size() && id < signatures.size(); id++) {
+        if (keptIds[id] != INVALID_ENTRY_ID) {
+            remapped[keptIds[id]] = signatures[id];
+            known[keptIds[id]] = 1;
+        }
+    }
+    for (EntryId id = 0; id < entries.size(); id++) {
+        if (!known[id]) {
+            remapped[id] = FuzzyPattern::characterSignature(entries.name(id));
+        }
+    }
+    signatures = std::move(remapped);
+}
+
+auto FuzzyIndex::rank(const EntryTable &entries, const FuzzyPattern &pattern, size_t limit,
+                      const std::function<bool(EntryId)> &accept) const -> FuzzyResults {
+    TRACE_SCOPE("Fuzzy rank");
+    FuzzyResults results;
+    if (pattern.empty() || limit == 0 || signatures.size() != entries.size()) {
+        return results;
+    }
+
+    auto better = [&](const FuzzyMatch &a, const FuzzyMatch &b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        size_t lengthA = entries.name(a.entry).size();
+        size_t lengthB = entries.name(b.entry).size();
+        if (lengthA != lengthB) {
+            return lengthA < lengthB;
+        }
+        return a.entry < b.entry;
+    };
+
+    // Keeps at most limit of the best matches, trimming only once there are twice that many so the
+    // trimming cost stays linear. Returns the worst match still kept.
+    auto trim = [&](std::vector<FuzzyMatch> &matches) -> std::optional<FuzzyMatch> {
+        if (matches.size() > limit) {
+            std::nth_element(matches.begin(), matches.begin() + (limit - 1), matches.end(), better);
+            matches.resize(limit);
+            return matches.back();
+        }
+        return std::nullopt;
+    };
+
+    uint32_t mask = pattern.signature();
+    size_t blocks = (signatures.size() + RANK_BLOCK - 1) / RANK_BLOCK;
+    std::vector<std::vector<FuzzyMatch>> found(blocks);
+    std::vector<size_t> counts(blocks, 0);
+
+    ThreadPool::parallelFor(blocks, [&](size_t block) {
+        auto &matches = found[block];
+        size_t begin = block * RANK_BLOCK;
+        size_t end = std::min(signatures.size(), begin + RANK_BLOCK);
+        std::optional<FuzzyMatch> cutoff; // Anything no better than this can't make the cut any more
+
+        auto consider = [&](size_t id) {
+            auto entry = static_cast<EntryId>(id);
+            if (accept && !accept(entry)) {
+                return;
+            }
+            if (auto score = pattern.score(entries.name(entry))) {
+                counts[block]++;
+                FuzzyMatch match{entry, *score};
+                if (!cutoff || better(match, *cutoff)) {
+                    matches.push_back(match);
+                    if (matches.size() >= 2 * limit) {
+                        cutoff = trim(matches);
+                    }
+                }
+            }
+        };
+
+        size_t id = begin;
+        for (; id + 4 <= end; id += 4) {
+            unsigned bits = matchFour(signatures.data() + id, mask);
+            for (int i = 0; bits; i++, bits >>= 1) {
+                if (bits & 1) {
+                    consider(id + i);
+                }
+            }
+        }
+        for (; id < end; id++) {
+            if ((signatures[id] & mask) == mask) {
+                consider(id);
+            }
+        }
+        trim(matches);
+    });
+
+    for (size_t block = 0; block < blocks; block++) {
+        results.total += counts[block];
+        results.matches.insert(results.matches.end(), found[block].begin(), found[block].end());
+    }
+    trim(results.matches);
+    std::sort(results.matches.begin(), results.matches.end(), better);
+    return results;
+}
@@ -0,0 +1,65 @@
+// fzf-style fuzzy matching and ranking of entry paths
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrytable.h"
+
+// A search as typed. Space separated terms must all match, each as a case-insensitive subsequence of
+// the path. Matches score higher the more of their characters are consecutive or start a path
+// component or word, the way fzf ranks them.
+class FuzzyPattern {
+public:
+    explicit FuzzyPattern(std::string_view text);
+
+    auto empty() const -> bool { return terms.empty(); }
+
+    // Bit set of the characters the pattern needs, in the same form as FuzzyIndex signatures
+    auto signature() const -> uint32_t { return mask; }
+
+    // nullopt when some term doesn't match at all
+    auto score(std::string_view path) const -> std::optional<int>;
+
+    static auto characterSignature(std::string_view text) -> uint32_t;
+
+private:
+    std::vector<std::string> terms; // Lower-cased
+    uint32_t mask = 0;
+};
+
+struct FuzzyMatch {
+    EntryId entry;
+    int score;
+};
+
+struct FuzzyResults {
+    std::vector<FuzzyMatch> matches; // Best first
+    size_t total = 0;                // Matches before cutting down to the limit
+};
+
+// Holds a 32-bit signature of which characters each path contains. A path missing any character the
+// pattern needs can't match, and checking that is one AND and compare per path, four paths at a time,
+// so scoring only ever runs on paths that have a real chance.
+class FuzzyIndex {
+public:
+    auto build(const EntryTable &entries) -> void;
+
+    // Brings the index over to a reloaded table. keptIds[old] is the new id of an entry that kept its
+    // name, or INVALID_ENTRY_ID; those keep their signatures, and only the rest are worked out.
+    auto remap(const EntryTable &entries, const std::vector<EntryId> &keptIds) -> void;
+    auto clear() -> void { signatures.clear(); }
+    auto memoryUsage() const -> size_t { return signatures.capacity() * sizeof(uint32_t); }
+
+    // The best limit matches among the entries accept lets through (all of them if it's empty), ordered
+    // by score, then shorter paths, then entry order
+    auto rank(const EntryTable &entries, const FuzzyPattern &pattern, size_t limit,
+              const std::function<bool(EntryId)> &accept = {}) const -> FuzzyResults;
+
+private:
+    std::vector<uint32_t> signatures; // Indexed by EntryId
+};
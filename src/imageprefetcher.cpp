@@ -0,0 +1,164 @@
+#include "imageprefetcher.h"
+#include "memorystats.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <cstring>
+
+ImagePrefetcher::ImagePrefetcher(size_t budgetBytes) : shared(std::make_shared<Shared>()) {
+    shared->budget = budgetBytes;
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->stopped = true;
+    shared->generation++; // So a decode still running doesn't add to a cache nothing will clear
+    shared->queue.clear();
+    MemoryStats::release(MemoryCategory::PrefetchedImages, shared->bytes, shared->cache.size());
+    shared->cache.clear();
+    shared->bytes = 0;
+}
+
+auto ImagePrefetcher::reset(Loader loader) -> void {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->generation++;
+    shared->loader = std::move(loader);
+    shared->queue.clear();
+    shared->wanted.clear();
+    shared->inFlight.clear();
+    shared->failed.clear();
+    MemoryStats::release(MemoryCategory::PrefetchedImages, shared->bytes, shared->cache.size());
+    shared->cache.clear();
+    shared->bytes = 0;
+}
+
+auto ImagePrefetcher::remap(const std::vector<EntryId> &newIds) -> void {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->generation++;
+    shared->queue.clear();
+    shared->wanted.clear();
+    shared->inFlight.clear();
+    shared->failed.clear();
+
+    std::unordered_map<EntryId, Image> cache;
+    shared->bytes = 0;
+    for (auto &[id, image] : shared->cache) {
+        EntryId newId = id < newIds.size() ? newIds[id] : INVALID_ENTRY_ID;
+        if (newId != INVALID_ENTRY_ID) {
+            shared->bytes += image.pixels.size();
+            cache.emplace(newId, std::move(image));
+        } else {
+            MemoryStats::release(MemoryCategory::PrefetchedImages, image.pixels.size());
+        }
+    }
+    shared->cache = std::move(cache);
+    shared->decoded.notify_all();
+}
+
+auto ImagePrefetcher::prefetch(const EntryTable &entries, const std::vector<EntryId> &ids) -> void {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->queue.clear();
+    shared->wanted.clear();
+
+    for (EntryId id : ids) {
+        shared->wanted.insert(id);
+        if (!shared->cache.count(id) && !shared->inFlight.count(id) && !shared->failed.count(id)) {
+            shared->queue.push_back({id, std::string(entries.name(id)), entries.offset(id), entries.size(id), entries.entry(id).format});
+        }
+    }
+
+    while (shared->workers < WORKERS && shared->workers < shared->queue.size()) {
+        shared->workers++;
+        ThreadPool::enqueue([shared = shared] { work(shared); });
+    }
+}
+
+auto ImagePrefetcher::take(EntryId id, const PixelAllocator &allocate) -> bool {
+    TRACE_SCOPE("Take prefetched image");
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->decoded.wait(lock, [&] { return !shared->inFlight.count(id); });
+
+    auto it = shared->cache.find(id);
+    if (it == shared->cache.end()) {
+        return false;
+    }
+
+    // Kept rather than handed over, so stepping back to it is just as quick
+    Image &image = it->second;
+    image.lastUse = ++shared->useCounter;
+    uint8_t *dst = allocate(image.width, image.height);
+    if (dst) {
+        std::memcpy(dst, image.pixels.data(), image.pixels.size());
+    }
+    return dst != nullptr;
+}
+
+auto ImagePrefetcher::memoryUsage() const -> size_t {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    return shared->bytes;
+}
+
+auto ImagePrefetcher::work(const std::shared_ptr<Shared> &shared) -> void {
+    std::unique_lock<std::mutex> lock(shared->mutex);
+
+    while (!shared->stopped && !shared->queue.empty()) {
+        Request request = std::move(shared->queue.front());
+        shared->queue.pop_front();
+        if (shared->cache.count(request.id) || shared->inFlight.count(request.id) || shared->failed.count(request.id)) {
+            continue;
+        }
+
+        shared->inFlight.insert(request.id);
+        uint64_t generation = shared->generation;
+        Loader loader = shared->loader;
+        lock.unlock();
+
+        Image image;
+        bool decoded;
+        {
+            TRACE_SCOPE("Prefetch image");
+            PakFileEntry entry{request.name, request.offset, request.size, request.format};
+            decoded = loader && loader(entry, [&](int width, int height) -> uint8_t * {
+                image.width = width;
+                image.height = height;
+                image.pixels.resize(static_cast<size_t>(width) * height * 4);
+                return image.pixels.data();
+            });
+        }
+
+        lock.lock();
+        if (generation == shared->generation) {
+            shared->inFlight.erase(request.id);
+            if (!decoded) {
+                shared->failed.insert(request.id);
+            } else if (makeRoom(*shared, image.pixels.size())) {
+                shared->bytes += image.pixels.size();
+                MemoryStats::allocate(MemoryCategory::PrefetchedImages, image.pixels.size());
+                image.lastUse = ++shared->useCounter;
+                shared->cache.emplace(request.id, std::move(image));
+            }
+        }
+        shared->decoded.notify_all();
+    }
+
+    shared->workers--;
+}
+
+auto ImagePrefetcher::makeRoom(Shared &shared, size_t bytes) -> bool {
+    while (shared.bytes + bytes > shared.budget) {
+        auto victim = shared.cache.end();
+        for (auto it = shared.cache.begin(); it != shared.cache.end(); ++it) {
+            if (!shared.wanted.count(it->first) && (victim == shared.cache.end() || it->second.lastUse < victim->second.lastUse)) {
+                victim = it;
+            }
+        }
+        if (victim == shared.cache.end()) {
+            return false;
+        }
+
+        shared.bytes -= victim->second.pixels.size();
+        MemoryStats::release(MemoryCategory::PrefetchedImages, victim->second.pixels.size());
+        shared.cache.erase(victim);
+    }
+    return true;
+}
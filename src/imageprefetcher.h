@@ -0,0 +1,96 @@
+// Decodes the images the viewer is likely to show next, ahead of time
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "entrytable.h"
+#include "types.h"
+
+// A couple of pool threads work through a queue of entries, most wanted first, and keep the decoded
+// pixels in a cache bounded by bytes. Showing a prefetched image is then a copy into upload memory.
+// Pixels stay on the CPU so the cache never holds on to GPU memory.
+class ImagePrefetcher {
+public:
+    // Reads and decodes one entry. Runs on pool threads, so it mustn't touch anything the main thread
+    // changes.
+    using Loader = std::function<bool(const PakFileEntry &entry, const PixelAllocator &allocate)>;
+
+    static constexpr size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+    static constexpr size_t WORKERS = 2; // Leaves the rest of the pool to whatever the user asked for
+
+    explicit ImagePrefetcher(size_t budgetBytes = DEFAULT_BUDGET);
+    ~ImagePrefetcher(); // Queued entries are dropped; decodes already running finish on their own
+
+    ImagePrefetcher(const ImagePrefetcher &) = delete;
+    ImagePrefetcher &operator=(const ImagePrefetcher &) = delete;
+
+    // Forgets everything, for when another archive is opened. Decodes still running for the old one
+    // are thrown away when they finish.
+    auto reset(Loader loader) -> void;
+
+    // Keeps the cached images across a reload of the archive. newIds maps each old id to the entry's new
+    // one, or to INVALID_ENTRY_ID if it's gone or its contents changed, in which case its image is
+    // dropped. Anything queued or being decoded is forgotten, as with reset().
+    auto remap(const std::vector<EntryId> &newIds) -> void;
+
+    // Replaces the queue with ids, most wanted first. Anything cached already stays cached, and is
+    // kept ahead of everything else when the cache is full.
+    auto prefetch(const EntryTable &entries, const std::vector<EntryId> &ids) -> void;
+
+    // Copies a prefetched image into allocate, waiting for it if it's being decoded right now. False
+    // if it was never prefetched or didn't decode.
+    auto take(EntryId id, const PixelAllocator &allocate) -> bool;
+
+    auto memoryUsage() const -> size_t;
+
+private:
+    struct Request {
+        EntryId id;
+        std::string name; // Owned, since the entry table can change while the request waits
+        uint64_t offset;
+        uint64_t size;
+        PakFormat format;
+    };
+
+    struct Image {
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> pixels;
+        uint64_t lastUse = 0;
+    };
+
+    struct Shared {
+        mutable std::mutex mutex;
+        std::condition_variable decoded;
+        Loader loader;
+        uint64_t generation = 0; // Bumped by reset()
+        size_t budget;
+        size_t bytes = 0;
+        uint64_t useCounter = 0;
+        size_t workers = 0;
+        bool stopped = false;
+
+        std::deque<Request> queue;
+        std::unordered_set<EntryId> wanted; // Everything in the latest prefetch(), which eviction spares
+        std::unordered_set<EntryId> inFlight;
+        std::unordered_set<EntryId> failed;
+        std::unordered_map<EntryId, Image> cache;
+    };
+
+    static auto work(const std::shared_ptr<Shared> &shared) -> void;
+
+    // Makes room for bytes more, evicting the least recently used images that aren't wanted. False if
+    // there still isn't room.
+    static auto makeRoom(Shared &shared, size_t bytes) -> bool;
+
+    std::shared_ptr<Shared> shared;
+};
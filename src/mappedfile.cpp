@@ -0,0 +1,47 @@
+#include "mappedfile.h"
+
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+    std::mutex avoidedMutex;
+    std::string avoidedPath;
+}
+
+auto MappedFile::avoid(const std::string &path) -> void {
+    std::lock_guard<std::mutex> lock(avoidedMutex);
+    avoidedPath = path;
+}
+
+MappedFile::MappedFile(const std::string &path) {
+    {
+        std::lock_guard<std::mutex> lock(avoidedMutex);
+        if (!avoidedPath.empty() && path == avoidedPath) {
+            return;
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED) {
+            data = static_cast<const char *>(address);
+            size = static_cast<size_t>(info.st_size);
+        }
+    }
+    ::close(fd); // The mapping keeps the file open
+}
+
+MappedFile::~MappedFile() {
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+}
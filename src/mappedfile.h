@@ -0,0 +1,34 @@
+// Read-only memory mapping of a whole file
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// PAK entries are stored as-is, so with the archive mapped an entry can be read where it sits without
+// being copied anywhere. data stays null if the file couldn't be opened or mapped.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Leaves one file unmapped from now on, or none with an empty path. A mapping of a file that's written
+    // over in place faults (SIGBUS) on pages past its new end where a read would only come up short, so
+    // an archive that's being watched for rewrites is streamed instead, as if mapping it had failed.
+    static auto avoid(const std::string &path) -> void;
+
+    // The bytes of [offset, offset + count), or nullptr if any of them are past the end of the file
+    auto range(uint64_t offset, uint64_t count) const -> const uint8_t * {
+        if (!data || offset > size || count > size - offset) {
+            return nullptr;
+        }
+        return reinterpret_cast<const uint8_t *>(data) + offset;
+    }
+
+    const char *data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,249 @@
+#include "md2model.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+    constexpr int32_t MD2_VERSION = 8;
+    constexpr size_t HEADER_FIELDS = 17;
+    constexpr size_t SKIN_NAME_SIZE = 64;
+    constexpr size_t TEXCOORD_SIZE = 4;      // int16 s, t in skin pixels
+    constexpr size_t TRIANGLE_SIZE = 12;     // int16 position[3], texCoord[3]
+    constexpr size_t FRAME_HEADER_SIZE = 40; // float scale[3], translate[3], char name[16]
+    constexpr size_t FRAME_NAME_SIZE = 16;
+    constexpr size_t VERTEX_SIZE = 4;        // uint8 x, y, z, normal index
+
+    // Well past what the Quake 2 tools allow, but low enough that a corrupt count can't ask for gigabytes
+    constexpr int32_t MAX_SKINS = 32;
+    constexpr int32_t MAX_VERTICES = 8192;
+    constexpr int32_t MAX_TEXCOORDS = 8192;
+    constexpr int32_t MAX_TRIANGLES = 16384;
+    constexpr int32_t MAX_FRAMES = 1024;
+    // Vertices are deduplicated on position * texture coordinate count + texture coordinate, which has
+    // to stay unique in 32 bits
+    static_assert(static_cast<uint64_t>(MAX_VERTICES) * MAX_TEXCOORDS <= UINT32_MAX);
+
+    enum HeaderField {
+        IDENT, VERSION, SKIN_WIDTH, SKIN_HEIGHT, FRAME_SIZE, NUM_SKINS, NUM_POSITIONS, NUM_TEXCOORDS, NUM_TRIANGLES,
+        NUM_GL_COMMANDS, NUM_FRAMES, OFS_SKINS, OFS_TEXCOORDS, OFS_TRIANGLES, OFS_FRAMES, OFS_GL_COMMANDS, OFS_END,
+    };
+
+    // Models are little endian on disk, like everything else the viewer reads
+    auto readI16(const uint8_t *bytes) -> int16_t {
+        int16_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    auto readName(const uint8_t *bytes, size_t size) -> std::string {
+        const char *text = reinterpret_cast<const char *>(bytes);
+        return std::string(text, strnlen(text, size));
+    }
+
+    // Whether count records of recordSize bytes starting at offset lie inside the file
+    auto fits(size_t fileSize, int32_t offset, int32_t count, size_t recordSize) -> bool {
+        return offset >= 0 && count >= 0 && static_cast<size_t>(offset) <= fileSize &&
+               static_cast<uint64_t>(count) * recordSize <= fileSize - static_cast<size_t>(offset);
+    }
+
+    // Frames are named after their animation with a number on the end, like run1 to run6 or pain301
+    auto animationName(const std::string &frame) -> std::string {
+        size_t end = frame.size();
+        while (end > 0 && std::isdigit(static_cast<unsigned char>(frame[end - 1]))) {
+            end--;
+        }
+        return frame.substr(0, end > 0 ? end : frame.size());
+    }
+}
+
+const float Md2Reader::NORMALS[NORMAL_COUNT][3] = {
+    {-0.525731f, 0.000000f, 0.850651f}, {-0.442863f, 0.238856f, 0.864188f}, {-0.295242f, 0.000000f, 0.955423f},
+    {-0.309017f, 0.500000f, 0.809017f}, {-0.162460f, 0.262866f, 0.951056f}, {0.000000f, 0.000000f, 1.000000f},
+    {0.000000f, 0.850651f, 0.525731f}, {-0.147621f, 0.716567f, 0.681718f}, {0.147621f, 0.716567f, 0.681718f},
+    {0.000000f, 0.525731f, 0.850651f}, {0.309017f, 0.500000f, 0.809017f}, {0.525731f, 0.000000f, 0.850651f},
+    {0.295242f, 0.000000f, 0.955423f}, {0.442863f, 0.238856f, 0.864188f}, {0.162460f, 0.262866f, 0.951056f},
+    {-0.681718f, 0.147621f, 0.716567f}, {-0.809017f, 0.309017f, 0.500000f}, {-0.587785f, 0.425325f, 0.688191f},
+    {-0.850651f, 0.525731f, 0.000000f}, {-0.864188f, 0.442863f, 0.238856f}, {-0.716567f, 0.681718f, 0.147621f},
+    {-0.688191f, 0.587785f, 0.425325f}, {-0.500000f, 0.809017f, 0.309017f}, {-0.238856f, 0.864188f, 0.442863f},
+    {-0.425325f, 0.688191f, 0.587785f}, {-0.716567f, 0.681718f, -0.147621f}, {-0.500000f, 0.809017f, -0.309017f},
+    {-0.525731f, 0.850651f, 0.000000f}, {0.000000f, 0.850651f, -0.525731f}, {-0.238856f, 0.864188f, -0.442863f},
+    {0.000000f, 0.955423f, -0.295242f}, {-0.262866f, 0.951056f, -0.162460f}, {0.000000f, 1.000000f, 0.000000f},
+    {0.000000f, 0.955423f, 0.295242f}, {-0.262866f, 0.951056f, 0.162460f}, {0.238856f, 0.864188f, 0.442863f},
+    {0.262866f, 0.951056f, 0.162460f}, {0.500000f, 0.809017f, 0.309017f}, {0.238856f, 0.864188f, -0.442863f},
+    {0.262866f, 0.951056f, -0.162460f}, {0.500000f, 0.809017f, -0.309017f}, {0.850651f, 0.525731f, 0.000000f},
+    {0.716567f, 0.681718f, 0.147621f}, {0.716567f, 0.681718f, -0.147621f}, {0.525731f, 0.850651f, 0.000000f},
+    {0.425325f, 0.688191f, 0.587785f}, {0.864188f, 0.442863f, 0.238856f}, {0.688191f, 0.587785f, 0.425325f},
+    {0.809017f, 0.309017f, 0.500000f}, {0.681718f, 0.147621f, 0.716567f}, {0.587785f, 0.425325f, 0.688191f},
+    {0.955423f, 0.295242f, 0.000000f}, {1.000000f, 0.000000f, 0.000000f}, {0.951056f, 0.162460f, 0.262866f},
+    {0.850651f, -0.525731f, 0.000000f}, {0.955423f, -0.295242f, 0.000000f}, {0.864188f, -0.442863f, 0.238856f},
+    {0.951056f, -0.162460f, 0.262866f}, {0.809017f, -0.309017f, 0.500000f}, {0.681718f, -0.147621f, 0.716567f},
+    {0.850651f, 0.000000f, 0.525731f}, {0.864188f, 0.442863f, -0.238856f}, {0.809017f, 0.309017f, -0.500000f},
+    {0.951056f, 0.162460f, -0.262866f}, {0.525731f, 0.000000f, -0.850651f}, {0.681718f, 0.147621f, -0.716567f},
+    {0.681718f, -0.147621f, -0.716567f}, {0.850651f, 0.000000f, -0.525731f}, {0.809017f, -0.309017f, -0.500000f},
+    {0.864188f, -0.442863f, -0.238856f}, {0.951056f, -0.162460f, -0.262866f}, {0.147621f, 0.716567f, -0.681718f},
+    {0.309017f, 0.500000f, -0.809017f}, {0.425325f, 0.688191f, -0.587785f}, {0.442863f, 0.238856f, -0.864188f},
+    {0.587785f, 0.425325f, -0.688191f}, {0.688191f, 0.587785f, -0.425325f}, {-0.147621f, 0.716567f, -0.681718f},
+    {-0.309017f, 0.500000f, -0.809017f}, {0.000000f, 0.525731f, -0.850651f}, {-0.525731f, 0.000000f, -0.850651f},
+    {-0.442863f, 0.238856f, -0.864188f}, {-0.295242f, 0.000000f, -0.955423f}, {-0.162460f, 0.262866f, -0.951056f},
+    {0.000000f, 0.000000f, -1.000000f}, {0.295242f, 0.000000f, -0.955423f}, {0.162460f, 0.262866f, -0.951056f},
+    {-0.442863f, -0.238856f, -0.864188f}, {-0.309017f, -0.500000f, -0.809017f}, {-0.162460f, -0.262866f, -0.951056f},
+    {0.000000f, -0.850651f, -0.525731f}, {-0.147621f, -0.716567f, -0.681718f}, {0.147621f, -0.716567f, -0.681718f},
+    {0.000000f, -0.525731f, -0.850651f}, {0.309017f, -0.500000f, -0.809017f}, {0.442863f, -0.238856f, -0.864188f},
+    {0.162460f, -0.262866f, -0.951056f}, {0.238856f, -0.864188f, -0.442863f}, {0.500000f, -0.809017f, -0.309017f},
+    {0.425325f, -0.688191f, -0.587785f}, {0.716567f, -0.681718f, -0.147621f}, {0.688191f, -0.587785f, -0.425325f},
+    {0.587785f, -0.425325f, -0.688191f}, {0.000000f, -0.955423f, -0.295242f}, {0.000000f, -1.000000f, 0.000000f},
+    {0.262866f, -0.951056f, -0.162460f}, {0.000000f, -0.850651f, 0.525731f}, {0.000000f, -0.955423f, 0.295242f},
+    {0.238856f, -0.864188f, 0.442863f}, {0.262866f, -0.951056f, 0.162460f}, {0.500000f, -0.809017f, 0.309017f},
+    {0.716567f, -0.681718f, 0.147621f}, {0.525731f, -0.850651f, 0.000000f}, {-0.238856f, -0.864188f, -0.442863f},
+    {-0.500000f, -0.809017f, -0.309017f}, {-0.262866f, -0.951056f, -0.162460f}, {-0.850651f, -0.525731f, 0.000000f},
+    {-0.716567f, -0.681718f, -0.147621f}, {-0.716567f, -0.681718f, 0.147621f}, {-0.525731f, -0.850651f, 0.000000f},
+    {-0.500000f, -0.809017f, 0.309017f}, {-0.238856f, -0.864188f, 0.442863f}, {-0.262866f, -0.951056f, 0.162460f},
+    {-0.864188f, -0.442863f, 0.238856f}, {-0.809017f, -0.309017f, 0.500000f}, {-0.688191f, -0.587785f, 0.425325f},
+    {-0.681718f, -0.147621f, 0.716567f}, {-0.442863f, -0.238856f, 0.864188f}, {-0.587785f, -0.425325f, 0.688191f},
+    {-0.309017f, -0.500000f, 0.809017f}, {-0.147621f, -0.716567f, 0.681718f}, {-0.425325f, -0.688191f, 0.587785f},
+    {-0.162460f, -0.262866f, 0.951056f}, {0.442863f, -0.238856f, 0.864188f}, {0.162460f, -0.262866f, 0.951056f},
+    {0.309017f, -0.500000f, 0.809017f}, {0.147621f, -0.716567f, 0.681718f}, {0.000000f, -0.525731f, 0.850651f},
+    {0.425325f, -0.688191f, 0.587785f}, {0.587785f, -0.425325f, 0.688191f}, {0.688191f, -0.587785f, 0.425325f},
+    {-0.955423f, 0.295242f, 0.000000f}, {-0.951056f, 0.162460f, 0.262866f}, {-1.000000f, 0.000000f, 0.000000f},
+    {-0.850651f, 0.000000f, 0.525731f}, {-0.955423f, -0.295242f, 0.000000f}, {-0.951056f, -0.162460f, 0.262866f},
+    {-0.864188f, 0.442863f, -0.238856f}, {-0.951056f, 0.162460f, -0.262866f}, {-0.809017f, 0.309017f, -0.500000f},
+    {-0.864188f, -0.442863f, -0.238856f}, {-0.951056f, -0.162460f, -0.262866f}, {-0.809017f, -0.309017f, -0.500000f},
+    {-0.681718f, 0.147621f, -0.716567f}, {-0.681718f, -0.147621f, -0.716567f}, {-0.850651f, 0.000000f, -0.525731f},
+    {-0.688191f, 0.587785f, -0.425325f}, {-0.587785f, 0.425325f, -0.688191f}, {-0.425325f, 0.688191f, -0.587785f},
+    {-0.425325f, -0.688191f, -0.587785f}, {-0.587785f, -0.425325f, -0.688191f}, {-0.688191f, -0.587785f, -0.425325f},
+};
+
+auto Md2Reader::read(const uint8_t *data, size_t size) -> std::optional<Md2Model> {
+    TRACE_SCOPE("Read MD2");
+    int32_t header[HEADER_FIELDS];
+    if (!data || size < sizeof(header) || std::memcmp(data, "IDP2", 4) != 0) {
+        return std::nullopt;
+    }
+    std::memcpy(header, data, sizeof(header));
+
+    int32_t positionCount = header[NUM_POSITIONS];
+    int32_t texCoordCount = header[NUM_TEXCOORDS];
+    int32_t triangleCount = header[NUM_TRIANGLES];
+    int32_t frameCount = header[NUM_FRAMES];
+    int32_t skinCount = header[NUM_SKINS];
+    if (header[VERSION] != MD2_VERSION || header[SKIN_WIDTH] <= 0 || header[SKIN_HEIGHT] <= 0 ||
+        positionCount <= 0 || positionCount > MAX_VERTICES || texCoordCount <= 0 || texCoordCount > MAX_TEXCOORDS ||
+        triangleCount <= 0 || triangleCount > MAX_TRIANGLES || frameCount <= 0 || frameCount > MAX_FRAMES ||
+        skinCount > MAX_SKINS) {
+        return std::nullopt;
+    }
+
+    auto frameSize = static_cast<size_t>(header[FRAME_SIZE]);
+    if (header[FRAME_SIZE] < 0 || frameSize < FRAME_HEADER_SIZE + static_cast<size_t>(positionCount) * VERTEX_SIZE ||
+        !fits(size, header[OFS_SKINS], skinCount, SKIN_NAME_SIZE) ||
+        !fits(size, header[OFS_TEXCOORDS], texCoordCount, TEXCOORD_SIZE) ||
+        !fits(size, header[OFS_TRIANGLES], triangleCount, TRIANGLE_SIZE) ||
+        !fits(size, header[OFS_FRAMES], frameCount, frameSize)) {
+        return std::nullopt;
+    }
+
+    Md2Model model;
+    model.skinWidth = header[SKIN_WIDTH];
+    model.skinHeight = header[SKIN_HEIGHT];
+    for (int32_t i = 0; i < skinCount; i++) {
+        std::string skin = readName(data + header[OFS_SKINS] + i * SKIN_NAME_SIZE, SKIN_NAME_SIZE);
+        if (!skin.empty()) {
+            model.skins.push_back(std::move(skin));
+        }
+    }
+
+    // One vertex for each distinct position and texture coordinate pair the triangles use. Triangles
+    // pointing outside either array are dropped rather than failing the whole model.
+    std::vector<std::pair<uint16_t, uint16_t>> corners; // Position and texture coordinate of each vertex
+    std::unordered_map<uint32_t, uint32_t> vertexOf;
+    vertexOf.reserve(static_cast<size_t>(triangleCount) * 3);
+    model.indices.reserve(static_cast<size_t>(triangleCount) * 3);
+
+    const uint8_t *texCoords = data + header[OFS_TEXCOORDS];
+    const uint8_t *triangles = data + header[OFS_TRIANGLES];
+    for (int32_t i = 0; i < triangleCount; i++) {
+        const uint8_t *triangle = triangles + i * TRIANGLE_SIZE;
+        uint32_t triangleVertices[3];
+        bool valid = true;
+        for (int corner = 0; corner < 3; corner++) {
+            auto position = static_cast<uint16_t>(readI16(triangle + corner * 2));
+            auto texCoord = static_cast<uint16_t>(readI16(triangle + 6 + corner * 2));
+            if (position >= positionCount || texCoord >= texCoordCount) {
+                valid = false;
+                break;
+            }
+
+            uint32_t key = static_cast<uint32_t>(position) * static_cast<uint32_t>(texCoordCount) + texCoord;
+            auto [it, inserted] = vertexOf.try_emplace(key, static_cast<uint32_t>(corners.size()));
+            if (inserted) {
+                corners.emplace_back(position, texCoord);
+            }
+            triangleVertices[corner] = it->second;
+        }
+        if (valid) {
+            model.indices.insert(model.indices.end(), triangleVertices, triangleVertices + 3);
+        }
+    }
+    if (model.indices.empty()) {
+        return std::nullopt;
+    }
+
+    model.vertexCount = corners.size();
+    model.texCoords.resize(model.vertexCount * 2);
+    for (size_t v = 0; v < model.vertexCount; v++) {
+        const uint8_t *texCoord = texCoords + corners[v].second * TEXCOORD_SIZE;
+        model.texCoords[v * 2 + 0] = readI16(texCoord) / static_cast<float>(model.skinWidth);
+        model.texCoords[v * 2 + 1] = readI16(texCoord + 2) / static_cast<float>(model.skinHeight);
+    }
+
+    // Gather every frame's positions into vertex order, still packed, so the whole animation is one
+    // upload and nothing is expanded on the CPU while it plays
+    model.frames.resize(frameCount);
+    model.positions.resize(static_cast<size_t>(frameCount) * model.vertexCount * VERTEX_SIZE);
+    std::fill(model.mins, model.mins + 3, std::numeric_limits<float>::max());
+    std::fill(model.maxs, model.maxs + 3, std::numeric_limits<float>::lowest());
+
+    for (int32_t f = 0; f < frameCount; f++) {
+        const uint8_t *frame = data + header[OFS_FRAMES] + f * frameSize;
+        Md2Frame &out = model.frames[f];
+        std::memcpy(out.scale, frame, sizeof(out.scale));
+        std::memcpy(out.translate, frame + 12, sizeof(out.translate));
+        out.name = readName(frame + 24, FRAME_NAME_SIZE);
+
+        const uint8_t *vertices = frame + FRAME_HEADER_SIZE;
+        uint8_t *packed = model.positions.data() + f * model.vertexCount * VERTEX_SIZE;
+        uint8_t low[3] = {255, 255, 255};
+        uint8_t high[3] = {0, 0, 0};
+        for (size_t v = 0; v < model.vertexCount; v++) {
+            const uint8_t *vertex = vertices + corners[v].first * VERTEX_SIZE;
+            for (int axis = 0; axis < 3; axis++) {
+                packed[axis] = vertex[axis];
+                low[axis] = std::min(low[axis], vertex[axis]);
+                high[axis] = std::max(high[axis], vertex[axis]);
+            }
+            // Out of range normals are clamped here so the shader can index without checking
+            packed[3] = std::min<uint8_t>(vertex[3], NORMAL_COUNT - 1);
+            packed += VERTEX_SIZE;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            float a = low[axis] * out.scale[axis] + out.translate[axis];
+            float b = high[axis] * out.scale[axis] + out.translate[axis];
+            model.mins[axis] = std::min({model.mins[axis], a, b});
+            model.maxs[axis] = std::max({model.maxs[axis], a, b});
+        }
+    }
+
+    for (int32_t f = 0; f < frameCount; f++) {
+        std::string name = animationName(model.frames[f].name);
+        if (model.animations.empty() || model.animations.back().name != name) {
+            model.animations.push_back({std::move(name), f, 0});
+        }
+        model.animations.back().frameCount++;
+    }
+    return model;
+}
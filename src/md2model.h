@@ -0,0 +1,52 @@
+// Parses Quake 2 .md2 models into vertex data laid out for the GPU
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct Md2Frame {
+    std::string name;    // e.g. "run3"
+    float scale[3];      // Vertex positions are bytes, scaled and then translated into model space
+    float translate[3];
+};
+
+// A run of frames sharing a name apart from the trailing number, like run1 to run6
+struct Md2Animation {
+    std::string name;
+    int firstFrame;
+    int frameCount;
+};
+
+// MD2 triangles index positions and texture coordinates separately. Every distinct pair becomes one
+// vertex here, so the mesh can be drawn indexed, and each frame stores the same vertices in the same
+// order. The frames are kept packed the way the file has them, four bytes a vertex, for the vertex
+// shader to unpack and blend.
+struct Md2Model {
+    int skinWidth = 0;
+    int skinHeight = 0;
+    std::vector<std::string> skins; // Paths in the archive, usually of PCX images
+    std::vector<Md2Frame> frames;
+    std::vector<Md2Animation> animations;
+
+    size_t vertexCount = 0;         // In every frame
+    std::vector<uint8_t> positions; // frames * vertexCount * 4: x, y, z and an index into NORMALS
+    std::vector<float> texCoords;   // vertexCount * 2, 0..1 across the skin
+    std::vector<uint32_t> indices;  // Three per triangle
+
+    float mins[3] = {0.0f, 0.0f, 0.0f}; // Bounds over every frame, in model space
+    float maxs[3] = {0.0f, 0.0f, 0.0f};
+};
+
+class Md2Reader {
+public:
+    static constexpr size_t NORMAL_COUNT = 162;
+    // The precalculated normals every MD2 vertex picks from
+    static const float NORMALS[NORMAL_COUNT][3];
+
+    // Reads a model straight out of the bytes it's stored in, or nothing if it isn't a valid MD2
+    static auto read(const uint8_t *data, size_t size) -> std::optional<Md2Model>;
+};
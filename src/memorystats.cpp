@@ -0,0 +1,128 @@
+#include "memorystats.h"
+
+#include <fstream>
+#include <unistd.h>
+
+namespace {
+    struct Counter {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> peakBytes{0};
+        std::atomic<uint64_t> totalAllocations{0};
+        std::atomic<bool> gauge{false};
+    };
+
+    Counter counters[MemoryStats::CATEGORY_COUNT];
+
+    const char *const NAMES[MemoryStats::CATEGORY_COUNT] = {
+        "Entry table", "File tree", "Search index", "Prefetched images", "Decode buffers", "Palettes",
+        "Images", "Thumbnails", "Atlas pages", "Map textures", "Model skins", "Model buffers",
+        "Render targets", "Upload buffers",
+    };
+
+    auto counter(MemoryCategory category) -> Counter & {
+        return counters[static_cast<size_t>(category)];
+    }
+
+    auto raisePeak(Counter &counter, uint64_t bytes) -> void {
+        uint64_t peak = counter.peakBytes.load(std::memory_order_relaxed);
+        while (bytes > peak && !counter.peakBytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Saturates rather than wrapping, so a release that was never matched by an allocation shows as 0
+    auto subtract(std::atomic<uint64_t> &value, uint64_t amount) -> void {
+        uint64_t current = value.load(std::memory_order_relaxed);
+        while (!value.compare_exchange_weak(current, current > amount ? current - amount : 0, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+auto MemoryStats::allocate(MemoryCategory category, uint64_t bytes, uint64_t count) -> void {
+    Counter &c = counter(category);
+    uint64_t now = c.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    c.allocations.fetch_add(count, std::memory_order_relaxed);
+    c.totalAllocations.fetch_add(count, std::memory_order_relaxed);
+    raisePeak(c, now);
+}
+
+auto MemoryStats::release(MemoryCategory category, uint64_t bytes, uint64_t count) -> void {
+    Counter &c = counter(category);
+    subtract(c.bytes, bytes);
+    subtract(c.allocations, count);
+}
+
+auto MemoryStats::set(MemoryCategory category, uint64_t bytes, uint64_t allocations) -> void {
+    Counter &c = counter(category);
+    c.gauge.store(true, std::memory_order_relaxed);
+    c.allocations.store(allocations, std::memory_order_relaxed);
+    c.bytes.store(bytes, std::memory_order_relaxed);
+    raisePeak(c, bytes);
+}
+
+auto MemoryStats::snapshot() -> std::array<MemoryStat, CATEGORY_COUNT> {
+    std::array<MemoryStat, CATEGORY_COUNT> stats;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        auto category = static_cast<MemoryCategory>(i);
+        const Counter &c = counters[i];
+        stats[i] = {name(category), isGpu(category), c.bytes.load(std::memory_order_relaxed),
+                    c.allocations.load(std::memory_order_relaxed), c.peakBytes.load(std::memory_order_relaxed),
+                    c.totalAllocations.load(std::memory_order_relaxed), c.gauge.load(std::memory_order_relaxed)};
+    }
+    return stats;
+}
+
+auto MemoryStats::resetPeaks() -> void {
+    for (auto &c : counters) {
+        c.peakBytes.store(c.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+auto MemoryStats::name(MemoryCategory category) -> const char * {
+    return NAMES[static_cast<size_t>(category)];
+}
+
+auto MemoryStats::isGpu(MemoryCategory category) -> bool {
+    return category >= MemoryCategory::Images;
+}
+
+auto MemoryStats::residentBytes() -> uint64_t {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    if (statm >> size >> resident) {
+        return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+auto MemoryStats::writeJson(const std::string &path) -> bool {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    auto stats = snapshot();
+    uint64_t totals[2] = {0, 0};
+    for (const auto &stat : stats) {
+        totals[stat.gpu] += stat.bytes;
+    }
+
+    out << "{\n  \"residentBytes\": " << residentBytes() << ",\n  \"cpuBytes\": " << totals[0]
+        << ",\n  \"gpuBytes\": " << totals[1] << ",\n  \"categories\": [";
+    for (size_t i = 0; i < stats.size(); i++) {
+        const auto &stat = stats[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << stat.name << "\", \"gpu\": " << (stat.gpu ? "true" : "false")
+            << ", \"bytes\": " << stat.bytes << ", \"allocations\": " << stat.allocations
+            << ", \"peakBytes\": " << stat.peakBytes << ", \"totalAllocations\": ";
+        if (stat.gauge) {
+            out << "null}";
+        } else {
+            out << stat.totalAllocations << "}";
+        }
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
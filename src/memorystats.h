@@ -0,0 +1,82 @@
+// Live memory and allocation counts per subsystem
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class MemoryCategory : uint8_t {
+    // CPU
+    EntryTable,
+    FileTree,
+    SearchIndex,
+    PrefetchedImages,
+    DecodeBuffers,
+    Palettes,
+    // GPU, estimated from the sizes asked for rather than what the driver really holds
+    Images,
+    Thumbnails,
+    AtlasPages,
+    MapTextures,
+    ModelSkins,
+    ModelBuffers,
+    RenderTargets,
+    UploadBuffers,
+    Count
+};
+
+struct MemoryStat {
+    const char *name;
+    bool gpu;
+    uint64_t bytes;            // Live now
+    uint64_t allocations;      // Live now
+    uint64_t peakBytes;        // Highest bytes has been since the start or the last resetPeaks()
+    uint64_t totalAllocations; // Ever made. Not known for gauges.
+    bool gauge;                // Measured by set() rather than accounted allocation by allocation
+};
+
+// Counters are plain atomics, so accounting from the decode workers costs about as much as the
+// increments themselves and never takes a lock. Subsystems that own their memory outright report
+// each allocation and release, as does every entry table, copies included; the ones whose size is
+// simplest to measure after the fact (the tree, the search index) are gauges that set() overwrites
+// whenever they're rebuilt.
+class MemoryStats {
+public:
+    static constexpr size_t CATEGORY_COUNT = static_cast<size_t>(MemoryCategory::Count);
+
+    static auto allocate(MemoryCategory category, uint64_t bytes, uint64_t count = 1) -> void;
+    static auto release(MemoryCategory category, uint64_t bytes, uint64_t count = 1) -> void;
+    static auto set(MemoryCategory category, uint64_t bytes, uint64_t allocations) -> void;
+
+    static auto snapshot() -> std::array<MemoryStat, CATEGORY_COUNT>;
+    static auto resetPeaks() -> void;
+
+    static auto name(MemoryCategory category) -> const char *;
+    static auto isGpu(MemoryCategory category) -> bool;
+
+    // Resident set size of the whole process, for comparing against what's accounted. 0 where unknown.
+    static auto residentBytes() -> uint64_t;
+
+    // Writes every category as JSON, for checking against budgets in scripts. A gauge's
+    // totalAllocations is null, since only what it holds at each reading is known.
+    static auto writeJson(const std::string &path) -> bool;
+};
+
+// Accounts a transient buffer for as long as the scope lives
+class MemoryScope {
+public:
+    MemoryScope(MemoryCategory category, uint64_t bytes) : category(category), bytes(bytes) {
+        MemoryStats::allocate(category, bytes);
+    }
+    ~MemoryScope() { MemoryStats::release(category, bytes); }
+
+    MemoryScope(const MemoryScope &) = delete;
+    MemoryScope &operator=(const MemoryScope &) = delete;
+
+private:
+    MemoryCategory category;
+    uint64_t bytes;
+};
@@ -0,0 +1,371 @@
+#include "modelpreview.h"
+#include "memorystats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+
+namespace {
+    constexpr GLuint FRAME_ATTRIBUTE = 0;      // uvec4 x, y, z, normal index of the frame being blended from
+    constexpr GLuint NEXT_FRAME_ATTRIBUTE = 1; // The same for the frame being blended towards
+    constexpr GLuint TEXCOORD_ATTRIBUTE = 2;
+    constexpr size_t PACKED_VERTEX_SIZE = 4;
+    constexpr float FIELD_OF_VIEW = 0.7854f; // 45 degrees, in radians
+
+    // RGBA8 colour plus a 24 bit depth buffer, which drivers pad out to 32 bits
+    auto targetBytes(int width, int height) -> uint64_t {
+        return static_cast<uint64_t>(width) * height * 8;
+    }
+
+    const char *VERTEX_SHADER = R"(#version 410 core
+layout(location = 0) in uvec4 frameVertex;
+layout(location = 1) in uvec4 nextFrameVertex;
+layout(location = 2) in vec2 texCoord;
+
+uniform mat4 viewProjection;
+uniform vec3 lightDirection;
+uniform vec3 scale[2];
+uniform vec3 translate[2];
+uniform float blend;
+uniform vec3 normals[162];
+
+out vec2 uv;
+out float shade;
+
+void main()
+{
+    vec3 from = vec3(frameVertex.xyz) * scale[0] + translate[0];
+    vec3 to = vec3(nextFrameVertex.xyz) * scale[1] + translate[1];
+    vec3 normal = normalize(mix(normals[frameVertex.w], normals[nextFrameVertex.w], blend));
+
+    gl_Position = viewProjection * vec4(mix(from, to, blend), 1.0);
+    uv = texCoord;
+    shade = 0.4 + 0.6 * max(dot(normal, lightDirection), 0.0);
+}
+)";
+
+    const char *FRAGMENT_SHADER = R"(#version 410 core
+in vec2 uv;
+in float shade;
+
+uniform sampler2D skin;
+uniform bool textured;
+
+out vec4 color;
+
+void main()
+{
+    vec3 albedo = textured ? texture(skin, uv).rgb : vec3(0.75);
+    color = vec4(albedo * shade, 1.0);
+}
+)";
+
+    // Column-major, as glUniformMatrix4fv takes it
+    using Matrix = std::array<float, 16>;
+
+    auto multiply(const Matrix &a, const Matrix &b) -> Matrix {
+        Matrix result{};
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) {
+                for (int k = 0; k < 4; k++) {
+                    result[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+                }
+            }
+        }
+        return result;
+    }
+
+    auto perspective(float fieldOfView, float aspect, float near, float far) -> Matrix {
+        float f = 1.0f / std::tan(fieldOfView / 2.0f);
+        Matrix m{};
+        m[0] = f / aspect;
+        m[5] = f;
+        m[10] = (far + near) / (near - far);
+        m[11] = -1.0f;
+        m[14] = 2.0f * far * near / (near - far);
+        return m;
+    }
+
+    // Quake models stand on the XY plane with Z up
+    auto lookAt(const float eye[3], const float target[3]) -> Matrix {
+        float forward[3] = {target[0] - eye[0], target[1] - eye[1], target[2] - eye[2]};
+        float length = std::sqrt(forward[0] * forward[0] + forward[1] * forward[1] + forward[2] * forward[2]);
+        for (float &v : forward) {
+            v /= length;
+        }
+        // forward x up, with up = (0, 0, 1)
+        float side[3] = {forward[1], -forward[0], 0.0f};
+        length = std::sqrt(side[0] * side[0] + side[1] * side[1]);
+        if (length < 1e-6f) {
+            side[0] = 1.0f;
+            side[1] = 0.0f;
+            length = 1.0f;
+        }
+        side[0] /= length;
+        side[1] /= length;
+        float up[3] = {side[1] * forward[2] - side[2] * forward[1], side[2] * forward[0] - side[0] * forward[2],
+                       side[0] * forward[1] - side[1] * forward[0]};
+
+        Matrix m{};
+        for (int i = 0; i < 3; i++) {
+            m[i * 4 + 0] = side[i];
+            m[i * 4 + 1] = up[i];
+            m[i * 4 + 2] = -forward[i];
+        }
+        m[12] = -(side[0] * eye[0] + side[1] * eye[1] + side[2] * eye[2]);
+        m[13] = -(up[0] * eye[0] + up[1] * eye[1] + up[2] * eye[2]);
+        m[14] = forward[0] * eye[0] + forward[1] * eye[1] + forward[2] * eye[2];
+        m[15] = 1.0f;
+        return m;
+    }
+
+    auto compileShader(GLenum type, const char *source) -> GLuint {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (compiled != GL_TRUE) {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "Model shader didn't compile: " << log << std::endl;
+            glDeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+}
+
+auto ModelPreview::createProgram() -> bool {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, VERTEX_SHADER);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER);
+    if (vertexShader && fragmentShader) {
+        program = glCreateProgram();
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glLinkProgram(program);
+    }
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = GL_FALSE;
+    if (program) {
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    }
+    if (linked != GL_TRUE) {
+        if (program) {
+            char log[1024];
+            glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+            std::cerr << "Model shader didn't link: " << log << std::endl;
+            glDeleteProgram(program);
+            program = 0;
+        }
+        return false;
+    }
+
+    uniforms.viewProjection = glGetUniformLocation(program, "viewProjection");
+    uniforms.lightDirection = glGetUniformLocation(program, "lightDirection");
+    uniforms.scale[0] = glGetUniformLocation(program, "scale[0]");
+    uniforms.scale[1] = glGetUniformLocation(program, "scale[1]");
+    uniforms.translate[0] = glGetUniformLocation(program, "translate[0]");
+    uniforms.translate[1] = glGetUniformLocation(program, "translate[1]");
+    uniforms.blend = glGetUniformLocation(program, "blend");
+    uniforms.normals = glGetUniformLocation(program, "normals");
+    uniforms.skin = glGetUniformLocation(program, "skin");
+    uniforms.textured = glGetUniformLocation(program, "textured");
+
+    // The normal table never changes, so it's set once for the life of the program
+    glUseProgram(program);
+    glUniform3fv(uniforms.normals, Md2Reader::NORMAL_COUNT, &Md2Reader::NORMALS[0][0]);
+    glUniform1i(uniforms.skin, 0);
+    glUseProgram(0);
+    return true;
+}
+
+auto ModelPreview::resizeTarget(int width, int height) -> bool {
+    if (framebuffer && width == targetWidth && height == targetHeight) {
+        return true;
+    }
+
+    if (!framebuffer) {
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &colorTexture);
+        glGenRenderbuffers(1, &depthBuffer);
+        MemoryStats::allocate(MemoryCategory::RenderTargets, 0, 2);
+    }
+    MemoryStats::release(MemoryCategory::RenderTargets, targetBytes(targetWidth, targetHeight), 0);
+    MemoryStats::allocate(MemoryCategory::RenderTargets, targetBytes(width, height), 0);
+
+    glBindTexture(GL_TEXTURE_2D, colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    targetWidth = width;
+    targetHeight = height;
+    return complete;
+}
+
+auto ModelPreview::load(const Md2Model &model) -> bool {
+    TRACE_SCOPE("Upload model");
+    unload();
+    if (model.vertexCount == 0 || model.indices.empty()) {
+        return false;
+    }
+
+    size_t positionBytes = model.positions.size();
+    size_t texCoordBytes = model.texCoords.size() * sizeof(float);
+
+    glGenVertexArrays(1, &vertexArray);
+    glGenBuffers(1, &vertexBuffer);
+    glGenBuffers(1, &indexBuffer);
+
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, positionBytes + texCoordBytes, nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, positionBytes, model.positions.data());
+    glBufferSubData(GL_ARRAY_BUFFER, positionBytes, texCoordBytes, model.texCoords.data());
+
+    // Texture coordinates are the same in every frame, so only the two frame attributes move per draw
+    glEnableVertexAttribArray(FRAME_ATTRIBUTE);
+    glEnableVertexAttribArray(NEXT_FRAME_ATTRIBUTE);
+    glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE);
+    glVertexAttribPointer(TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const void *>(positionBytes));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, model.indices.size() * sizeof(uint32_t), model.indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    vertexCount = model.vertexCount;
+    frameCount = model.frames.size();
+    indexCount = model.indices.size();
+    vertexBytes = positionBytes + texCoordBytes;
+    indexBytes = model.indices.size() * sizeof(uint32_t);
+    MemoryStats::allocate(MemoryCategory::ModelBuffers, vertexBytes + indexBytes, 2);
+    return true;
+}
+
+auto ModelPreview::unload() -> void {
+    if (vertexArray) {
+        glDeleteVertexArrays(1, &vertexArray);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        MemoryStats::release(MemoryCategory::ModelBuffers, vertexBytes + indexBytes, 2);
+    }
+    vertexArray = vertexBuffer = indexBuffer = 0;
+    vertexCount = frameCount = indexCount = 0;
+    vertexBytes = indexBytes = 0;
+}
+
+auto ModelPreview::render(const Md2Model &model, const Pose &pose, int width, int height) -> GLuint {
+    TRACE_SCOPE("Render model");
+    if (!vertexArray || width <= 0 || height <= 0 || model.frames.size() != frameCount) {
+        return 0;
+    }
+    if (!program && (programFailed || !createProgram())) {
+        programFailed = true;
+        return 0;
+    }
+    if (!resizeTarget(width, height)) {
+        return 0;
+    }
+
+    int frames[2] = {std::clamp(pose.frame, 0, static_cast<int>(frameCount) - 1),
+                     std::clamp(pose.nextFrame, 0, static_cast<int>(frameCount) - 1)};
+
+    // Orbit the middle of the bounds from far enough away that the whole animation stays in view
+    float center[3];
+    float radius = 0.0f;
+    for (int axis = 0; axis < 3; axis++) {
+        center[axis] = (model.mins[axis] + model.maxs[axis]) / 2.0f;
+        float half = (model.maxs[axis] - model.mins[axis]) / 2.0f;
+        radius += half * half;
+    }
+    radius = std::max(std::sqrt(radius), 1.0f);
+    float distance = radius / std::sin(FIELD_OF_VIEW / 2.0f) * pose.zoom;
+    float toEye[3] = {std::cos(pose.pitch) * std::cos(pose.yaw), std::cos(pose.pitch) * std::sin(pose.yaw),
+                      std::sin(pose.pitch)};
+    float eye[3] = {center[0] + toEye[0] * distance, center[1] + toEye[1] * distance, center[2] + toEye[2] * distance};
+
+    float near = std::max(distance - radius * 1.5f, distance * 0.01f);
+    float far = distance + radius * 1.5f;
+    Matrix viewProjection = multiply(perspective(FIELD_OF_VIEW, static_cast<float>(width) / height, near, far),
+                                     lookAt(eye, center));
+
+    // Light from over the viewer's shoulder, so the side facing the camera is always lit
+    float light[3] = {toEye[0] - toEye[1] * 0.5f, toEye[1] + toEye[0] * 0.5f, toEye[2] + 0.7f};
+    float lightLength = std::sqrt(light[0] * light[0] + light[1] * light[1] + light[2] * light[2]);
+
+    // The rest of the frame is drawn over a clear it didn't expect to be changed
+    GLfloat clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glClearColor(0.12f, 0.12f, 0.14f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+
+    glUseProgram(program);
+    glUniformMatrix4fv(uniforms.viewProjection, 1, GL_FALSE, viewProjection.data());
+    glUniform3f(uniforms.lightDirection, light[0] / lightLength, light[1] / lightLength, light[2] / lightLength);
+    for (int i = 0; i < 2; i++) {
+        glUniform3fv(uniforms.scale[i], 1, model.frames[frames[i]].scale);
+        glUniform3fv(uniforms.translate[i], 1, model.frames[frames[i]].translate);
+    }
+    glUniform1f(uniforms.blend, std::clamp(pose.blend, 0.0f, 1.0f));
+    glUniform1i(uniforms.textured, pose.skin != 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, pose.skin);
+
+    // Picking the two keyframes is just a matter of where the attributes start reading
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    size_t frameBytes = vertexCount * PACKED_VERTEX_SIZE;
+    glVertexAttribIPointer(FRAME_ATTRIBUTE, 4, GL_UNSIGNED_BYTE, 0, reinterpret_cast<const void *>(frames[0] * frameBytes));
+    glVertexAttribIPointer(NEXT_FRAME_ATTRIBUTE, 4, GL_UNSIGNED_BYTE, 0,
+                           reinterpret_cast<const void *>(frames[1] * frameBytes));
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCount), GL_UNSIGNED_INT, nullptr);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+    glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return colorTexture;
+}
+
+auto ModelPreview::release() -> void {
+    unload();
+    if (program) {
+        glDeleteProgram(program);
+    }
+    if (framebuffer) {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        MemoryStats::release(MemoryCategory::RenderTargets, targetBytes(targetWidth, targetHeight), 2);
+    }
+    program = framebuffer = colorTexture = depthBuffer = 0;
+    targetWidth = targetHeight = 0;
+}
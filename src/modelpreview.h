@@ -0,0 +1,75 @@
+// Draws MD2 models into an offscreen texture for the content area
+
+#pragma once
+
+#include <cstddef>
+#include "md2model.h"
+#include "types.h"
+
+// Every frame of the animation sits in one vertex buffer, packed as the model file has them, with the
+// texture coordinates after them. Drawing a pose points two vertex attributes at the frames either
+// side of it and the vertex shader unpacks, blends and lights them, so an animation plays without the
+// CPU touching a single vertex. GL objects are created on first use and need the context, so call
+// release() before it goes.
+class ModelPreview {
+public:
+    struct Pose {
+        int frame = 0;      // Blends from frame towards nextFrame
+        int nextFrame = 0;
+        float blend = 0.0f; // 0 is frame, 1 is nextFrame
+        float yaw = 0.0f;   // Camera orbit around the model, in radians
+        float pitch = 0.0f;
+        float zoom = 1.0f;  // 1 fits the model's bounds in view
+        GLuint skin = 0;    // 0 shades the model without a texture
+    };
+
+    ModelPreview() = default;
+    ModelPreview(const ModelPreview &) = delete;
+    ModelPreview &operator=(const ModelPreview &) = delete;
+
+    // Uploads the model's vertices, replacing whatever was loaded. The model's vertex arrays aren't
+    // needed once this returns.
+    auto load(const Md2Model &model) -> bool;
+    auto unload() -> void;
+
+    // Draws the loaded model at width x height and returns the texture holding the result, or 0 if
+    // nothing is loaded. model has to be the one passed to load(), for its frames and bounds.
+    auto render(const Md2Model &model, const Pose &pose, int width, int height) -> GLuint;
+
+    // Frees the shader and render target as well as the model
+    auto release() -> void;
+
+    auto bufferSize() const -> size_t { return vertexBytes + indexBytes; } // Bytes of the loaded model on the GPU
+
+private:
+    auto createProgram() -> bool;
+    auto resizeTarget(int width, int height) -> bool;
+
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint depthBuffer = 0;
+    int targetWidth = 0;
+    int targetHeight = 0;
+    bool programFailed = false; // Don't retry a shader that didn't compile every frame
+
+    size_t vertexCount = 0; // Per frame
+    size_t frameCount = 0;
+    size_t indexCount = 0;
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+
+    struct {
+        GLint viewProjection;
+        GLint lightDirection;
+        GLint scale[2];
+        GLint translate[2];
+        GLint blend;
+        GLint normals;
+        GLint skin;
+        GLint textured;
+    } uniforms{};
+};
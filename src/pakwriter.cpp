@@ -0,0 +1,166 @@
+#include "pakwriter.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+    constexpr char PAK_SIGNATURE[4] = {'P', 'A', 'C', 'K'};
+    constexpr size_t HEADER_SIZE = 12;
+    constexpr size_t STREAM_CHUNK = 1024 * 1024;
+
+    // Splits a path into the parts the directory layout sorts on
+    struct PathKey {
+        std::string_view directory;
+        std::string_view extension;
+        std::string_view name;
+    };
+
+    auto pathKey(std::string_view path) -> PathKey {
+        size_t slash = path.rfind('/');
+        std::string_view directory = slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+        std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+
+        size_t dot = name.rfind('.');
+        std::string_view extension = dot == std::string_view::npos ? std::string_view() : name.substr(dot + 1);
+        return {directory, extension, name};
+    }
+}
+
+auto PakWriter::open(const std::string &path) -> bool {
+    directory.clear();
+
+    // The real header goes in once the directory's position is known
+    uint8_t header[HEADER_SIZE] = {};
+    return output.open(path) && output.write(header, sizeof(header));
+}
+
+auto PakWriter::canAdd(std::string_view name, uint64_t size) const -> bool {
+    uint64_t directorySize = (directory.size() + 1) * sizeof(DirectoryEntry);
+    return !name.empty() && name.size() <= MAX_NAME_LENGTH &&
+           output.position() + size + directorySize <= MAX_ARCHIVE_SIZE;
+}
+
+auto PakWriter::record(std::string_view name, uint64_t offset, uint64_t size) -> void {
+    DirectoryEntry entry = {};
+    std::memcpy(entry.name, name.data(), name.size());
+    entry.offset = static_cast<uint32_t>(offset);
+    entry.size = static_cast<uint32_t>(size);
+    directory.push_back(entry);
+}
+
+auto PakWriter::add(std::string_view name, const void *data, size_t size) -> bool {
+    if (!canAdd(name, size)) {
+        return false;
+    }
+
+    uint64_t offset = output.position();
+    if (!output.write(data, size)) {
+        return false;
+    }
+
+    record(name, offset, size);
+    return true;
+}
+
+auto PakWriter::addStream(std::string_view name, EntryStream &stream) -> bool {
+    if (!canAdd(name, stream.size())) {
+        return false;
+    }
+
+    uint64_t offset = output.position();
+    std::vector<uint8_t> chunk(static_cast<size_t>(std::min<uint64_t>(stream.size(), STREAM_CHUNK)));
+
+    uint64_t remaining = stream.size();
+    while (remaining > 0) {
+        size_t read = stream.read(chunk.data(), static_cast<size_t>(std::min<uint64_t>(remaining, chunk.size())));
+        // A short read leaves what was copied as dead space; the archive itself is still valid
+        if (read == 0 || !output.write(chunk.data(), read)) {
+            return false;
+        }
+        remaining -= read;
+    }
+
+    record(name, offset, stream.size());
+    return true;
+}
+
+auto PakWriter::addFileRange(std::string_view name, int fd, uint64_t offset, uint64_t size) -> bool {
+    if (!canAdd(name, size)) {
+        return false;
+    }
+
+    uint64_t start = output.position();
+    if (!output.copyFrom(fd, offset, size)) {
+        return false;
+    }
+
+    record(name, start, size);
+    return true;
+}
+
+auto PakWriter::finish() -> bool {
+    TRACE_SCOPE("Write PAK directory");
+    uint64_t directoryOffset = output.position();
+    uint64_t directorySize = directory.size() * sizeof(DirectoryEntry);
+    if (directoryOffset + directorySize > MAX_ARCHIVE_SIZE ||
+        !output.write(directory.data(), directorySize)) {
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    uint32_t fields[2] = {static_cast<uint32_t>(directoryOffset), static_cast<uint32_t>(directorySize)};
+    std::memcpy(header, PAK_SIGNATURE, sizeof(PAK_SIGNATURE));
+    std::memcpy(header + 4, fields, sizeof(fields));
+
+    return output.writeAt(0, header, sizeof(header)) && output.commit();
+}
+
+auto PakWriter::order(const EntryTable &entries, PakLayout layout, const std::vector<std::string> &accessLog)
+    -> std::vector<EntryId> {
+    std::vector<EntryId> ids(entries.size());
+    std::iota(ids.begin(), ids.end(), 0);
+
+    if (layout == PakLayout::Name) {
+        std::sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) { return entries.name(a) < entries.name(b); });
+    } else if (layout == PakLayout::Directory) {
+        std::vector<PathKey> keys(entries.size());
+        for (EntryId id = 0; id < entries.size(); id++) {
+            keys[id] = pathKey(entries.name(id));
+        }
+        std::sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) {
+            const PathKey &x = keys[a];
+            const PathKey &y = keys[b];
+            if (x.directory != y.directory) {
+                return x.directory < y.directory;
+            }
+            if (x.extension != y.extension) {
+                return x.extension < y.extension;
+            }
+            return x.name < y.name;
+        });
+    }
+
+    if (accessLog.empty()) {
+        return ids;
+    }
+
+    // Pull the logged entries to the front, keeping the layout order for the rest
+    std::unordered_map<std::string_view, size_t> firstUse;
+    for (size_t i = 0; i < accessLog.size(); i++) {
+        firstUse.emplace(accessLog[i], i);
+    }
+
+    std::vector<size_t> ranks(entries.size(), SIZE_MAX);
+    for (EntryId id = 0; id < entries.size(); id++) {
+        auto it = firstUse.find(entries.name(id));
+        if (it != firstUse.end()) {
+            ranks[id] = it->second;
+        }
+    }
+
+    std::stable_sort(ids.begin(), ids.end(), [&](EntryId a, EntryId b) { return ranks[a] < ranks[b]; });
+    return ids;
+}
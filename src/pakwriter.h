@@ -0,0 +1,61 @@
+// Writes Quake .pak archives
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrystream.h"
+#include "entrytable.h"
+#include "filewriter.h"
+
+// Order entries are written in. Entries read together are quickest to load when they sit next to each
+// other on disk.
+enum class PakLayout {
+    Original,  // As they are in the source
+    Name,      // Sorted by full path
+    Directory, // Each directory's files together, grouped by extension, ahead of its subdirectories
+};
+
+// Entry data is written first and the directory after it, with the header patched in at the end, so an
+// archive is written in a single forward pass.
+class PakWriter {
+public:
+    static constexpr size_t MAX_NAME_LENGTH = 55;            // Names are stored in 56 bytes with a NUL
+    static constexpr uint64_t MAX_ARCHIVE_SIZE = UINT32_MAX; // Offsets and sizes are 32-bit on disk
+
+    auto open(const std::string &path) -> bool;
+
+    // False when the name is too long or the entry would take the archive past MAX_ARCHIVE_SIZE
+    auto canAdd(std::string_view name, uint64_t size) const -> bool;
+
+    // Each returns false without adding a directory entry if the entry can't be stored
+    auto add(std::string_view name, const void *data, size_t size) -> bool;
+    auto addStream(std::string_view name, EntryStream &stream) -> bool;
+    auto addFileRange(std::string_view name, int fd, uint64_t offset, uint64_t size) -> bool;
+
+    // Writes the directory and header. Nothing shows up at the destination until this succeeds.
+    auto finish() -> bool;
+
+    auto hasFailed() const -> bool { return output.hasFailed(); }
+    auto entryCount() const -> size_t { return directory.size(); }
+    auto bytesWritten() const -> uint64_t { return output.position(); }
+
+    // Entries in layout order. Anything named in accessLog comes first, in the order it was first used.
+    static auto order(const EntryTable &entries, PakLayout layout, const std::vector<std::string> &accessLog = {})
+        -> std::vector<EntryId>;
+
+private:
+    struct DirectoryEntry {
+        char name[56];
+        uint32_t offset;
+        uint32_t size;
+    };
+    static_assert(sizeof(DirectoryEntry) == 64, "PAK directory entries are 64 bytes on disk");
+
+    auto record(std::string_view name, uint64_t offset, uint64_t size) -> void;
+
+    FileWriter output;
+    std::vector<DirectoryEntry> directory;
+};
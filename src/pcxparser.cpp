@@ -1,10 +1,22 @@
 #include "pcxparser.h"
+#include "trace.h"
 
 #include <vector>
-#include <fstream>
 #include <optional>
 #include <algorithm>
+#include <array>
 #include <cstdint>
+#include <cstring>
+
+// Defining PCX_SCALAR leaves out the vector code, so the tests can check both against each other
+#if defined(PCX_SCALAR)
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PCX_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCX_NEON
+#endif
 
 constexpr uint8_t  PCX_MAGIC_NUMBER        = 0x0A;  // The first byte of a PCX file should always equal this magic number.
 constexpr uint8_t  PCX_HEADER_SIZE         = 128;   // Size in bytes of the PCX file header
@@ -12,26 +24,54 @@ constexpr uint16_t PALETTE_SIZE_256        = 768;   // The size in bytes of the
 constexpr uint8_t  PALETTE_SIZE_EGA        = 48;    // The size in bytes of the 16-color EGA palette
 constexpr uint8_t  PALETTE_256_MARKER_BYTE = 0x0C;  // Byte marker that indicates the start of a 256 color palette, which immediately precedes the palette data
 
-auto readHeader(std::ifstream &file) -> std::optional<PCXHeader> {
-    // TODO: We should be checking the magic number and validating it's correct
+// The standard EGA colours, for 16-color images whose header doesn't carry a palette of its own
+constexpr uint8_t DEFAULT_EGA_PALETTE[PALETTE_SIZE_EGA] = {
+    0x00, 0x00, 0x00,  0x00, 0x00, 0xAA,  0x00, 0xAA, 0x00,  0x00, 0xAA, 0xAA,
+    0xAA, 0x00, 0x00,  0xAA, 0x00, 0xAA,  0xAA, 0x55, 0x00,  0xAA, 0xAA, 0xAA,
+    0x55, 0x55, 0x55,  0x55, 0x55, 0xFF,  0x55, 0xFF, 0x55,  0x55, 0xFF, 0xFF,
+    0xFF, 0x55, 0x55,  0xFF, 0x55, 0xFF,  0xFF, 0xFF, 0x55,  0xFF, 0xFF, 0xFF,
+};
+
+// How the scanlines store their pixels
+enum class PCXLayout {
+    Unsupported,
+    Packed,    // One plane of 1, 2, 4 or 8 bit palette indices
+    Planar,    // 2 to 4 planes of 1 bit each, which together make up a palette index (EGA is 4 planes)
+    TrueColor  // 3 planes of 8 bit red, green and blue, with an optional fourth plane of alpha
+};
+
+using PaletteTable = std::array<std::array<uint8_t, 4>, 256>; // RGBA for each palette index
 
+auto static readHeader(const std::vector<uint8_t> &data) -> std::optional<PCXHeader> {
+    if (data.size() < PCX_HEADER_SIZE) {
+        return std::nullopt;
+    }
+
+    // The header is packed and little endian on disk, which matches the struct layout
     PCXHeader header;
-    file.read(reinterpret_cast<char *>(&header.magic_number), 1);
-    file.read(reinterpret_cast<char *>(&header.version), 1);
-    file.read(reinterpret_cast<char *>(&header.encoding), 1);
-    file.read(reinterpret_cast<char *>(&header.bitsPerPixel), 1);
-    file.read(reinterpret_cast<char *>(&header.xmin), 2);
-    file.read(reinterpret_cast<char *>(&header.ymin), 2);
-    file.read(reinterpret_cast<char *>(&header.xmax), 2);
-    file.read(reinterpret_cast<char *>(&header.ymax), 2);
-    file.read(reinterpret_cast<char *>(&header.hres), 2);
-    file.read(reinterpret_cast<char *>(&header.vres), 2);
-    file.read(reinterpret_cast<char *>(header.palette), PALETTE_SIZE_EGA);
-    file.seekg(1, std::ios::cur); // reserved
-    file.read(reinterpret_cast<char *>(&header.colorPlanes), 1);
-    file.read(reinterpret_cast<char *>(&header.bytesPerLine), 2);
-
-    return file ? std::optional(header) : std::nullopt;
+    std::memcpy(&header, data.data(), sizeof(PCXHeader));
+
+    if (header.magic_number != PCX_MAGIC_NUMBER) {
+        return std::nullopt;
+    }
+
+    return header;
+}
+
+auto static getLayout(const PCXHeader &header) -> PCXLayout {
+    int bits = header.bitsPerPixel;
+    int planes = header.colorPlanes;
+
+    if (planes == 1 && (bits == 1 || bits == 2 || bits == 4 || bits == 8)) {
+        return PCXLayout::Packed;
+    }
+    if (bits == 1 && planes >= 2 && planes <= 4) {
+        return PCXLayout::Planar;
+    }
+    if (bits == 8 && (planes == 3 || planes == 4)) {
+        return PCXLayout::TrueColor;
+    }
+    return PCXLayout::Unsupported;
 }
 
 // Check if a byte has an run marker in it used by run-length encoding (RLE).
@@ -55,17 +95,21 @@ auto static inline getRunCount(uint8_t byte) -> uint8_t {
 }
 
 // Decodes PCX image data encoded using run-length encoding (RLE).
-auto decodeRLE(const std::vector<uint8_t> &raw, size_t size) -> std::vector<uint8_t> {
+auto static decodeRLE(const uint8_t *raw, size_t rawSize, size_t size) -> std::vector<uint8_t> {
+    TRACE_SCOPE("Decode PCX RLE");
     std::vector<uint8_t> decoded(size);
 
     size_t src = 0;
     size_t dst = 0;
 
-    while (dst < size && src < raw.size()) {
+    while (dst < size && src < rawSize) {
         uint8_t byte = raw[src++];
 
         if (hasRunMarker(byte)) { // If the top two bits are being used as a run marker...
 	    uint8_t count = getRunCount(byte);  // The remaining 6 bits tell us the run count.
+	    if (src >= rawSize) {
+	        break;
+	    }
 	    byte = raw[src++];
             std::fill_n(decoded.begin() + dst, std::min<size_t>(count, size - dst), byte);
             dst += count;
@@ -87,15 +131,21 @@ auto static inline getImageDimensions(const PCXHeader header) -> std::pair<int,
     return std::make_pair(width, height);
 }
 
-auto PCXParser::loadPCX(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<PCXImage> {
-    std::ifstream file(pakPath, std::ios::binary);
+auto PCXParser::readPalette(const std::vector<uint8_t> &data) -> std::optional<std::vector<uint8_t>> {
+    if (data.size() < PCX_HEADER_SIZE + PALETTE_SIZE_256 + 1) {
+        return std::nullopt;
+    }
 
-    if (!file.is_open()) {
+    auto marker = data.end() - PALETTE_SIZE_256 - 1;
+    if (*marker != PALETTE_256_MARKER_BYTE) {
         return std::nullopt;
     }
 
-    file.seekg(entry.offset);
-    auto header = readHeader(file);
+    return std::vector<uint8_t>(marker + 1, data.end());
+}
+
+auto PCXParser::probePCX(const std::vector<uint8_t> &data) -> std::optional<ImageInfo> {
+    auto header = readHeader(data);
 
     if (!header) {
         return std::nullopt;
@@ -103,45 +153,208 @@ auto PCXParser::loadPCX(const std::string &pakPath, const PakFileEntry &entry) -
 
     auto [width, height] = getImageDimensions(*header);
 
-    // Read the raw image data
-    std::vector<uint8_t> raw(entry.size - PCX_HEADER_SIZE);
-    file.seekg(entry.offset + PCX_HEADER_SIZE);
-    file.read(reinterpret_cast<char *>(raw.data()), raw.size());
+    if (width <= 0 || height <= 0 || getLayout(*header) == PCXLayout::Unsupported) {
+        return std::nullopt;
+    }
+
+    int bits = header->bitsPerPixel * header->colorPlanes;
+    return ImageInfo{width, height, "PCX " + std::to_string(bits) + "-bit"};
+}
+
+// Palettes up to 16 colors live in the header. Plenty of files leave it empty, which means the
+// standard EGA colors, or black and white for 1 bit images.
+auto static buildPalette(const std::vector<uint8_t> &data, const PCXHeader &header, int indexBits) -> PaletteTable {
+    PaletteTable table{};
+    auto setColor = [&](int index, const uint8_t *rgb) { table[index] = {rgb[0], rgb[1], rgb[2], 255}; };
+
+    if (indexBits == 8) {
+        auto palette = PCXParser::readPalette(data);
+        for (int i = 0; i < 256; i++) {
+            if (palette) {
+                setColor(i, palette->data() + i * 3);
+            } else {
+                // Without a trailing palette the best guess is greyscale
+                auto grey = static_cast<uint8_t>(i);
+                table[i] = {grey, grey, grey, 255};
+            }
+        }
+        return table;
+    }
+
+    bool empty = header.version == PCXVersion::PCX_VERSION_2_8_NO_PALETTE ||
+                 std::all_of(std::begin(header.palette), std::end(header.palette), [](uint8_t c) { return c == 0; });
+
+    if (indexBits == 1 && (empty || std::memcmp(header.palette, header.palette + 3, 3) == 0)) {
+        table[0] = {0, 0, 0, 255};
+        table[1] = {255, 255, 255, 255};
+        return table;
+    }
+
+    const uint8_t *ega = empty ? DEFAULT_EGA_PALETTE : header.palette;
+    for (int i = 0; i < 16; i++) {
+        setColor(i, ega + i * 3);
+    }
+    return table;
+}
 
-    // Decode RLE data
-    auto data = decodeRLE(raw, width * height);
+// Spreads the 8 bits of a byte out into 8 bytes of 0 or 1, most significant bit first, so a byte of
+// 1 bit pixels unpacks with one lookup. Values stay below 16 however they're shifted and combined,
+// so the shifts never carry from one byte into the next.
+struct BitSpreadTable {
+    uint64_t spread[256];
 
-    // TODO: We're assuming that the PCX image has a 256 color palette, which is going to be true
-    // the vast majority of the time but isn't guaranteed, and the code will likely choke on those edge
-    // cases.
+    BitSpreadTable() {
+        for (int value = 0; value < 256; value++) {
+            uint8_t bytes[8];
+            for (int bit = 0; bit < 8; bit++) {
+                bytes[bit] = (value >> (7 - bit)) & 1;
+            }
+            std::memcpy(&spread[value], bytes, sizeof(bytes));
+        }
+    }
+};
 
-    // Read the palette data
-    std::vector<uint8_t> palette(PALETTE_SIZE_256);
-    file.seekg(entry.offset + entry.size - PALETTE_SIZE_256 - 1);
-    uint8_t paletteMarker;
-    file.read(reinterpret_cast<char *>(&paletteMarker), 1);
+const BitSpreadTable bitSpread;
 
-    if (paletteMarker == PALETTE_256_MARKER_BYTE) {
-        file.read(reinterpret_cast<char *>(palette.data()), PALETTE_SIZE_256);
+// Palette indices for one row of 1 bit planes. Plane p supplies bit p of each index.
+auto static unpackPlanes(const uint8_t *scanline, int planes, int bytesPerLine, int width, uint8_t *indices) -> void {
+    int bytes = (width + 7) / 8;
+    for (int i = 0; i < bytes; i++) {
+        uint64_t eight = 0;
+        for (int plane = 0; plane < planes; plane++) {
+            eight |= bitSpread.spread[scanline[plane * bytesPerLine + i]] << plane;
+        }
+        std::memcpy(indices + i * 8, &eight, sizeof(eight));
     }
+}
 
-    std::vector<uint8_t> rgba(width * height * 4);
+// Palette indices for one row of 2 or 4 bit pixels, packed most significant first
+auto static unpackBits(const uint8_t *scanline, int bits, int width, uint8_t *indices) -> void {
+    int perByte = 8 / bits;
+    uint8_t mask = static_cast<uint8_t>((1 << bits) - 1);
+    for (int x = 0; x < width; x++) {
+        int shift = 8 - bits * (x % perByte + 1);
+        indices[x] = (scanline[x / perByte] >> shift) & mask;
+    }
+}
 
-    for (int i = 0; i < width * height; i++) {
-        uint8_t colorIndex = data[i];
-        rgba[i * 4 + 0] = palette[colorIndex * 3 + 0]; // R
-        rgba[i * 4 + 1] = palette[colorIndex * 3 + 1]; // G
-        rgba[i * 4 + 2] = palette[colorIndex * 3 + 2]; // B
-        rgba[i * 4 + 3] = 255;                         // A
+auto static expandPalette(const uint8_t *indices, const PaletteTable &palette, int width, uint8_t *rgba) -> void {
+    for (int x = 0; x < width; x++) {
+        std::memcpy(rgba + x * 4, palette[indices[x]].data(), 4);
     }
+}
+
+// Interleaves separate rows of red, green, blue and alpha into RGBA pixels
+auto static interleavePlanes(const uint8_t *red, const uint8_t *green, const uint8_t *blue, const uint8_t *alpha,
+                             int width, uint8_t *rgba) -> void {
+    int x = 0;
+#if defined(PCX_SSE2)
+    for (; x + 16 <= width; x += 16) {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(red + x));
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(green + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(blue + x));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(alpha + x));
 
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // Bytes pair up into RG and BA, then the pairs into whole pixels
+        __m128i rgLow = _mm_unpacklo_epi8(r, g);
+        __m128i rgHigh = _mm_unpackhi_epi8(r, g);
+        __m128i baLow = _mm_unpacklo_epi8(b, a);
+        __m128i baHigh = _mm_unpackhi_epi8(b, a);
 
-    return PCXImage{width, height, textureID, ""}; // Initialize filename field
+        auto *out = reinterpret_cast<__m128i *>(rgba + x * 4);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rgLow, baLow));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+    }
+#elif defined(PCX_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t pixels = {{vld1q_u8(red + x), vld1q_u8(green + x), vld1q_u8(blue + x), vld1q_u8(alpha + x)}};
+        vst4q_u8(rgba + x * 4, pixels);
+    }
+#endif
+    for (; x < width; x++) {
+        rgba[x * 4 + 0] = red[x];
+        rgba[x * 4 + 1] = green[x];
+        rgba[x * 4 + 2] = blue[x];
+        rgba[x * 4 + 3] = alpha[x];
+    }
 }
 
+auto PCXParser::decodePCX(const std::vector<uint8_t> &data, const PixelAllocator &allocate) -> bool {
+    auto header = readHeader(data);
+
+    if (!header) {
+        return false;
+    }
+
+    auto [width, height] = getImageDimensions(*header);
+    PCXLayout layout = getLayout(*header);
+    int planes = header->colorPlanes;
+    int bytesPerLine = header->bytesPerLine;
+
+    // Scanlines are padded out to bytesPerLine, but can't be shorter than the image is wide
+    if (width <= 0 || height <= 0 || layout == PCXLayout::Unsupported ||
+        static_cast<int64_t>(bytesPerLine) * 8 < static_cast<int64_t>(width) * header->bitsPerPixel) {
+        return false;
+    }
+
+    // Every plane of a row is stored one after the other, each bytesPerLine long, so the whole image is
+    // one run of fixed size scanlines whether it's compressed or not
+    size_t lineSize = static_cast<size_t>(planes) * bytesPerLine;
+    size_t imageSize = lineSize * height;
+    std::vector<uint8_t> scanlines;
+    if (header->encoding == PCXEncodingType::PCX_RLE_ENCODING) {
+        scanlines = decodeRLE(data.data() + PCX_HEADER_SIZE, data.size() - PCX_HEADER_SIZE, imageSize);
+    } else {
+        scanlines.assign(imageSize, 0);
+        std::memcpy(scanlines.data(), data.data() + PCX_HEADER_SIZE, std::min(imageSize, data.size() - PCX_HEADER_SIZE));
+    }
+
+    PaletteTable palette{};
+    if (layout != PCXLayout::TrueColor) {
+        palette = buildPalette(data, *header, header->bitsPerPixel * planes);
+    }
+
+    uint8_t *rgba = allocate(width, height);
+
+    if (!rgba) {
+        return false;
+    }
+
+    TRACE_SCOPE("Convert PCX scanlines");
+    std::vector<uint8_t> indices(static_cast<size_t>(width) + 8); // Whole bytes of 1 bit pixels can overshoot
+    std::vector<uint8_t> opaque(layout == PCXLayout::TrueColor && planes == 3 ? width : 0, 255);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *scanline = scanlines.data() + y * lineSize;
+        uint8_t *row = rgba + static_cast<size_t>(y) * width * 4;
+
+        switch (layout) {
+        case PCXLayout::Packed:
+            if (header->bitsPerPixel == 8) {
+                expandPalette(scanline, palette, width, row);
+                break;
+            }
+            if (header->bitsPerPixel == 1) {
+                unpackPlanes(scanline, 1, bytesPerLine, width, indices.data());
+            } else {
+                unpackBits(scanline, header->bitsPerPixel, width, indices.data());
+            }
+            expandPalette(indices.data(), palette, width, row);
+            break;
+        case PCXLayout::Planar:
+            unpackPlanes(scanline, planes, bytesPerLine, width, indices.data());
+            expandPalette(indices.data(), palette, width, row);
+            break;
+        case PCXLayout::TrueColor:
+            interleavePlanes(scanline, scanline + bytesPerLine, scanline + 2 * bytesPerLine,
+                             planes == 4 ? scanline + 3 * bytesPerLine : opaque.data(), width, row);
+            break;
+        case PCXLayout::Unsupported:
+            break;
+        }
+    }
+
+    return true;
+}
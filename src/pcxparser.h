@@ -4,6 +4,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 #include "types.h"
 
 enum class PCXVersion: uint8_t {
@@ -11,12 +12,12 @@ enum class PCXVersion: uint8_t {
     PCX_VERSION_2_8_EGA        = 0x02,
     PCX_VERSION_2_8_NO_PALETTE = 0x03,
     PCX_VERSION_WINDOWS        = 0x04,
-    PCX_VERSION_3              = 0x05  // Likely the only version worth supporting
+    PCX_VERSION_3              = 0x05  // Required for 256-color and 24-bit images
 };
 
 enum class PCXEncodingType: uint8_t {
     PCX_NO_ENCODING,
-    PCX_RLE_ENCODING // 99% of PCX images use RLE and is the only type worth supporting
+    PCX_RLE_ENCODING // 99% of PCX images use RLE
 };
 
 // Pragmas to ensure the PCX header is packed/aligned correctly if we ever want to export PCX files
@@ -33,20 +34,20 @@ struct PCXHeader {
     uint16_t hres;
     uint16_t vres;
     uint8_t palette[48];      // The EGA pallete for 16-color images
+    uint8_t reserved;
     uint8_t colorPlanes;
     uint16_t bytesPerLine;
 };
 #pragma pack(pop)
 
-struct PCXImage {
-    int width;
-    int height;
-    GLuint textureID;
-    std::string filename;
-};
-
-
 class PCXParser {
 public:
-    static auto loadPCX(const std::string &pakPath, const PakFileEntry &entry) -> std::optional<PCXImage>;
+    // Reads the dimensions and pixel format from the 128 byte header alone.
+    static auto probePCX(const std::vector<uint8_t> &data) -> std::optional<ImageInfo>;
+
+    // Decodes a whole PCX file into RGBA pixels obtained from allocate.
+    static auto decodePCX(const std::vector<uint8_t> &data, const PixelAllocator &allocate) -> bool;
+
+    // Returns the 256 color palette appended to the end of a PCX file, as 768 bytes of RGB.
+    static auto readPalette(const std::vector<uint8_t> &data) -> std::optional<std::vector<uint8_t>>;
 };
@@ -0,0 +1,290 @@
+#include "perceptualhash.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PHASH_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PHASH_NEON
+#endif
+
+namespace {
+    constexpr int SAMPLE_SIZE = 32; // The image is reduced to this many pixels square before the DCT
+    constexpr int KEPT_SIZE = 8;    // Lowest frequencies kept in each direction, one bit each
+    constexpr size_t QUERY_BLOCK = 1024;
+
+    // BT.601 weights in 8.8 fixed point
+    constexpr int LUMA_R = 77;
+    constexpr int LUMA_G = 150;
+    constexpr int LUMA_B = 29;
+
+    // Rows of the DCT-II basis for the frequencies we keep, sampled at the 32 pixel positions
+    struct DctBasis {
+        alignas(16) float rows[KEPT_SIZE][SAMPLE_SIZE];
+
+        DctBasis() {
+            const double pi = std::acos(-1.0);
+            for (int u = 0; u < KEPT_SIZE; u++) {
+                double scale = std::sqrt((u == 0 ? 1.0 : 2.0) / SAMPLE_SIZE);
+                for (int x = 0; x < SAMPLE_SIZE; x++) {
+                    rows[u][x] = static_cast<float>(scale * std::cos((2 * x + 1) * u * pi / (2 * SAMPLE_SIZE)));
+                }
+            }
+        }
+    };
+
+    const DctBasis basis;
+
+    auto lumaRow(const uint8_t *rgba, int width, uint16_t *out) -> void {
+        int x = 0;
+#if defined(PHASH_SSE2)
+        const __m128i weights = _mm_setr_epi16(LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B, 0);
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + x * 4));
+
+            // Each madd yields r*R + g*G and b*B for two pixels, which the shuffles then pair up
+            __m128 low = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights));
+            __m128 high = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights));
+            __m128i sums = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0))),
+                                         _mm_castps_si128(_mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1))));
+
+            __m128i luma = _mm_srli_epi32(sums, 8);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), _mm_packs_epi32(luma, luma));
+        }
+#elif defined(PHASH_NEON)
+        for (; x + 8 <= width; x += 8) {
+            uint8x8x4_t pixels = vld4_u8(rgba + x * 4);
+            uint16x8_t sums = vmull_u8(pixels.val[0], vdup_n_u8(LUMA_R));
+            sums = vmlal_u8(sums, pixels.val[1], vdup_n_u8(LUMA_G));
+            sums = vmlal_u8(sums, pixels.val[2], vdup_n_u8(LUMA_B));
+            vst1q_u16(out + x, vshrq_n_u16(sums, 8));
+        }
+#endif
+        for (; x < width; x++) {
+            const uint8_t *pixel = rgba + x * 4;
+            out[x] = static_cast<uint16_t>((pixel[0] * LUMA_R + pixel[1] * LUMA_G + pixel[2] * LUMA_B) >> 8);
+        }
+    }
+
+    auto dot(const float *a, const float *b) -> float {
+#if defined(PHASH_SSE2)
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < SAMPLE_SIZE; i += 4) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(sum);
+#elif defined(PHASH_NEON)
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int i = 0; i < SAMPLE_SIZE; i += 4) {
+            sum = vmlaq_f32(sum, vld1q_f32(a + i), vld1q_f32(b + i));
+        }
+        float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#else
+        float sum = 0.0f;
+        for (int i = 0; i < SAMPLE_SIZE; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+#endif
+    }
+
+    // Average luma of each cell when the image is cut into a 32x32 grid. Images smaller than that
+    // repeat pixels across cells instead.
+    auto sample(const uint8_t *rgba, int width, int height, float *out) -> void {
+        int columnStart[SAMPLE_SIZE + 1];
+        for (int i = 0; i <= SAMPLE_SIZE; i++) {
+            columnStart[i] = static_cast<int>(static_cast<int64_t>(i) * width / SAMPLE_SIZE);
+        }
+
+        std::vector<uint16_t> luma(width);
+        size_t stride = static_cast<size_t>(width) * 4;
+
+        for (int row = 0; row < SAMPLE_SIZE; row++) {
+            int y0 = static_cast<int>(static_cast<int64_t>(row) * height / SAMPLE_SIZE);
+            int y1 = std::max(static_cast<int>(static_cast<int64_t>(row + 1) * height / SAMPLE_SIZE), y0 + 1);
+
+            uint32_t sums[SAMPLE_SIZE] = {};
+            for (int y = y0; y < y1; y++) {
+                lumaRow(rgba + y * stride, width, luma.data());
+                for (int column = 0; column < SAMPLE_SIZE; column++) {
+                    int x1 = std::max(columnStart[column + 1], columnStart[column] + 1);
+                    for (int x = columnStart[column]; x < x1; x++) {
+                        sums[column] += luma[x];
+                    }
+                }
+            }
+
+            for (int column = 0; column < SAMPLE_SIZE; column++) {
+                int columns = std::max(columnStart[column + 1] - columnStart[column], 1);
+                out[row * SAMPLE_SIZE + column] = static_cast<float>(sums[column]) / (columns * (y1 - y0));
+            }
+        }
+    }
+
+    // Calls visit with value and every value that differs from it in at most radius of the bits from
+    // firstBit upwards, each exactly once
+    template <typename F>
+    auto forEachNearby(uint32_t value, int radius, int firstBit, int bits, F &&visit) -> void {
+        visit(value);
+        if (radius == 0) {
+            return;
+        }
+        for (int bit = firstBit; bit < bits; bit++) {
+            forEachNearby(value ^ (1u << bit), radius - 1, bit + 1, bits, visit);
+        }
+    }
+
+    auto findRoot(std::vector<uint32_t> &parents, uint32_t index) -> uint32_t {
+        while (parents[index] != index) {
+            parents[index] = parents[parents[index]];
+            index = parents[index];
+        }
+        return index;
+    }
+}
+
+auto PerceptualHash::compute(const uint8_t *rgba, int width, int height) -> uint64_t {
+    TRACE_SCOPE("Perceptual hash");
+    alignas(16) float pixels[SAMPLE_SIZE * SAMPLE_SIZE];
+    sample(rgba, width, height, pixels);
+
+    // Separable DCT, only for the frequencies that make it into the hash. The row pass is stored
+    // transposed so the column pass can read it contiguously too.
+    alignas(16) float rows[KEPT_SIZE][SAMPLE_SIZE];
+    for (int y = 0; y < SAMPLE_SIZE; y++) {
+        for (int u = 0; u < KEPT_SIZE; u++) {
+            rows[u][y] = dot(pixels + y * SAMPLE_SIZE, basis.rows[u]);
+        }
+    }
+
+    float coefficients[KEPT_SIZE * KEPT_SIZE];
+    for (int v = 0; v < KEPT_SIZE; v++) {
+        for (int u = 0; u < KEPT_SIZE; u++) {
+            coefficients[v * KEPT_SIZE + u] = dot(basis.rows[v], rows[u]);
+        }
+    }
+
+    float sorted[KEPT_SIZE * KEPT_SIZE];
+    std::copy(std::begin(coefficients), std::end(coefficients), sorted);
+    std::sort(std::begin(sorted), std::end(sorted));
+    float median = (sorted[31] + sorted[32]) * 0.5f;
+
+    uint64_t hash = 0;
+    for (int i = 0; i < KEPT_SIZE * KEPT_SIZE; i++) {
+        if (coefficients[i] > median) {
+            hash |= 1ull << i;
+        }
+    }
+    return hash;
+}
+
+auto PerceptualHash::distance(uint64_t a, uint64_t b) -> int {
+    return __builtin_popcountll(a ^ b);
+}
+
+PerceptualIndex::PerceptualIndex(std::vector<uint64_t> hashes) : hashes(std::move(hashes)) {
+    const auto &all = this->hashes;
+
+    // Counting sort of the indices by each chunk's value
+    for (int chunk = 0; chunk < CHUNKS; chunk++) {
+        auto &starts = bucketStarts[chunk];
+        auto &indices = bucketIndices[chunk];
+        starts.assign((1u << CHUNK_BITS) + 1, 0);
+        indices.resize(all.size());
+
+        int shift = chunk * CHUNK_BITS;
+        for (uint64_t hash : all) {
+            starts[((hash >> shift) & 0xffff) + 1]++;
+        }
+        std::partial_sum(starts.begin(), starts.end(), starts.begin());
+
+        std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+        for (uint32_t i = 0; i < all.size(); i++) {
+            indices[next[(all[i] >> shift) & 0xffff]++] = i;
+        }
+    }
+}
+
+auto PerceptualIndex::neighbours(size_t index, int maxDistance, std::vector<uint32_t> &out) const -> void {
+    out.clear();
+    maxDistance = std::clamp(maxDistance, 0, MAX_DISTANCE);
+    uint64_t query = hashes[index];
+
+    for (int chunk = 0; chunk < CHUNKS; chunk++) {
+        const auto &starts = bucketStarts[chunk];
+        const auto &indices = bucketIndices[chunk];
+        uint32_t value = (query >> (chunk * CHUNK_BITS)) & 0xffff;
+
+        forEachNearby(value, maxDistance / CHUNKS, 0, CHUNK_BITS, [&](uint32_t probe) {
+            for (uint32_t i = starts[probe]; i < starts[probe + 1]; i++) {
+                uint32_t candidate = indices[i];
+                if (candidate != index && PerceptualHash::distance(query, hashes[candidate]) <= maxDistance) {
+                    out.push_back(candidate);
+                }
+            }
+        });
+    }
+
+    // A close enough hash usually matches in more than one chunk
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+auto PerceptualIndex::clusters(int maxDistance) const -> std::vector<std::vector<uint32_t>> {
+    TRACE_SCOPE("Cluster perceptual hashes");
+
+    // Queries run in parallel; each block keeps its links to later hashes, since the earlier ones
+    // found the same link from the other end
+    size_t blocks = (hashes.size() + QUERY_BLOCK - 1) / QUERY_BLOCK;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> links(blocks);
+
+    ThreadPool::parallelFor(blocks, [&](size_t block) {
+        std::vector<uint32_t> found;
+        size_t end = std::min(hashes.size(), (block + 1) * QUERY_BLOCK);
+        for (size_t i = block * QUERY_BLOCK; i < end; i++) {
+            neighbours(i, maxDistance, found);
+            for (uint32_t j : found) {
+                if (j > i) {
+                    links[block].emplace_back(static_cast<uint32_t>(i), j);
+                }
+            }
+        }
+    });
+
+    std::vector<uint32_t> parents(hashes.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    for (const auto &blockLinks : links) {
+        for (auto [a, b] : blockLinks) {
+            uint32_t rootA = findRoot(parents, a);
+            uint32_t rootB = findRoot(parents, b);
+            if (rootA != rootB) {
+                parents[std::max(rootA, rootB)] = std::min(rootA, rootB);
+            }
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> groups(hashes.size());
+    for (uint32_t i = 0; i < hashes.size(); i++) {
+        groups[findRoot(parents, i)].push_back(i);
+    }
+
+    std::vector<std::vector<uint32_t>> result;
+    for (auto &group : groups) {
+        if (group.size() > 1) {
+            result.push_back(std::move(group));
+        }
+    }
+
+    std::stable_sort(result.begin(), result.end(), [](const auto &a, const auto &b) { return a.size() > b.size(); });
+    return result;
+}
@@ -0,0 +1,48 @@
+// Perceptual hashes for finding images that look alike without being byte-identical
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// DCT hash: the image is shrunk to 32x32 luma, and each of its 8x8 lowest frequencies becomes one bit
+// depending on whether it is above their median. Re-saving, re-quantizing to another palette, small
+// edits and rescaling only flip a few bits, so similar images end up a small Hamming distance apart.
+class PerceptualHash {
+public:
+    static auto compute(const uint8_t *rgba, int width, int height) -> uint64_t;
+
+    static auto distance(uint64_t a, uint64_t b) -> int;
+};
+
+// Multi-index hashing: every hash is split into four 16-bit chunks, each with its own lookup table.
+// Two hashes within distance d must have at least one chunk within d / 4 of each other, so a query
+// only probes the chunk values that close rather than comparing against every other hash.
+class PerceptualIndex {
+public:
+    static constexpr int DEFAULT_DISTANCE = 8;
+    static constexpr int MAX_DISTANCE = 15; // Further than this a query probes too many chunk values to pay off
+
+    PerceptualIndex() = default;
+    explicit PerceptualIndex(std::vector<uint64_t> hashes);
+
+    auto size() const -> size_t { return hashes.size(); }
+    auto hash(size_t index) const -> uint64_t { return hashes[index]; }
+
+    // Indices of every other hash within maxDistance of hash(index), in ascending order
+    auto neighbours(size_t index, int maxDistance, std::vector<uint32_t> &out) const -> void;
+
+    // Groups of two or more hashes linked by chains of neighbours, biggest first. The queries are
+    // spread over the thread pool.
+    auto clusters(int maxDistance) const -> std::vector<std::vector<uint32_t>>;
+
+private:
+    static constexpr int CHUNKS = 4;
+    static constexpr int CHUNK_BITS = 16;
+
+    std::vector<uint64_t> hashes;
+    // Per chunk, the indices of every hash sorted by that chunk's value, and where each value's run starts
+    std::vector<uint32_t> bucketStarts[CHUNKS];
+    std::vector<uint32_t> bucketIndices[CHUNKS];
+};
@@ -0,0 +1,422 @@
+#include "pk3writer.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <unistd.h>
+
+namespace {
+    constexpr size_t CHUNK_SIZE = 1024 * 1024;
+    constexpr size_t DICTIONARY_SIZE = 32 * 1024; // Deflate can't refer back further than this anyway
+    constexpr uint64_t WINDOW_BYTES = 32 * 1024 * 1024;
+    constexpr size_t WINDOW_CHUNKS = 8192;
+
+    constexpr uint16_t METHOD_STORED = 0;
+    constexpr uint16_t METHOD_DEFLATED = 8;
+    constexpr uint16_t VERSION_DEFAULT = 20;
+    constexpr uint16_t VERSION_ZIP64 = 45;
+    constexpr uint16_t VERSION_MADE_BY = (3 << 8) | VERSION_ZIP64; // Unix
+    constexpr uint16_t FLAG_UTF8 = 1 << 11;
+
+    constexpr uint32_t MAX_32 = 0xFFFFFFFFu;
+    constexpr uint16_t MAX_16 = 0xFFFFu;
+    // Deflate can make incompressible data a little bigger, so entries this close to 4 GB reserve
+    // Zip64 sizes in their local header before their compressed size is known
+    constexpr uint64_t ZIP64_ENTRY_SIZE = 0xF0000000ull;
+
+    auto put16(std::vector<uint8_t> &out, uint16_t value) -> void {
+        out.push_back(value & 0xFF);
+        out.push_back(value >> 8);
+    }
+
+    auto put32(std::vector<uint8_t> &out, uint32_t value) -> void {
+        put16(out, value & 0xFFFF);
+        put16(out, value >> 16);
+    }
+
+    auto put64(std::vector<uint8_t> &out, uint64_t value) -> void {
+        put32(out, value & 0xFFFFFFFFu);
+        put32(out, value >> 32);
+    }
+
+    auto nameFlags(std::string_view name) -> uint16_t {
+        bool ascii = std::all_of(name.begin(), name.end(), [](char c) { return static_cast<unsigned char>(c) < 0x80; });
+        return ascii ? 0 : FLAG_UTF8;
+    }
+
+    auto deflateChunk(const std::vector<uint8_t> &data, const std::vector<uint8_t> &dictionary, bool last, int level,
+                      std::vector<uint8_t> &out) -> bool {
+        z_stream stream = {};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        if (!dictionary.empty()) {
+            deflateSetDictionary(&stream, dictionary.data(), static_cast<uInt>(dictionary.size()));
+        }
+
+        // The bound doesn't allow for the sync flush marker, hence the few spare bytes
+        out.resize(deflateBound(&stream, static_cast<uLong>(data.size())) + 16);
+        stream.next_in = const_cast<Bytef *>(data.data());
+        stream.avail_in = static_cast<uInt>(data.size());
+
+        int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+        int result;
+        do {
+            if (stream.total_out == out.size()) {
+                out.resize(out.size() * 2);
+            }
+            stream.next_out = out.data() + stream.total_out;
+            stream.avail_out = static_cast<uInt>(out.size() - stream.total_out);
+            result = deflate(&stream, flush);
+        } while (result == Z_OK && (last || stream.avail_in > 0 || stream.avail_out == 0));
+
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return last ? result == Z_STREAM_END : result == Z_OK || result == Z_BUF_ERROR;
+    }
+}
+
+Pk3Writer::Pk3Writer(int level) : level(level) {}
+
+Pk3Writer::~Pk3Writer() {
+    // The job in flight writes into compressing, so it has to finish before that goes away
+    if (compressed.valid()) {
+        compressed.wait();
+    }
+}
+
+auto Pk3Writer::open(const std::string &path) -> bool {
+    std::time_t now = std::time(nullptr);
+    std::tm local = *std::localtime(&now);
+    dosTime = static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+    dosDate = static_cast<uint16_t>(((std::max(local.tm_year, 80) - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+
+    return output.open(path);
+}
+
+auto Pk3Writer::shouldStore(std::string_view name) -> bool {
+    size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos) {
+        return false;
+    }
+
+    std::string ext(name.substr(dot + 1));
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "png" || ext == "jpg" || ext == "jpeg" || ext == "ogg" || ext == "mp3" || ext == "pk3" ||
+           ext == "zip" || ext == "gz" || ext == "roq";
+}
+
+auto Pk3Writer::canAdd(std::string_view name, uint64_t) const -> bool {
+    return !name.empty() && name.size() <= MAX_16 && !hasFailed();
+}
+
+auto Pk3Writer::addEntry(std::string_view name, uint64_t size, const ReadFunc &read) -> bool {
+    if (!canAdd(name, size)) {
+        return false;
+    }
+
+    size_t index = entries.size();
+    bool stored = level == 0 || size == 0 || shouldStore(name);
+    entries.push_back({std::string(name), size, stored ? METHOD_STORED : METHOD_DEFLATED, size >= ZIP64_ENTRY_SIZE});
+
+    size_t firstChunk = filling.chunks.size();
+    bool submitted = false; // Part of the entry has already gone off to be compressed
+    std::vector<uint8_t> dictionary;
+    uint64_t remaining = size;
+
+    do {
+        Chunk chunk;
+        chunk.entry = index;
+        chunk.first = remaining == size;
+        chunk.stored = stored;
+        chunk.dictionary = std::move(dictionary);
+        chunk.data.resize(static_cast<size_t>(std::min<uint64_t>(remaining, CHUNK_SIZE)));
+        remaining -= chunk.data.size();
+        chunk.last = remaining == 0;
+
+        if (!read(chunk.data.data(), chunk.data.size())) {
+            if (submitted) {
+                // Its local header may already be on disk, so there's no taking it back
+                failed = true;
+                return false;
+            }
+
+            for (size_t i = firstChunk; i < filling.chunks.size(); i++) {
+                filling.bytes -= filling.chunks[i].data.size();
+            }
+            filling.chunks.resize(firstChunk);
+            entries.pop_back();
+            return false;
+        }
+
+        // The next chunk is primed with this one's tail so matches can reach back across the cut
+        if (!stored && !chunk.last) {
+            size_t tail = std::min(chunk.data.size(), DICTIONARY_SIZE);
+            dictionary.assign(chunk.data.end() - tail, chunk.data.end());
+        }
+
+        filling.bytes += chunk.data.size();
+        filling.chunks.push_back(std::move(chunk));
+
+        if (filling.bytes >= WINDOW_BYTES || filling.chunks.size() >= WINDOW_CHUNKS) {
+            if (!submitWindow()) {
+                return false;
+            }
+            submitted = true;
+            firstChunk = 0;
+        }
+    } while (remaining > 0);
+
+    return true;
+}
+
+auto Pk3Writer::add(std::string_view name, const void *data, size_t size) -> bool {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    return addEntry(name, size, [&](uint8_t *buffer, size_t count) {
+        std::copy(bytes, bytes + count, buffer);
+        bytes += count;
+        return true;
+    });
+}
+
+auto Pk3Writer::addStream(std::string_view name, EntryStream &stream) -> bool {
+    return addEntry(name, stream.size(), [&](uint8_t *buffer, size_t count) {
+        while (count > 0) {
+            size_t read = stream.read(buffer, count);
+            if (read == 0) {
+                return false;
+            }
+            buffer += read;
+            count -= read;
+        }
+        return true;
+    });
+}
+
+auto Pk3Writer::addFileRange(std::string_view name, int fd, uint64_t offset, uint64_t size) -> bool {
+    return addEntry(name, size, [&](uint8_t *buffer, size_t count) {
+        while (count > 0) {
+            ssize_t read = ::pread(fd, buffer, count, static_cast<off_t>(offset));
+            if (read <= 0) {
+                return false;
+            }
+            buffer += read;
+            count -= read;
+            offset += read;
+        }
+        return true;
+    });
+}
+
+auto Pk3Writer::compressWindow(Window &window, int level) -> void {
+    TRACE_SCOPE("Deflate window");
+    ThreadPool::parallelFor(window.chunks.size(), [&](size_t i) {
+        Chunk &chunk = window.chunks[i];
+        chunk.crc = static_cast<uint32_t>(crc32(crc32(0, nullptr, 0), chunk.data.data(), static_cast<uInt>(chunk.data.size())));
+        if (chunk.stored) {
+            return;
+        }
+
+        bool deflated = deflateChunk(chunk.data, chunk.dictionary, chunk.last, level, chunk.compressed);
+        if (chunk.first && chunk.last) {
+            // Entries that fit in one chunk can still change their minds, and do if deflate didn't help
+            chunk.stored = !deflated || chunk.compressed.size() >= chunk.data.size();
+        } else {
+            chunk.failed = !deflated;
+        }
+        chunk.dictionary = {};
+    });
+}
+
+auto Pk3Writer::waitForWindow() -> bool {
+    if (!compressed.valid()) {
+        return true;
+    }
+
+    compressed.get();
+    bool written = writeWindow(*compressing);
+    compressing.reset();
+    return written;
+}
+
+auto Pk3Writer::submitWindow() -> bool {
+    if (!waitForWindow()) {
+        return false;
+    }
+
+    compressing = std::make_unique<Window>(std::move(filling));
+    filling = Window();
+    compressed = ThreadPool::submit([window = compressing.get(), level = level] { compressWindow(*window, level); });
+    return true;
+}
+
+auto Pk3Writer::localHeader(const Entry &entry) const -> std::vector<uint8_t> {
+    std::vector<uint8_t> header;
+    header.reserve(30 + entry.name.size() + 20);
+
+    put32(header, 0x04034b50);
+    put16(header, entry.zip64 ? VERSION_ZIP64 : VERSION_DEFAULT);
+    put16(header, nameFlags(entry.name));
+    put16(header, entry.method);
+    put16(header, dosTime);
+    put16(header, dosDate);
+    put32(header, entry.crc);
+    put32(header, entry.zip64 ? MAX_32 : static_cast<uint32_t>(entry.compressedSize));
+    put32(header, entry.zip64 ? MAX_32 : static_cast<uint32_t>(entry.size));
+    put16(header, static_cast<uint16_t>(entry.name.size()));
+    put16(header, entry.zip64 ? 20 : 0);
+    header.insert(header.end(), entry.name.begin(), entry.name.end());
+
+    if (entry.zip64) {
+        put16(header, 0x0001);
+        put16(header, 16);
+        put64(header, entry.size);
+        put64(header, entry.compressedSize);
+    }
+    return header;
+}
+
+auto Pk3Writer::addCentralRecord(const Entry &entry) -> void {
+    // The Zip64 extra field holds just the values that didn't fit, in this order
+    std::vector<uint8_t> extra;
+    if (entry.size >= MAX_32) {
+        put64(extra, entry.size);
+    }
+    if (entry.compressedSize >= MAX_32) {
+        put64(extra, entry.compressedSize);
+    }
+    if (entry.headerOffset >= MAX_32) {
+        put64(extra, entry.headerOffset);
+    }
+
+    auto &out = centralDirectory;
+    put32(out, 0x02014b50);
+    put16(out, VERSION_MADE_BY);
+    put16(out, extra.empty() && !entry.zip64 ? VERSION_DEFAULT : VERSION_ZIP64);
+    put16(out, nameFlags(entry.name));
+    put16(out, entry.method);
+    put16(out, dosTime);
+    put16(out, dosDate);
+    put32(out, entry.crc);
+    put32(out, static_cast<uint32_t>(std::min<uint64_t>(entry.compressedSize, MAX_32)));
+    put32(out, static_cast<uint32_t>(std::min<uint64_t>(entry.size, MAX_32)));
+    put16(out, static_cast<uint16_t>(entry.name.size()));
+    put16(out, static_cast<uint16_t>(extra.empty() ? 0 : extra.size() + 4));
+    put16(out, 0); // Comment length
+    put16(out, 0); // Disk number
+    put16(out, 0); // Internal attributes
+    put32(out, 0100644u << 16); // Unix permissions
+    put32(out, static_cast<uint32_t>(std::min<uint64_t>(entry.headerOffset, MAX_32)));
+    out.insert(out.end(), entry.name.begin(), entry.name.end());
+
+    if (!extra.empty()) {
+        put16(out, 0x0001);
+        put16(out, static_cast<uint16_t>(extra.size()));
+        out.insert(out.end(), extra.begin(), extra.end());
+    }
+}
+
+auto Pk3Writer::writeWindow(Window &window) -> bool {
+    TRACE_SCOPE("Write PK3 window");
+    for (Chunk &chunk : window.chunks) {
+        if (chunk.failed) {
+            failed = true;
+            return false;
+        }
+
+        Entry &entry = entries[chunk.entry];
+        const auto &bytes = chunk.stored ? chunk.data : chunk.compressed;
+
+        if (chunk.first) {
+            entry.headerOffset = output.position();
+            if (chunk.stored) {
+                entry.method = METHOD_STORED;
+            }
+            // A single chunk entry is complete already, so its header is right first time
+            if (chunk.last) {
+                entry.crc = chunk.crc;
+                entry.compressedSize = bytes.size();
+            }
+
+            auto header = localHeader(entry);
+            if (!output.write(header.data(), header.size())) {
+                return false;
+            }
+        }
+
+        if (!output.write(bytes.data(), bytes.size())) {
+            return false;
+        }
+
+        if (!chunk.first || !chunk.last) {
+            entry.crc = chunk.first ? chunk.crc : static_cast<uint32_t>(crc32_combine(entry.crc, chunk.crc, static_cast<z_off_t>(chunk.data.size())));
+            entry.compressedSize += bytes.size();
+        }
+
+        if (chunk.last) {
+            if (!chunk.first) {
+                auto header = localHeader(entry);
+                if (!output.writeAt(entry.headerOffset, header.data(), header.size())) {
+                    return false;
+                }
+            }
+
+            addCentralRecord(entry);
+            entry.name = std::string(); // Only the central directory needs it from here on
+        }
+
+        chunk = Chunk();
+    }
+    return true;
+}
+
+auto Pk3Writer::finish() -> bool {
+    TRACE_SCOPE("Write PK3 directory");
+    if (hasFailed() || !submitWindow() || !waitForWindow()) {
+        return false;
+    }
+
+    uint64_t directoryOffset = output.position();
+    uint64_t directorySize = centralDirectory.size();
+    uint64_t count = entries.size();
+    if (!output.write(centralDirectory.data(), centralDirectory.size())) {
+        return false;
+    }
+
+    std::vector<uint8_t> end;
+    bool zip64 = count >= MAX_16 || directoryOffset >= MAX_32 || directorySize >= MAX_32;
+    if (zip64) {
+        uint64_t recordOffset = output.position();
+
+        put32(end, 0x06064b50);
+        put64(end, 44); // Size of the rest of the record
+        put16(end, VERSION_MADE_BY);
+        put16(end, VERSION_ZIP64);
+        put32(end, 0); // This disk
+        put32(end, 0); // Disk the directory starts on
+        put64(end, count);
+        put64(end, count);
+        put64(end, directorySize);
+        put64(end, directoryOffset);
+
+        put32(end, 0x07064b50);
+        put32(end, 0);
+        put64(end, recordOffset);
+        put32(end, 1); // Total disks
+    }
+
+    put32(end, 0x06054b50);
+    put16(end, 0);
+    put16(end, 0);
+    put16(end, static_cast<uint16_t>(std::min<uint64_t>(count, MAX_16)));
+    put16(end, static_cast<uint16_t>(std::min<uint64_t>(count, MAX_16)));
+    put32(end, static_cast<uint32_t>(std::min<uint64_t>(directorySize, MAX_32)));
+    put32(end, static_cast<uint32_t>(std::min<uint64_t>(directoryOffset, MAX_32)));
+    put16(end, 0); // Comment length
+
+    return output.write(end.data(), end.size()) && output.commit();
+}
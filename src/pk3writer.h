@@ -0,0 +1,99 @@
+// Writes ZIP-based .pk3 archives, compressing entries in parallel
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrystream.h"
+#include "filewriter.h"
+
+// Entry data is cut into 1 MB chunks that are deflated across the thread pool, a window of chunks at a
+// time, while the caller reads the next window. Chunks after the first are primed with the last 32 KB of
+// the one before and sync-flushed, pigz style, so they join up into one ordinary deflate stream and a
+// single large entry still uses every core. Zip64 records are only written where sizes, offsets or the
+// entry count need them.
+class Pk3Writer {
+public:
+    explicit Pk3Writer(int level = -1); // zlib compression level, -1 for zlib's default
+    ~Pk3Writer();
+
+    Pk3Writer(const Pk3Writer &) = delete;
+    Pk3Writer &operator=(const Pk3Writer &) = delete;
+
+    auto open(const std::string &path) -> bool;
+
+    auto canAdd(std::string_view name, uint64_t size) const -> bool;
+
+    // Each returns false without adding an entry if the entry can't be stored. The data is copied, so
+    // it can go away as soon as these return.
+    auto add(std::string_view name, const void *data, size_t size) -> bool;
+    auto addStream(std::string_view name, EntryStream &stream) -> bool;
+    auto addFileRange(std::string_view name, int fd, uint64_t offset, uint64_t size) -> bool;
+
+    // Waits for the last chunks to compress, then writes the central directory
+    auto finish() -> bool;
+
+    auto hasFailed() const -> bool { return failed || output.hasFailed(); }
+    auto entryCount() const -> size_t { return entries.size(); }
+    auto bytesWritten() const -> uint64_t { return output.position(); }
+
+    // Formats that are already compressed, which deflate would only slow down
+    static auto shouldStore(std::string_view name) -> bool;
+
+private:
+    struct Entry {
+        std::string name;
+        uint64_t size;
+        uint16_t method;
+        bool zip64;                // Sizes in the local header live in a Zip64 extra field
+        uint64_t headerOffset = 0;
+        uint32_t crc = 0;
+        uint64_t compressedSize = 0;
+    };
+
+    struct Chunk {
+        size_t entry;
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> dictionary; // Tail of the previous chunk of the same entry
+        std::vector<uint8_t> compressed;
+        uint32_t crc = 0;
+        bool first;
+        bool last;
+        bool stored;
+        bool failed = false; // Deflate gave up on it
+    };
+
+    struct Window {
+        std::vector<Chunk> chunks;
+        uint64_t bytes = 0;
+    };
+
+    using ReadFunc = std::function<bool(uint8_t *buffer, size_t size)>;
+
+    auto addEntry(std::string_view name, uint64_t size, const ReadFunc &read) -> bool;
+
+    // Writes out the window that was compressing and starts compressing the one being filled
+    auto submitWindow() -> bool;
+    auto waitForWindow() -> bool;
+    auto writeWindow(Window &window) -> bool;
+    static auto compressWindow(Window &window, int level) -> void;
+
+    auto localHeader(const Entry &entry) const -> std::vector<uint8_t>;
+    auto addCentralRecord(const Entry &entry) -> void;
+
+    int level;
+    FileWriter output;
+    std::vector<Entry> entries;
+    std::vector<uint8_t> centralDirectory; // Built up as entries are finished, written in one go at the end
+    Window filling;
+    std::unique_ptr<Window> compressing;
+    std::future<void> compressed;
+    uint16_t dosTime = 0;
+    uint16_t dosDate = 0;
+    bool failed = false;
+};
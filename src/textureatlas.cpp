@@ -0,0 +1,133 @@
+#include "textureatlas.h"
+#include "textureuploader.h"
+#include "memorystats.h"
+
+#include <limits>
+
+auto TextureAtlas::fits(int width, int height) -> bool {
+    return width > 0 && height > 0 && width <= MAX_PACKED_SIZE && height <= MAX_PACKED_SIZE;
+}
+
+// Bottom-left skyline heuristic: returns the index of the skyline node the region should start at,
+// or -1 if it doesn't fit anywhere on the page.
+auto TextureAtlas::findPosition(const Page &page, int width, int height, int &bestX, int &bestY) -> int {
+    int bestIndex = -1;
+    int bestTop = std::numeric_limits<int>::max();
+    int bestWidth = std::numeric_limits<int>::max();
+
+    for (size_t i = 0; i < page.skyline.size(); i++) {
+        int x = page.skyline[i].x;
+        if (x + width > PAGE_SIZE) {
+            break;
+        }
+
+        // The region rests on the highest skyline segment underneath it
+        int y = 0;
+        int remaining = width;
+        for (size_t j = i; remaining > 0; j++) {
+            y = std::max(y, page.skyline[j].y);
+            remaining -= page.skyline[j].width;
+        }
+
+        if (y + height > PAGE_SIZE) {
+            continue;
+        }
+
+        int top = y + height;
+        if (top < bestTop || (top == bestTop && page.skyline[i].width < bestWidth)) {
+            bestIndex = static_cast<int>(i);
+            bestTop = top;
+            bestWidth = page.skyline[i].width;
+            bestX = x;
+            bestY = y;
+        }
+    }
+
+    return bestIndex;
+}
+
+auto TextureAtlas::insert(Page &page, int index, int x, int y, int width, int height) -> void {
+    page.skyline.insert(page.skyline.begin() + index, {x, y + height, width});
+
+    // Shrink or remove the segments the new one now covers
+    for (size_t i = index + 1; i < page.skyline.size();) {
+        SkylineNode &previous = page.skyline[i - 1];
+        SkylineNode &node = page.skyline[i];
+
+        int overlap = previous.x + previous.width - node.x;
+        if (overlap <= 0) {
+            break;
+        }
+
+        node.x += overlap;
+        node.width -= overlap;
+
+        if (node.width <= 0) {
+            page.skyline.erase(page.skyline.begin() + i);
+        }
+        else {
+            break;
+        }
+    }
+
+    // Merge neighbouring segments at the same height
+    for (size_t i = 0; i + 1 < page.skyline.size();) {
+        if (page.skyline[i].y == page.skyline[i + 1].y) {
+            page.skyline[i].width += page.skyline[i + 1].width;
+            page.skyline.erase(page.skyline.begin() + i + 1);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+auto TextureAtlas::createPage() -> Page & {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PAGE_SIZE, PAGE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    MemoryStats::allocate(MemoryCategory::AtlasPages, PAGE_BYTES);
+    pages.push_back({textureID, {{0, 0, PAGE_SIZE}}});
+    return pages.back();
+}
+
+auto TextureAtlas::allocate(int width, int height) -> std::optional<AtlasRegion> {
+    if (!fits(width, height)) {
+        return std::nullopt;
+    }
+
+    int paddedWidth = width + PADDING;
+    int paddedHeight = height + PADDING;
+
+    // Only the most recent page is worth trying; earlier ones were full enough to need a new page
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Page &page = (attempt == 0 && !pages.empty()) ? pages.back() : createPage();
+
+        int x = 0;
+        int y = 0;
+        int index = findPosition(page, paddedWidth, paddedHeight, x, y);
+
+        if (index >= 0) {
+            insert(page, index, x, y, paddedWidth, paddedHeight);
+            return AtlasRegion{page.textureID, x, y, width, height};
+        }
+    }
+
+    return std::nullopt;
+}
+
+auto TextureAtlas::clear() -> void {
+    for (const auto &page : pages) {
+        TextureUploader::release(page.textureID);
+    }
+    MemoryStats::release(MemoryCategory::AtlasPages, PAGE_BYTES * pages.size(), pages.size());
+    pages.clear();
+}
+
+auto TextureAtlas::pageCount() const -> size_t {
+    return pages.size();
+}
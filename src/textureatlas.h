@@ -0,0 +1,53 @@
+// Packs small images into shared texture pages
+
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "types.h"
+
+struct AtlasRegion {
+    GLuint textureID; // The page texture the region lives in
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Quake textures are mostly tiny, and giving each one its own texture means a texture switch and a
+// separate draw command per gallery cell. Packing them into a few large pages with a skyline packer
+// lets ImGui batch consecutive cells into a single draw call. Regions can't be freed individually;
+// the whole atlas is cleared when the gallery it belongs to is thrown away.
+class TextureAtlas {
+public:
+    static constexpr int PAGE_SIZE = 2048;
+    static constexpr int MAX_PACKED_SIZE = 128; // Anything bigger gets its own texture
+    static constexpr int PADDING = 1;           // Gap between regions so neighbours never bleed into each other
+    static constexpr uint64_t PAGE_BYTES = static_cast<uint64_t>(PAGE_SIZE) * PAGE_SIZE * 4;
+
+    static auto fits(int width, int height) -> bool;
+
+    auto allocate(int width, int height) -> std::optional<AtlasRegion>;
+    auto clear() -> void;
+    auto pageCount() const -> size_t;
+
+private:
+    // One segment of the skyline: the top edge of everything packed so far, between x and x + width
+    struct SkylineNode {
+        int x;
+        int y;
+        int width;
+    };
+
+    struct Page {
+        GLuint textureID;
+        std::vector<SkylineNode> skyline;
+    };
+
+    static auto findPosition(const Page &page, int width, int height, int &bestX, int &bestY) -> int;
+    static auto insert(Page &page, int index, int x, int y, int width, int height) -> void;
+
+    auto createPage() -> Page &;
+
+    std::vector<Page> pages;
+};
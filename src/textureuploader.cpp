@@ -0,0 +1,269 @@
+#include "textureuploader.h"
+#include "trace.h"
+#include "textureatlas.h"
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+    struct Slot {
+        GLuint buffer = 0;
+        GLsync fence = nullptr; // Signalled once the GPU has finished the copy out of this slot
+        bool inUse = false;     // Mapped or waiting in the queue
+    };
+
+    struct PendingUpload {
+        GLuint textureID;
+        int x;                             // Destination inside the texture when subImage is set
+        int y;
+        bool subImage;                     // Writes into an existing texture (an atlas page)
+        int width;
+        int height;
+        int slot;                          // -1 when the pixels are in clientPixels instead of a PBO
+        std::vector<uint8_t> clientPixels; // Fallback for images bigger than a slot or when the ring is full
+    };
+
+    struct Accounted {
+        MemoryCategory category;
+        uint64_t bytes;
+    };
+
+    std::vector<Slot> slots;
+    std::deque<PendingUpload> queue;
+    std::unordered_map<GLuint, Accounted> accounted; // Every texture created here and not yet released
+    size_t slotSize = 0;
+    size_t frameBudget = 0;
+    size_t nextSlot = 0;
+
+    auto slotIsFree(Slot &slot) -> bool {
+        if (slot.inUse) {
+            return false;
+        }
+
+        if (slot.fence) {
+            GLenum result = glClientWaitSync(slot.fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+                return false;
+            }
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+
+        return true;
+    }
+
+    // Finds the next slot the GPU is done with, without ever blocking on a fence.
+    auto acquireSlot(size_t bytes) -> int {
+        if (bytes > slotSize) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            size_t index = (nextSlot + i) % slots.size();
+            if (slotIsFree(slots[index])) {
+                nextSlot = index + 1;
+                return static_cast<int>(index);
+            }
+        }
+
+        return -1;
+    }
+}
+
+auto TextureUploader::init(size_t slotCount, size_t size, size_t budget) -> void {
+    shutdown();
+
+    slotSize = size;
+    frameBudget = budget;
+    slots.resize(slotCount);
+
+    for (auto &slot : slots) {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, slotSize, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    MemoryStats::allocate(MemoryCategory::UploadBuffers, slotSize * slots.size(), slots.size());
+}
+
+auto TextureUploader::shutdown() -> void {
+    // Atlas pages belong to the TextureAtlas, which deletes them itself
+    for (auto &pending : queue) {
+        if (!pending.subImage) {
+            glDeleteTextures(1, &pending.textureID);
+        }
+    }
+    queue.clear();
+
+    for (const auto &[textureID, texture] : accounted) {
+        MemoryStats::release(texture.category, texture.bytes);
+    }
+    accounted.clear();
+    MemoryStats::release(MemoryCategory::UploadBuffers, slotSize * slots.size(), slots.size());
+
+    for (auto &slot : slots) {
+        if (slot.fence) {
+            glDeleteSync(slot.fence);
+        }
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    slots.clear();
+    nextSlot = 0;
+}
+
+auto TextureUploader::upload(const DecodeFunc &decode, TextureAtlas *atlas, MemoryCategory category) -> std::optional<PCXImage> {
+    int width = 0;
+    int height = 0;
+    int slot = -1;
+    std::vector<uint8_t> clientPixels;
+
+    PixelAllocator allocate = [&](int w, int h) -> uint8_t * {
+        if (w <= 0 || h <= 0 || width != 0) {
+            return nullptr;
+        }
+
+        width = w;
+        height = h;
+        size_t bytes = static_cast<size_t>(w) * h * 4;
+
+        slot = acquireSlot(bytes);
+        if (slot >= 0) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[slot].buffer);
+            // The fence already told us the GPU is done with this slot, so there's nothing to sync against
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            if (mapped) {
+                slots[slot].inUse = true;
+                return static_cast<uint8_t *>(mapped);
+            }
+            slot = -1;
+        }
+
+        clientPixels.resize(bytes);
+        return clientPixels.data();
+    };
+
+    bool decoded = decode(allocate);
+
+    if (slot >= 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[slot].buffer);
+        // A false return means the buffer contents were lost while mapped (e.g. a mode switch)
+        decoded = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE && decoded;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    if (!decoded || width == 0) {
+        if (slot >= 0) {
+            slots[slot].inUse = false;
+        }
+        return std::nullopt;
+    }
+
+    if (atlas) {
+        if (auto region = atlas->allocate(width, height)) {
+            queue.push_back({region->textureID, region->x, region->y, true, width, height, slot, std::move(clientPixels)});
+
+            PCXImage image{width, height, region->textureID, ""};
+            image.u0 = static_cast<float>(region->x) / TextureAtlas::PAGE_SIZE;
+            image.v0 = static_cast<float>(region->y) / TextureAtlas::PAGE_SIZE;
+            image.u1 = static_cast<float>(region->x + width) / TextureAtlas::PAGE_SIZE;
+            image.v1 = static_cast<float>(region->y + height) / TextureAtlas::PAGE_SIZE;
+            image.inAtlas = true;
+            return image;
+        }
+    }
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    queue.push_back({textureID, 0, 0, false, width, height, slot, std::move(clientPixels)});
+
+    Accounted texture{category, static_cast<uint64_t>(width) * height * 4};
+    MemoryStats::allocate(texture.category, texture.bytes);
+    accounted[textureID] = texture;
+
+    return PCXImage{width, height, textureID, ""};
+}
+
+auto TextureUploader::pump() -> void {
+    TRACE_SCOPE("Upload textures");
+    size_t uploaded = 0;
+
+    // Always make progress on at least one upload, even if it alone is over budget
+    while (!queue.empty() && (uploaded == 0 || uploaded < frameBudget)) {
+        PendingUpload &pending = queue.front();
+
+        glBindTexture(GL_TEXTURE_2D, pending.textureID);
+
+        // With a PBO bound the pixel pointer is an offset into it
+        const void *pixels = nullptr;
+        if (pending.slot >= 0) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[pending.slot].buffer);
+        }
+        else {
+            pixels = pending.clientPixels.data();
+        }
+
+        if (pending.subImage) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, pending.x, pending.y, pending.width, pending.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+        else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pending.width, pending.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+
+        if (pending.slot >= 0) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            Slot &slot = slots[pending.slot];
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.inUse = false;
+        }
+
+        uploaded += static_cast<size_t>(pending.width) * pending.height * 4;
+        queue.pop_front();
+    }
+}
+
+namespace {
+    auto dropPending(GLuint textureID) -> void {
+        auto it = std::remove_if(queue.begin(), queue.end(), [textureID](const PendingUpload &pending) {
+            if (pending.textureID != textureID) {
+                return false;
+            }
+            // Nothing was issued from this slot yet, so it can be handed out again without a fence
+            if (pending.slot >= 0) {
+                slots[pending.slot].inUse = false;
+            }
+            return true;
+        });
+        queue.erase(it, queue.end());
+    }
+}
+
+auto TextureUploader::release(GLuint textureID) -> void {
+    dropPending(textureID);
+    glDeleteTextures(1, &textureID);
+
+    auto it = accounted.find(textureID);
+    if (it != accounted.end()) {
+        MemoryStats::release(it->second.category, it->second.bytes);
+        accounted.erase(it);
+    }
+}
+
+auto TextureUploader::release(const PCXImage &image) -> void {
+    if (!image.inAtlas) {
+        release(image.textureID);
+    }
+}
+
+auto TextureUploader::hasPendingUploads() -> bool {
+    return !queue.empty();
+}
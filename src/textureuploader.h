@@ -0,0 +1,37 @@
+// Asynchronous texture uploads through a ring of pixel buffer objects (PBOs)
+
+#pragma once
+
+#include <optional>
+#include <functional>
+#include "memorystats.h"
+#include "types.h"
+
+class TextureAtlas;
+
+// Decoders write their pixels straight into mapped PBO memory. The actual glTexImage2D calls are
+// deferred to pump(), which issues at most a fixed number of bytes per frame, and each ring slot is
+// fenced so it is only reused once the GPU has finished reading from it.
+class TextureUploader {
+public:
+    static auto init(size_t slotCount = 8, size_t slotSize = 4 * 1024 * 1024, size_t frameBudget = 8 * 1024 * 1024) -> void;
+    static auto shutdown() -> void;
+
+    // Runs the decoder against staging memory and queues the result for upload. The returned texture
+    // is valid immediately but its contents only arrive once pump() gets to it. Images small enough
+    // are packed into the atlas when one is given. The texture's size is accounted under category;
+    // images packed into the atlas are accounted with its pages instead.
+    static auto upload(const DecodeFunc &decode, TextureAtlas *atlas = nullptr,
+                       MemoryCategory category = MemoryCategory::Images) -> std::optional<PCXImage>;
+
+    // Issues queued uploads until this frame's byte budget is used up. Call once per frame.
+    static auto pump() -> void;
+
+    // Deletes a texture, dropping anything still queued for it.
+    static auto release(GLuint textureID) -> void;
+
+    // Releases an image returned by upload(). Atlas pages are left alone; they go away with the atlas.
+    static auto release(const PCXImage &image) -> void;
+
+    static auto hasPendingUploads() -> bool;
+};
@@ -0,0 +1,122 @@
+#include "textureusage.h"
+#include "archiveanalysis.h"
+#include "bspreader.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <unordered_map>
+
+namespace {
+    auto toLower(std::string text) -> std::string {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return text;
+    }
+
+    // Lower-cased texture names of one map, or nullopt if it can't be read
+    auto readMap(BspSource &source) -> std::optional<std::vector<std::string>> {
+        auto header = BspReader::readHeader(source);
+        if (!header) {
+            return std::nullopt;
+        }
+
+        std::vector<std::string> names;
+        for (auto &texture : BspReader::readTextures(source, *header)) {
+            names.push_back(toLower(std::move(texture.name)));
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        return names;
+    }
+}
+
+auto TextureUsage::build(const std::string &path, const EntryTable &entries, std::vector<EntryId> maps,
+                         VisitEntriesFunc visitEntries) -> TextureUsage {
+    TRACE_SCOPE("Index map textures");
+    // Maps are kept in entry order, so every texture's list of users comes out sorted
+    std::sort(maps.begin(), maps.end());
+    std::vector<std::optional<std::vector<std::string>>> perMap(maps.size());
+    auto slot = [&](EntryId id) { return static_cast<size_t>(std::lower_bound(maps.begin(), maps.end(), id) - maps.begin()); };
+
+    // Maps stored directly in a PAK are read where they sit in the mapped file. Everything else, including
+    // maps inside archives mounted from the PAK, is streamed.
+    std::optional<MappedFile> mapped;
+    if (entries.format() == PakFormat::PAK) {
+        mapped.emplace(path);
+    }
+    std::vector<EntryId> streamed;
+    if (mapped && mapped->data) {
+        for (EntryId id : maps) {
+            if (entries.flags(id) & ENTRY_NESTED) {
+                streamed.push_back(id);
+            }
+        }
+        ThreadPool::parallelFor(maps.size(), [&](size_t i) {
+            EntryId id = maps[i];
+            if (entries.flags(id) & ENTRY_NESTED) {
+                return;
+            }
+            if (const uint8_t *bytes = mapped->range(entries.offset(id), entries.size(id))) {
+                BspSource source(bytes, entries.size(id));
+                perMap[i] = readMap(source);
+            }
+        });
+    } else {
+        streamed = maps;
+    }
+    if (!streamed.empty()) {
+        ArchiveAnalysis::visitParallel(path, entries, std::move(streamed), visitEntries,
+                                       [&](EntryId id, EntryStream &stream, std::vector<uint8_t> &) {
+            BspSource source(stream);
+            perMap[slot(id)] = readMap(source);
+        });
+    }
+
+    std::unordered_map<std::string, std::vector<EntryId>> byTexture;
+    TextureUsage usage;
+    for (size_t i = 0; i < maps.size(); i++) {
+        if (!perMap[i]) {
+            usage.failedMaps++;
+            continue;
+        }
+        usage.mapCount++;
+        for (auto &name : *perMap[i]) {
+            byTexture[std::move(name)].push_back(maps[i]);
+        }
+    }
+
+    for (auto &[name, users] : byTexture) {
+        usage.names.push_back(name);
+    }
+    std::sort(usage.names.begin(), usage.names.end());
+    usage.mapsUsing.reserve(usage.names.size());
+    for (const auto &name : usage.names) {
+        usage.mapsUsing.push_back(std::move(byTexture[name]));
+    }
+    return usage;
+}
+
+auto TextureUsage::textureKey(std::string_view path) -> std::string {
+    constexpr std::string_view TEXTURES = "textures/";
+    std::string key = toLower(std::string(path));
+    if (key.compare(0, TEXTURES.size(), TEXTURES) == 0) {
+        key.erase(0, TEXTURES.size());
+    }
+
+    size_t dot = key.rfind('.');
+    if (dot != std::string::npos && key.find('/', dot) == std::string::npos) {
+        key.erase(dot);
+    }
+    return key;
+}
+
+auto TextureUsage::find(std::string_view key) const -> size_t {
+    auto it = std::lower_bound(names.begin(), names.end(), key);
+    if (it == names.end() || *it != key) {
+        return std::string::npos;
+    }
+    return static_cast<size_t>(it - names.begin());
+}
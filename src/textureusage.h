@@ -0,0 +1,38 @@
+// Which maps use which textures, across every map in an archive
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "entrystream.h"
+#include "entrytable.h"
+
+// Built from the texture references of every .bsp at once, so questions like "which maps still use
+// this texture" don't need any map opened. Texture names are compared lower-cased, the way the games
+// look them up.
+class TextureUsage {
+public:
+    // Reads only the lump directory and texture lump of each map, with maps spread over the thread
+    // pool. PAK archives are mapped; other formats are streamed.
+    static auto build(const std::string &path, const EntryTable &entries, std::vector<EntryId> maps,
+                      VisitEntriesFunc visitEntries) -> TextureUsage;
+
+    // Lower-cased, and with a Quake 2 texture path's textures/ prefix and extension taken off, which is
+    // how maps refer to them
+    static auto textureKey(std::string_view path) -> std::string;
+
+    auto textureCount() const -> size_t { return names.size(); }
+    auto texture(size_t index) const -> const std::string & { return names[index]; }
+    auto users(size_t index) const -> const std::vector<EntryId> & { return mapsUsing[index]; }
+
+    // Index of a texture, from its textureKey, or npos if no map uses it
+    auto find(std::string_view key) const -> size_t;
+
+    size_t mapCount = 0;    // Maps read successfully
+    size_t failedMaps = 0;  // Maps that weren't BSPs this can read
+
+private:
+    std::vector<std::string> names;                // Sorted
+    std::vector<std::vector<EntryId>> mapsUsing;   // Alongside names, each in entry order
+};
@@ -0,0 +1,131 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> workers;
+    std::function<void()> completionHook;
+    bool stopping = false;
+
+    auto workerLoop() -> void {
+        while (true) {
+            std::function<void()> job;
+            std::function<void()> hook;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [] { return stopping || !queue.empty(); });
+
+                if (queue.empty()) {
+                    return;
+                }
+
+                job = std::move(queue.front());
+                queue.pop_front();
+                hook = completionHook;
+            }
+
+            job();
+
+            if (hook) {
+                hook();
+            }
+        }
+    }
+}
+
+auto ThreadPool::init(size_t threadCount) -> void {
+    shutdown();
+
+    if (threadCount == 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        threadCount = cores > 2 ? cores - 1 : 1;
+    }
+
+    stopping = false;
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(workerLoop);
+    }
+}
+
+auto ThreadPool::shutdown() -> void {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueChanged.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+auto ThreadPool::setCompletionHook(std::function<void()> hook) -> void {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    completionHook = std::move(hook);
+}
+
+auto ThreadPool::enqueue(std::function<void()> job) -> void {
+    // Without workers (before init or after shutdown) jobs run inline, so their futures still complete
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(job));
+    }
+    queueChanged.notify_one();
+}
+
+auto ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &body) -> void {
+    // Helpers may only get to run after the caller has already finished everything and returned, so
+    // the state they share lives on the heap, and they never touch body once the work has run out
+    struct Shared {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> finished{0};
+        size_t count;
+        const std::function<void(size_t)> *body;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    auto shared = std::make_shared<Shared>();
+    shared->count = count;
+    shared->body = &body;
+
+    auto work = [](Shared &s) {
+        size_t index;
+        while ((index = s.next.fetch_add(1)) < s.count) {
+            (*s.body)(index);
+            if (s.finished.fetch_add(1) + 1 == s.count) {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(count, workers.size());
+    for (size_t i = 1; i < helpers; i++) {
+        enqueue([shared, work] { work(*shared); });
+    }
+
+    work(*shared);
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->done.wait(lock, [&] { return shared->finished.load() == count; });
+}
+
+auto ThreadPool::threadCount() -> size_t {
+    return workers.size();
+}
@@ -0,0 +1,43 @@
+// Fixed set of worker threads for work that shouldn't stall the UI
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+// Jobs run in the order they were submitted. Each finished job calls the completion hook, which the
+// main loop uses to wake itself up when it is blocked waiting for events.
+class ThreadPool {
+public:
+    static auto init(size_t threadCount = 0) -> void; // 0 picks one thread per core, less one for the UI
+    static auto shutdown() -> void;                   // Finishes queued jobs, then joins the workers
+
+    // Called from a worker thread after every job. Must be thread safe.
+    static auto setCompletionHook(std::function<void()> hook) -> void;
+
+    static auto enqueue(std::function<void()> job) -> void;
+
+    template <typename F>
+    static auto submit(F &&task) -> std::future<std::invoke_result_t<F>> {
+        using Result = std::invoke_result_t<F>;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        enqueue([packaged] { (*packaged)(); });
+        return future;
+    }
+
+    // Runs body(0) .. body(count - 1) across the pool and returns once they have all finished. The
+    // calling thread takes work too, so this is safe to call from inside a pool job.
+    static auto parallelFor(size_t count, const std::function<void(size_t)> &body) -> void;
+
+    static auto threadCount() -> size_t;
+};
+
+// True once a future from submit() can be read without blocking
+template <typename T>
+auto isReady(const std::future<T> &future) -> bool {
+    return future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
@@ -0,0 +1,155 @@
+#include "thumbnail.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define THUMBNAIL_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define THUMBNAIL_NEON
+#endif
+
+namespace {
+    // Same rounding as the vector paths: average the two rows first, then the two columns
+    auto inline average4(uint8_t a0, uint8_t b0, uint8_t a1, uint8_t b1) -> uint8_t {
+        int left = (a0 + a1 + 1) >> 1;
+        int right = (b0 + b1 + 1) >> 1;
+        return static_cast<uint8_t>((left + right + 1) >> 1);
+    }
+
+    // Produces count output pixels from two input rows, returns how many it managed with vector code
+    auto halveRowVector(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, int count) -> int {
+        int x = 0;
+#if defined(THUMBNAIL_SSE2)
+        for (; x + 4 <= count; x += 4) {
+            // 8 source pixels from each row make 4 output pixels
+            __m128i a = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8)));
+            __m128i b = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8 + 16)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8 + 16)));
+
+            // Split into even and odd pixels so horizontal neighbours line up
+            __m128 af = _mm_castsi128_ps(a);
+            __m128 bf = _mm_castsi128_ps(b);
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), _mm_avg_epu8(even, odd));
+        }
+#elif defined(THUMBNAIL_NEON)
+        for (; x + 4 <= count; x += 4) {
+            // vld2q_u32 deinterleaves the 8 source pixels into even and odd ones
+            uint32x4x2_t top = vld2q_u32(reinterpret_cast<const uint32_t *>(row0 + x * 8));
+            uint32x4x2_t bottom = vld2q_u32(reinterpret_cast<const uint32_t *>(row1 + x * 8));
+
+            uint8x16_t even = vrhaddq_u8(vreinterpretq_u8_u32(top.val[0]), vreinterpretq_u8_u32(bottom.val[0]));
+            uint8x16_t odd = vrhaddq_u8(vreinterpretq_u8_u32(top.val[1]), vreinterpretq_u8_u32(bottom.val[1]));
+
+            vst1q_u8(dst + x * 4, vrhaddq_u8(even, odd));
+        }
+#endif
+        return x;
+    }
+}
+
+auto Thumbnail::sizeForCell(float cellSize) -> int {
+    // The gallery draws images at up to 90% of the cell
+    int needed = static_cast<int>(cellSize * 0.9f);
+
+    int size = MIN_SIZE;
+    while (size < needed && size < MAX_SIZE) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+auto Thumbnail::halve(const uint8_t *src, int width, int height, uint8_t *dst) -> void {
+    int outWidth = std::max(1, width / 2);
+    int outHeight = std::max(1, height / 2);
+    size_t stride = static_cast<size_t>(width) * 4;
+
+    for (int y = 0; y < outHeight; y++) {
+        const uint8_t *row0 = src + std::min(y * 2, height - 1) * stride;
+        const uint8_t *row1 = src + std::min(y * 2 + 1, height - 1) * stride;
+        uint8_t *out = dst + static_cast<size_t>(y) * outWidth * 4;
+
+        // Single column images can't be paired horizontally, so they stay on the scalar path
+        int x = width >= 2 ? halveRowVector(row0, row1, out, outWidth) : 0;
+
+        for (; x < outWidth; x++) {
+            int left = std::min(x * 2, width - 1) * 4;
+            int right = std::min(x * 2 + 1, width - 1) * 4;
+            for (int c = 0; c < 4; c++) {
+                out[x * 4 + c] = average4(row0[left + c], row0[right + c], row1[left + c], row1[right + c]);
+            }
+        }
+    }
+}
+
+auto Thumbnail::downscale(const uint8_t *rgba, int width, int height, int maxSize, const PixelAllocator &allocate) -> bool {
+    TRACE_SCOPE("Downscale thumbnail");
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> next;
+    const uint8_t *src = rgba;
+
+    while (width > maxSize || height > maxSize) {
+        int outWidth = std::max(1, width / 2);
+        int outHeight = std::max(1, height / 2);
+
+        // The last level goes straight into the destination
+        if (outWidth <= maxSize && outHeight <= maxSize) {
+            uint8_t *dst = allocate(outWidth, outHeight);
+            if (!dst) {
+                return false;
+            }
+            halve(src, width, height, dst);
+            return true;
+        }
+
+        next.resize(static_cast<size_t>(outWidth) * outHeight * 4);
+        halve(src, width, height, next.data());
+        std::swap(current, next);
+        src = current.data();
+        width = outWidth;
+        height = outHeight;
+    }
+
+    uint8_t *dst = allocate(width, height);
+    if (!dst) {
+        return false;
+    }
+    std::memcpy(dst, src, static_cast<size_t>(width) * height * 4);
+    return true;
+}
+
+auto Thumbnail::generate(const DecodeFunc &decode, int maxSize, const PixelAllocator &allocate) -> bool {
+    std::vector<uint8_t> full;
+    int width = 0;
+    int height = 0;
+
+    bool decoded = decode([&](int w, int h) -> uint8_t * {
+        if (w <= maxSize && h <= maxSize) {
+            return allocate(w, h);
+        }
+
+        width = w;
+        height = h;
+        full.resize(static_cast<size_t>(w) * h * 4);
+        return full.data();
+    });
+
+    if (!decoded) {
+        return false;
+    }
+
+    // Small images were decoded in place
+    if (full.empty()) {
+        return true;
+    }
+
+    return downscale(full.data(), width, height, maxSize, allocate);
+}
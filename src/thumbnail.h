@@ -0,0 +1,29 @@
+// Downscaled gallery thumbnails
+
+#pragma once
+
+#include <vector>
+#include "types.h"
+
+// The gallery never shows an image bigger than its cell, so uploading a 1024x1024 skybox at full size
+// for a 180 pixel cell only wastes VRAM and upload bandwidth. Images bigger than the cell's size bucket
+// are box filtered down by repeated 2x2 halving before they're handed to the uploader.
+class Thumbnail {
+public:
+    static constexpr int MIN_SIZE = 32;
+    static constexpr int MAX_SIZE = 512;
+
+    // Power of two size bucket that covers an image drawn inside a grid cell of the given size. The
+    // gallery only needs regenerating when this changes.
+    static auto sizeForCell(float cellSize) -> int;
+
+    // Decodes an image and writes it into allocate, scaled down so neither side is above maxSize.
+    // Images that are already small enough are decoded straight into the destination.
+    static auto generate(const DecodeFunc &decode, int maxSize, const PixelAllocator &allocate) -> bool;
+
+    // Halves an RGBA image until neither side is above maxSize and writes the result into allocate.
+    static auto downscale(const uint8_t *rgba, int width, int height, int maxSize, const PixelAllocator &allocate) -> bool;
+
+    // 2x2 box filter of a width x height RGBA image into a (width / 2) x (height / 2) one.
+    static auto halve(const uint8_t *src, int width, int height, uint8_t *dst) -> void;
+};
@@ -0,0 +1,358 @@
+#include "thumbnailcache.h"
+#include "trace.h"
+
+#include <unordered_map>
+#include <filesystem>
+#include <mutex>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace {
+    constexpr char PACK_MAGIC[8] = {'P', 'A', 'K', 'T', 'H', 'M', 'B', '1'};
+    constexpr char PACK_FILENAME[] = "thumbnails.pack";
+    constexpr char LOCK_FILENAME[] = "thumbnails.lock";
+    constexpr uint64_t MAX_PACK_SIZE = 2ull * 1024 * 1024 * 1024; // Start over rather than grow forever
+
+    struct RecordHeader {
+        uint64_t key;
+        uint32_t width;
+        uint32_t height;
+        uint32_t payloadSize; // width * height * 4 bytes of RGBA follow the header
+        uint32_t reserved;
+    };
+
+    std::string packPath;
+    int fd = -1;
+    int lockFd = -1;
+    const uint8_t *mapped = nullptr;
+    uint64_t mappedSize = 0;
+    uint64_t fileSize = 0;
+    std::unordered_map<uint64_t, uint64_t> recordOffsets;
+    std::mutex mutex; // Thumbnails are generated on the main thread and ahead of time on the pool
+
+    auto hashBytes(uint64_t hash, const void *data, size_t size) -> uint64_t {
+        // FNV-1a
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // Several viewers can share the cache, so anything that changes the pack's length holds an exclusive
+    // lock on a file beside it. The lock is on a separate file because the pack itself gets replaced.
+    class PackLock {
+    public:
+        PackLock() {
+            while (lockFd >= 0 && flock(lockFd, LOCK_EX) != 0 && errno == EINTR) {
+            }
+        }
+        ~PackLock() {
+            if (lockFd >= 0) {
+                flock(lockFd, LOCK_UN);
+            }
+        }
+
+        PackLock(const PackLock &) = delete;
+        PackLock &operator=(const PackLock &) = delete;
+    };
+
+    template <typename T>
+    auto hashValue(uint64_t hash, const T &value) -> uint64_t {
+        return hashBytes(hash, &value, sizeof(T));
+    }
+
+    auto unmap() -> void {
+        if (mapped) {
+            munmap(const_cast<uint8_t *>(mapped), mappedSize);
+        }
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+
+    // Maps everything written so far. Records appended since the last call become visible.
+    auto remap() -> bool {
+        unmap();
+        if (fileSize == 0) {
+            return false;
+        }
+
+        void *address = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+
+        mapped = static_cast<const uint8_t *>(address);
+        mappedSize = fileSize;
+        return true;
+    }
+
+    // Builds the index, and cuts off a partially written record left behind by a crash. Called with the
+    // lock held, so the tail can't be a record another viewer is still writing.
+    auto scan() -> void {
+        uint64_t offset = sizeof(PACK_MAGIC);
+
+        while (offset + sizeof(RecordHeader) <= mappedSize) {
+            RecordHeader header;
+            std::memcpy(&header, mapped + offset, sizeof(RecordHeader));
+
+            uint64_t expected = static_cast<uint64_t>(header.width) * header.height * 4;
+            if (header.payloadSize != expected || offset + sizeof(RecordHeader) + expected > mappedSize) {
+                break;
+            }
+
+            recordOffsets[header.key] = offset;
+            offset += sizeof(RecordHeader) + expected;
+        }
+
+        if (offset < fileSize && ftruncate(fd, offset) == 0) {
+            fileSize = offset;
+        }
+    }
+
+    auto closePack() -> void {
+        unmap();
+        recordOffsets.clear();
+
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+        fileSize = 0;
+    }
+
+    auto closeFile() -> void {
+        closePack();
+        if (lockFd >= 0) {
+            ::close(lockFd);
+        }
+        lockFd = -1;
+    }
+
+    // Starts an empty pack. It's written beside the old one and renamed over it rather than truncated
+    // in place, since other viewers may have the old one mapped and would fault reading past its new end.
+    auto reset() -> bool {
+        closePack();
+
+        std::string tempPath = packPath + ".tmp";
+        int tempFd = ::open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (tempFd < 0) {
+            return false;
+        }
+        if (write(tempFd, PACK_MAGIC, sizeof(PACK_MAGIC)) != sizeof(PACK_MAGIC) ||
+            rename(tempPath.c_str(), packPath.c_str()) != 0) {
+            ::close(tempFd);
+            unlink(tempPath.c_str());
+            return false;
+        }
+
+        fd = tempFd;
+        fileSize = sizeof(PACK_MAGIC);
+        return remap();
+    }
+
+    // Opens and indexes whatever is at packPath, starting over if it isn't a pack. Called with the lock held.
+    auto openPack() -> bool {
+        closePack();
+        fd = ::open(packPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            closePack();
+            return false;
+        }
+        fileSize = static_cast<uint64_t>(st.st_size);
+
+        bool valid = fileSize >= sizeof(PACK_MAGIC) && fileSize <= MAX_PACK_SIZE && remap() &&
+                     std::memcmp(mapped, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0;
+
+        if (!valid && !reset()) {
+            closePack();
+            return false;
+        }
+
+        scan();
+        return true;
+    }
+
+    // Picks up a pack another viewer started over since this one opened it, and records it appended.
+    // Called with the lock held.
+    auto refresh() -> bool {
+        struct stat current, opened;
+        if (stat(packPath.c_str(), &current) != 0 || fstat(fd, &opened) != 0) {
+            return false;
+        }
+        if (current.st_ino != opened.st_ino || current.st_dev != opened.st_dev) {
+            return openPack();
+        }
+        fileSize = static_cast<uint64_t>(opened.st_size);
+        return true;
+    }
+}
+
+auto ThumbnailCache::defaultDirectory() -> std::string {
+    const char *home = std::getenv("HOME");
+
+#ifdef __APPLE__
+    return home ? std::string(home) + "/Library/Caches/pak-adventure" : "";
+#else
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        return std::string(xdg) + "/pak-adventure";
+    }
+    return home ? std::string(home) + "/.cache/pak-adventure" : "";
+#endif
+}
+
+auto ThumbnailCache::open(const std::string &directory) -> bool {
+    std::lock_guard<std::mutex> lock(mutex);
+    closeFile();
+
+    if (directory.empty()) {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    std::string lockPath = directory + "/" + LOCK_FILENAME;
+    lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd < 0) {
+        return false;
+    }
+
+    packPath = directory + "/" + PACK_FILENAME;
+    PackLock packLock;
+    if (!openPack()) {
+        closeFile();
+        return false;
+    }
+    return true;
+}
+
+auto ThumbnailCache::close() -> void {
+    std::lock_guard<std::mutex> lock(mutex);
+    closeFile();
+}
+
+auto ThumbnailCache::archiveKey(const std::string &pakPath) -> uint64_t {
+    struct stat st;
+    if (stat(pakPath.c_str(), &st) != 0) {
+        return 0;
+    }
+
+    std::error_code error;
+    std::string canonical = std::filesystem::weakly_canonical(pakPath, error).string();
+    if (error) {
+        canonical = pakPath;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hashBytes(hash, canonical.data(), canonical.size());
+    hash = hashValue(hash, static_cast<uint64_t>(st.st_size));
+#ifdef __APPLE__
+    hash = hashValue(hash, static_cast<int64_t>(st.st_mtimespec.tv_sec));
+    hash = hashValue(hash, static_cast<int64_t>(st.st_mtimespec.tv_nsec));
+#else
+    hash = hashValue(hash, static_cast<int64_t>(st.st_mtim.tv_sec));
+    hash = hashValue(hash, static_cast<int64_t>(st.st_mtim.tv_nsec));
+#endif
+    return hash;
+}
+
+auto ThumbnailCache::entryKey(uint64_t archiveKey, const PakFileEntry &entry, int thumbnailSize) -> uint64_t {
+    uint64_t hash = hashValue(archiveKey, entry.offset);
+    hash = hashValue(hash, entry.size);
+    hash = hashValue(hash, thumbnailSize);
+    return hashBytes(hash, entry.filename.data(), entry.filename.size());
+}
+
+auto ThumbnailCache::contains(uint64_t key) -> bool {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recordOffsets.count(key) != 0;
+}
+
+auto ThumbnailCache::lookup(uint64_t key, const PixelAllocator &allocate) -> bool {
+    TRACE_SCOPE("Thumbnail cache lookup");
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = recordOffsets.find(key);
+    if (it == recordOffsets.end()) {
+        return false;
+    }
+
+    // The record is checked before anything is copied, since the pack may be damaged, or have been
+    // replaced by another viewer. Anything that doesn't add up is treated as a miss.
+    uint64_t offset = it->second;
+    auto covered = [&](uint64_t end) { return end <= mappedSize || (remap() && end <= mappedSize); };
+    if (!covered(offset + sizeof(RecordHeader))) {
+        recordOffsets.erase(it);
+        return false;
+    }
+
+    RecordHeader header;
+    std::memcpy(&header, mapped + offset, sizeof(RecordHeader));
+
+    uint64_t expected = static_cast<uint64_t>(header.width) * header.height * 4;
+    if (header.key != key || expected == 0 || header.payloadSize != expected ||
+        !covered(offset + sizeof(RecordHeader) + expected)) {
+        recordOffsets.erase(it);
+        return false;
+    }
+
+    uint8_t *dst = allocate(static_cast<int>(header.width), static_cast<int>(header.height));
+    if (!dst) {
+        return false;
+    }
+
+    std::memcpy(dst, mapped + offset + sizeof(RecordHeader), expected);
+    return true;
+}
+
+auto ThumbnailCache::store(uint64_t key, int width, int height, const uint8_t *rgba) -> void {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0 || recordOffsets.count(key)) {
+        return;
+    }
+
+    RecordHeader header{key, static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+                        static_cast<uint32_t>(width * height * 4), 0};
+
+    // Other viewers may have appended, or started the pack over, since it was last looked at, so the
+    // record goes at the end as it is now rather than where this process last wrote
+    PackLock packLock;
+    if (!refresh()) {
+        closeFile();
+        return;
+    }
+
+    if (fileSize + sizeof(RecordHeader) + header.payloadSize > MAX_PACK_SIZE && !reset()) {
+        closeFile();
+        return;
+    }
+
+    iovec parts[2] = {
+        {&header, sizeof(RecordHeader)},
+        {const_cast<uint8_t *>(rgba), header.payloadSize},
+    };
+
+    ssize_t written = pwritev(fd, parts, 2, static_cast<off_t>(fileSize));
+    if (written != static_cast<ssize_t>(sizeof(RecordHeader) + header.payloadSize)) {
+        // Leave the torn record for scan() to cut off next time, and stop appending after it
+        closeFile();
+        return;
+    }
+
+    // The mapping only grows to cover the new record once something looks it up
+    recordOffsets[key] = fileSize;
+    fileSize += written;
+}
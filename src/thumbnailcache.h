@@ -0,0 +1,29 @@
+// Persistent on-disk cache of decoded gallery thumbnails
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "types.h"
+
+// Thumbnails are appended to a single pack file in the user's cache directory, which is memory mapped
+// and indexed when the cache is opened. Keys cover the archive's path, size and modification time as
+// well as the entry and thumbnail size, so a rebuilt archive simply stops hitting its old records.
+// Lookups and stores can come from any thread.
+class ThumbnailCache {
+public:
+    static auto defaultDirectory() -> std::string;
+
+    static auto open(const std::string &directory = defaultDirectory()) -> bool;
+    static auto close() -> void;
+
+    // Identifies the current contents of an archive on disk. Returns 0 if it can't be stat'ed.
+    static auto archiveKey(const std::string &pakPath) -> uint64_t;
+    static auto entryKey(uint64_t archiveKey, const PakFileEntry &entry, int thumbnailSize) -> uint64_t;
+
+    static auto contains(uint64_t key) -> bool;
+
+    // Copies a cached thumbnail into allocate. Returns false if there isn't one.
+    static auto lookup(uint64_t key, const PixelAllocator &allocate) -> bool;
+    static auto store(uint64_t key, int width, int height, const uint8_t *rgba) -> void;
+};
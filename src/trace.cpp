@@ -0,0 +1,220 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+std::atomic<bool> Trace::enabled{false};
+
+namespace {
+    constexpr size_t BUFFER_CAPACITY = 1 << 15; // Events kept per thread before the oldest are overwritten
+    constexpr size_t FRAME_HISTORY = 240;
+
+    // Fields are atomics so a reader racing with the owning thread reads stale data, never torn data
+    struct Event {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> end{0};
+    };
+
+    struct ThreadBuffer {
+        uint32_t threadID;
+        std::atomic<uint64_t> head{0}; // Total number of events ever written
+        Event events[BUFFER_CAPACITY];
+    };
+
+    struct EventCopy {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+        uint32_t threadID;
+    };
+
+    // A thread's buffer outlives it, so its events can still be exported, but goes back on the free
+    // list when it exits for the next new thread to record into. The number of buffers is bounded by
+    // the most threads ever recording at once rather than growing with every short-lived thread, and
+    // threads that ran one after another share a row in the exported trace.
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    std::vector<ThreadBuffer *> freeBuffers;
+
+    struct BufferOwner {
+        ThreadBuffer *buffer = nullptr;
+
+        ~BufferOwner() {
+            if (buffer) {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                freeBuffers.push_back(buffer);
+            }
+        }
+    };
+
+    thread_local BufferOwner threadBuffer;
+
+    // Only touched from the main thread
+    std::vector<uint64_t> frameStarts;
+
+    auto getThreadBuffer() -> ThreadBuffer * {
+        if (!threadBuffer.buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            if (!freeBuffers.empty()) {
+                threadBuffer.buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+            } else {
+                registry.push_back(std::make_unique<ThreadBuffer>());
+                threadBuffer.buffer = registry.back().get();
+                threadBuffer.buffer->threadID = static_cast<uint32_t>(registry.size());
+            }
+        }
+        return threadBuffer.buffer;
+    }
+
+    // Copies the events that finished at or after since, newest first
+    auto snapshot(uint64_t since) -> std::vector<EventCopy> {
+        std::vector<EventCopy> events;
+        std::lock_guard<std::mutex> lock(registryMutex);
+
+        for (const auto &buffer : registry) {
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t oldest = head > BUFFER_CAPACITY ? head - BUFFER_CAPACITY : 0;
+            size_t first = events.size();
+
+            // Events are written in the order they end, so walk back until they're too old
+            for (uint64_t i = head; i > oldest; i--) {
+                const Event &event = buffer->events[(i - 1) % BUFFER_CAPACITY];
+                uint64_t end = event.end.load(std::memory_order_relaxed);
+                if (end < since) {
+                    break;
+                }
+                events.push_back({event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                                  end, buffer->threadID});
+            }
+
+            // Throw away anything the owning thread lapped while we were copying
+            uint64_t newHead = buffer->head.load(std::memory_order_acquire);
+            uint64_t keep = newHead - head >= BUFFER_CAPACITY ? 0 : BUFFER_CAPACITY - (newHead - head);
+            if (events.size() - first > keep) {
+                events.resize(first + keep);
+            }
+        }
+
+        return events;
+    }
+
+    auto writeEscaped(std::ofstream &out, const char *text) -> void {
+        for (; *text; text++) {
+            if (*text == '"' || *text == '\\') {
+                out << '\\';
+            }
+            out << *text;
+        }
+    }
+}
+
+auto Trace::setEnabled(bool enable) -> void {
+    enabled.store(enable, std::memory_order_relaxed);
+    frameStarts.clear();
+}
+
+auto Trace::now() -> uint64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+auto Trace::record(const char *name, uint64_t start, uint64_t end) -> void {
+    ThreadBuffer *buffer = getThreadBuffer();
+
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    Event &event = buffer->events[head % BUFFER_CAPACITY];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+auto Trace::beginFrame() -> void {
+    if (!isEnabled()) {
+        return;
+    }
+
+    uint64_t start = now();
+
+    if (!frameStarts.empty()) {
+        record("Frame", frameStarts.back(), start);
+    }
+
+    frameStarts.push_back(start);
+    if (frameStarts.size() > FRAME_HISTORY + 1) {
+        frameStarts.erase(frameStarts.begin());
+    }
+}
+
+auto Trace::lastFrame() -> std::vector<PhaseTiming> {
+    std::vector<PhaseTiming> phases;
+    if (frameStarts.size() < 2) {
+        return phases;
+    }
+
+    uint64_t frameStart = frameStarts[frameStarts.size() - 2];
+    uint64_t frameEnd = frameStarts.back();
+
+    for (const auto &event : snapshot(frameStart)) {
+        if (event.start < frameStart || event.end > frameEnd) {
+            continue;
+        }
+
+        // The same literal can live at different addresses in different translation units
+        auto it = std::find_if(phases.begin(), phases.end(),
+                               [&](const PhaseTiming &phase) { return std::strcmp(phase.name, event.name) == 0; });
+        if (it == phases.end()) {
+            phases.push_back({event.name, 0.0, 0});
+            it = phases.end() - 1;
+        }
+
+        it->milliseconds += (event.end - event.start) / 1e6;
+        it->calls++;
+    }
+
+    std::sort(phases.begin(), phases.end(),
+              [](const PhaseTiming &a, const PhaseTiming &b) { return a.milliseconds > b.milliseconds; });
+    return phases;
+}
+
+auto Trace::frameHistory() -> std::vector<float> {
+    std::vector<float> history;
+    for (size_t i = 1; i < frameStarts.size(); i++) {
+        history.push_back((frameStarts[i] - frameStarts[i - 1]) / 1e6f);
+    }
+    return history;
+}
+
+auto Trace::exportChromeTrace(const std::string &path) -> bool {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    auto events = snapshot(0);
+    std::sort(events.begin(), events.end(), [](const EventCopy &a, const EventCopy &b) { return a.start < b.start; });
+
+    uint64_t origin = events.empty() ? 0 : events.front().start;
+
+    // Timestamps are in microseconds, and default stream precision would round them to a few digits
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); i++) {
+        const auto &event = events[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":\"";
+        writeEscaped(out, event.name);
+        out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadID
+            << ",\"ts\":" << (event.start - origin) / 1000.0
+            << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+    }
+    out << "\n]}\n";
+
+    return static_cast<bool>(out);
+}
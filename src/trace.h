@@ -0,0 +1,68 @@
+// Scoped timing markers with a per-frame summary and Chrome trace export
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope under the given name, which must be a string literal
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+struct PhaseTiming {
+    const char *name;
+    double milliseconds;
+    int calls;
+};
+
+// Every thread records into its own fixed size ring buffer, so recording never takes a lock or
+// allocates. When tracing is off a marker costs a single relaxed load.
+class Trace {
+public:
+    static auto isEnabled() -> bool {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    static auto setEnabled(bool enable) -> void;
+
+    // Nanoseconds on a monotonic clock
+    static auto now() -> uint64_t;
+
+    static auto record(const char *name, uint64_t start, uint64_t end) -> void;
+
+    // Marks the start of a new frame on the main thread
+    static auto beginFrame() -> void;
+
+    // Time spent in each named phase during the last complete frame, across all threads
+    static auto lastFrame() -> std::vector<PhaseTiming>;
+
+    // Durations of recent frames in milliseconds, oldest first
+    static auto frameHistory() -> std::vector<float>;
+
+    // Writes everything still in the ring buffers as Chrome/Perfetto trace event JSON
+    static auto exportChromeTrace(const std::string &path) -> bool;
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name(name), start(Trace::isEnabled() ? Trace::now() : 0) {}
+
+    ~TraceScope() {
+        if (start) {
+            Trace::record(name, start, Trace::now());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
@@ -1,20 +1,50 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <cstdint>
-#include <zip.h>
+#include <functional>
 #include <GLFW/glfw3.h>
 
 enum class PakFormat {
     PAK,   // Original Quake/Quake 2 .pak format
     PKZIP, // ZIP-based formats (PK3, PK4, etc.)
+    NESTED, // Entries of an archive stored inside the open one, read through the archive holding it
     UNKNOWN
 };
 
+// One entry as handed to the archive readers. The name points into the EntryTable it came from.
 struct PakFileEntry {
-    std::string filename;
-    uint32_t offset;
-    uint32_t size;
+    std::string_view filename;
+    uint64_t offset; // Only meaningful for PAK; ZIP entries are found by name
+    uint64_t size;   // Uncompressed size
     PakFormat format;
-    zip_file_t *zipFile;
 };
+
+// A decoded image that lives on the GPU. Despite the name this is used for every image format.
+struct PCXImage {
+    int width;
+    int height;
+    GLuint textureID;
+    std::string filename;
+    // Where the image sits inside textureID; anything other than 0..1 means it shares an atlas page
+    float u0 = 0.0f;
+    float v0 = 0.0f;
+    float u1 = 1.0f;
+    float v1 = 1.0f;
+    bool inAtlas = false;
+};
+
+// What an image's header says about it, known without decoding any pixels
+struct ImageInfo {
+    int width;
+    int height;
+    std::string format;
+};
+
+// Handed to image decoders so they can ask for somewhere to write width * height RGBA pixels
+// once they know the image dimensions. Returning nullptr tells the decoder to give up.
+using PixelAllocator = std::function<uint8_t *(int width, int height)>;
+
+// Runs a decoder that writes its pixels into memory obtained from the allocator it's given.
+using DecodeFunc = std::function<bool(const PixelAllocator &allocate)>;
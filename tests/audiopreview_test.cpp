@@ -0,0 +1,164 @@
+// Plays, seeks and stops sounds on miniaudio's null backend, which keeps time like a device without one
+
+#include "audiopreview.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+    constexpr uint32_t SAMPLE_RATE = 48000;
+    constexpr double SOUND_SECONDS = 1.0;
+    constexpr auto TIMEOUT = std::chrono::seconds(5);
+
+    class MemoryStream : public EntryStream {
+    public:
+        explicit MemoryStream(std::shared_ptr<const std::vector<uint8_t>> data) : data(std::move(data)) {}
+
+        auto size() const -> uint64_t override { return data->size(); }
+        auto position() const -> uint64_t override { return offset; }
+
+        auto read(uint8_t *buffer, size_t count) -> size_t override {
+            size_t length = std::min(count, data->size() - offset);
+            std::memcpy(buffer, data->data() + offset, length);
+            offset += length;
+            return length;
+        }
+
+        auto seek(uint64_t position) -> bool override {
+            if (position > data->size()) {
+                return false;
+            }
+            offset = static_cast<size_t>(position);
+            return true;
+        }
+
+    private:
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        size_t offset = 0;
+    };
+
+    // 16-bit stereo PCM, a quiet sine wave
+    auto makeWav(double seconds) -> std::vector<uint8_t> {
+        auto frames = static_cast<uint32_t>(seconds * SAMPLE_RATE);
+        uint32_t dataSize = frames * 4;
+        std::vector<uint8_t> wav;
+        auto put = [&](uint32_t value, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                wav.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        };
+        auto tag = [&](const char *text) { wav.insert(wav.end(), text, text + 4); };
+
+        tag("RIFF");
+        put(36 + dataSize, 4);
+        tag("WAVE");
+        tag("fmt ");
+        put(16, 4);
+        put(1, 2); // PCM
+        put(2, 2);
+        put(SAMPLE_RATE, 4);
+        put(SAMPLE_RATE * 4, 4);
+        put(4, 2);
+        put(16, 2);
+        tag("data");
+        put(dataSize, 4);
+        for (uint32_t i = 0; i < frames; i++) {
+            auto sample = static_cast<int16_t>(4000 * std::sin(i * 0.05));
+            put(static_cast<uint16_t>(sample), 2);
+            put(static_cast<uint16_t>(sample), 2);
+        }
+        return wav;
+    }
+
+    int failures = 0;
+
+    auto expect(bool condition, const char *what) -> void {
+        if (!condition) {
+            std::fprintf(stderr, "Failed: %s\n", what);
+            failures++;
+        }
+    }
+
+    // Polls until done returns true, which it must within TIMEOUT
+    auto waitUntil(const std::function<bool()> &done) -> bool {
+        auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+}
+
+int main() {
+    auto wav = std::make_shared<const std::vector<uint8_t>>(makeWav(SOUND_SECONDS));
+    auto openWav = [wav]() -> std::unique_ptr<EntryStream> { return std::make_unique<MemoryStream>(wav); };
+
+    AudioPreview audio(AudioPreview::Output::Null);
+    expect(!audio.isPlaying() && audio.position() == 0.0, "nothing plays before the first play()");
+    expect(!audio.seek(0.5), "seek() needs something to have been played");
+
+    if (!audio.play(openWav)) {
+        std::fprintf(stderr, "The null backend couldn't be opened\n");
+        return 1;
+    }
+    expect(audio.isPlaying(), "a sound counts as playing while it starts");
+    expect(waitUntil([&] { return audio.position() > 0.0; }), "play() reaches the device");
+    expect(std::fabs(audio.length() - SOUND_SECONDS) < 0.01, "the length comes from the decoder");
+
+    // Until the device has flushed what it had, the position is 0; after, it's from the new point.
+    // Anything in between would be the old generation's frames counted against the new one.
+    expect(audio.seek(0.5), "seek() restarts the sound");
+    bool onlyNewFrames = true;
+    expect(waitUntil([&] {
+               double position = audio.position();
+               onlyNewFrames = onlyNewFrames && (position == 0.0 || position >= 0.5);
+               return position > 0.5;
+           }),
+           "seek() reaches the device");
+    expect(onlyNewFrames, "nothing from before the seek is counted after it");
+    expect(audio.position() < SOUND_SECONDS, "the seek skipped ahead rather than past the end");
+
+    expect(waitUntil([&] { return !audio.isPlaying(); }), "the sound plays to the end");
+    expect(!audio.hasFailed(), "a sound that played through hasn't failed");
+
+    audio.play(openWav);
+    expect(waitUntil([&] { return audio.position() > 0.0; }), "play() again after the end");
+    audio.stop();
+    expect(!audio.isPlaying() && !audio.hasFailed(), "stop() stops straight away");
+
+    expect(audio.seek(0.25), "seek() after stop() plays again");
+    expect(waitUntil([&] { return audio.position() >= 0.25; }), "seek() after stop() reaches the device");
+    audio.stop();
+
+    audio.play([]() -> std::unique_ptr<EntryStream> { return nullptr; });
+    expect(waitUntil([&] { return audio.hasFailed(); }), "a sound that can't be opened fails");
+    expect(waitUntil([&] { return !audio.isPlaying(); }), "a failed sound isn't playing");
+
+    // Requests faster than the device takes them; only the last one should be heard
+    for (int i = 0; i < 50; i++) {
+        audio.play(openWav);
+        audio.seek(0.1 * (i % 10));
+        if (i % 7 == 0) {
+            audio.stop();
+        }
+    }
+    audio.seek(0.75);
+    expect(waitUntil([&] { return audio.position() >= 0.75; }), "the last of many requests wins");
+    expect(!audio.hasFailed(), "rapid requests don't fail");
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("Play, seek and stop work on the null backend\n");
+    return 0;
+}
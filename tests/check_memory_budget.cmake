@@ -0,0 +1,34 @@
+# Fails if the memory report PakViewer --stats wrote is over budget, or is missing what --decode
+# should have put in it.
+#   cmake -DSTATS=stats.json -DCPU_BUDGET=<bytes> -DDECODE_BUDGET=<bytes> -P check_memory_budget.cmake
+
+cmake_minimum_required(VERSION 3.19)
+
+file(READ ${STATS} report)
+string(JSON cpuBytes GET ${report} cpuBytes)
+if(cpuBytes GREATER CPU_BUDGET)
+    message(FATAL_ERROR "${cpuBytes} bytes of CPU memory held after loading, over the budget of ${CPU_BUDGET}")
+endif()
+
+string(JSON count LENGTH ${report} categories)
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+    string(JSON name GET ${report} categories ${i} name)
+    string(JSON bytes GET ${report} categories ${i} bytes)
+    string(JSON peakBytes GET ${report} categories ${i} peakBytes)
+    string(JSON totalAllocations GET ${report} categories ${i} totalAllocations)
+
+    if(name STREQUAL "Entry table" AND bytes EQUAL 0)
+        message(FATAL_ERROR "The open archive's entry table isn't accounted")
+    elseif(name STREQUAL "Decode buffers")
+        if(totalAllocations EQUAL 0)
+            message(FATAL_ERROR "Nothing was decoded")
+        elseif(peakBytes GREATER DECODE_BUDGET)
+            message(FATAL_ERROR "Decode buffers peaked at ${peakBytes} bytes, over the budget of ${DECODE_BUDGET}")
+        endif()
+    elseif(name STREQUAL "Palettes" AND bytes EQUAL 0)
+        message(FATAL_ERROR "No palette was loaded for the WALs")
+    endif()
+endforeach()
+
+message(STATUS "${cpuBytes} bytes of CPU memory held, within ${CPU_BUDGET}")
@@ -0,0 +1,86 @@
+// Checks ContentHash against XXH64 values from the reference implementation
+
+#include "contenthash.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+    constexpr uint64_t PRIME = 2654435761u;
+
+    struct Vector {
+        size_t size;
+        uint64_t unseeded;
+        uint64_t seeded; // With PRIME as the seed
+    };
+
+    // Sizes either side of the 32-byte stripe and the 8 and 4-byte tails, so every path is covered
+    const Vector VECTORS[] = {
+        {0, 0xef46db3751d8e999ull, 0xac75fda2929b17efull},   {1, 0x4fce394cc88952d8ull, 0x739840cb819fa723ull},
+        {4, 0x9256e58aa397aef1ull, 0x09d5ffdfb928ab4bull},   {8, 0xf74cb1451b32b8cfull, 0x9c44b77fbcc302c5ull},
+        {14, 0xcffa8db881bc3a3dull, 0x5b9611585efcc9cbull},  {31, 0xad09d9a6941dd847ull, 0x9c90d9d9c2e3d340ull},
+        {32, 0xaf5753d39159edeeull, 0xdcab9233b8ca7b0full},  {33, 0x6711cbdd8543baa8ull, 0x66e9cecf2f1de71cull},
+        {63, 0xff4410e17ce11efaull, 0x7f715f51d0f26050ull},  {64, 0x18f5388f1d2ba08cull, 0x479e7103cf9aa020ull},
+        {101, 0x0eab543384f878adull, 0xcaa65939306f1e21ull}, {222, 0x9dd507880debb03dull, 0xdc515172b8ee0600ull},
+        {256, 0x650c5a61a60eb210ull, 0x1116aa5771a1084cull},
+    };
+
+    // The same pseudo-random buffer xxHash's own sanity checks use
+    auto makeBuffer(size_t size) -> std::vector<uint8_t> {
+        std::vector<uint8_t> buffer(size);
+        uint64_t generator = PRIME;
+        for (auto &byte : buffer) {
+            byte = static_cast<uint8_t>(generator >> 24);
+            generator = (generator * generator) & 0xFFFFFFFF;
+        }
+        return buffer;
+    }
+
+    int failures = 0;
+
+    auto check(const char *what, size_t size, uint64_t seed, uint64_t got, uint64_t expected) -> void {
+        if (got != expected) {
+            std::fprintf(stderr, "%s of %zu bytes, seed %" PRIu64 ": got %016" PRIx64 ", expected %016" PRIx64 "\n", what,
+                         size, seed, got, expected);
+            failures++;
+        }
+    }
+
+    // Feeds the input in uneven pieces, so partial stripes get buffered and carried over
+    auto hashInChunks(const uint8_t *data, size_t size, uint64_t seed, size_t chunk) -> uint64_t {
+        ContentHash hash(seed);
+        for (size_t offset = 0; offset < size; offset += chunk) {
+            hash.update(data + offset, std::min(chunk, size - offset));
+        }
+        return hash.digest();
+    }
+}
+
+int main() {
+    std::vector<uint8_t> buffer = makeBuffer(256);
+
+    for (const Vector &vector : VECTORS) {
+        for (uint64_t seed : {uint64_t{0}, PRIME}) {
+            uint64_t expected = seed ? vector.seeded : vector.unseeded;
+            check("One-shot hash", vector.size, seed, ContentHash::hash(buffer.data(), vector.size, seed), expected);
+            for (size_t chunk : {1, 3, 7, 13, 32, 33}) {
+                check("Streamed hash", vector.size, seed, hashInChunks(buffer.data(), vector.size, seed, chunk), expected);
+            }
+        }
+    }
+
+    const char *text = "Nobody inspects the spammish repetition";
+    check("Text hash", std::strlen(text), 0, ContentHash::hash(text, std::strlen(text)), 0xfbcea83c8a378bf1ull);
+    check("Text hash", 1, 0, ContentHash::hash("a", 1), 0xd24ec4f1a98c6e5bull);
+    check("Text hash", 3, 0, ContentHash::hash("abc", 3), 0x44bc2cf5ad770999ull);
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All XXH64 vectors match\n");
+    return 0;
+}
@@ -0,0 +1,245 @@
+// Decodes PCX files built in memory for each layout the parser handles and compares every pixel with
+// what the file was built from. Built twice, once with PCX_SCALAR, so the vector and portable code
+// both have to agree with the same answers.
+
+#include "pcxparser.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    // An image described the way it should decode, before it's written out as a PCX file
+    struct Picture {
+        int width;
+        int height;
+        std::vector<uint8_t> rgba;
+    };
+
+    auto makeHeader(int bits, int planes, int width, int height, int bytesPerLine, PCXEncodingType encoding)
+        -> PCXHeader {
+        PCXHeader header{};
+        header.magic_number = 0x0A;
+        header.version = PCXVersion::PCX_VERSION_3;
+        header.encoding = encoding;
+        header.bitsPerPixel = static_cast<uint8_t>(bits);
+        header.xmin = 10; // The image is the box between the mins and maxes, which needn't start at 0
+        header.ymin = 20;
+        header.xmax = static_cast<uint16_t>(10 + width - 1);
+        header.ymax = static_cast<uint16_t>(20 + height - 1);
+        header.colorPlanes = static_cast<uint8_t>(planes);
+        header.bytesPerLine = static_cast<uint16_t>(bytesPerLine);
+        return header;
+    }
+
+    // Runs of repeated bytes, and single bytes that would read as a run marker, go out as count and value
+    // pairs. Runs stop at the end of each scanline, as the format asks.
+    auto encodeRLE(const std::vector<uint8_t> &scanlines, size_t lineSize) -> std::vector<uint8_t> {
+        std::vector<uint8_t> encoded;
+        for (size_t line = 0; line < scanlines.size(); line += lineSize) {
+            size_t i = line;
+            while (i < line + lineSize) {
+                size_t run = 1;
+                while (i + run < line + lineSize && run < 63 && scanlines[i + run] == scanlines[i]) {
+                    run++;
+                }
+                if (run > 1 || scanlines[i] >= 0xC0) {
+                    encoded.push_back(static_cast<uint8_t>(0xC0 | run));
+                }
+                encoded.push_back(scanlines[i]);
+                i += run;
+            }
+        }
+        return encoded;
+    }
+
+    auto writeFile(const PCXHeader &header, const std::vector<uint8_t> &scanlines,
+                   const std::vector<uint8_t> &palette256 = {}) -> std::vector<uint8_t> {
+        std::vector<uint8_t> file(128, 0);
+        std::memcpy(file.data(), &header, sizeof(header));
+
+        size_t lineSize = static_cast<size_t>(header.colorPlanes) * header.bytesPerLine;
+        std::vector<uint8_t> body =
+            header.encoding == PCXEncodingType::PCX_RLE_ENCODING ? encodeRLE(scanlines, lineSize) : scanlines;
+        file.insert(file.end(), body.begin(), body.end());
+
+        if (!palette256.empty()) {
+            file.push_back(0x0C);
+            file.insert(file.end(), palette256.begin(), palette256.end());
+        }
+        return file;
+    }
+
+    auto check(const std::string &name, const std::vector<uint8_t> &file, const Picture &expected) -> void {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+        bool decoded = PCXParser::decodePCX(file, [&](int w, int h) {
+            width = w;
+            height = h;
+            pixels.assign(static_cast<size_t>(w) * h * 4, 0);
+            return pixels.data();
+        });
+
+        if (!decoded) {
+            std::fprintf(stderr, "%s: didn't decode\n", name.c_str());
+            failures++;
+            return;
+        }
+        if (width != expected.width || height != expected.height) {
+            std::fprintf(stderr, "%s: decoded as %dx%d, expected %dx%d\n", name.c_str(), width, height,
+                         expected.width, expected.height);
+            failures++;
+            return;
+        }
+        for (size_t i = 0; i < pixels.size(); i++) {
+            if (pixels[i] != expected.rgba[i]) {
+                size_t pixel = i / 4;
+                std::fprintf(stderr, "%s: pixel %zu,%zu channel %zu is %d, expected %d\n", name.c_str(),
+                             pixel % width, pixel / width, i % 4, pixels[i], expected.rgba[i]);
+                failures++;
+                return;
+            }
+        }
+    }
+
+    // Channel values that repeat in places, so there are runs to encode, and go above 0xC0 in others
+    auto channel(int x, int y, int c) -> uint8_t {
+        if (x >= 4 && x < 12) {
+            return static_cast<uint8_t>(0xC8 + c);
+        }
+        return static_cast<uint8_t>(x * 37 + y * 11 + c * 89);
+    }
+
+    // 24 and 32 bit images store each row as a run of red, then green, then blue (then alpha). Widths
+    // past 16 and not a multiple of it go through both the vector loop and the tail after it.
+    auto testTrueColor(int planes, int width, int height, PCXEncodingType encoding) -> void {
+        int bytesPerLine = width + (width & 1);
+        Picture picture{width, height, std::vector<uint8_t>(static_cast<size_t>(width) * height * 4)};
+        std::vector<uint8_t> scanlines(static_cast<size_t>(planes) * bytesPerLine * height, 0);
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                for (int c = 0; c < 4; c++) {
+                    uint8_t value = c < planes ? channel(x, y, c) : 255;
+                    picture.rgba[(static_cast<size_t>(y) * width + x) * 4 + c] = value;
+                    if (c < planes) {
+                        scanlines[(static_cast<size_t>(y) * planes + c) * bytesPerLine + x] = value;
+                    }
+                }
+            }
+        }
+
+        auto header = makeHeader(8, planes, width, height, bytesPerLine, encoding);
+        std::string name = std::to_string(planes * 8) + "-bit " + std::to_string(width) + "x" + std::to_string(height) +
+                           (encoding == PCXEncodingType::PCX_RLE_ENCODING ? " RLE" : " uncompressed");
+        check(name, writeFile(header, scanlines), picture);
+    }
+
+    // Palette indices come from planes of 1 bit pixels, plane p holding bit p of every index, most
+    // significant pixel first in each byte
+    auto packPlanes(const std::vector<int> &indices, int planes, int width, int height, int bytesPerLine)
+        -> std::vector<uint8_t> {
+        std::vector<uint8_t> scanlines(static_cast<size_t>(planes) * bytesPerLine * height, 0);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int index = indices[static_cast<size_t>(y) * width + x];
+                for (int plane = 0; plane < planes; plane++) {
+                    if ((index >> plane) & 1) {
+                        scanlines[(static_cast<size_t>(y) * planes + plane) * bytesPerLine + x / 8] |=
+                            static_cast<uint8_t>(0x80 >> (x % 8));
+                    }
+                }
+            }
+        }
+        return scanlines;
+    }
+
+    auto paletteColor(const uint8_t *rgb, int index, std::vector<uint8_t> &rgba) -> void {
+        rgba.insert(rgba.end(), {rgb[index * 3], rgb[index * 3 + 1], rgb[index * 3 + 2], 255});
+    }
+
+    // EGA: 4 planes of 1 bit, indexing the 16 color palette in the header
+    auto testPlanarEGA(int width, int height) -> void {
+        uint8_t palette[48];
+        for (int i = 0; i < 48; i++) {
+            palette[i] = static_cast<uint8_t>(i * 5 + 3);
+        }
+
+        std::vector<int> indices;
+        Picture picture{width, height, {}};
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int index = (x * 3 + y) % 16;
+                indices.push_back(index);
+                paletteColor(palette, index, picture.rgba);
+            }
+        }
+
+        int bytesPerLine = ((width + 7) / 8 + 1) & ~1;
+        auto header = makeHeader(1, 4, width, height, bytesPerLine, PCXEncodingType::PCX_RLE_ENCODING);
+        std::memcpy(header.palette, palette, sizeof(palette));
+        check("4-bit EGA planar", writeFile(header, packPlanes(indices, 4, width, height, bytesPerLine)), picture);
+    }
+
+    // 1 bit images without a header palette are black and white
+    auto testMonochrome(int width, int height) -> void {
+        const uint8_t blackWhite[6] = {0, 0, 0, 255, 255, 255};
+
+        std::vector<int> indices;
+        Picture picture{width, height, {}};
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int index = (x / 3 + y) & 1;
+                indices.push_back(index);
+                paletteColor(blackWhite, index, picture.rgba);
+            }
+        }
+
+        int bytesPerLine = ((width + 7) / 8 + 1) & ~1;
+        auto header = makeHeader(1, 1, width, height, bytesPerLine, PCXEncodingType::PCX_RLE_ENCODING);
+        check("1-bit", writeFile(header, packPlanes(indices, 1, width, height, bytesPerLine)), picture);
+    }
+
+    // 8 bit indices into the 256 color palette at the end of the file, stored without compression
+    auto testPaletted(int width, int height) -> void {
+        std::vector<uint8_t> palette(768);
+        for (size_t i = 0; i < palette.size(); i++) {
+            palette[i] = static_cast<uint8_t>(i * 7 + 1);
+        }
+
+        int bytesPerLine = width + (width & 1);
+        std::vector<uint8_t> scanlines(static_cast<size_t>(bytesPerLine) * height, 0);
+        Picture picture{width, height, {}};
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int index = (x * 13 + y * 29) & 255;
+                scanlines[static_cast<size_t>(y) * bytesPerLine + x] = static_cast<uint8_t>(index);
+                paletteColor(palette.data(), index, picture.rgba);
+            }
+        }
+
+        auto header = makeHeader(8, 1, width, height, bytesPerLine, PCXEncodingType::PCX_NO_ENCODING);
+        check("8-bit uncompressed", writeFile(header, scanlines, palette), picture);
+    }
+}
+
+int main() {
+    testTrueColor(3, 37, 5, PCXEncodingType::PCX_RLE_ENCODING);
+    testTrueColor(3, 37, 5, PCXEncodingType::PCX_NO_ENCODING);
+    testTrueColor(4, 21, 3, PCXEncodingType::PCX_NO_ENCODING);
+    testTrueColor(3, 7, 2, PCXEncodingType::PCX_RLE_ENCODING); // Narrower than one vector
+    testPlanarEGA(19, 6);
+    testMonochrome(29, 4);
+    testPaletted(23, 5);
+
+    if (failures) {
+        std::fprintf(stderr, "%d images decoded wrongly\n", failures);
+        return 1;
+    }
+    std::printf("All PCX images decode as expected\n");
+    return 0;
+}
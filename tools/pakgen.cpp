@@ -0,0 +1,709 @@
+// Writes synthetic .pak and .pk3 archives for stress testing and benchmarking the viewer
+//
+// The output only depends on the options, so two runs with the same seed produce byte-identical
+// archives on any machine. Image entries are real PCX (RLE, 256 colours), WAL (with all four mip
+// levels, plus the pics/colormap.pcx they take their palette from) and PNG files.
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    struct Options {
+        std::string output;
+        uint64_t entries = 1000;
+        int depth = 3;
+        int fanout = 8;
+        uint64_t seed = 1;
+        int maxImageSize = 128;
+        uint64_t sparse = 0; // Size of an extra all-zero entry written as a hole, for archives past 4 GB
+        uint64_t repeat = 0; // Every Nth file is a copy of the one before it, for a known number of duplicates
+        std::string root;    // Prefixed to every name, so the same archive under another root diffs as all moved
+        // Relative weights of each kind of file
+        int pcx = 30;
+        int wal = 30;
+        int png = 20;
+        int txt = 10;
+        int dat = 10;
+    };
+
+    enum class Kind { PCX, WAL, PNG, TXT, DAT };
+
+    // splitmix64. The standard library's distributions aren't specified exactly enough to give the
+    // same numbers on every platform, so all randomness comes from here.
+    class Random {
+    public:
+        explicit Random(uint64_t seed) : state(seed) {}
+
+        auto next() -> uint64_t {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        // In [0, bound)
+        auto below(uint64_t bound) -> uint64_t {
+            return bound ? next() % bound : 0;
+        }
+
+    private:
+        uint64_t state;
+    };
+
+    auto put16(std::vector<uint8_t> &out, uint16_t value) -> void {
+        out.push_back(value & 0xFF);
+        out.push_back(value >> 8);
+    }
+
+    auto put32(std::vector<uint8_t> &out, uint32_t value) -> void {
+        put16(out, value & 0xFFFF);
+        put16(out, value >> 16);
+    }
+
+    auto put64(std::vector<uint8_t> &out, uint64_t value) -> void {
+        put32(out, value & 0xFFFFFFFF);
+        put32(out, value >> 32);
+    }
+
+    auto put32BE(std::vector<uint8_t> &out, uint32_t value) -> void {
+        out.push_back(value >> 24);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back(value & 0xFF);
+    }
+
+    auto putString(std::vector<uint8_t> &out, const std::string &text, size_t width) -> void {
+        for (size_t i = 0; i < width; i++) {
+            out.push_back(i < text.size() ? text[i] : 0);
+        }
+    }
+
+    // A fixed 256 colour palette: a few gradients, roughly in the spirit of Quake's
+    auto makePalette() -> std::vector<uint8_t> {
+        std::vector<uint8_t> palette(768);
+        for (int i = 0; i < 256; i++) {
+            int ramp = i / 16;
+            int level = (i % 16) * 16 + 8;
+            palette[i * 3 + 0] = static_cast<uint8_t>(ramp & 1 ? level : level / 2);
+            palette[i * 3 + 1] = static_cast<uint8_t>(ramp & 2 ? level : level / 3);
+            palette[i * 3 + 2] = static_cast<uint8_t>(ramp & 4 ? level : level / 4);
+        }
+        return palette;
+    }
+
+    // Palette indices with large flat areas, so RLE has runs to find, plus some per-image variation
+    auto makeIndexedPixels(int width, int height, uint64_t variant) -> std::vector<uint8_t> {
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height);
+        int cell = 4 << (variant % 3);
+        uint8_t base = static_cast<uint8_t>(variant * 37);
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                bool checker = ((x / cell) + (y / cell)) & 1;
+                pixels[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>(checker ? base + y / 4 : base + 128 + x / 8);
+            }
+        }
+        return pixels;
+    }
+
+    auto encodePCX(int width, int height, const std::vector<uint8_t> &pixels, const std::vector<uint8_t> &palette) -> std::vector<uint8_t> {
+        std::vector<uint8_t> out;
+        int bytesPerLine = (width + 1) & ~1; // Always even
+
+        out.push_back(0x0A); // Manufacturer
+        out.push_back(5);    // Version 3.0
+        out.push_back(1);    // RLE
+        out.push_back(8);    // Bits per pixel
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, static_cast<uint16_t>(width - 1));
+        put16(out, static_cast<uint16_t>(height - 1));
+        put16(out, 72);
+        put16(out, 72);
+        out.insert(out.end(), 48, 0); // EGA palette
+        out.push_back(0);             // Reserved
+        out.push_back(1);             // Colour planes
+        put16(out, static_cast<uint16_t>(bytesPerLine));
+        put16(out, 1); // Palette type: colour
+        out.insert(out.end(), 58, 0);
+
+        // Runs never cross scanlines, and any literal with both top bits set has to go out as a run of one
+        std::vector<uint8_t> line(bytesPerLine, 0);
+        for (int y = 0; y < height; y++) {
+            std::copy_n(pixels.begin() + static_cast<size_t>(y) * width, width, line.begin());
+
+            for (int x = 0; x < bytesPerLine;) {
+                uint8_t value = line[x];
+                int run = 1;
+                while (x + run < bytesPerLine && run < 63 && line[x + run] == value) {
+                    run++;
+                }
+
+                if (run > 1 || value >= 0xC0) {
+                    out.push_back(static_cast<uint8_t>(0xC0 | run));
+                }
+                out.push_back(value);
+                x += run;
+            }
+        }
+
+        out.push_back(0x0C);
+        out.insert(out.end(), palette.begin(), palette.end());
+        return out;
+    }
+
+    auto encodeWAL(const std::string &name, int width, int height, const std::vector<uint8_t> &pixels) -> std::vector<uint8_t> {
+        constexpr size_t HEADER_SIZE = 100;
+        std::vector<uint8_t> out;
+
+        putString(out, name, 32);
+        put32(out, width);
+        put32(out, height);
+
+        size_t offset = HEADER_SIZE;
+        for (int mip = 0; mip < 4; mip++) {
+            put32(out, static_cast<uint32_t>(offset));
+            offset += static_cast<size_t>(width >> mip) * (height >> mip);
+        }
+
+        putString(out, "", 32); // Next frame of the animation
+        put32(out, 0);          // Flags
+        put32(out, 0);          // Contents
+        put32(out, 0);          // Value
+
+        // Each mip is a point sampled copy of the level above it
+        for (int mip = 0; mip < 4; mip++) {
+            int step = 1 << mip;
+            for (int y = 0; y < height; y += step) {
+                for (int x = 0; x < width; x += step) {
+                    out.push_back(pixels[static_cast<size_t>(y) * width + x]);
+                }
+            }
+        }
+        return out;
+    }
+
+    auto appendChunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data) -> void {
+        put32BE(out, static_cast<uint32_t>(data.size()));
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        put32BE(out, crc32(0, out.data() + start, static_cast<uInt>(out.size() - start)));
+    }
+
+    auto encodePNG(int width, int height, const std::vector<uint8_t> &pixels, const std::vector<uint8_t> &palette) -> std::vector<uint8_t> {
+        static const uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::vector<uint8_t> out(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+
+        std::vector<uint8_t> header;
+        put32BE(header, width);
+        put32BE(header, height);
+        header.push_back(8); // Bit depth
+        header.push_back(6); // RGBA
+        header.push_back(0); // Deflate
+        header.push_back(0); // Adaptive filtering
+        header.push_back(0); // No interlace
+        appendChunk(out, "IHDR", header);
+
+        // Every row uses filter type 0, with a soft alpha ramp so the alpha channel isn't constant
+        std::vector<uint8_t> raw;
+        raw.reserve(static_cast<size_t>(width * 4 + 1) * height);
+        for (int y = 0; y < height; y++) {
+            raw.push_back(0);
+            for (int x = 0; x < width; x++) {
+                uint8_t index = pixels[static_cast<size_t>(y) * width + x];
+                raw.insert(raw.end(), palette.begin() + index * 3, palette.begin() + index * 3 + 3);
+                raw.push_back(static_cast<uint8_t>(255 - x * 128 / width));
+            }
+        }
+
+        uLongf compressedSize = compressBound(static_cast<uLong>(raw.size()));
+        std::vector<uint8_t> compressed(compressedSize);
+        compress2(compressed.data(), &compressedSize, raw.data(), static_cast<uLong>(raw.size()), Z_BEST_SPEED);
+        compressed.resize(compressedSize);
+        appendChunk(out, "IDAT", compressed);
+
+        appendChunk(out, "IEND", {});
+        return out;
+    }
+
+    auto makeText(uint64_t index, Random &random) -> std::vector<uint8_t> {
+        static const char *const WORDS[] = {"bind", "set", "alias", "exec", "map", "skill", "deathmatch", "fraglimit",
+                                             "timelimit", "sv_gravity", "cl_forwardspeed", "echo", "wait", "+attack"};
+        std::string text = "// Generated file " + std::to_string(index) + "\n";
+
+        int lines = 4 + static_cast<int>(random.below(60));
+        for (int i = 0; i < lines; i++) {
+            int words = 1 + static_cast<int>(random.below(5));
+            for (int w = 0; w < words; w++) {
+                text += WORDS[random.below(sizeof(WORDS) / sizeof(WORDS[0]))];
+                text += w + 1 < words ? ' ' : '\n';
+            }
+        }
+        return std::vector<uint8_t>(text.begin(), text.end());
+    }
+
+    auto makeBinary(Random &random) -> std::vector<uint8_t> {
+        std::vector<uint8_t> data(64 + random.below(4096));
+        for (auto &byte : data) {
+            byte = static_cast<uint8_t>(random.next());
+        }
+        return data;
+    }
+
+    struct File {
+        std::string name;
+        std::vector<uint8_t> data;
+        bool compressible; // PNGs are already deflated, so they get stored as is
+    };
+
+    constexpr char SPARSE_NAME[] = "sparse.bin";
+
+    // CRC-32 of size zero bytes, without needing them in memory
+    auto zeroCRC(uint64_t size) -> uint32_t {
+        std::vector<uint8_t> zeros(1 << 20);
+        uint32_t block = crc32(0, zeros.data(), static_cast<uInt>(zeros.size()));
+        uint32_t crc = crc32(0, nullptr, 0);
+        while (size > 0) {
+            uint64_t length = std::min<uint64_t>(size, zeros.size());
+            uint32_t next = length == zeros.size() ? block : crc32(0, zeros.data(), static_cast<uInt>(length));
+            crc = crc32_combine(crc, next, static_cast<z_off_t>(length));
+            size -= length;
+        }
+        return crc;
+    }
+
+    // Produces every entry in order, so archives with millions of entries never have to be held in memory
+    class Generator {
+    public:
+        explicit Generator(const Options &options) : options(options), random(options.seed), palette(makePalette()) {
+            weights[0] = options.pcx;
+            weights[1] = options.wal;
+            weights[2] = options.png;
+            weights[3] = options.txt;
+            weights[4] = options.dat;
+            for (int weight : weights) {
+                totalWeight += weight;
+            }
+        }
+
+        // WALs can't be shown without the palette in the colormap, so it goes in first
+        auto count() const -> uint64_t {
+            return options.entries + (options.wal > 0 ? 1 : 0);
+        }
+
+        auto next() -> File {
+            uint64_t before = index;
+            File file = generate();
+            if (options.repeat > 0 && index != before && index % options.repeat == 0 && !previous.name.empty()) {
+                // Only the contents are copied; the name keeps its own path and takes the copied extension
+                file.name = file.name.substr(0, file.name.rfind('.')) + previous.name.substr(previous.name.rfind('.'));
+                file.data = previous.data;
+                file.compressible = previous.compressible;
+            }
+            if (options.repeat > 0) {
+                previous = file;
+            }
+            file.name = options.root + file.name;
+            return file;
+        }
+
+    private:
+        auto generate() -> File {
+            if (index == 0 && options.wal > 0 && !colormapDone) {
+                colormapDone = true;
+                auto pixels = makeIndexedPixels(256, 64, 0);
+                return {"pics/colormap.pcx", encodePCX(256, 64, pixels, palette), true};
+            }
+
+            uint64_t i = index++;
+            Kind kind = pickKind();
+
+            std::string path;
+            int depth = options.depth > 0 ? 1 + static_cast<int>(random.below(options.depth)) : 0;
+            for (int level = 0; level < depth; level++) {
+                path += "d" + std::to_string(random.below(options.fanout)) + "/";
+            }
+            path += "f" + std::to_string(i);
+
+            // Image sides are multiples of 16, which the WAL mips need
+            int sizes = std::max(1, options.maxImageSize / 16);
+            int width = 16 * (1 + static_cast<int>(random.below(sizes)));
+            int height = 16 * (1 + static_cast<int>(random.below(sizes)));
+
+            switch (kind) {
+            case Kind::PCX:
+                return {path + ".pcx", encodePCX(width, height, makeIndexedPixels(width, height, i), palette), true};
+            case Kind::WAL:
+                return {path + ".wal", encodeWAL(path, width, height, makeIndexedPixels(width, height, i)), true};
+            case Kind::PNG:
+                return {path + ".png", encodePNG(width, height, makeIndexedPixels(width, height, i), palette), false};
+            case Kind::TXT:
+                return {path + ".cfg", makeText(i, random), true};
+            case Kind::DAT:
+                break;
+            }
+            return {path + ".dat", makeBinary(random), true};
+        }
+
+        auto pickKind() -> Kind {
+            uint64_t roll = random.below(totalWeight);
+            for (int i = 0; i < 5; i++) {
+                if (roll < static_cast<uint64_t>(weights[i])) {
+                    return static_cast<Kind>(i);
+                }
+                roll -= weights[i];
+            }
+            return Kind::DAT;
+        }
+
+        const Options &options;
+        Random random;
+        std::vector<uint8_t> palette;
+        int weights[5];
+        int totalWeight = 0;
+        uint64_t index = 0;
+        bool colormapDone = false;
+        File previous;
+    };
+
+    auto writePAK(const Options &options, std::ofstream &out) -> bool {
+        constexpr size_t NAME_SIZE = 56;
+        Generator generator(options);
+
+        // The header is patched once the directory's position is known
+        std::vector<uint8_t> header;
+        putString(header, "PACK", 4);
+        put32(header, 0);
+        put32(header, 0);
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+        std::vector<uint8_t> directory;
+        uint64_t offset = header.size();
+
+        for (uint64_t i = 0; i < generator.count(); i++) {
+            File file = generator.next();
+            if (file.name.size() >= NAME_SIZE) {
+                std::cerr << "Path too long for a PAK entry: " << file.name << " (try a smaller --depth)\n";
+                return false;
+            }
+            if (offset + file.data.size() > UINT32_MAX) {
+                std::cerr << "PAK files can't be bigger than 4 GB; try fewer --entries or a .pk3\n";
+                return false;
+            }
+
+            out.write(reinterpret_cast<const char *>(file.data.data()), file.data.size());
+
+            putString(directory, file.name, NAME_SIZE);
+            put32(directory, static_cast<uint32_t>(offset));
+            put32(directory, static_cast<uint32_t>(file.data.size()));
+            offset += file.data.size();
+        }
+
+        // The sparse entry goes after the directory, so it can start below 4 GB and end past it
+        uint64_t sparseOffset = offset + directory.size() + (options.sparse ? 64 : 0);
+        if (options.sparse) {
+            if (options.sparse > UINT32_MAX || sparseOffset > UINT32_MAX) {
+                std::cerr << "A PAK entry has to start below 4 GB and be smaller than 4 GB\n";
+                return false;
+            }
+            putString(directory, SPARSE_NAME, NAME_SIZE);
+            put32(directory, static_cast<uint32_t>(sparseOffset));
+            put32(directory, static_cast<uint32_t>(options.sparse));
+        }
+
+        if (offset + directory.size() > UINT32_MAX) {
+            std::cerr << "PAK directory doesn't fit below 4 GB\n";
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char *>(directory.data()), directory.size());
+
+        // Only the last byte is written; everything before it is left as a hole
+        if (options.sparse) {
+            out.seekp(static_cast<std::streamoff>(sparseOffset + options.sparse - 1));
+            out.put(0);
+        }
+
+        header.clear();
+        putString(header, "PACK", 4);
+        put32(header, static_cast<uint32_t>(offset));
+        put32(header, static_cast<uint32_t>(directory.size()));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+        return static_cast<bool>(out);
+    }
+
+    auto deflateRaw(const std::vector<uint8_t> &data) -> std::vector<uint8_t> {
+        z_stream stream{};
+        deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+        std::vector<uint8_t> out(deflateBound(&stream, static_cast<uLong>(data.size())));
+        stream.next_in = const_cast<Bytef *>(data.data());
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = out.data();
+        stream.avail_out = static_cast<uInt>(out.size());
+        deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        return out;
+    }
+
+    // A plain ZIP writer: every entry's sizes are known before its local header is written, so there
+    // are no data descriptors. Zip64 records only appear once the archive needs them.
+    auto writePK3(const Options &options, std::ofstream &out) -> bool {
+        constexpr uint16_t DOS_DATE = (0 << 9) | (1 << 5) | 1; // 1980-01-01, fixed so output is reproducible
+        constexpr uint32_t ZIP64_LIMIT = 0xFFFFFFFF;
+        Generator generator(options);
+
+        std::vector<uint8_t> centralDirectory;
+        std::vector<uint8_t> header;
+        uint64_t offset = 0;
+
+        // Writes one entry's local header and data, and adds it to the central directory. Sizes past
+        // 4 GB go in a Zip64 extra field in both headers, and offsets past it in the central directory's.
+        auto writeEntry = [&](const std::string &name, const std::vector<uint8_t> &payload, uint16_t method,
+                              uint32_t crc, uint64_t size, uint64_t compressedSize) {
+            bool sizesTooBig = size >= ZIP64_LIMIT || compressedSize >= ZIP64_LIMIT;
+            bool offsetTooBig = offset >= ZIP64_LIMIT;
+
+            header.clear();
+            put32(header, 0x04034b50);
+            put16(header, sizesTooBig ? 45 : 20); // Version needed
+            put16(header, 0);                     // Flags
+            put16(header, method);
+            put16(header, 0); // Time
+            put16(header, DOS_DATE);
+            put32(header, crc);
+            put32(header, sizesTooBig ? ZIP64_LIMIT : static_cast<uint32_t>(compressedSize));
+            put32(header, sizesTooBig ? ZIP64_LIMIT : static_cast<uint32_t>(size));
+            put16(header, static_cast<uint16_t>(name.size()));
+            put16(header, sizesTooBig ? 20 : 0); // Extra field length
+            header.insert(header.end(), name.begin(), name.end());
+            if (sizesTooBig) {
+                put16(header, 0x0001);
+                put16(header, 16);
+                put64(header, size);
+                put64(header, compressedSize);
+            }
+
+            out.write(reinterpret_cast<const char *>(header.data()), header.size());
+            if (payload.size() == compressedSize) {
+                out.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+            } else {
+                // All zeros that aren't held in memory; seeking over them leaves a hole
+                out.seekp(static_cast<std::streamoff>(compressedSize), std::ios::cur);
+            }
+
+            std::vector<uint8_t> extra;
+            if (size >= ZIP64_LIMIT) {
+                put64(extra, size);
+            }
+            if (compressedSize >= ZIP64_LIMIT) {
+                put64(extra, compressedSize);
+            }
+            if (offsetTooBig) {
+                put64(extra, offset);
+            }
+
+            put32(centralDirectory, 0x02014b50);
+            put16(centralDirectory, (3 << 8) | 45); // Made by Unix, spec 4.5
+            put16(centralDirectory, extra.empty() ? 20 : 45);
+            put16(centralDirectory, 0);
+            put16(centralDirectory, method);
+            put16(centralDirectory, 0);
+            put16(centralDirectory, DOS_DATE);
+            put32(centralDirectory, crc);
+            put32(centralDirectory, static_cast<uint32_t>(std::min<uint64_t>(compressedSize, ZIP64_LIMIT)));
+            put32(centralDirectory, static_cast<uint32_t>(std::min<uint64_t>(size, ZIP64_LIMIT)));
+            put16(centralDirectory, static_cast<uint16_t>(name.size()));
+            put16(centralDirectory, static_cast<uint16_t>(extra.empty() ? 0 : 4 + extra.size()));
+            put16(centralDirectory, 0); // Comment length
+            put16(centralDirectory, 0); // Disk number
+            put16(centralDirectory, 0); // Internal attributes
+            put32(centralDirectory, 0100644u << 16);
+            put32(centralDirectory, static_cast<uint32_t>(std::min<uint64_t>(offset, ZIP64_LIMIT)));
+            centralDirectory.insert(centralDirectory.end(), name.begin(), name.end());
+            if (!extra.empty()) {
+                put16(centralDirectory, 0x0001);
+                put16(centralDirectory, static_cast<uint16_t>(extra.size()));
+                centralDirectory.insert(centralDirectory.end(), extra.begin(), extra.end());
+            }
+
+            offset += header.size() + compressedSize;
+        };
+
+        // The sparse entry goes first, so everything generated after it sits past the hole
+        if (options.sparse) {
+            writeEntry(SPARSE_NAME, {}, 0, zeroCRC(options.sparse), options.sparse, options.sparse);
+        }
+
+        for (uint64_t i = 0; i < generator.count(); i++) {
+            File file = generator.next();
+            uint32_t crc = crc32(0, file.data.data(), static_cast<uInt>(file.data.size()));
+
+            std::vector<uint8_t> deflated;
+            bool store = !file.compressible;
+            if (!store) {
+                deflated = deflateRaw(file.data);
+                store = deflated.size() >= file.data.size();
+            }
+            const std::vector<uint8_t> &payload = store ? file.data : deflated;
+            writeEntry(file.name, payload, store ? 0 : 8, crc, file.data.size(), payload.size());
+        }
+
+        uint64_t count = generator.count() + (options.sparse ? 1 : 0);
+        uint64_t directoryOffset = offset;
+        uint64_t directorySize = centralDirectory.size();
+        out.write(reinterpret_cast<const char *>(centralDirectory.data()), centralDirectory.size());
+
+        std::vector<uint8_t> end;
+        bool zip64 = count >= 0xFFFF || directoryOffset >= ZIP64_LIMIT || directorySize >= ZIP64_LIMIT;
+        if (zip64) {
+            uint64_t recordOffset = directoryOffset + directorySize;
+
+            put32(end, 0x06064b50);
+            put64(end, 44); // Size of the rest of the record
+            put16(end, (3 << 8) | 45);
+            put16(end, 45);
+            put32(end, 0);
+            put32(end, 0);
+            put64(end, count);
+            put64(end, count);
+            put64(end, directorySize);
+            put64(end, directoryOffset);
+
+            put32(end, 0x07064b50);
+            put32(end, 0);
+            put64(end, recordOffset);
+            put32(end, 1);
+        }
+
+        put32(end, 0x06054b50);
+        put16(end, 0);
+        put16(end, 0);
+        put16(end, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        put16(end, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        put32(end, static_cast<uint32_t>(std::min<uint64_t>(directorySize, ZIP64_LIMIT)));
+        put32(end, static_cast<uint32_t>(std::min<uint64_t>(directoryOffset, ZIP64_LIMIT)));
+        put16(end, 0);
+        out.write(reinterpret_cast<const char *>(end.data()), end.size());
+
+        return static_cast<bool>(out);
+    }
+
+    auto printUsage() -> void {
+        std::cerr << "Usage: PakGen [options] <output.pak|output.pk3>\n"
+                     "  --entries N         Number of files to generate (default 1000)\n"
+                     "  --depth N           Maximum directory depth (default 3)\n"
+                     "  --fanout N          Subdirectories per directory (default 8)\n"
+                     "  --seed N            Seed for the generated layout and contents (default 1)\n"
+                     "  --max-image-size N  Largest image side in pixels (default 128)\n"
+                     "  --mix P,W,N,T,D     Relative weights of PCX, WAL, PNG, text and binary files\n"
+                     "                      (default 30,30,20,10,10)\n"
+                     "  --sparse N          Add sparse.bin, N zero bytes written as a hole, so archives past\n"
+                     "                      4 GB take almost no disk space. It comes first in a PK3, so the\n"
+                     "                      other entries sit past it, and last in a PAK.\n"
+                     "  --repeat N          Make every Nth file a copy of the one before it\n"
+                     "  --root DIR          Put every file under DIR/\n";
+    }
+
+    auto parseOptions(int argc, char **argv, Options &options) -> bool {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (arg == "--entries" && hasValue) {
+                options.entries = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--depth" && hasValue) {
+                options.depth = std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--fanout" && hasValue) {
+                options.fanout = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--seed" && hasValue) {
+                options.seed = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--max-image-size" && hasValue) {
+                options.maxImageSize = std::clamp(std::atoi(argv[++i]), 16, 4096);
+            } else if (arg == "--sparse" && hasValue) {
+                options.sparse = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--repeat" && hasValue) {
+                options.repeat = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--root" && hasValue) {
+                options.root = argv[++i];
+                if (!options.root.empty() && options.root.back() != '/') {
+                    options.root += '/';
+                }
+            } else if (arg == "--mix" && hasValue) {
+                if (std::sscanf(argv[++i], "%d,%d,%d,%d,%d", &options.pcx, &options.wal, &options.png, &options.txt,
+                                &options.dat) != 5) {
+                    return false;
+                }
+            } else if (arg.rfind("--", 0) == 0 || !options.output.empty()) {
+                return false;
+            } else {
+                options.output = arg;
+            }
+        }
+
+        int weights[] = {options.pcx, options.wal, options.png, options.txt, options.dat};
+        bool anyWeight = std::any_of(std::begin(weights), std::end(weights), [](int w) { return w > 0; });
+        bool negativeWeight = std::any_of(std::begin(weights), std::end(weights), [](int w) { return w < 0; });
+
+        return !options.output.empty() && anyWeight && !negativeWeight;
+    }
+
+    auto hasExtension(const std::string &path, const std::string &extension) -> bool {
+        if (path.size() < extension.size()) {
+            return false;
+        }
+        std::string tail = path.substr(path.size() - extension.size());
+        std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+        return tail == extension;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    bool pak = hasExtension(options.output, ".pak");
+    if (!pak && !hasExtension(options.output, ".pk3") && !hasExtension(options.output, ".pk4")) {
+        std::cerr << "Output must end in .pak, .pk3 or .pk4\n";
+        return 1;
+    }
+
+    // A bigger stream buffer than the default cuts the number of write calls considerably. It has to
+    // be set before the file is opened to take effect.
+    std::vector<char> buffer(1 << 20);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    out.open(options.output, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Couldn't open " << options.output << " for writing\n";
+        return 1;
+    }
+
+    bool written = pak ? writePAK(options, out) : writePK3(options, out);
+    out.close();
+
+    if (!written || !out) {
+        std::cerr << "Failed to write " << options.output << "\n";
+        return 1;
+    }
+
+    std::cout << "Wrote " << options.output << "\n";
+    return 0;
+}